@@ -23,98 +23,358 @@
  */
 
 #include "logc_buffer.h"
+#include "logc_probe.h"
 
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
+
+// seconds a frame may stay reserved before the reader skips it
+#define LOGC_COMMIT_TIMEOUT     2
+
+// number of times a snapshot is taken again if the writers overwrote the frames it copied
+#define LOGC_SNAPSHOT_TRIES     3
+
+/**
+ * frame header, the type in the high byte, the round of the position in the next byte
+ * and the length of the message in the low 2 bytes. The types are not valid utf-8.
+ */
+#define FRAME_RESERVED      0xf9u
+#define FRAME_COMMITTED     0xfau
+#define FRAME_SKIPPED       0xfbu   // the writer found the buffer closed
+
+#define frame_round(handle, pos)    ((uint32_t)((pos) / (handle)->size) & 0xff)
+#define frame_header(handle, type, pos, len) \
+    (((uint32_t)(type) << 24) | (frame_round(handle, pos) << 16) | (uint32_t)(len))
+#define frame_type(hdr)             ((hdr) >> 24)
+#define frame_len(hdr)              ((int)((hdr) & 0xffff))
+#define frame_at(handle, pos)       ((uint32_t *)((handle)->buffer + (pos) % (handle)->size))
 
 #ifdef LOGC_DEBUG
 #include "../common/logc_utils.h"
 #endif
 
+/**
+ * Copy the message of the frame at pos to the buffer, from the start of the buffer
+ * for the part that does not fit before the end
+ */
+static void
+frame_copy_in(struct logc_buffer *handle, uint64_t pos, char *msg, int len)
+{
+    uint32_t off = (pos + 4) % handle->size;
+    int first = handle->size - off < (uint32_t)len ? (int)(handle->size - off) : len;
+
+    memcpy(handle->buffer + off, msg, first);
+    memcpy(handle->buffer, msg + first, len - first);
+}
+
+/**
+ * Copy the message of the frame at pos from the buffer to msg
+ */
+static void
+frame_copy_out(struct logc_buffer *handle, uint64_t pos, char *msg, int len)
+{
+    uint32_t off = (pos + 4) % handle->size;
+    int first = handle->size - off < (uint32_t)len ? (int)(handle->size - off) : len;
+
+    memcpy(msg, handle->buffer + off, first);
+    memcpy(msg + first, handle->buffer, len - first);
+}
+
 int
 logc_buffer_write(struct logc_buffer *handle, char *msg, int len)
 {
-    int l_write = __atomic_fetch_add(&(handle->w_offset), len, __ATOMIC_RELAXED);
+    LOGC_PROBE2(ring_write_entry, handle, len);
 
-    while(l_write + len > (handle->size - 1)) {
-        /**
-         * Here l_write may be > size
-         * There will never be a situation where while cond is true and below if cond is true
-         * in 2 threads
-         */
-        if(l_write < handle->size)   // update marker, wrap around from here
-            handle->marker = l_write;   // no need to do it atomic, if condition will be true only in one thread
+    int frame = LOGC_FRAME_SIZE(len);
+    uint64_t l_write = __atomic_fetch_add(&(handle->w_offset), frame, __ATOMIC_SEQ_CST);
 
-        while(1) {
-            int w = __atomic_load_n(&(handle->w_offset), __ATOMIC_RELAXED); // here w > size
+    // the reader checks w_offset after copying a frame, a frame being overwritten is not read
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
-            if(w < handle->size) // some thread chaged the w_offset, already wraped around
-                break;
-
-            if(__atomic_compare_exchange_n(&(handle->w_offset), &w, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
-                break;
-        }
+    uint32_t *header = frame_at(handle, l_write);
+    __atomic_store_n(header, frame_header(handle, FRAME_RESERVED, l_write, len), __ATOMIC_RELAXED);
 
-        // get new l_write
-        l_write = __atomic_fetch_add(&(handle->w_offset), len, __ATOMIC_RELAXED);
+    /**
+     * a closed buffer is drained upto the w_offset the server loads after closing it,
+     * so the check comes after the reservation, see logc_ring.h
+     */
+    if(__atomic_load_n(&(handle->closed), __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(header, frame_header(handle, FRAME_SKIPPED, l_write, len), __ATOMIC_RELEASE);
+        return -1;
     }
 
-    memcpy(handle->buffer + l_write, msg, len);    // write to the ring buffer
+    if((l_write + frame) % handle->size < (uint64_t)frame)
+        LOGC_PROBE2(ring_wrap, handle, l_write);
 
-    int l_used = __atomic_add_fetch(&(handle->used), len, __ATOMIC_RELAXED);
+    frame_copy_in(handle, l_write, msg, len);    // write to the ring buffer
+
+    // commit
+    __atomic_store_n(header, frame_header(handle, FRAME_COMMITTED, l_write, len), __ATOMIC_RELEASE);
+
+    int64_t l_used = (int64_t)(l_write + frame - __atomic_load_n(&(handle->r_offset), __ATOMIC_RELAXED));
     
     // console_log("\nused: %d, threshold: %d\n\n", l_used, handle->threshold);
 
-    if(l_used > handle->threshold)
+    LOGC_PROBE3(ring_write_exit, handle, len, l_used);
+
+    if(l_used > handle->threshold) {
+        LOGC_PROBE2(ring_threshold, handle, l_used);
         return 1;
+    }
 
     return 0;
 }
 
-int
-logc_buffer_read_all(struct logc_buffer *handle, char *read_buff)
+/**
+ * Size of the frame with header hdr at pos, if it is a frame of the round of pos that
+ * ends before w_offset
+ *
+ * @returns size of the frame, 0 if it is not
+ */
+static int
+frame_check(struct logc_buffer *handle, uint32_t hdr, uint64_t pos, uint64_t w_offset)
 {
-    int zero = 0;
-    int r_offset;
-    int w_offset;
-    int marker;
+    uint32_t type = frame_type(hdr);
+    if(type != FRAME_RESERVED && type != FRAME_COMMITTED && type != FRAME_SKIPPED)
+        return 0;
 
-    if(!__atomic_compare_exchange_n(&(handle->read_lock), &zero, 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    if(((hdr >> 16) & 0xff) != frame_round(handle, pos))
         return 0;
 
-    r_offset = __atomic_load_n(&(handle->r_offset), __ATOMIC_RELAXED);
-    w_offset = __atomic_load_n(&(handle->w_offset), __ATOMIC_RELAXED);
-    marker   = __atomic_load_n(&(handle->marker),   __ATOMIC_RELAXED);
+    int frame = LOGC_FRAME_SIZE(frame_len(hdr));
+    return pos + frame <= w_offset ? frame : 0;
+}
+
+/**
+ * Find the first frame from pos upto w_offset by its header
+ *
+ * @returns position of the frame, w_offset if there is none
+ */
+static uint64_t
+frame_find(struct logc_buffer *handle, uint64_t pos, uint64_t w_offset)
+{
+    for(; pos < w_offset; pos += 4) {
+        uint32_t hdr = __atomic_load_n(frame_at(handle, pos), __ATOMIC_ACQUIRE);
+        if(frame_check(handle, hdr, pos, w_offset) != 0)
+            return pos;
+    }
+
+    return w_offset;
+}
 
-    int len = w_offset - r_offset;
-    if(len < 0)
-        len = (marker - r_offset) + w_offset;
+/**
+ * Check if the frames copied from pos are still whole, no writer has reserved a frame a
+ * whole buffer ahead of pos
+ */
+static int
+frames_whole(struct logc_buffer *handle, uint64_t pos)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&(handle->w_offset), __ATOMIC_RELAXED) - pos <= handle->size;
+}
 
-    handle->r_offset = w_offset; // No need atomic op. Only 1 thread can chage this value
-    __atomic_sub_fetch(&(handle->used), len, __ATOMIC_RELAXED);
+/**
+ * Check if the reader has stopped at the frame at pos for LOGC_COMMIT_TIMEOUT seconds
+ */
+static int
+stall_expired(struct logc_buffer *handle, uint64_t pos)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    // No need atomic op. Only 1 thread can change this value
-    handle->read_lock = 0;
+    // 0 is no stall
+    uint32_t since = (uint32_t)now.tv_sec + 1;
 
-    // Now read the message
-    if(r_offset == w_offset) {
+    if(handle->stall_since == 0 || handle->stall_offset != pos) {
+        handle->stall_offset = pos;
+        handle->stall_since = since;
         return 0;
     }
 
-    int n;
-    if(r_offset < w_offset) {
-        n = w_offset - r_offset;
-        memcpy(read_buff, handle->buffer + r_offset, n);
-        read_buff[n] = '\0';
+    return since - handle->stall_since >= LOGC_COMMIT_TIMEOUT;
+}
+
+/**
+ * Check the frames copied since batch, they are dropped if a writer has overwritten them
+ *
+ * @param n: bytes read upto r_offset
+ * @param batch_n: bytes read upto batch
+ * @param lost: the bytes of the frames dropped are added to it
+ * @returns bytes read
+ */
+static int
+batch_check(struct logc_buffer *handle, uint64_t batch, uint64_t r_offset, int n, int batch_n, uint64_t *lost)
+{
+    if(r_offset == batch || frames_whole(handle, batch))
+        return n;
+
+    *lost += r_offset - batch;
+    return batch_n;
+}
+
+/**
+ * Read the committed frames from r_offset to read_buff
+ *
+ * @param abandoned: if 1, the writers are gone, a frame not committed is skipped right away
+ * @param torn: set to 1 if a frame not committed was skipped, may be NULL
+ * @returns size read in bytes
+ */
+static int
+read_frames(struct logc_buffer *handle, char *read_buff, int abandoned, int *torn)
+{
+    int zero = 0;
+
+    if(!__atomic_compare_exchange_n(&(handle->read_lock), &zero, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+
+    uint64_t w_offset = __atomic_load_n(&(handle->w_offset), __ATOMIC_ACQUIRE);
+    uint64_t r_offset = handle->r_offset;
+    uint64_t lost = 0;
+    int n = 0;
+    int stalled = 0;
+
+    // the frames copied since batch are checked at once
+    uint64_t batch = r_offset;
+    int batch_n = 0;
+
+    while(1) {
+        // the writers have overwritten frames not read, go on from the oldest frame left
+        if(w_offset - r_offset > handle->size) {
+            n = batch_check(handle, batch, r_offset, n, batch_n, &lost);
+
+            uint64_t pos = frame_find(handle, w_offset - handle->size, w_offset);
+            lost += pos - r_offset;
+            r_offset = batch = pos;
+            batch_n = n;
+        }
+
+        if(r_offset >= w_offset)
+            break;
+
+        uint32_t hdr = __atomic_load_n(frame_at(handle, r_offset), __ATOMIC_ACQUIRE);
+        int frame = frame_check(handle, hdr, r_offset, w_offset);
+
+        if(frame == 0 || frame_type(hdr) == FRAME_RESERVED) {
+            // overwritten since w_offset was loaded
+            if(!frames_whole(handle, r_offset)) {
+                w_offset = __atomic_load_n(&(handle->w_offset), __ATOMIC_ACQUIRE);
+                continue;
+            }
+
+            // being written, or its writer died before it committed
+            if(!abandoned && !stall_expired(handle, r_offset)) {
+                stalled = 1;
+                break;
+            }
+
+            // a header not marked yet is skipped upto the next frame
+            r_offset = frame != 0 ? r_offset + frame : frame_find(handle, r_offset + 4, w_offset);
+            if(torn != NULL)
+                *torn = 1;
+            continue;
+        }
+
+        if(frame_type(hdr) == FRAME_COMMITTED) {
+            // read_buff is full, w_offset was loaded again after an overwrite
+            if(n + frame_len(hdr) > handle->size)
+                break;
+
+            frame_copy_out(handle, r_offset, read_buff + n, frame_len(hdr));
+            n += frame_len(hdr);
+        }
+        r_offset += frame;
+
+        // a writer a whole buffer ahead may have overwritten the frames copied since batch
+        if(r_offset - batch >= handle->size / 4) {
+            n = batch_check(handle, batch, r_offset, n, batch_n, &lost);
+            batch = r_offset;
+            batch_n = n;
+        }
     }
-    else {
-        int n = marker - r_offset;
-        memcpy(read_buff, handle->buffer + r_offset, n);
-        memcpy(read_buff + n, handle->buffer, w_offset);
-        n += w_offset;
-        read_buff[n] = '\0';
+
+    n = batch_check(handle, batch, r_offset, n, batch_n, &lost);
+
+    __atomic_store_n(&(handle->r_offset), r_offset, __ATOMIC_RELEASE);
+    if(!stalled)
+        handle->stall_since = 0;
+    handle->dropped += lost;
+
+    __atomic_store_n(&(handle->read_lock), 0, __ATOMIC_RELEASE);
+
+    read_buff[n] = '\0';
+    return n;
+}
+
+int
+logc_buffer_read_all(struct logc_buffer *handle, char *read_buff)
+{
+    return read_frames(handle, read_buff, 0, NULL);
+}
+
+int
+logc_buffer_read_abandoned(struct logc_buffer *handle, char *read_buff, int *torn)
+{
+    *torn = 0;
+    return read_frames(handle, read_buff, 1, torn);
+}
+
+int
+logc_buffer_empty(struct logc_buffer *handle)
+{
+    uint64_t r_offset = __atomic_load_n(&(handle->r_offset), __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&(handle->w_offset), __ATOMIC_ACQUIRE) == r_offset;
+}
+
+int
+logc_buffer_snapshot(struct logc_buffer *handle, char *read_buff, int max)
+{
+    int n = 0;
+
+    for(int tries = 0; tries < LOGC_SNAPSHOT_TRIES; ++tries) {
+        uint64_t w_offset = __atomic_load_n(&(handle->w_offset), __ATOMIC_ACQUIRE);
+        uint64_t start = frame_find(handle, w_offset > handle->size ? w_offset - handle->size : 0, w_offset);
+        uint64_t pos;
+        uint32_t hdr;
+        int frame;
+        int total = 0;
+
+        // the frames being written end the snapshot
+        for(pos = start; pos < w_offset; pos += frame) {
+            hdr = __atomic_load_n(frame_at(handle, pos), __ATOMIC_ACQUIRE);
+            if((frame = frame_check(handle, hdr, pos, w_offset)) == 0)
+                break;
+            if(frame_type(hdr) == FRAME_COMMITTED)
+                total += frame_len(hdr);
+        }
+
+        // keep the latest messages that fit in max
+        for(pos = start; total > max && pos < w_offset; pos += frame) {
+            hdr = __atomic_load_n(frame_at(handle, pos), __ATOMIC_ACQUIRE);
+            if((frame = frame_check(handle, hdr, pos, w_offset)) == 0)
+                break;
+            if(frame_type(hdr) == FRAME_COMMITTED)
+                total -= frame_len(hdr);
+        }
+
+        for(start = pos, n = 0; pos < w_offset; pos += frame) {
+            hdr = __atomic_load_n(frame_at(handle, pos), __ATOMIC_ACQUIRE);
+            if((frame = frame_check(handle, hdr, pos, w_offset)) == 0)
+                break;
+            if(frame_type(hdr) != FRAME_COMMITTED)
+                continue;
+            if(n + frame_len(hdr) > max)
+                break;
+
+            frame_copy_out(handle, pos, read_buff + n, frame_len(hdr));
+            n += frame_len(hdr);
+        }
+
+        if(frames_whole(handle, start))
+            break;
     }
 
-    return len;
+    read_buff[n] = '\0';
+    return n;
 }
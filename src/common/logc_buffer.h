@@ -25,23 +25,42 @@
 /**
  * Logc wait free buffer
  * Implementation of wait free atomic ring buffer
+ *
+ * Every message is a frame: a 4 byte header followed by the message, padded to 4 bytes.
+ * The frames are at positions that only grow, a frame is at its position % size and
+ * goes on from the start of the buffer if it does not fit before the end.
+ * A writer reserves the frame, marks the header reserved, copies the message and
+ * commits the header last, with release. The header has the round of the position,
+ * so the header a frame had in the previous round is never taken for the current one.
+ * The reader reads the frames in order upto the first frame that is not committed, so
+ * it never waits for the writers and never reads a message being written. A frame left
+ * reserved for LOGC_COMMIT_TIMEOUT seconds, its writer died in the middle of the write,
+ * is skipped. A writer a whole buffer ahead of the reader overwrites the oldest frames,
+ * the reader finds the oldest frame left by its header.
  */
 
 #ifndef LOGC_BUFFER_H
 #define LOGC_BUFFER_H
 
 #include <stdint.h>
+#include <string.h>
+
+#define LOGC_FRAME_MAX_LEN      0xffff  // maximum length of a message
+
+// bytes a message of len bytes takes in the buffer, a header of 4 bytes and the message padded to 4
+#define LOGC_FRAME_SIZE(len)    (4 + (((len) + 3) & ~3))
 
 struct logc_buffer
 {
-    uint32_t w_offset;      // write offset
-    uint32_t r_offset;      // read offset
-    uint32_t marker;        // offset at the end of buffer upto which data is written before wrap around
+    uint64_t w_offset;      // write position, the next frame is reserved here
+    uint64_t r_offset;      // read position, the next frame to read
+    uint64_t stall_offset;  // position of the frame not committed the reader stopped at
     uint32_t size;          // size of the buffer in bytes
-    uint32_t used;          // total bytes used in buffer
     uint32_t threshold;     // threshold in bytes
     uint32_t read_lock;     // use as lock for reading
-    uint32_t hole;          // for alignment
+    uint32_t closed;        // 1 once the writers have moved to another ring, see logc_ring.h
+    uint32_t stall_since;   // monotonic second the reader first stopped at stall_offset, 0 if it did not
+    uint32_t dropped;       // total bytes of the frames overwritten before they were read
     char     buffer[];      // logging buffer
 };
 
@@ -59,17 +78,39 @@ struct logc_buffer
  * 
  * @param handle A logc handle
  * @param addr A shared momory address
+ * @param sz Size of the ring in bytes, excluding the logc_buffer header, a multiple of 4
+ *           The buffer is cleared, a header left by a previous use is never read
+ * @param thr Usage threshold in bytes
  */
-#define logc_buffer_map_and_init(handle, addr) \
+#define logc_buffer_map_and_init(handle, addr, sz, thr) \
 { \
     (handle) = (struct logc_buffer *)(addr); \
     (handle)->w_offset = 0; \
     (handle)->r_offset = 0; \
-    (handle)->marker = 0; \
-    (handle)->size = MAX_LOG_BUFF_SIZE; \
-    (handle)->used = 0; \
-    (handle)->threshold = MAX_LOG_BUFF_SIZE * 0.5; \
+    (handle)->size = (sz); \
+    (handle)->threshold = (thr); \
     (handle)->read_lock = 0; \
+    (handle)->closed = 0; \
+    (handle)->stall_offset = 0; \
+    (handle)->stall_since = 0; \
+    (handle)->dropped = 0; \
+    memset((handle)->buffer, 0, (sz)); \
+}
+
+/**
+ * Bytes of the frames written to logc buffer and not read yet
+ * More than the size if the writers have overwritten frames not read
+ * 
+ * @param handle A logc_buffer handle
+ */
+static inline uint32_t
+logc_buffer_used(struct logc_buffer *handle)
+{
+    // the reader never goes past w_offset, load r_offset first
+    uint64_t r_offset = __atomic_load_n(&(handle->r_offset), __ATOMIC_ACQUIRE);
+    uint64_t used = __atomic_load_n(&(handle->w_offset), __ATOMIC_RELAXED) - r_offset;
+
+    return used < UINT32_MAX ? (uint32_t)used : UINT32_MAX;
 }
 
 /**
@@ -77,21 +118,62 @@ struct logc_buffer
  * 
  * @param handle A logc_buffer handle
  * @param msg Pointer to the msg
- * @param len Length of the msg
+ * @param len Length of the msg, at most LOGC_FRAME_MAX_LEN
  * 
- * @returns 1 if threshold of the logc_buffer is reached, 0 otherwise
+ * @returns 1 if threshold of the logc_buffer is reached, 0 otherwise,
+ *          -1 if the buffer is closed, nothing is written
  */
 int logc_buffer_write(struct logc_buffer *handle, char *msg, int len);
 
 /**
  * Read all the messages from logc buffer to read_buff
- * This will read all the messages from r_offset to w_offset
+ * This will read the committed frames from r_offset upto w_offset
+ * 
+ * Never waits for the writers, the frames not committed yet are read by the next call.
+ * A frame not committed for LOGC_COMMIT_TIMEOUT seconds is skipped. If the writers have
+ * overwritten frames not read, the frames left whole are read and the bytes of the others
+ * are added to dropped.
  * 
  * @param handle A logc_buffer handle
- * @param read_buff A pointer to a buffer. The size of this buffer should at least equal to threshold
+ * @param read_buff A pointer to a buffer of at least the size of the buffer + 1 bytes
  * 
  * @return Size read in bytes. 0 if nothing was read
  */
 int logc_buffer_read_all(struct logc_buffer *handle, char *read_buff);
 
+/**
+ * Read all the messages of a logc buffer whose writers are gone
+ * A frame not committed is skipped right away, its writer died in the middle of the write
+ * 
+ * @param handle A logc_buffer handle
+ * @param read_buff A pointer to a buffer of at least the size of the buffer + 1 bytes
+ * @param torn Set to 1 if a frame was skipped, 0 otherwise
+ * 
+ * @return Size read in bytes. 0 if nothing was read
+ */
+int logc_buffer_read_abandoned(struct logc_buffer *handle, char *read_buff, int *torn);
+
+/**
+ * Check if every frame reserved in a logc buffer is read
+ * 
+ * @param handle A logc_buffer handle
+ * 
+ * @return 1 if the buffer is empty, 0 otherwise
+ */
+int logc_buffer_empty(struct logc_buffer *handle);
+
+/**
+ * Copy the latest messages of logc buffer to read_buff, oldest first
+ * The buffer is not consumed. Used for a buffer which is never read, where the
+ * writers keep overwriting the oldest messages (flight recorder).
+ * The copy has whole messages only, the oldest frame left is found by its header.
+ * 
+ * @param handle A logc_buffer handle
+ * @param read_buff A pointer to a buffer of at least max + 1 bytes
+ * @param max Maximum number of bytes to copy
+ * 
+ * @return Size copied in bytes
+ */
+int logc_buffer_snapshot(struct logc_buffer *handle, char *read_buff, int max);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc callsite
+ * Messages and bytes logged by every callsite of a client
+ *
+ * A client that turns the counting on, see logc_set_callsite_counting, counts its
+ * callsites in an open addressing table in the segment of the connection, keyed by
+ * the callsite id of logc_record.h. A thread logging from a new callsite takes a free
+ * entry with a compare and swap of the id, then writes the file and the line; the
+ * line is written last, so a reader skips an entry until its line is set. The
+ * counters are atomic adds, the threads and the processes of a pool share the
+ * entries. A callsite that finds no free entry in LOGC_CALLSITE_PROBES is only
+ * counted as untracked.
+ *
+ * The server reads the table with relaxed loads and reports the noisiest callsites.
+ */
+
+#ifndef LOGC_CALLSITE_H
+#define LOGC_CALLSITE_H
+
+#include <stdint.h>
+
+#define LOGC_CALLSITES          1024    // entries of a table, a power of two
+#define LOGC_CALLSITE_PROBES    32      // entries probed for a callsite
+#define LOGC_CALLSITE_FILE_LEN  40      // end of the file name kept in an entry
+
+struct logc_callsite_entry
+{
+    uint32_t id;                            // callsite id, 0 if free
+    uint32_t line;                          // line of the callsite, 0 until the entry is filled
+    uint64_t messages;                      // messages logged
+    uint64_t bytes;                         // bytes written to the rings
+    char     file[LOGC_CALLSITE_FILE_LEN];  // file of the callsite, the end of it if longer
+};
+
+struct logc_callsites
+{
+    uint32_t n_callsites;                   // entries taken
+    uint32_t hole;
+    uint64_t untracked;                     // messages of the callsites without an entry
+    struct logc_callsite_entry entries[LOGC_CALLSITES];
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc forward
+ * Protocol between the forwarder of the logc server and a log collector
+ *
+ * The forwarder connects to the collector and sends a hello with the id of its
+ * stream. The collector replies with an ack of the stream offset it has, 0 for a
+ * new stream. The forwarder then sends batches from that offset. Every batch has
+ * a logc_forward_batch_header with the stream offset of the batch followed by the
+ * batch data, compressed with logc_lz if the header says so. The collector acks
+ * the end offset of every batch it has written.
+ *
+ * A batch has the drained logs of any number of log files. Every entry of a batch
+ * has a logc_forward_entry followed by the log file path and the logs.
+ *
+ * All integers are little endian.
+ */
+
+#ifndef LOGC_FORWARD_H
+#define LOGC_FORWARD_H
+
+#include <stdint.h>
+
+#define LOGC_FORWARD_MAGIC          0x64776663  // "cfwd"
+#define LOGC_FORWARD_BATCH_SIZE     (64 * 1024) // maximum uncompressed size of a batch
+
+// batch flags
+#define LOGC_FORWARD_COMPRESSED     0x01
+
+struct logc_forward_hello
+{
+    uint32_t magic;         // LOGC_FORWARD_MAGIC
+    uint32_t hole;          // for alignment
+    uint64_t stream_id;     // id of the stream, kept across restarts of the server while it has spooled batches
+};
+
+struct logc_forward_ack
+{
+    uint32_t magic;         // LOGC_FORWARD_MAGIC
+    uint32_t hole;          // for alignment
+    uint64_t offset;        // stream offset up to which the batches are written
+};
+
+struct logc_forward_batch_header
+{
+    uint32_t magic;         // LOGC_FORWARD_MAGIC
+    uint32_t flags;         // batch flags
+    uint64_t offset;        // stream offset of the batch, the offsets count uncompressed bytes
+    uint32_t raw_len;       // uncompressed length of the batch
+    uint32_t data_len;      // length of the data following the header
+};
+
+struct logc_forward_entry
+{
+    uint16_t path_len;      // length of the log file path following the entry
+    uint16_t hole;          // for alignment
+    uint32_t len;           // length of the logs following the path
+};
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE     // for strptime
+
+#include "logc_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+int
+logc_index_line_time(const char *line, int64_t *ts)
+{
+    struct tm tm;
+
+    // a JSON line starts with the time, see logc_json.h
+    if(strncmp(line, "{\"ts\":", 6) == 0) {
+        char *end;
+        *ts = strtoll(line + 6, &end, 10);
+        return end == line + 6 ? -1 : 0;
+    }
+
+    // the client writes the time with "%c" of the C locale
+    memset(&tm, 0, sizeof(tm));
+    if(strptime(line, "%a %b %e %H:%M:%S %Y", &tm) == NULL)
+        return -1;
+
+    tm.tm_isdst = -1;
+    *ts = mktime(&tm);
+    return 0;
+}
+
+int
+logc_index_parse_time(const char *arg, int64_t *ts)
+{
+    char *end;
+    struct tm tm;
+
+    long long epoch = strtoll(arg, &end, 10);
+    if(*arg != '\0' && *end == '\0') {
+        *ts = epoch;
+        return 0;
+    }
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(arg, "%Y-%m-%d %H:%M:%S", &tm);
+    if(end == NULL)
+        end = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+    if(end == NULL || *end != '\0')
+        return -1;
+
+    tm.tm_isdst = -1;
+    *ts = mktime(&tm);
+    return 0;
+}
+
+/**
+ * Read the nth entry of a time index
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+read_entry(FILE *index_fp, long n, struct logc_time_index_entry *entry)
+{
+    if(fseek(index_fp, n * sizeof(*entry), SEEK_SET) != 0)
+        return -1;
+
+    if(fread(entry, sizeof(*entry), 1, index_fp) != 1)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Number of entries in a time index
+ */
+static long
+count_entries(FILE *index_fp)
+{
+    if(fseek(index_fp, 0, SEEK_END) != 0)
+        return 0;
+
+    return ftell(index_fp) / sizeof(struct logc_time_index_entry);
+}
+
+int64_t
+logc_index_find(FILE *index_fp, int64_t ts)
+{
+    struct logc_time_index_entry entry;
+    long n = count_entries(index_fp);
+
+    if(n == 0)
+        return -1;
+
+    // first entry at or after ts
+    long lo = 0, hi = n;
+    while(lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if(read_entry(index_fp, mid, &entry) == -1)
+            return -1;
+
+        if(entry.ts < ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // messages before the entry may be at ts, start from the previous entry
+    if(lo > 0)
+        lo--;
+
+    if(read_entry(index_fp, lo, &entry) == -1)
+        return -1;
+
+    return entry.offset;
+}
+
+int64_t
+logc_index_find_end(FILE *index_fp, int64_t ts)
+{
+    struct logc_time_index_entry entry;
+    long n = count_entries(index_fp);
+
+    // first entry after ts
+    long lo = 0, hi = n;
+    while(lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if(read_entry(index_fp, mid, &entry) == -1)
+            return -1;
+
+        if(entry.ts <= ts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == n || read_entry(index_fp, lo, &entry) == -1)
+        return -1;
+
+    return entry.offset;
+}
@@ -0,0 +1,92 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc time index
+ * The server writes a sparse time index <log file>.tidx while writing a text or
+ * binary log file. Every LOGC_TIME_INDEX_INTERVAL bytes of logs it appends a
+ * logc_time_index_entry with the offset of the next log message and its time.
+ * The times in the index never decrease, so a reader can binary search the index
+ * for the offset of a time. The index moves with the log file when it is rotated.
+ */
+
+#ifndef LOGC_INDEX_H
+#define LOGC_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOGC_TIME_INDEX_SUFFIX      ".tidx"
+#define LOGC_TIME_INDEX_INTERVAL    (64 * 1024)
+
+struct logc_time_index_entry
+{
+    int64_t  ts;        // time of the message at offset, epoch nanoseconds
+    uint64_t offset;    // offset of the message in the log file
+};
+
+/**
+ * Time of a text log message, date time | file | func | line | msg,
+ * or of a JSON line, {"ts":<epoch seconds>.<nanoseconds>,...
+ * 
+ * @param line Log message
+ * @param ts Set to the time of the message, epoch seconds
+ * 
+ * @return 0 on success, -1 if the line does not start with a time
+ */
+int logc_index_line_time(const char *line, int64_t *ts);
+
+/**
+ * Parse a time given by a user, epoch seconds or local time as YYYY-MM-DD HH:MM:SS
+ * 
+ * @param arg Time
+ * @param ts Set to the time, epoch seconds
+ * 
+ * @return 0 on success, -1 if the time is invalid
+ */
+int logc_index_parse_time(const char *arg, int64_t *ts);
+
+/**
+ * Find the offset to read from for messages at or after a time
+ * The offset is of the last index entry before the time, so no message
+ * at or after the time is before the offset.
+ * 
+ * @param index_fp Time index file
+ * @param ts Time, epoch nanoseconds
+ * 
+ * @return offset in the log file, -1 if the index is empty
+ */
+int64_t logc_index_find(FILE *index_fp, int64_t ts);
+
+/**
+ * Find the offset to stop reading at for messages at or before a time
+ * 
+ * @param index_fp Time index file
+ * @param ts Time, epoch nanoseconds
+ * 
+ * @return offset of the first index entry after the time, -1 if there is none
+ */
+int64_t logc_index_find_end(FILE *index_fp, int64_t ts);
+
+#endif
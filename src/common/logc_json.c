@@ -0,0 +1,243 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for memmem
+
+#include "logc_json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const char *level_names[] = LOGC_LEVEL_NAMES;
+static const char hex_digits[] = "0123456789abcdef";
+
+static pthread_once_t json_once = PTHREAD_ONCE_INIT;
+static int json_avx2_supported;
+
+
+static inline int
+needs_escape(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+/**
+ * write the escape sequence of a character that needs escaping
+ *
+ * @returns length of the escape sequence
+ */
+static inline int
+escape_char(char *dst, unsigned char c)
+{
+    dst[0] = '\\';
+
+    switch(c) {
+    case '"':  dst[1] = '"';  return 2;
+    case '\\': dst[1] = '\\'; return 2;
+    case '\n': dst[1] = 'n';  return 2;
+    case '\r': dst[1] = 'r';  return 2;
+    case '\t': dst[1] = 't';  return 2;
+    default:
+        memcpy(dst + 1, "u00", 3);
+        dst[4] = hex_digits[c >> 4];
+        dst[5] = hex_digits[c & 0xf];
+        return 6;
+    }
+}
+
+static int
+escape_scalar(char *dst, const char *src, int len)
+{
+    int n = 0;
+
+    for(int i = 0; i < len; ++i) {
+        unsigned char c = src[i];
+        if(needs_escape(c))
+            n += escape_char(dst + n, c);
+        else
+            dst[n++] = c;
+    }
+
+    return n;
+}
+
+#if defined(__x86_64__)
+/**
+ * escape 16 bytes at a time, SSE2 is always there on x86_64
+ * every chunk is stored whole, the bytes after a character to escape are overwritten
+ */
+static int
+escape_sse2(char *dst, const char *src, int len)
+{
+    const __m128i ctrl_max = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    int i = 0;
+    int n = 0;
+
+    while(i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        // unsigned v <= 0x1f is max(v, 0x1f) == 0x1f
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        unsigned mask = _mm_movemask_epi8(special);
+
+        _mm_storeu_si128((__m128i *)(dst + n), v);
+        if(mask == 0) {
+            i += 16;
+            n += 16;
+            continue;
+        }
+
+        int k = __builtin_ctz(mask);
+        n += k;
+        n += escape_char(dst + n, src[i + k]);
+        i += k + 1;
+    }
+
+    return n + escape_scalar(dst + n, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int
+escape_avx2(char *dst, const char *src, int len)
+{
+    const __m256i ctrl_max = _mm256_set1_epi8(0x1f);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    int i = 0;
+    int n = 0;
+
+    while(i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl_max), ctrl_max),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)));
+        unsigned mask = _mm256_movemask_epi8(special);
+
+        _mm256_storeu_si256((__m256i *)(dst + n), v);
+        if(mask == 0) {
+            i += 32;
+            n += 32;
+            continue;
+        }
+
+        int k = __builtin_ctz(mask);
+        n += k;
+        n += escape_char(dst + n, src[i + k]);
+        i += k + 1;
+    }
+
+    return n + escape_sse2(dst + n, src + i, len - i);
+}
+#endif
+
+static void
+json_init()
+{
+#if defined(__x86_64__)
+    json_avx2_supported = __builtin_cpu_supports("avx2");
+#endif
+}
+
+int
+logc_json_escape(char *dst, const char *src, int len)
+{
+    pthread_once(&json_once, json_init);
+
+#if defined(__x86_64__)
+    if(json_avx2_supported)
+        return escape_avx2(dst, src, len);
+    return escape_sse2(dst, src, len);
+#else
+    return escape_scalar(dst, src, len);
+#endif
+}
+
+/**
+ * write a string field, name is the separator and the quoted name
+ *
+ * @returns end of the field
+ */
+static char *
+put_string(char *dst, const char *name, const char *s, int len)
+{
+    int name_len = strlen(name);
+
+    memcpy(dst, name, name_len);
+    dst += name_len;
+    *dst++ = '"';
+    dst += logc_json_escape(dst, s, len);
+    *dst++ = '"';
+
+    return dst;
+}
+
+int
+logc_json_record(char *dst, const struct logc_record *rec, const char *msg, uint32_t pid)
+{
+    const char *fields[5];
+    int lens[5];
+    int n_fields = 0;
+    const char *p = msg;
+    const char *end = msg + rec->len - 1;     // without the end line
+    char *out = dst;
+
+    // the fields of the text line, date time | file | func | line | msg
+    while(n_fields < 4) {
+        const char *sep = memmem(p, end - p, " | ", 3);
+        if(sep == NULL)
+            break;
+        fields[n_fields] = p;
+        lens[n_fields++] = sep - p;
+        p = sep + 3;
+    }
+    fields[n_fields] = p;
+    lens[n_fields++] = end - p;
+
+    out += sprintf(out, "{\"ts\":%lld.%09lld,\"level\":\"%s\",\"callsite\":\"%08x\"",
+                   (long long)(rec->ts / 1000000000), (long long)(rec->ts % 1000000000),
+                   rec->level <= 6 ? level_names[rec->level] : "", rec->callsite);
+    if(pid != 0)
+        out += sprintf(out, ",\"pid\":%u", pid);
+
+    if(n_fields == 5) {
+        out = put_string(out, ",\"file\":", fields[1], lens[1]);
+        out = put_string(out, ",\"func\":", fields[2], lens[2]);
+        out += sprintf(out, ",\"line\":%d", atoi(fields[3]));
+        out = put_string(out, ",\"msg\":", fields[4], lens[4]);
+    }
+    else {
+        out = put_string(out, ",\"msg\":", msg, end - msg);
+    }
+
+    memcpy(out, "}\n", 2);
+    return out + 2 - dst;
+}
@@ -0,0 +1,75 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc JSON
+ * JSON lines encoding of log records
+ *
+ * A record is encoded as one JSON object on a line, with the fields of the text
+ * line split out:
+ *     {"ts":<epoch seconds>.<nanoseconds>,"level":"<level>","callsite":"<id>",
+ *      "pid":<client pid>,"file":"<file>","func":"<function>","line":<line>,"msg":"<message>"}
+ * The strings are escaped with SSE2 or AVX2, so a string without a character to
+ * escape is copied 16 or 32 bytes at a time.
+ */
+
+#ifndef LOGC_JSON_H
+#define LOGC_JSON_H
+
+#include "logc_record.h"
+
+#include <stdint.h>
+
+/**
+ * Maximum length of len bytes escaped, every byte can become \u00XX
+ */
+#define logc_json_escape_bound(len) ((len) * 6)
+
+// maximum length of a JSON line of a record
+#define LOGC_JSON_MAX_LINE      (logc_json_escape_bound(LOGC_RECORD_MAX_LEN) + 256)
+
+/**
+ * Escape a string for a JSON string, without the quotes
+ * 
+ * @param dst Destination, at least logc_json_escape_bound(len) bytes
+ * @param src String
+ * @param len Length of src
+ * 
+ * @return length of the escaped string
+ */
+int logc_json_escape(char *dst, const char *src, int len);
+
+/**
+ * Encode a record as a JSON line
+ * 
+ * @param dst Destination, at least LOGC_JSON_MAX_LINE bytes
+ * @param rec Header of the record
+ * @param msg Message of the record
+ * @param pid Pid of the client, 0 to leave it out
+ * 
+ * @return length of the JSON line, with the end line
+ */
+int logc_json_record(char *dst, const struct logc_record *rec, const char *msg, uint32_t pid);
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc latency
+ * Histograms of the time taken by the log calls of a client
+ *
+ * A client sampling its log calls times one in every period calls of a thread
+ * with the cycle counter: the whole call, formatting the message, writing it to
+ * the ring and sending a write request, when one is sent. The ticks are counted
+ * in log-linear histograms, four buckets for every power of two, of the slot of
+ * the thread in the segment of the connection. Only the thread owning a slot
+ * writes it, so counting takes no lock and no atomic read-modify-write. The
+ * threads that find every slot taken share the last slot, which is always
+ * counted with atomic adds.
+ *
+ * The server reads the histograms of the segment with relaxed loads for the
+ * stats, the client takes no part in it. The pages of the histograms are not
+ * touched until a client samples.
+ */
+
+#ifndef LOGC_LATENCY_H
+#define LOGC_LATENCY_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LOGC_LATENCY_MAGIC      0x79636c6c  // "llcy"
+#define LOGC_LATENCY_SLOTS      16          // per-thread histograms in a segment
+#define LOGC_LATENCY_SUB_BITS   2           // 4 buckets for every power of two
+#define LOGC_LATENCY_BUCKETS    88          // upto 2^23 ticks, the last bucket takes the rest
+
+enum logc_latency_stage
+{
+    LOGC_LATENCY_TOTAL,     // whole log call
+    LOGC_LATENCY_FORMAT,    // formatting the message
+    LOGC_LATENCY_RING,      // writing the message to the ring
+    LOGC_LATENCY_DOORBELL,  // sending the write request
+    LOGC_LATENCY_STAGES
+};
+
+#define LOGC_LATENCY_STAGE_NAMES { "total", "format", "ring", "doorbell" }
+
+struct logc_latency_slot
+{
+    uint32_t tid;           // thread owning the slot, 0 if free
+    uint32_t hole;
+    uint64_t counts[LOGC_LATENCY_STAGES][LOGC_LATENCY_BUCKETS];
+};
+
+struct logc_latency
+{
+    uint32_t magic;         // LOGC_LATENCY_MAGIC once the client samples
+    uint32_t period;        // one in period calls of a thread is sampled
+    uint32_t ticks_per_ms;  // cycle counter frequency, calibrated by the client
+    uint32_t n_slots;       // slots claimed, can be more than LOGC_LATENCY_SLOTS
+    struct logc_latency_slot slots[LOGC_LATENCY_SLOTS];
+};
+
+/**
+ * Read the cycle counter, the monotonic clock in nanoseconds if there is none
+ */
+static inline uint64_t
+logc_latency_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Histogram bucket of a number of ticks
+ * 
+ * @param ticks Ticks taken
+ */
+static inline int
+logc_latency_bucket(uint64_t ticks)
+{
+    if(ticks < (1 << LOGC_LATENCY_SUB_BITS))
+        return ticks;
+
+    int exp = 63 - __builtin_clzll(ticks);
+    int bucket = ((exp - LOGC_LATENCY_SUB_BITS + 1) << LOGC_LATENCY_SUB_BITS) +
+                 ((ticks >> (exp - LOGC_LATENCY_SUB_BITS)) & ((1 << LOGC_LATENCY_SUB_BITS) - 1));
+
+    return bucket < LOGC_LATENCY_BUCKETS ? bucket : LOGC_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Lowest number of ticks counted in a bucket
+ * 
+ * @param bucket Histogram bucket
+ */
+static inline uint64_t
+logc_latency_bucket_low(int bucket)
+{
+    int sub = bucket & ((1 << LOGC_LATENCY_SUB_BITS) - 1);
+    int exp = (bucket >> LOGC_LATENCY_SUB_BITS) + LOGC_LATENCY_SUB_BITS - 1;
+
+    if(bucket < (1 << LOGC_LATENCY_SUB_BITS))
+        return bucket;
+
+    return (uint64_t)((1 << LOGC_LATENCY_SUB_BITS) + sub) << (exp - LOGC_LATENCY_SUB_BITS);
+}
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc level
+ * Log levels of a client kept in its segment and changed by the server
+ *
+ * The level of a client and its overrides, for the messages of a channel and/or
+ * of a source file, are in the segment header. logc-ctl asks the server to change
+ * them while the client runs.
+ *
+ * A log call only loads the gate, the lowest of the level and the override levels,
+ * with a relaxed load. A message at or above the gate is resolved against the
+ * overrides, so the overrides cost nothing until one of them lets more messages
+ * through. The overrides are changed under a sequence lock: the writer makes the
+ * sequence odd while it changes them and a reader retries until it reads the same
+ * even sequence before and after.
+ */
+
+#ifndef LOGC_LEVEL_H
+#define LOGC_LEVEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define LOGC_LEVEL_OVERRIDES    16      // overrides of a client
+#define LOGC_LEVEL_FILE_LEN     40      // end of a file path matched by an override
+#define LOGC_LEVEL_ANY_CHANNEL  -1      // an override for every channel
+#define LOGC_LEVEL_SPINS        1024    // tries to read or take the sequence lock
+
+/**
+ * Operations of a level request
+ */
+#define LOGC_LEVEL_GET      1       // report the levels
+#define LOGC_LEVEL_SET      2       // set the level, or an override if a channel or a file is given
+#define LOGC_LEVEL_CLEAR    3       // remove an override, every override if no channel and no file is given
+
+struct logc_level_override
+{
+    int32_t level;                          // level of the matching messages
+    int32_t channel;                        // channel, LOGC_LEVEL_ANY_CHANNEL for every channel
+    char    file[LOGC_LEVEL_FILE_LEN];      // end of the file path, "" for every file
+};
+
+struct logc_levels
+{
+    int32_t  gate;              // lowest level of a message that may be logged, the only field read by a log call
+    int32_t  level;             // level of the messages without an override
+    uint32_t seq;               // odd while the levels change, 0 until the client sets its level
+    uint32_t n_overrides;
+    struct logc_level_override overrides[LOGC_LEVEL_OVERRIDES];
+};
+
+/**
+ * Level request, a fixed size request of logc-ctl
+ */
+struct logc_level_request
+{
+    uint8_t  code;                          // REQUEST_LEVEL
+    uint8_t  op;                            // LOGC_LEVEL_*
+    int8_t   channel;                       // channel, LOGC_LEVEL_ANY_CHANNEL for none
+    int8_t   level;                         // level for LOGC_LEVEL_SET
+    uint32_t pid;                           // pid of the client, 0 for every client
+    char     file[LOGC_LEVEL_FILE_LEN];     // file for an override, "" for none
+};
+
+/**
+ * Take the sequence lock of the levels
+ *
+ * @param levels Levels of a segment
+ * @param first Take it only if the levels were never set
+ * @return sequence of the lock, 0 if the lock was not taken
+ */
+static inline uint32_t
+logc_levels_lock(struct logc_levels *levels, int first)
+{
+    for(int i = 0; i < LOGC_LEVEL_SPINS; ++i) {
+        uint32_t s = __atomic_load_n(&(levels->seq), __ATOMIC_RELAXED);
+
+        if(first && s != 0)
+            return 0;
+
+        if(!(s & 1) && __atomic_compare_exchange_n(&(levels->seq), &s, s + 1, 0,
+                                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            // the odd sequence is seen before any change
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return s + 1;
+        }
+
+        sched_yield();
+    }
+
+    return 0;
+}
+
+/**
+ * Set the gate and release the sequence lock of the levels
+ *
+ * @param levels Levels of a segment
+ * @param seq Sequence returned by logc_levels_lock
+ */
+static inline void
+logc_levels_unlock(struct logc_levels *levels, uint32_t seq)
+{
+    int32_t gate = levels->level;
+
+    for(uint32_t i = 0; i < levels->n_overrides; ++i) {
+        if(levels->overrides[i].level < gate)
+            gate = levels->overrides[i].level;
+    }
+
+    __atomic_store_n(&(levels->gate), gate, __ATOMIC_RELAXED);
+    __atomic_store_n(&(levels->seq), seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Check if a file path ends with the file of an override, at a directory boundary
+ */
+static inline int
+logc_level_file_match(const char *path, int path_len, const char *file)
+{
+    int len = strnlen(file, LOGC_LEVEL_FILE_LEN);
+
+    if(len > path_len || memcmp(path + path_len - len, file, len) != 0)
+        return 0;
+
+    return len == path_len || path[path_len - len - 1] == '/';
+}
+
+/**
+ * Level of the messages of a channel logged from a file
+ * The most specific override wins: channel and file, then file, then channel.
+ *
+ * @param levels Levels of a segment
+ * @param channel Channel of the message
+ * @param path File of the log call
+ * @return level, the gate if the levels kept changing
+ */
+static inline int32_t
+logc_levels_resolve(struct logc_levels *levels, int channel, const char *path)
+{
+    int path_len = strlen(path);
+
+    for(int i = 0; i < LOGC_LEVEL_SPINS; ++i) {
+        uint32_t seq = __atomic_load_n(&(levels->seq), __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        int32_t level = levels->level;
+        int best = 0;
+
+        uint32_t n = levels->n_overrides;
+        for(uint32_t j = 0; j < n && j < LOGC_LEVEL_OVERRIDES; ++j) {
+            struct logc_level_override *o = &(levels->overrides[j]);
+            int match = 0;
+
+            if(o->channel != LOGC_LEVEL_ANY_CHANNEL) {
+                if(o->channel != channel)
+                    continue;
+                match += 1;
+            }
+            if(o->file[0] != '\0') {
+                if(!logc_level_file_match(path, path_len, o->file))
+                    continue;
+                match += 2;
+            }
+
+            if(match >= best) {
+                best = match;
+                level = o->level;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&(levels->seq), __ATOMIC_RELAXED) == seq)
+            return level;
+    }
+
+    return __atomic_load_n(&(levels->gate), __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,285 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_lz.h"
+
+#include <string.h>
+
+#define HASH_LOG        12
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       // the last 5 bytes are always literals
+#define MF_LIMIT        12      // the last match starts at least 12 bytes before the end
+#define MAX_OFFSET      65535
+#define SKIP_TRIGGER    6       // search faster in incompressible data
+
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/**
+ * Write a literal or match length that does not fit in the token
+ */
+static inline uint8_t *
+write_length(uint8_t *op, int len)
+{
+    while(len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+int
+logc_lz_compress(const char *src_buff, int src_len, char *dst_buff, int dst_cap)
+{
+    const uint8_t *src = (const uint8_t *)src_buff;
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + src_len;
+    const uint8_t *mf_limit = end - MF_LIMIT;
+    const uint8_t *match_limit = end - LAST_LITERALS;
+    uint8_t *op = (uint8_t *)dst_buff;
+    uint8_t *op_end = op + dst_cap;
+    uint32_t table[1 << HASH_LOG];
+
+    memset(table, 0, sizeof(table));
+
+    if(src_len > MF_LIMIT) {
+        ip++;
+
+        while(ip < mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = ip - src;
+
+            if(ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+                ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+
+            // extend the match backwards
+            while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            // extend the match forwards
+            const uint8_t *mp = ip + MIN_MATCH;
+            const uint8_t *rp = ref + MIN_MATCH;
+            while(mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            int lit_len = ip - anchor;
+            int match_len = mp - ip - MIN_MATCH;
+
+            if(op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > op_end)
+                return 0;
+
+            // token, literals, offset, match length
+            uint8_t *token = op++;
+            if(lit_len >= 15) {
+                *token = 15 << 4;
+                op = write_length(op, lit_len - 15);
+            }
+            else {
+                *token = lit_len << 4;
+            }
+
+            memcpy(op, anchor, lit_len);
+            op += lit_len;
+
+            uint16_t offset = ip - ref;
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+
+            if(match_len >= 15) {
+                *token |= 15;
+                op = write_length(op, match_len - 15);
+            }
+            else {
+                *token |= match_len;
+            }
+
+            ip = mp;
+            anchor = ip;
+
+            if(ip < mf_limit)
+                table[hash32(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    // last literals
+    int lit_len = end - anchor;
+    if(op + 1 + lit_len / 255 + 1 + lit_len > op_end)
+        return 0;
+
+    uint8_t *token = op++;
+    if(lit_len >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, lit_len - 15);
+    }
+    else {
+        *token = lit_len << 4;
+    }
+
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return op - (uint8_t *)dst_buff;
+}
+
+int
+logc_lz_decompress(const char *src_buff, int src_len, char *dst_buff, int dst_cap)
+{
+    const uint8_t *ip = (const uint8_t *)src_buff;
+    const uint8_t *ip_end = ip + src_len;
+    uint8_t *dst = (uint8_t *)dst_buff;
+    uint8_t *op = dst;
+    uint8_t *op_end = dst + dst_cap;
+
+    while(ip < ip_end) {
+        uint8_t token = *ip++;
+        uint8_t b;
+
+        // literals
+        int lit_len = token >> 4;
+        if(lit_len == 15) {
+            do {
+                if(ip >= ip_end)
+                    return -1;
+                b = *ip++;
+                lit_len += b;
+            } while(b == 255);
+        }
+
+        if(ip + lit_len > ip_end || op + lit_len > op_end)
+            return -1;
+
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        // the last sequence has only literals
+        if(ip == ip_end)
+            break;
+
+        // match
+        if(ip + 2 > ip_end)
+            return -1;
+
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if(offset == 0 || offset > op - dst)
+            return -1;
+
+        int match_len = token & 15;
+        if(match_len == 15) {
+            do {
+                if(ip >= ip_end)
+                    return -1;
+                b = *ip++;
+                match_len += b;
+            } while(b == 255);
+        }
+        match_len += MIN_MATCH;
+
+        if(op + match_len > op_end)
+            return -1;
+
+        const uint8_t *match = op - offset;
+        if(offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        }
+        else {
+            // overlapping copy, repeats the last offset bytes
+            while(match_len--)
+                *op++ = *match++;
+        }
+    }
+
+    return op - dst;
+}
+
+int
+logc_lz_write_block(FILE *fp, FILE *index_fp, const char *raw, int raw_len,
+                    uint64_t raw_offset, int64_t first_ts, int64_t last_ts)
+{
+    char data[logc_lz_compress_bound(LOGC_LZ_BLOCK_SIZE)];
+    struct logc_lz_block_header header;
+    struct logc_lz_index_entry entry;
+
+    int data_len = logc_lz_compress(raw, raw_len, data, raw_len);
+
+    header.magic = LOGC_LZ_BLOCK_MAGIC;
+    header.flags = 0;
+    header.raw_len = raw_len;
+    header.data_len = data_len;
+    header.raw_offset = raw_offset;
+    header.first_ts = first_ts;
+    header.last_ts = last_ts;
+
+    // not compressible, store as it is
+    const char *block_data = data;
+    if(data_len == 0) {
+        header.flags = LOGC_LZ_BLOCK_RAW;
+        header.data_len = raw_len;
+        block_data = raw;
+    }
+
+    entry.raw_offset = raw_offset;
+    entry.file_offset = ftell(fp);
+    entry.first_ts = first_ts;
+    entry.last_ts = last_ts;
+    entry.raw_len = raw_len;
+    entry.hole = 0;
+
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(block_data, 1, header.data_len, fp);
+    if(fflush(fp) != 0)
+        return -1;
+
+    // the index entry is written after the block, an index entry always points to a complete block
+    fwrite(&entry, sizeof(entry), 1, index_fp);
+    if(fflush(index_fp) != 0)
+        return -1;
+
+    return 0;
+}
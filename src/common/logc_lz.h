@@ -0,0 +1,118 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc LZ
+ * A fast LZ77 compressor producing the LZ4 block format, and the format of
+ * block compressed log files
+ *
+ * A block compressed log file starts with LOGC_LZ_FILE_MAGIC followed by blocks.
+ * Every block has a logc_lz_block_header followed by the compressed data, and can
+ * be decompressed on its own. The sidecar index file <log file>.bidx has a
+ * logc_lz_index_entry for every block, so a reader can seek by offset or time.
+ */
+
+#ifndef LOGC_LZ_H
+#define LOGC_LZ_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOGC_LZ_FILE_MAGIC      "LOGCLZ01"
+#define LOGC_LZ_FILE_MAGIC_LEN  8
+#define LOGC_LZ_BLOCK_MAGIC     0x6b6c626c      // "lblk"
+#define LOGC_LZ_BLOCK_SIZE      (64 * 1024)     // uncompressed size of a block
+#define LOGC_LZ_INDEX_SUFFIX    ".bidx"
+
+// block flags
+#define LOGC_LZ_BLOCK_RAW       0x01            // data is stored uncompressed
+
+struct logc_lz_block_header
+{
+    uint32_t magic;         // LOGC_LZ_BLOCK_MAGIC
+    uint32_t flags;         // block flags
+    uint32_t raw_len;       // uncompressed length
+    uint32_t data_len;      // length of the data following the header
+    uint64_t raw_offset;    // uncompressed offset of the block in the log
+    int64_t  first_ts;      // time the first byte of the block was written, epoch seconds
+    int64_t  last_ts;       // time the last byte of the block was written, epoch seconds
+};
+
+struct logc_lz_index_entry
+{
+    uint64_t raw_offset;    // uncompressed offset of the block in the log
+    uint64_t file_offset;   // offset of the block header in the log file
+    int64_t  first_ts;      // time the first byte of the block was written
+    int64_t  last_ts;       // time the last byte of the block was written
+    uint32_t raw_len;       // uncompressed length of the block
+    uint32_t hole;          // for alignment
+};
+
+/**
+ * Maximum size of the compressed data of len bytes
+ */
+#define logc_lz_compress_bound(len) ((len) + (len) / 255 + 16)
+
+/**
+ * Compress src to dst
+ * 
+ * @param src Data to compress
+ * @param src_len Length of src
+ * @param dst Destination buffer
+ * @param dst_cap Size of dst
+ * 
+ * @return compressed length, 0 if it does not fit in dst_cap
+ */
+int logc_lz_compress(const char *src, int src_len, char *dst, int dst_cap);
+
+/**
+ * Decompress src to dst
+ * 
+ * @param src Compressed data
+ * @param src_len Length of src
+ * @param dst Destination buffer
+ * @param dst_cap Size of dst
+ * 
+ * @return decompressed length, -1 if src is corrupt or does not fit in dst_cap
+ */
+int logc_lz_decompress(const char *src, int src_len, char *dst, int dst_cap);
+
+/**
+ * Compress a block and append it to a block compressed log file and its block index
+ * The block is stored uncompressed if it does not compress.
+ * 
+ * @param fp Log file
+ * @param index_fp Block index file
+ * @param raw Uncompressed block, at most LOGC_LZ_BLOCK_SIZE bytes
+ * @param raw_len Length of raw
+ * @param raw_offset Uncompressed offset of the block in the log
+ * @param first_ts Time the first byte of the block was written
+ * @param last_ts Time the last byte of the block was written
+ * 
+ * @return 0 on success, -1 if a write failed
+ */
+int logc_lz_write_block(FILE *fp, FILE *index_fp, const char *raw, int raw_len,
+                        uint64_t raw_offset, int64_t first_ts, int64_t last_ts);
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc probes
+ * Static tracepoints of the client and the server hot paths
+ *
+ * Built with USDT=1 (make USDT=1, needs sys/sdt.h) every probe is a nop in the
+ * code and a note in the binary that perf, bpftrace or systemtap attach to as
+ * usdt:<binary>:logc:<probe>. Every probe has a semaphore, the tracer counts
+ * itself in it while attached, and the probe only loads its arguments when the
+ * semaphore is set, so a probe that is not traced costs a load and a branch.
+ * Without USDT the probes compile to nothing.
+ *
+ * Probes                   arguments
+ * --------------------------------------------------------------------
+ * ring_write_entry         ring, length
+ * ring_write_exit          ring, length, bytes used after the write
+ * ring_wrap                ring, position of a frame that goes on from the start
+ * ring_threshold           ring, bytes used
+ * doorbell                 channel, urgent
+ * client_connect           shm name, channels, shards
+ * client_close             shm name
+ * server_connect           client pid, shm name
+ * server_close             client pid
+ * drain_start              client pid, channel
+ * drain_end                client pid, channel, bytes drained
+ * file_write               format, length
+ *
+ * The ring probes are in the client library, the drain, file and server probes
+ * are in logcserver. docs/bpftrace has example scripts.
+ */
+
+#ifndef LOGC_PROBE_H
+#define LOGC_PROBE_H
+
+#define LOGC_PROBE_LIST(X)  \
+    X(ring_write_entry)     \
+    X(ring_write_exit)      \
+    X(ring_wrap)            \
+    X(ring_threshold)       \
+    X(doorbell)             \
+    X(client_connect)       \
+    X(client_close)         \
+    X(server_connect)       \
+    X(server_close)         \
+    X(drain_start)          \
+    X(drain_end)            \
+    X(file_write)
+
+#ifdef LOGC_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// sys/sdt.h names the semaphore of a probe <provider>_<probe>_semaphore
+#define LOGC_PROBE_SEMAPHORE(name)  logc_##name##_semaphore
+
+#define LOGC_PROBE_DECLARE(name)    extern unsigned short LOGC_PROBE_SEMAPHORE(name);
+LOGC_PROBE_LIST(LOGC_PROBE_DECLARE)
+
+#define LOGC_PROBE_ENABLED(name)    __builtin_expect(LOGC_PROBE_SEMAPHORE(name) != 0, 0)
+
+#define LOGC_PROBE1(name, a)                                            \
+    do {                                                                \
+        if(LOGC_PROBE_ENABLED(name))                                    \
+            STAP_PROBE1(logc, name, a);                                 \
+    } while(0)
+
+#define LOGC_PROBE2(name, a, b)                                         \
+    do {                                                                \
+        if(LOGC_PROBE_ENABLED(name))                                    \
+            STAP_PROBE2(logc, name, a, b);                              \
+    } while(0)
+
+#define LOGC_PROBE3(name, a, b, c)                                      \
+    do {                                                                \
+        if(LOGC_PROBE_ENABLED(name))                                    \
+            STAP_PROBE3(logc, name, a, b, c);                           \
+    } while(0)
+
+#else
+
+#define LOGC_PROBE_ENABLED(name)    0
+
+#define LOGC_PROBE1(name, a)        do { } while(0)
+#define LOGC_PROBE2(name, a, b)     do { } while(0)
+#define LOGC_PROBE3(name, a, b, c)  do { } while(0)
+
+#endif  // LOGC_USDT
+
+#endif  // LOGC_PROBE_H
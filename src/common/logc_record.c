@@ -0,0 +1,135 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_record.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY     0x82f63b78  // reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_hw_supported;
+
+
+char *
+logc_record_next(char *buff, int len, int *off, struct logc_record *rec)
+{
+    for(int i = *off; i + (int)sizeof(struct logc_record) < len; ++i) {
+        if((uint8_t)buff[i] != LOGC_RECORD_MAGIC)
+            continue;
+
+        memcpy(rec, buff + i, sizeof(struct logc_record));
+
+        // a record has a valid level and a complete message ending with a new line
+        char *msg = buff + i + sizeof(struct logc_record);
+        if(rec->level > 6 || rec->len == 0 || rec->len > LOGC_RECORD_MAX_LEN ||
+           msg + rec->len > buff + len || msg[rec->len - 1] != '\n')
+            continue;
+
+        *off = msg + rec->len - buff;
+        return msg;
+    }
+
+    *off = len;
+    return NULL;
+}
+
+int
+logc_record_to_text(char *buff, int len)
+{
+    struct logc_record rec;
+    int off = 0;
+    int n = 0;
+    char *msg;
+
+    while((msg = logc_record_next(buff, len, &off, &rec)) != NULL) {
+        memmove(buff + n, msg, rec.len);
+        n += rec.len;
+    }
+
+    return n;
+}
+
+static void
+crc32c_init()
+{
+    for(uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for(int j = 0; j < 8; ++j)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[i] = crc;
+    }
+
+#if defined(__x86_64__)
+    crc32c_hw_supported = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+
+    while(len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+
+    while(len-- > 0)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+
+    return (uint32_t)c;
+}
+#endif
+
+uint32_t
+logc_crc32c(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    pthread_once(&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+
+#if defined(__x86_64__)
+    if(crc32c_hw_supported)
+        return ~crc32c_hw(crc, p, len);
+#endif
+
+    while(len-- > 0)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
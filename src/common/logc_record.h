@@ -0,0 +1,132 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc record
+ * Log records of structured channels and the binary log file format
+ *
+ * The client of a structured channel writes a logc_record header before every
+ * log message in the rings, so the server gets the time, level and callsite of
+ * every message without parsing the text. The message is the text line written
+ * to a text log file.
+ *
+ * A binary log file starts with LOGC_BIN_FILE_MAGIC followed by blocks. Every block
+ * has a logc_bin_block_header followed by length prefixed records, a logc_record
+ * header and the message. The CRC32C of the records is in the block header, so a
+ * torn block at a crash is detected and skipped, and a file can be verified at the
+ * speed of the disk.
+ */
+
+#ifndef LOGC_RECORD_H
+#define LOGC_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOGC_RECORD_MAGIC       0xa7
+#define LOGC_RECORD_MAX_LEN     1024    // maximum length of a message
+
+#define LOGC_BIN_FILE_MAGIC     "LOGCBIN1"
+#define LOGC_BIN_FILE_MAGIC_LEN 8
+#define LOGC_BIN_BLOCK_MAGIC    0x6b6c6262  // "bblk"
+#define LOGC_BIN_BLOCK_SIZE     (64 * 1024) // maximum length of the records of a block
+
+// log levels, same as enum logc_level of logc.h
+#define LOGC_LEVEL_NAMES        { "ALL", "INFO", "DEBUG", "WARN", "ERROR", "TRACE", "DISABLE" }
+#define LOGC_LEVEL_WARN         3
+
+struct logc_record
+{
+    uint8_t  magic;         // LOGC_RECORD_MAGIC
+    uint8_t  level;         // log level of the message
+    uint16_t len;           // length of the message following the header
+    uint32_t callsite;      // callsite id, see logc_callsite_id
+    int64_t  ts;            // time the message was logged, epoch nanoseconds
+};
+
+struct logc_bin_block_header
+{
+    uint32_t magic;         // LOGC_BIN_BLOCK_MAGIC
+    uint32_t len;           // length of the records following the header
+    uint32_t n_records;     // number of records in the block
+    uint32_t crc;           // CRC32C of the records
+};
+
+/**
+ * Id of a callsite, FNV-1a hash of the file name and the line number
+ * 
+ * @param file Source file of the callsite
+ * @param line Line number of the callsite
+ */
+static inline uint32_t
+logc_callsite_id(const char *file, int line)
+{
+    uint32_t h = 2166136261u;
+
+    while(*file)
+        h = (h ^ (uint8_t)*file++) * 16777619u;
+
+    for(int i = 0; i < 4; ++i, line >>= 8)
+        h = (h ^ (uint8_t)line) * 16777619u;
+
+    return h;
+}
+
+/**
+ * Find the next record in the logs read from a ring
+ * Bytes that are not a record, like the remains of a torn write or the
+ * partial first record of a flight recorder snapshot, are skipped.
+ * 
+ * @param buff Logs read from a ring
+ * @param len Length of buff
+ * @param off Offset to search from, set to the offset after the record
+ * @param rec Set to the header of the record
+ * 
+ * @return message of the record, NULL if there are no more records
+ */
+char *logc_record_next(char *buff, int len, int *off, struct logc_record *rec);
+
+/**
+ * Convert the records read from a ring to text
+ * 
+ * @param buff Logs read from a ring, the text is written in place
+ * @param len Length of buff
+ * 
+ * @return length of the text
+ */
+int logc_record_to_text(char *buff, int len);
+
+/**
+ * CRC32C (Castagnoli) of data
+ * Uses the SSE4.2 crc32 instruction when the CPU has it.
+ * 
+ * @param crc CRC of the previous data, 0 to start
+ * @param data Data
+ * @param len Length of data
+ * 
+ * @return CRC32C
+ */
+uint32_t logc_crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif
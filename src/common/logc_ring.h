@@ -0,0 +1,116 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc ring
+ * Bulk rings that grow under bursts and shrink when idle
+ *
+ * The bulk ring of a channel in a shard is the first level of a chain of rings, the
+ * other levels are shared memory objects of their own, named
+ * <segment name>.<shard>.<channel>.<level>, each LOGC_RING_GROWTH times the size of the
+ * level before. The ring_level of the segment has the level the producers write to.
+ *
+ * The server moves the producers to another level when a drain finds the ring above
+ * LOGC_RING_HIGH_PCT, or when the ring stayed below LOGC_RING_LOW_PCT for
+ * LOGC_RING_IDLE seconds. It initialises the new ring, links it in ring_level and
+ * closes the old ring. A producer reads ring_level before a write, and a write to a
+ * closed ring fails after it reserves space, its frame is committed as skipped and
+ * the producer reads ring_level again. The server drains the closed ring until every
+ * frame reserved in it is committed, then returns its
+ * memory and keeps the object, so the mappings of the producers stay valid and the
+ * next burst reuses it. The logs of the closed ring are older than the logs of the
+ * new ring, they are drained first.
+ */
+
+#ifndef LOGC_RING_H
+#define LOGC_RING_H
+
+#include "logc_buffer.h"
+#include "logc_utils.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOGC_RING_LEVELS        4       // the ring in the segment and 3 extensions
+#define LOGC_RING_GROWTH_SHIFT  2       // a level is 4 times the size of the level before
+#define LOGC_RING_GROWTH        (1 << LOGC_RING_GROWTH_SHIFT)
+#define LOGC_RING_HIGH_PCT      75      // a drain finds the ring this full, the ring grows
+#define LOGC_RING_LOW_PCT       10      // the ring stays below this fill, the ring shrinks
+#define LOGC_RING_IDLE          5       // seconds below LOGC_RING_LOW_PCT before the ring shrinks
+#define LOGC_RING_RETRIES       8       // writes to a closed ring before a message is dropped
+
+/**
+ * Size of the ring of a level in bytes, excluding the logc_buffer header
+ *
+ * @param level Level of the ring
+ */
+#define logc_ring_size(level) ((uint32_t)MAX_LOG_BUFF_SIZE << (LOGC_RING_GROWTH_SHIFT * (level)))
+
+/**
+ * Size of the ring of the last level
+ */
+#define LOGC_RING_MAX_SIZE logc_ring_size(LOGC_RING_LEVELS - 1)
+
+/**
+ * Size of the shared memory object of a level
+ *
+ * @param level Level of the ring
+ */
+#define logc_ring_object_size(level) (sizeof(struct logc_buffer) + logc_ring_size(level))
+
+/**
+ * Name of the shared memory object of a level
+ *
+ * @param name Set to the name, MAX_FILE_PATH_SIZE bytes
+ * @param shm_name Name of the segment
+ * @param shard Shard id
+ * @param channel Channel id
+ * @param level Level of the ring, 1 or more
+ */
+static inline void
+logc_ring_name(char *name, const char *shm_name, int shard, int channel, int level)
+{
+    snprintf(name, MAX_FILE_PATH_SIZE, "%s.%d.%d.%d", shm_name, shard, channel, level);
+}
+
+/**
+ * Map the ring of a level created by the server
+ *
+ * @param shm_name Name of the segment
+ * @param shard Shard id
+ * @param channel Channel id
+ * @param level Level of the ring, 1 or more
+ * @return the ring, NULL on failure
+ */
+static inline struct logc_buffer *
+logc_ring_open(const char *shm_name, int shard, int channel, int level)
+{
+    char name[MAX_FILE_PATH_SIZE];
+    size_t size = logc_ring_object_size(level);
+
+    logc_ring_name(name, shm_name, shard, channel, level);
+    return (struct logc_buffer *)open_shared_mem(name, &size);
+}
+
+#endif
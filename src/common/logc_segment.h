@@ -0,0 +1,133 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc shared memory segment
+ * A segment holds a header followed by one bulk ring and one urgent ring
+ * per channel. All the channels of a connection share a single segment.
+ *
+ * A segment shared by a pool of processes (pre-fork workers) has a shard of
+ * rings for every producer process. A process claims a shard by writing its
+ * pid to the owner of the shard, so a process dying in the middle of a write
+ * can only tear its own shard.
+ *
+ * The header also keeps the configuration of every channel, so a restarted
+ * server or logc-recover can drain the segment without the client.
+ * The log levels of the client are in the header too, the server changes them.
+ * So is the level of every bulk ring, the server grows a bulk ring into a chain of
+ * bigger rings under bursts, see logc_ring.h.
+ *
+ * The latency histograms of the client, see logc_latency.h, and the callsite
+ * counters, see logc_callsite.h, follow the rings.
+ */
+
+#ifndef LOGC_SEGMENT_H
+#define LOGC_SEGMENT_H
+
+#include "logc_buffer.h"
+#include "logc_latency.h"
+#include "logc_callsite.h"
+#include "logc_level.h"
+#include "logc_utils.h"
+
+#include <stdint.h>
+
+#define LOGC_SEGMENT_MAGIC  0x63676f6c  // "logc"
+
+struct logc_segment_channel
+{
+    uint32_t flags;                             // channel flags of init request
+    uint32_t format;                            // log file format, LOGC_FORMAT_*
+    uint32_t dump_size;                         // flight recorder dump size
+    char     log_file_path[MAX_FILE_PATH_SIZE]; // log file of the channel
+};
+
+struct logc_segment
+{
+    uint32_t magic;                     // LOGC_SEGMENT_MAGIC once initialised by the server
+    uint32_t pid;                       // pid of the client process
+    uint32_t n_channels;                // number of channels in the segment
+    uint32_t n_shards;                  // number of producer shards, 1 if not shared by a pool
+    uint32_t owner[LOGC_MAX_SHARDS];    // pid of the process owning a shard, 0 if free
+    struct logc_segment_channel channels[LOGC_MAX_CHANNELS];
+    struct logc_levels levels;          // log levels of the client, see logc_level.h
+    uint32_t ring_level[LOGC_MAX_SHARDS][LOGC_MAX_CHANNELS];   // bulk ring the producers write to, see logc_ring.h
+};
+
+/**
+ * Size of the rings of a channel
+ */
+#define LOGC_CHANNEL_SIZE \
+    (2 * sizeof(struct logc_buffer) + MAX_LOG_BUFF_SIZE + MAX_URGENT_BUFF_SIZE)
+
+/**
+ * Size of a segment with n shards of n channels
+ */
+#define logc_segment_size(shards, channels) \
+    (sizeof(struct logc_segment) + (shards) * (channels) * LOGC_CHANNEL_SIZE + \
+     sizeof(struct logc_latency) + sizeof(struct logc_callsites))
+
+/**
+ * Address of the bulk ring of a channel in a shard
+ * n_channels of the segment must be set before
+ * 
+ * @param seg A logc_segment
+ * @param shard Shard id
+ * @param ch Channel id
+ */
+#define logc_segment_bulk_ring(seg, shard, ch) \
+    ((void *)((char *)(seg) + sizeof(struct logc_segment) + \
+              ((shard) * ((struct logc_segment *)(seg))->n_channels + (ch)) * LOGC_CHANNEL_SIZE))
+
+/**
+ * Address of the urgent ring of a channel in a shard
+ * 
+ * @param seg A logc_segment
+ * @param shard Shard id
+ * @param ch Channel id
+ */
+#define logc_segment_urgent_ring(seg, shard, ch) \
+    ((void *)((char *)logc_segment_bulk_ring(seg, shard, ch) + sizeof(struct logc_buffer) + MAX_LOG_BUFF_SIZE))
+
+/**
+ * Address of the latency histograms of a segment
+ * n_shards and n_channels of the segment must be set before
+ * 
+ * @param seg A logc_segment
+ */
+#define logc_segment_latency(seg) \
+    ((struct logc_latency *)((char *)(seg) + sizeof(struct logc_segment) + \
+                             ((struct logc_segment *)(seg))->n_shards * \
+                             ((struct logc_segment *)(seg))->n_channels * LOGC_CHANNEL_SIZE))
+
+/**
+ * Address of the callsite counters of a segment
+ * n_shards and n_channels of the segment must be set before
+ * 
+ * @param seg A logc_segment
+ */
+#define logc_segment_callsites(seg) \
+    ((struct logc_callsites *)((char *)logc_segment_latency(seg) + sizeof(struct logc_latency)))
+
+#endif
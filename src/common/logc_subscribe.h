@@ -0,0 +1,72 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc subscription
+ * Shared memory of a live subscriber of the drained logs
+ *
+ * A subscriber, like logc-tail, sends a subscribe request with its filters. The
+ * server creates a shared memory with a logc_subscription header and a ring, and
+ * writes the drained log lines that pass the filters to the ring. The subscriber
+ * reads the ring with logc_buffer_read_all.
+ *
+ * The server never waits for a subscriber. A subscriber that lets the ring fill
+ * up to half is dropped: the state is set to LOGC_SUBSCRIPTION_DROPPED and
+ * nothing more is written to the ring.
+ */
+
+#ifndef LOGC_SUBSCRIBE_H
+#define LOGC_SUBSCRIBE_H
+
+#include "logc_buffer.h"
+
+#include <stdint.h>
+
+#define LOGC_SUBSCRIPTION_MAGIC     0x62757363  // "csub"
+#define LOGC_SUBSCRIPTION_RING_SIZE (1024 * 1024)
+
+// subscription states
+#define LOGC_SUBSCRIPTION_ACTIVE    0
+#define LOGC_SUBSCRIPTION_DROPPED   1       // the subscriber was too slow
+
+struct logc_subscription
+{
+    uint32_t magic;         // LOGC_SUBSCRIPTION_MAGIC
+    uint32_t state;         // subscription state
+    uint64_t n_lines;       // number of lines written to the ring
+};
+
+/**
+ * Size of the shared memory of a subscription
+ */
+#define logc_subscription_size() \
+    (sizeof(struct logc_subscription) + sizeof(struct logc_buffer) + LOGC_SUBSCRIPTION_RING_SIZE)
+
+/**
+ * Address of the ring of a subscription
+ */
+#define logc_subscription_ring(sub) \
+    ((struct logc_buffer *)((char *)(sub) + sizeof(struct logc_subscription)))
+
+#endif
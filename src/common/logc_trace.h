@@ -0,0 +1,86 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc trace
+ * Capture of the log traffic of a logc server, replayed by logc-replay
+ *
+ * A trace file starts with a logc_trace_header followed by records. A client has a
+ * connect record with the format and the flags of its channels, a drain record for
+ * every drain of a ring with the bytes drained, and the drained logs if the trace has
+ * payloads, and a close record. The time of a record is the nanoseconds since the
+ * start of the capture. The records are in time order.
+ *
+ * All integers are little endian.
+ */
+
+#ifndef LOGC_TRACE_H
+#define LOGC_TRACE_H
+
+#include <stdint.h>
+
+#define LOGC_TRACE_MAGIC        "LOGCTRC1"
+#define LOGC_TRACE_MAGIC_LEN    8
+
+// trace flags
+#define LOGC_TRACE_PAYLOADS     0x01        // drain records have the drained logs
+
+// record types
+#define LOGC_TRACE_CONNECT      1
+#define LOGC_TRACE_DRAIN        2
+#define LOGC_TRACE_CLOSE        3
+
+// drain record flags
+#define LOGC_TRACE_URGENT       0x01        // drain of an urgent ring
+
+struct logc_trace_header
+{
+    char     magic[LOGC_TRACE_MAGIC_LEN];   // LOGC_TRACE_MAGIC
+    uint32_t flags;                         // trace flags
+    uint32_t hole;                          // for alignment
+    int64_t  start;                         // start of the capture, epoch nanoseconds
+};
+
+struct logc_trace_record
+{
+    uint8_t  type;          // record type
+    uint8_t  channel;       // channel of a drain, number of channels of a connect
+    uint8_t  flags;         // drain record flags
+    uint8_t  n_shards;      // producer shards of a connect
+    uint32_t client;        // id of the client in the trace, from 1
+    int64_t  ts;            // nanoseconds since the start of the capture
+    uint32_t len;           // bytes drained
+    uint32_t payload_len;   // length of the payload following the record
+};
+
+/**
+ * payload of a connect record, for every channel
+ */
+struct logc_trace_channel
+{
+    uint8_t  format;        // log file format, LOGC_FORMAT_*
+    uint8_t  flags;         // channel flags of init request
+};
+
+#endif
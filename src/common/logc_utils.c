@@ -26,6 +26,7 @@
 
 #include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -49,20 +50,55 @@ console_log__(char *file, char *function, int line, char *format, ...)
 #endif
 
 void *
-create_shared_mem(char *name)
+create_shared_mem(char *name, size_t size)
 {
-    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
     if(fd == -1) {
         return NULL;
     }
 
-    ftruncate(fd, MAX_LOG_BUFF_SIZE);
+    if(ftruncate(fd, size) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    return addr;
+}
 
-    void *addr = mmap(NULL, MAX_LOG_BUFF_SIZE, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+void *
+open_shared_mem(char *name, size_t *size)
+{
+    int fd = shm_open(name, O_RDWR, 0666);
+    if(fd == -1) {
+        return NULL;
+    }
+
+    size_t map_size = size != NULL ? *size : 0;
+    if(map_size == 0) {
+        struct stat st;
+        if(fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return NULL;
+        }
+        map_size = st.st_size;
+    }
+
+    void *addr = mmap(NULL, map_size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
     if(addr == MAP_FAILED) {
+        close(fd);
         return NULL;
     }
 
+    if(size != NULL)
+        *size = map_size;
+
     close(fd);
     return addr;
-}
\ No newline at end of file
+}
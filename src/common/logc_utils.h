@@ -25,18 +25,42 @@
 #ifndef LOGC_UTILS_H
 #define LOGC_UTILS_H
 
+#include <stddef.h>
 
 
 #define LOGC_SERVER_SOCKET_PATH   "/dev/shm/logc.server"
-#define MAX_LOG_BUFF_SIZE     1024 * 16
-#define MAX_READ_BUFF_SIZE    128
+#define LOGC_REGISTRY_PATH        "/dev/shm/logc.registry"
+#define MAX_LOG_BUFF_SIZE     (1024 * 16)
+#define MAX_URGENT_BUFF_SIZE  (1024 * 2)
+#define MAX_READ_BUFF_SIZE    4096
 #define MAX_WRITE_BUFF_SIZE   128
 #define MAX_FILE_PATH_SIZE    128
+#define LOGC_MAX_CHANNELS     16
+#define LOGC_MAX_SHARDS       64
 
 // Request codes
 #define REQUEST_INIT            1
 #define REQUEST_WRITE           2
 #define REQUEST_CLOSE           3
+#define REQUEST_WRITE_URGENT    4
+#define REQUEST_DUMP            5
+#define REQUEST_ATTACH          6
+#define REQUEST_SUBSCRIBE       7
+#define REQUEST_STATS           8
+#define REQUEST_LEVEL           9
+
+// Channel flags in init request
+#define LOGC_CHANNEL_APPEND     0x01    // open the log file in append mode
+#define LOGC_CHANNEL_FLIGHT     0x02    // flight recorder, bulk ring is only dumped on crash or trigger
+
+// Log file formats
+#define LOGC_FORMAT_TEXT        0       // plain text
+#define LOGC_FORMAT_LZ          1       // independently compressed blocks with a block index, see logc_lz.h
+#define LOGC_FORMAT_BIN         2       // CRC32C framed blocks of records, see logc_record.h
+#define LOGC_FORMAT_JSON        3       // JSON lines of records, see logc_json.h
+
+// the rings of a structured channel have a record header before every message
+#define logc_format_structured(format) ((format) >= LOGC_FORMAT_BIN)
 
 
 #ifdef LOGC_DEBUG
@@ -51,10 +75,22 @@
 /**
  * Create a shared memory with the given name in read write mode.
  * And map the file to memory.
+ * Fails with EEXIST if a shared memory with the name exists.
+ * 
+ * @param name name of the shared memory file
+ * @param size size of the shared memory in bytes
+ * @return address of mapped memory, NULL if failed
+ */
+void *create_shared_mem(char *name, size_t size);
+
+/**
+ * Open an existing shared memory with the given name in read write mode.
+ * And map the file to memory.
  * 
  * @param name name of the shared memory file
+ * @param size if not NULL, set to the size of the shared memory. Mapped size is *size if it is not 0
  * @return address of mapped memory, NULL if failed
  */
-void *create_shared_mem(char *name);
+void *open_shared_mem(char *name, size_t *size);
 
 #endif
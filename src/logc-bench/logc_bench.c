@@ -0,0 +1,604 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-bench
+ * Microbenchmarks of the client and ring hot paths, written as JSON
+ *
+ * usage: logc-bench [-n ops] [-d dir] [-S server] [-o file]
+ *     -n  operations per thread, 200000 by default
+ *     -d  directory of the log files, /tmp by default
+ *     -S  logc server binary, started in dir if no server is running
+ *     -o  write the results to file instead of stdout
+ *
+ * Benchmarks:
+ *     ring_write      logc_buffer_write by 1 to 8 threads, with a thread draining the ring
+ *     ring_read_all   logc_buffer_read_all of the draining thread of ring_write
+ *     drain_to_file   logc_buffer_read_all and fwrite to a file of a ring filled upto
+ *                     the threshold, as the server drains
+ *     logc_log        logc_log end to end, needs a logc server
+ *     fprintf         baseline, the same line with fprintf to a shared FILE
+ *     write           baseline, the same line with a write syscall
+ *
+ * Every result has the throughput, in bytes where the size is known, and the p50, p99
+ * and p99.9 latency of an operation in nanoseconds, upper bounds of log-linear buckets
+ * of cycle counter ticks.
+ */
+
+#define _GNU_SOURCE       // for pthread_barrier_t
+
+#include "../logc-client/logc.h"
+#include "../common/logc_buffer.h"
+#include "../common/logc_latency.h"
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAX_THREADS 8
+
+struct bench_result
+{
+    const char *name;
+    int threads;
+    int msg_size;
+    uint64_t ops;
+    uint64_t bytes;
+    double seconds;
+    uint64_t hist[LOGC_LATENCY_BUCKETS];
+};
+
+struct bench_thread
+{
+    struct bench_result *result;    // result of the benchmark, merged after the run
+    uint64_t hist[LOGC_LATENCY_BUCKETS];
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t busy_ticks;            // time of the timed part only, if not the whole run
+    int id;
+};
+
+static uint64_t n_ops = 200000;
+static char *dir = "/tmp";
+static uint32_t ticks_per_ms;
+static FILE *out;
+static int n_results;
+
+// benchmark state shared by the threads of a run
+static struct logc_buffer *ring;
+static int msg_size;
+static int writers_done;
+static FILE *shared_fp;
+static int shared_fd;
+static struct logc_handle *handle;
+static pthread_barrier_t start_barrier;
+
+
+static inline void
+count_op(uint64_t *hist, uint64_t start)
+{
+    hist[logc_latency_bucket(logc_latency_ticks() - start)]++;
+}
+
+static double
+now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Cycle counter ticks in a millisecond, measured against the monotonic clock
+ */
+static uint32_t
+calibrate()
+{
+    double begin = now_seconds();
+    uint64_t ticks = logc_latency_ticks();
+
+    while(now_seconds() - begin < 0.01)
+        ;
+
+    return (logc_latency_ticks() - ticks) / ((now_seconds() - begin) * 1000);
+}
+
+/**
+ * Upper bound of the bucket of a percentile, in nanoseconds
+ */
+static uint64_t
+percentile(uint64_t *hist, uint64_t n, double pct)
+{
+    uint64_t rank = (uint64_t)(n * pct / 100.0);
+    uint64_t seen = 0;
+    int b;
+
+    if(n == 0)
+        return 0;
+
+    for(b = 0; b < LOGC_LATENCY_BUCKETS - 1; ++b) {
+        seen += hist[b];
+        if(seen > rank)
+            break;
+    }
+
+    return logc_latency_bucket_low(b + 1) * 1000000 / ticks_per_ms;
+}
+
+static void
+write_result(struct bench_result *r)
+{
+    uint64_t n = 0;
+    for(int b = 0; b < LOGC_LATENCY_BUCKETS; ++b)
+        n += r->hist[b];
+
+    fprintf(out, "%s\n    {\"bench\": \"%s\", \"threads\": %d, \"msg_size\": %d, \"ops\": %llu, \"seconds\": %.6f, "
+                 "\"ops_per_sec\": %.0f, \"mb_per_sec\": %.2f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}",
+            n_results++ > 0 ? "," : "", r->name, r->threads, r->msg_size, (unsigned long long)r->ops, r->seconds,
+            r->seconds > 0 ? r->ops / r->seconds : 0, r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0,
+            (unsigned long long)percentile(r->hist, n, 50), (unsigned long long)percentile(r->hist, n, 99),
+            (unsigned long long)percentile(r->hist, n, 99.9));
+    fflush(out);
+}
+
+static void
+write_skipped(const char *name, const char *reason)
+{
+    fprintf(out, "%s\n    {\"bench\": \"%s\", \"skipped\": \"%s\"}", n_results++ > 0 ? "," : "", name, reason);
+}
+
+/**
+ * Run a benchmark on n threads and write its result
+ *
+ * @param name: name of the benchmark
+ * @param fn: thread function, gets a bench_thread
+ * @param threads: number of threads
+ * @param size: message size
+ */
+static void
+run(const char *name, void *(*fn)(void *), int threads, int size)
+{
+    struct bench_result result = { .name = name, .threads = threads, .msg_size = size };
+    struct bench_thread bt[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+
+    for(int i = 0; i < threads; ++i) {
+        memset(&bt[i], 0, sizeof(bt[i]));
+        bt[i].result = &result;
+        bt[i].id = i;
+        pthread_create(&tid[i], NULL, fn, &bt[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double begin = now_seconds();
+    uint64_t busy_ticks = 0;
+
+    for(int i = 0; i < threads; ++i) {
+        pthread_join(tid[i], NULL);
+
+        busy_ticks += bt[i].busy_ticks;
+        result.ops += bt[i].ops;
+        result.bytes += bt[i].bytes;
+        for(int b = 0; b < LOGC_LATENCY_BUCKETS; ++b)
+            result.hist[b] += bt[i].hist[b];
+    }
+
+    result.seconds = busy_ticks > 0 ? busy_ticks / (ticks_per_ms * 1000.0) : now_seconds() - begin;
+    pthread_barrier_destroy(&start_barrier);
+
+    write_result(&result);
+}
+
+/**
+ * Fill a message of msg_size bytes ending with a new line
+ */
+static void
+fill_msg(char *msg, int size, int id)
+{
+    memset(msg, 'a' + id % 26, size - 1);
+    msg[size - 1] = '\n';
+}
+
+/**
+ * Format a log line like the client
+ */
+static int
+format_line(char *buff, int size, uint64_t i)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    int len = strftime(buff, size, "%c", localtime_r(&now, &tm));
+
+    len += snprintf(buff + len, size - len, " | %s | %s | %d | message %llu of the benchmark\n",
+                    __FILE__, __func__, __LINE__, (unsigned long long)i);
+    return len < size ? len : size - 1;
+}
+
+static void *
+ring_writer(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    char msg[1024];
+
+    fill_msg(msg, msg_size, bt->id);
+    pthread_barrier_wait(&start_barrier);
+
+    for(uint64_t i = 0; i < n_ops; ++i) {
+        uint64_t start = logc_latency_ticks();
+        logc_buffer_write(ring, msg, msg_size);
+        count_op(bt->hist, start);
+    }
+
+    bt->ops = n_ops;
+    bt->bytes = n_ops * msg_size;
+    return NULL;
+}
+
+/**
+ * Drain the ring until the writers are done, the result is ring_read_all
+ */
+static void *
+ring_reader(void *arg)
+{
+    struct bench_result *result = (struct bench_result *)arg;
+    char *buff = malloc(ring->size);
+    double begin = now_seconds();
+
+    while(!__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE)) {
+        uint64_t start = logc_latency_ticks();
+        int n = logc_buffer_read_all(ring, buff);
+
+        if(n > 0) {
+            count_op(result->hist, start);
+            result->ops++;
+            result->bytes += n;
+        }
+    }
+
+    result->seconds = now_seconds() - begin;
+    free(buff);
+    return NULL;
+}
+
+static struct logc_buffer *
+ring_alloc()
+{
+    struct logc_buffer *r;
+    logc_buffer_map_and_init(r, malloc(sizeof(struct logc_buffer) + MAX_LOG_BUFF_SIZE),
+                             MAX_LOG_BUFF_SIZE, MAX_LOG_BUFF_SIZE * 0.5);
+    return r;
+}
+
+/**
+ * ring_write and ring_read_all, writers and a draining thread on a ring of a channel
+ */
+static void
+bench_ring(int threads, int size)
+{
+    struct bench_result reads = { .name = "ring_read_all", .threads = threads, .msg_size = size };
+    pthread_t reader;
+
+    ring = ring_alloc();
+    msg_size = size;
+    writers_done = 0;
+
+    pthread_create(&reader, NULL, ring_reader, &reads);
+    run("ring_write", ring_writer, threads, size);
+    __atomic_store_n(&writers_done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    write_result(&reads);
+    free(ring);
+}
+
+static void *
+drain_reader(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    char *buff = malloc(ring->size);
+    char msg[1024];
+
+    fill_msg(msg, msg_size, 0);
+    pthread_barrier_wait(&start_barrier);
+
+    while(bt->bytes < n_ops * msg_size) {
+        // fill the ring upto the threshold, as a write request finds it
+        while(logc_buffer_write(ring, msg, msg_size) == 0)
+            ;
+
+        uint64_t start = logc_latency_ticks();
+        int n = logc_buffer_read_all(ring, buff);
+        fwrite(buff, 1, n, shared_fp);
+        count_op(bt->hist, start);
+
+        bt->busy_ticks += logc_latency_ticks() - start;
+        bt->ops++;
+        bt->bytes += n;
+    }
+
+    fflush(shared_fp);
+    free(buff);
+    return NULL;
+}
+
+/**
+ * drain_to_file, the ring is filled upto the threshold and drained to a file,
+ * only the drains are timed
+ */
+static void
+bench_drain(int size)
+{
+    char path[MAX_FILE_PATH_SIZE];
+
+    snprintf(path, sizeof(path), "%s/logc_bench_drain_%d.log", dir, getpid());
+    shared_fp = fopen(path, "w");
+    if(shared_fp == NULL) {
+        write_skipped("drain_to_file", strerror(errno));
+        return;
+    }
+
+    ring = ring_alloc();
+    msg_size = size;
+
+    run("drain_to_file", drain_reader, 1, size);
+
+    fclose(shared_fp);
+    unlink(path);
+    free(ring);
+}
+
+static void *
+logc_log_writer(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for(uint64_t i = 0; i < n_ops; ++i) {
+        uint64_t start = logc_latency_ticks();
+        logc_info(handle, "message %llu of the benchmark", (unsigned long long)i);
+        count_op(bt->hist, start);
+    }
+
+    bt->ops = n_ops;
+    return NULL;
+}
+
+static void *
+fprintf_writer(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for(uint64_t i = 0; i < n_ops; ++i) {
+        uint64_t start = logc_latency_ticks();
+        time_t now = time(NULL);
+        struct tm tm;
+        char date[64];
+
+        strftime(date, sizeof(date), "%c", localtime_r(&now, &tm));
+        bt->bytes += fprintf(shared_fp, "%s | %s | %s | %d | message %llu of the benchmark\n",
+                             date, __FILE__, __func__, __LINE__, (unsigned long long)i);
+        count_op(bt->hist, start);
+    }
+
+    bt->ops = n_ops;
+    return NULL;
+}
+
+static void *
+write_writer(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    char line[1024];
+
+    pthread_barrier_wait(&start_barrier);
+
+    for(uint64_t i = 0; i < n_ops; ++i) {
+        uint64_t start = logc_latency_ticks();
+        int len = format_line(line, sizeof(line), i);
+
+        if(write(shared_fd, line, len) == len)
+            bt->bytes += len;
+        count_op(bt->hist, start);
+    }
+
+    bt->ops = n_ops;
+    return NULL;
+}
+
+static int
+server_running()
+{
+    struct sockaddr_un server_addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int ret;
+
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    ret = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0;
+
+    close(fd);
+    return ret;
+}
+
+/**
+ * logc_log end to end, and the fprintf and write baselines
+ */
+static void
+bench_log(int threads)
+{
+    char path[MAX_FILE_PATH_SIZE];
+
+    snprintf(path, sizeof(path), "%s/logc_bench_logc_%d.log", dir, getpid());
+    handle = logc_handle_init(path, ALL, false);
+    if(!server_running() || logc_connect(handle) == -1) {
+        write_skipped("logc_log", "no logc server");
+    }
+    else {
+        run("logc_log", logc_log_writer, threads, 0);
+        logc_close(handle);
+    }
+    free(handle);
+    unlink(path);
+    strcat(path, ".tidx");
+    unlink(path);
+
+    snprintf(path, sizeof(path), "%s/logc_bench_fprintf_%d.log", dir, getpid());
+    shared_fp = fopen(path, "w");
+    if(shared_fp != NULL) {
+        run("fprintf", fprintf_writer, threads, 0);
+        fclose(shared_fp);
+        unlink(path);
+    }
+
+    snprintf(path, sizeof(path), "%s/logc_bench_write_%d.log", dir, getpid());
+    shared_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    if(shared_fd != -1) {
+        run("write", write_writer, threads, 0);
+        close(shared_fd);
+        unlink(path);
+    }
+}
+
+/**
+ * Start the logc server in dir if none is running
+ *
+ * @returns pid of the started server, 0 if a server is running or none could be started
+ */
+static pid_t
+start_server(char *server)
+{
+    if(server == NULL || server_running())
+        return 0;
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if(chdir(dir) == 0)
+            execl(server, server, (char *)NULL);
+        _exit(127);
+    }
+
+    // wait for the server to listen
+    for(int i = 0; pid > 0 && i < 200 && !server_running(); ++i)
+        usleep(10000);
+
+    return pid > 0 ? pid : 0;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-bench [-n ops] [-d dir] [-S server] [-o file]\n"
+                    "    -n  operations per thread, 200000 by default\n"
+                    "    -d  directory of the log files, /tmp by default\n"
+                    "    -S  logc server binary, started in dir if no server is running\n"
+                    "    -o  write the results to file instead of stdout\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int thread_counts[] = { 1, 2, 4, 8 };
+    static const int sizes[] = { 32, 128, 512 };
+    char *server = NULL;
+    int opt;
+
+    out = stdout;
+
+    while((opt = getopt(argc, argv, "n:d:S:o:h")) != -1) {
+        switch(opt) {
+        case 'n':
+            n_ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'S':
+            server = realpath(optarg, NULL);
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if(out == NULL) {
+                fprintf(stderr, "logc-bench: cannot open %s: %s\n", optarg, strerror(errno));
+                return 1;
+            }
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(n_ops == 0) {
+        usage();
+        return 1;
+    }
+
+    ticks_per_ms = calibrate();
+    pid_t server_pid = start_server(server);
+
+    fprintf(out, "{\n  \"ops_per_thread\": %llu,\n  \"ticks_per_ms\": %u,\n  \"results\": [",
+            (unsigned long long)n_ops, ticks_per_ms);
+
+    for(int t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t) {
+        for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+            bench_ring(thread_counts[t], sizes[s]);
+    }
+
+    for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        bench_drain(sizes[s]);
+
+    for(int t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+        bench_log(thread_counts[t]);
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if(server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+
+    if(out != stdout)
+        fclose(out);
+    free(server);
+    return 0;
+}
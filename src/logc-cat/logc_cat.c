@@ -0,0 +1,206 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-cat
+ * Writes the logs of block compressed log files to stdout
+ *
+ * usage: logc-cat [-o offset] [-t from] [-T to] log_file ...
+ *     -o  start at the uncompressed offset
+ *     -t  start at the first block written at or after the time
+ *     -T  stop after the last block written at or before the time
+ *
+ * A time is either epoch seconds or local time as YYYY-MM-DD HH:MM:SS.
+ * The block index <log file>.bidx is used to seek to the first block, the blocks
+ * are read sequentially from there. Without the index, every block is read.
+ * Time selection is per block, a block has the logs drained within about a second.
+ */
+
+#include "../common/logc_lz.h"
+#include "../common/logc_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+
+// uncompressed offset to start at
+static uint64_t from_offset = 0;
+
+// time range of the blocks to write
+static int64_t from_time = 0;
+static int64_t to_time = INT64_MAX;
+
+
+/**
+ * Find the file offset of the first block to write with the block index
+ *
+ * @returns file offset of the block, the offset of the first block if there is no index
+ */
+static long
+seek_index(char *log_file_path)
+{
+    char index_path[4096];
+    struct logc_lz_index_entry entry;
+    long file_offset = LOGC_LZ_FILE_MAGIC_LEN;
+
+    snprintf(index_path, sizeof(index_path), "%s%s", log_file_path, LOGC_LZ_INDEX_SUFFIX);
+    FILE *fp = fopen(index_path, "r");
+    if(fp == NULL)
+        return file_offset;
+
+    // the index is in the order of the blocks, skip the blocks before the range
+    while(fread(&entry, sizeof(entry), 1, fp) == 1) {
+        file_offset = entry.file_offset;
+        if(entry.raw_offset + entry.raw_len > from_offset && entry.last_ts >= from_time)
+            break;
+    }
+
+    fclose(fp);
+    return file_offset;
+}
+
+/**
+ * Write the logs of a block compressed log file to stdout
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+cat_file(char *log_file_path)
+{
+    static char data[logc_lz_compress_bound(LOGC_LZ_BLOCK_SIZE)];
+    static char raw[LOGC_LZ_BLOCK_SIZE];
+    char magic[LOGC_LZ_FILE_MAGIC_LEN];
+    struct logc_lz_block_header header;
+
+    FILE *fp = fopen(log_file_path, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "logc-cat: cannot open %s: %s\n", log_file_path, strerror(errno));
+        return -1;
+    }
+
+    if(fread(magic, 1, LOGC_LZ_FILE_MAGIC_LEN, fp) != LOGC_LZ_FILE_MAGIC_LEN ||
+       memcmp(magic, LOGC_LZ_FILE_MAGIC, LOGC_LZ_FILE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "logc-cat: %s is not a block compressed log file\n", log_file_path);
+        fclose(fp);
+        return -1;
+    }
+
+    fseek(fp, seek_index(log_file_path), SEEK_SET);
+
+    int ret = 0;
+    while(fread(&header, sizeof(header), 1, fp) == 1) {
+        if(header.magic != LOGC_LZ_BLOCK_MAGIC || header.raw_len > LOGC_LZ_BLOCK_SIZE ||
+           header.data_len > sizeof(data)) {
+            fprintf(stderr, "logc-cat: %s: corrupt block at %ld\n", log_file_path, ftell(fp) - (long)sizeof(header));
+            ret = -1;
+            break;
+        }
+
+        if(fread(data, 1, header.data_len, fp) != header.data_len) {
+            // the server was stopped in the middle of writing the block
+            fprintf(stderr, "logc-cat: %s: incomplete last block\n", log_file_path);
+            break;
+        }
+
+        if(header.first_ts > to_time)
+            break;
+        if(header.raw_offset + header.raw_len <= from_offset || header.last_ts < from_time)
+            continue;
+
+        char *block = data;
+        if(!(header.flags & LOGC_LZ_BLOCK_RAW)) {
+            if(logc_lz_decompress(data, header.data_len, raw, sizeof(raw)) != header.raw_len) {
+                fprintf(stderr, "logc-cat: %s: corrupt block data at offset %llu\n",
+                        log_file_path, (unsigned long long)header.raw_offset);
+                ret = -1;
+                break;
+            }
+            block = raw;
+        }
+
+        uint32_t skip = 0;
+        if(header.raw_offset < from_offset)
+            skip = from_offset - header.raw_offset;
+
+        fwrite(block + skip, 1, header.raw_len - skip, stdout);
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-cat [-o offset] [-t from] [-T to] log_file ...\n"
+                    "    -o  start at the uncompressed offset\n"
+                    "    -t  start at the first block written at or after the time\n"
+                    "    -T  stop after the last block written at or before the time\n"
+                    "    a time is epoch seconds or YYYY-MM-DD HH:MM:SS\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:t:T:h")) != -1) {
+        switch(opt) {
+        case 'o':
+            from_offset = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            if(logc_index_parse_time(optarg, &from_time) == -1) {
+                fprintf(stderr, "logc-cat: invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            if(logc_index_parse_time(optarg, &to_time) == -1) {
+                fprintf(stderr, "logc-cat: invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind == argc) {
+        usage();
+        return 1;
+    }
+
+    int ret = 0;
+    for(int i = optind; i < argc; ++i) {
+        if(cat_file(argv[i]) == -1)
+            ret = 1;
+    }
+
+    return ret;
+}
@@ -23,7 +23,11 @@
  */
 
 #include "logc.h"
+#include "logc_embedded.h"
 #include "../common/logc_utils.h"
+#include "../common/logc_segment.h"
+#include "../common/logc_record.h"
+#include "../common/logc_probe.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -37,61 +41,374 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
-#define LOGC_SERVER_SOCKET_PATH "/dev/shm/logc.server"
 #define REQ_BUFF_SIZE 128
 #define RESP_BUFF_SIZE 128
+#define MAX_POOL_HANDLES 16
 
+// pool handles, a process forked from the pool owner claims a shard of every pool handle
+static struct logc_handle *pool_handles[MAX_POOL_HANDLES];
+static int n_pool_handles;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_atfork_once = PTHREAD_ONCE_INIT;
+
+// taken to map a level of a bulk ring
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// latency histograms of the thread, slot claimed in the histograms of the segment
+static __thread uint32_t latency_calls;
+static __thread struct logc_latency *latency_thread_hist;
+static __thread struct logc_latency_slot *latency_slot;
+static __thread int latency_shared;
+
+
+static int send_urgent_write_request(struct logc_handle *handle, int channel);
+static int send_request(struct logc_handle *handle, uint8_t *req_buff, int len);
+
+/**
+ * Histograms slot of the calling thread, claimed on the first sample
+ */
+static struct logc_latency_slot *
+latency_thread_slot(struct logc_latency *hist)
+{
+    if(latency_thread_hist == hist)
+        return latency_slot;
+
+    // a thread logging to more handles finds its slot again
+    uint32_t tid = syscall(SYS_gettid);
+    uint32_t n = __atomic_load_n(&(hist->n_slots), __ATOMIC_ACQUIRE);
+    uint32_t i;
+
+    for(i = 0; i < n && i < LOGC_LATENCY_SLOTS; ++i) {
+        if(__atomic_load_n(&(hist->slots[i].tid), __ATOMIC_RELAXED) == tid)
+            break;
+    }
+
+    if(i == n || i == LOGC_LATENCY_SLOTS) {
+        i = __atomic_fetch_add(&(hist->n_slots), 1, __ATOMIC_ACQ_REL);
+        if(i >= LOGC_LATENCY_SLOTS)
+            i = LOGC_LATENCY_SLOTS - 1;
+        __atomic_store_n(&(hist->slots[i].tid), tid, __ATOMIC_RELAXED);
+    }
+
+    latency_thread_hist = hist;
+    latency_slot = &(hist->slots[i]);
+    latency_shared = i == LOGC_LATENCY_SLOTS - 1;
+    return latency_slot;
+}
+
+static inline void
+latency_count(struct logc_latency_slot *slot, int stage, uint64_t ticks)
+{
+    uint64_t *count = &(slot->counts[stage][logc_latency_bucket(ticks)]);
+
+    if(latency_shared)
+        __atomic_fetch_add(count, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count a sampled log call
+ * 
+ * @param start Ticks at the start of the call
+ * @param formatted Ticks after formatting the message
+ * @param written Ticks after writing the message to the ring
+ * @param end Ticks at the end of the call
+ * @param doorbell 1 if a write request was sent
+ */
+static void
+latency_record(struct logc_handle *handle, uint64_t start, uint64_t formatted, uint64_t written, uint64_t end, int doorbell)
+{
+    struct logc_latency_slot *slot = latency_thread_slot(handle->latency);
+
+    latency_count(slot, LOGC_LATENCY_TOTAL, end - start);
+    latency_count(slot, LOGC_LATENCY_FORMAT, formatted - start);
+    latency_count(slot, LOGC_LATENCY_RING, written - formatted);
+    if(doorbell)
+        latency_count(slot, LOGC_LATENCY_DOORBELL, end - written);
+}
+
+/**
+ * Cycle counter ticks in a millisecond, measured against the monotonic clock
+ */
+static uint32_t
+latency_calibrate()
+{
+    struct timespec begin, now;
+    int64_t elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    uint64_t ticks = logc_latency_ticks();
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - begin.tv_sec) * 1000000000LL + now.tv_nsec - begin.tv_nsec;
+    } while(elapsed < 2000000);
+    ticks = logc_latency_ticks() - ticks;
+
+    return ticks * 1000000 / elapsed;
+}
+
+/**
+ * Start or stop sampling to the histograms of the segment of a connected handle
+ */
+static void
+latency_start(struct logc_handle *handle)
+{
+    struct logc_latency *hist = logc_segment_latency(handle->mmap_addr);
+
+    if(handle->latency_period == 0) {
+        // the histograms are kept for the stats
+        __atomic_store_n(&(handle->latency), NULL, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if(hist->ticks_per_ms == 0)
+        hist->ticks_per_ms = latency_calibrate();
+    hist->period = handle->latency_period;
+    __atomic_store_n(&(hist->magic), LOGC_LATENCY_MAGIC, __ATOMIC_RELEASE);
+
+    handle->latency_mask = handle->latency_period - 1;
+    __atomic_store_n(&(handle->latency), hist, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count a message of a callsite in the callsite table of the segment
+ * 
+ * @param table Callsite table of the segment
+ * @param callsite Callsite id
+ * @param len Bytes written to the ring
+ */
+static void
+callsite_count(struct logc_callsites *table, uint32_t callsite, const char *file, int line, int len)
+{
+    uint32_t id = callsite != 0 ? callsite : 1;
+
+    for(int probe = 0; probe < LOGC_CALLSITE_PROBES; ++probe) {
+        struct logc_callsite_entry *entry = &(table->entries[(id + probe) & (LOGC_CALLSITES - 1)]);
+        uint32_t cur = __atomic_load_n(&(entry->id), __ATOMIC_RELAXED);
+
+        if(cur == 0) {
+            if(__atomic_compare_exchange_n(&(entry->id), &cur, id, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                // keep the end of a long file name, the start is the common path
+                int file_len = strlen(file);
+                if(file_len >= LOGC_CALLSITE_FILE_LEN)
+                    file += file_len - LOGC_CALLSITE_FILE_LEN + 1;
+                strcpy(entry->file, file);
+
+                __atomic_store_n(&(entry->line), line, __ATOMIC_RELEASE);
+                __atomic_fetch_add(&(table->n_callsites), 1, __ATOMIC_RELAXED);
+                cur = id;
+            }
+        }
+
+        if(cur == id) {
+            __atomic_fetch_add(&(entry->messages), 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&(entry->bytes), len, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    __atomic_fetch_add(&(table->untracked), 1, __ATOMIC_RELAXED);
+}
 
 static inline int
-get_cur_time(char *buff, size_t sz)
+get_cur_time(char *buff, size_t sz, time_t cur_time)
 {
-    time_t cur_time = time(NULL);
     int n = strftime(buff, sz, "%c", localtime(&cur_time));
     return n;
 }
 
+/**
+ * Bulk ring of a channel the producers write to, the server may link a bigger or a smaller ring
+ * The levels are mapped on their first write
+ */
+static struct logc_buffer *
+bulk_ring(struct logc_handle *handle, struct logc_channel *ch, int channel)
+{
+    uint32_t level = __atomic_load_n(ch->ring_level, __ATOMIC_ACQUIRE);
+    if(level == 0 || level >= LOGC_RING_LEVELS)
+        return ch->log_buffer;
+
+    struct logc_buffer *ring = __atomic_load_n(&(ch->rings[level]), __ATOMIC_ACQUIRE);
+    if(ring != NULL)
+        return ring;
+
+    pthread_mutex_lock(&ring_lock);
+    ring = ch->rings[level];
+    if(ring == NULL) {
+        ring = logc_ring_open(handle->shm_name, handle->shard, channel, level);
+        if(ring != NULL)
+            __atomic_store_n(&(ch->rings[level]), ring, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    // the closed ring in the segment refuses the write
+    return ring != NULL ? ring : ch->log_buffer;
+}
+
+/**
+ * Write a message to the bulk ring of a channel
+ * A write to a ring closed by the server is retried on the ring linked after it
+ *
+ * @returns 1 if the threshold of the ring is reached, 0 otherwise
+ */
+static int
+write_bulk(struct logc_handle *handle, struct logc_channel *ch, int channel, char *buff, int len)
+{
+    for(int i = 0; i < LOGC_RING_RETRIES; ++i) {
+        int ret = logc_buffer_write(bulk_ring(handle, ch, channel), buff, len);
+        if(ret != -1)
+            return ret;
+    }
+
+    return 0;
+}
+
 /**
  * Log msg format
  * date time | file | func | line | msg
+ * The message of a structured channel follows a logc_record header
  */
-void write_log_to_buffer__(struct logc_handle *handle, char * file, char *func, int line, const char *format, ...)
+void write_log_to_buffer__(struct logc_handle *handle, int channel, enum logc_level level, char * file, char *func, int line,
+                           uint32_t *site, const char *format, ...)
 {
+    // the gate let the message through, the overrides of the segment decide
+    if(handle->levels != NULL && __atomic_load_n(&(handle->levels->n_overrides), __ATOMIC_RELAXED) != 0 &&
+       (int32_t)level < logc_levels_resolve(handle->levels, channel, file))
+        return;
+
+    struct logc_channel *ch = &(handle->channels[channel]);
     va_list va_args;
-    char buff[1024];
+    char buff[sizeof(struct logc_record) + LOGC_RECORD_MAX_LEN];
+    char *msg = buff;
+    int structured = logc_format_structured(ch->format);
+    uint32_t callsite = __atomic_load_n(site, __ATOMIC_RELAXED);
+    struct logc_callsites *callsites = __atomic_load_n(&(handle->callsites), __ATOMIC_RELAXED);
+    struct timespec ts;
     int len = 0;
+    int doorbell = 0;
+    uint64_t start = 0, formatted = 0, written = 0;
+
+    // the first message of the call hashes its callsite, the threads racing store the same id
+    if(callsite == 0) {
+        callsite = logc_callsite_id(file, line);
+        __atomic_store_n(site, callsite, __ATOMIC_RELAXED);
+    }
+
+    // one sampled call in a period, the others only pay for the counter
+    int sampled = handle->latency != NULL && (++latency_calls & handle->latency_mask) == 0;
+    if(sampled)
+        start = logc_latency_ticks();
+
+    if(structured) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        msg += sizeof(struct logc_record);
+    }
+    else {
+        ts.tv_sec = time(NULL);
+    }
 
     // fill date time
-    len += get_cur_time(buff, 1024);
-    len += sprintf(buff + len, " | %s | %s | %d | ", file, func, line);
+    len += get_cur_time(msg, LOGC_RECORD_MAX_LEN, ts.tv_sec);
+    len += snprintf(msg + len, LOGC_RECORD_MAX_LEN - len, " | %s | %s | %d | ", file, func, line);
 
     va_start(va_args, format);
-    len += vsnprintf(buff + len, 1024, format, va_args);
+    if(len < LOGC_RECORD_MAX_LEN)
+        len += vsnprintf(msg + len, LOGC_RECORD_MAX_LEN - len, format, va_args);
+    va_end(va_args);
+
+    // truncate long messages, keep room for the end line
+    if(len > LOGC_RECORD_MAX_LEN - 1)
+        len = LOGC_RECORD_MAX_LEN - 1;
 
     // add end line
-    buff[len] = '\n';
+    msg[len] = '\n';
     len++;
 
-    // Write to logc_buffer
-    if(logc_buffer_write(handle->log_buffer, buff, len) == 1) {
+    if(structured) {
+        struct logc_record rec;
+        rec.magic = LOGC_RECORD_MAGIC;
+        rec.level = level;
+        rec.len = len;
+        rec.callsite = callsite;
+        rec.ts = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+        memcpy(buff, &rec, sizeof(rec));
+        len += sizeof(rec);
+    }
+
+    if(callsites != NULL)
+        callsite_count(callsites, callsite, file, line, len);
+
+    if(sampled)
+        formatted = logc_latency_ticks();
+
+    // Urgent messages skip the bulk ring, the server drains them right away
+    if(level >= handle->urgent_level) {
+        // the dump of a flight recorder keeps the urgent logs as context
+        if(ch->flight)
+            write_bulk(handle, ch, channel, buff, len);
+
+        doorbell = logc_buffer_write(ch->urgent_buffer, buff, len) == 1;
+        if(sampled)
+            written = logc_latency_ticks();
+
+        if(doorbell)
+            send_urgent_write_request(handle, channel);
+    }
+    else {
+        // Write to logc_buffer, flight recorder is never drained
+        doorbell = write_bulk(handle, ch, channel, buff, len) == 1 && !ch->flight;
+        if(sampled)
+            written = logc_latency_ticks();
+
         // Threshold reached send write request
-        send_write_request(handle);
+        if(doorbell)
+            send_write_request(handle, channel);
     }
+
+    if(sampled)
+        latency_record(handle, start, formatted, written, logc_latency_ticks(), doorbell);
 }
 
+/**
+ * Init request
+ * code | n_channels | n_shards | (flags | format | dump size | log file path) for every channel
+ */
 static int
 send_init_request(struct logc_handle *handle)
 {
-    int log_file_path_len = strlen(handle->log_file_path) + 1;
     // Make request
     uint8_t code = REQUEST_INIT;
-    uint8_t req_buff[REQ_BUFF_SIZE];
+    uint8_t n_channels = handle->n_channels;
+    uint8_t n_shards = handle->n_shards;
+    uint8_t req_buff[MAX_READ_BUFF_SIZE];
 
     memcpy(req_buff, &code, sizeof(uint8_t));
-    memcpy(req_buff + 1, &(handle->append), sizeof(uint8_t));
-    memcpy(req_buff + 2, handle->log_file_path, log_file_path_len);
+    memcpy(req_buff + 1, &n_channels, sizeof(uint8_t));
+    memcpy(req_buff + 2, &n_shards, sizeof(uint8_t));
+
+    int sz = 3;
+    for(int i = 0; i < handle->n_channels; ++i) {
+        struct logc_channel *ch = &(handle->channels[i]);
+        int log_file_path_len = strlen(ch->log_file_path) + 1;
+
+        uint8_t flags = 0;
+        if(ch->append)
+            flags |= LOGC_CHANNEL_APPEND;
+        if(ch->flight)
+            flags |= LOGC_CHANNEL_FLIGHT;
+
+        memcpy(req_buff + sz, &flags, sizeof(uint8_t));
+        memcpy(req_buff + sz + 1, &(ch->format), sizeof(uint8_t));
+        memcpy(req_buff + sz + 2, &(ch->flight_size), sizeof(uint32_t));
+        memcpy(req_buff + sz + 6, ch->log_file_path, log_file_path_len);
+        sz += 6 + log_file_path_len;
+    }
 
-    int sz = 2 + log_file_path_len;
     // Send
     int wb = write(handle->fd, req_buff, sz);
     if(wb <= 0)
@@ -100,6 +417,102 @@ send_init_request(struct logc_handle *handle)
     return 0;
 }
 
+/**
+ * Connect to the logc server socket
+ * 
+ * @return connected socket fd, -1 on failure
+ */
+static int
+connect_to_server()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    struct sockaddr_un logc_server_addr;
+    logc_server_addr.sun_family = AF_UNIX;
+    strcpy(logc_server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+
+    if(connect(fd, (struct sockaddr *)(&logc_server_addr), sizeof(logc_server_addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Reconnect to a restarted logc server and attach the shared memory of the handle
+ * Only one thread reconnects, at most once a second. The new connection takes over
+ * the fd number of the old one, so the other threads keep using handle->fd.
+ * 
+ * Attach request
+ * code | shm name
+ * 
+ * @return 0 on success, -1 on failure
+ */
+static int
+reconnect(struct logc_handle *handle)
+{
+    int zero = 0;
+    time_t now = time(NULL);
+
+    if(now == handle->reconnect_time)
+        return -1;
+
+    if(!__atomic_compare_exchange_n(&(handle->reconnecting), &zero, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return -1;
+
+    handle->reconnect_time = now;
+
+    int ret = -1;
+    int fd = connect_to_server();
+    if(fd != -1) {
+        uint8_t req_buff[MAX_FILE_PATH_SIZE + 1];
+        uint8_t resp_buff[RESP_BUFF_SIZE];
+        int len = strlen(handle->shm_name) + 1;
+
+        req_buff[0] = REQUEST_ATTACH;
+        memcpy(req_buff + 1, handle->shm_name, len);
+
+        if(write(fd, req_buff, len + 1) > 0 && read(fd, resp_buff, RESP_BUFF_SIZE) > 0 && resp_buff[0] == 1)
+            ret = dup2(fd, handle->fd) == -1 ? -1 : 0;
+
+        close(fd);
+    }
+
+    __atomic_store_n(&(handle->reconnecting), 0, __ATOMIC_RELEASE);
+    return ret;
+}
+
+/**
+ * Send a request to the logc server
+ * If the server has gone away, reconnect and send again
+ * A handle drained in the process passes the request to its consumer thread
+ * 
+ * @return 0 on success, -1 on failure
+ */
+static int
+send_request(struct logc_handle *handle, uint8_t *req_buff, int len)
+{
+    // no server, the consumer thread of the process takes the request
+    if(handle->embedded != NULL)
+        return logc_embedded_request(handle->embedded, req_buff, len);
+
+    if(send(handle->fd, req_buff, len, MSG_NOSIGNAL) == len)
+        return 0;
+
+    if(errno != EPIPE && errno != ECONNRESET && errno != ENOTCONN)
+        return -1;
+
+    if(reconnect(handle) == -1)
+        return -1;
+
+    if(send(handle->fd, req_buff, len, MSG_NOSIGNAL) == len)
+        return 0;
+    return -1;
+}
+
 static int
 wait_for_init_response(struct logc_handle *handle, char *shm_name)
 {
@@ -123,18 +536,27 @@ int
 #else
 static int
 #endif
-send_write_request(struct logc_handle *handle)
+send_write_request(struct logc_handle *handle, int channel)
 {
     // Make write request
     uint8_t req_buff[REQ_BUFF_SIZE];
-    uint8_t code = REQUEST_WRITE;
 
-    uint8_t *ptr = req_buff;
-    memcpy(ptr, &code, sizeof(uint8_t));
+    req_buff[0] = REQUEST_WRITE;
+    req_buff[1] = channel;
 
-    if(write(handle->fd, &req_buff, 1) <= 0)
-        return -1;
-    return 0;
+    LOGC_PROBE2(doorbell, channel, 0);
+
+    return send_request(handle, req_buff, 2);
+}
+
+static int
+send_urgent_write_request(struct logc_handle *handle, int channel)
+{
+    uint8_t req_buff[2] = { REQUEST_WRITE_URGENT, channel };
+
+    LOGC_PROBE2(doorbell, channel, 1);
+
+    return send_request(handle, req_buff, 2);
 }
 
 struct logc_handle *
@@ -142,53 +564,289 @@ logc_handle_init(char *log_file_path, enum logc_level level, bool append)
 {
     struct logc_handle *handle = (struct logc_handle *)malloc(sizeof(struct logc_handle));
 
-    strcpy(handle->log_file_path, log_file_path);
     handle->level = level;
-    handle->append = append;
+    handle->urgent_level = ERROR;
+    handle->n_channels = 0;
+    handle->n_shards = 1;
+    handle->shard = 0;
+    handle->reconnecting = 0;
+    handle->reconnect_time = 0;
+    handle->mmap_addr = NULL;
+    handle->latency_period = 0;
+    handle->latency_mask = 0;
+    handle->latency = NULL;
+    handle->count_callsites = false;
+    handle->callsites = NULL;
+    handle->level_gate = level;
+    handle->gate = &(handle->level_gate);
+    handle->levels = NULL;
+    handle->embedded_mode = LOGC_EMBEDDED_OFF;
+    handle->embedded_shared = false;
+    handle->embedded = NULL;
+    logc_channel_add(handle, log_file_path, append);
 
     return handle;
 }
 
 int
-logc_connect(struct logc_handle *handle)
+logc_channel_add(struct logc_handle *handle, char *log_file_path, bool append)
 {
-    handle->fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if(handle->fd == -1)
+    if(handle->n_channels == LOGC_MAX_CHANNELS || strlen(log_file_path) >= MAX_FILE_PATH_SIZE)
         return -1;
 
-    struct sockaddr_un logc_server_addr;
-    logc_server_addr.sun_family = AF_UNIX;
-    strcpy(logc_server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    struct logc_channel *ch = &(handle->channels[handle->n_channels]);
+    strcpy(ch->log_file_path, log_file_path);
+    ch->append = append;
+    ch->flight = 0;
+    ch->flight_size = 0;
+    ch->format = LOGC_FORMAT_TEXT;
 
-    int ret;
+    return handle->n_channels++;
+}
 
-    // Connect to logc server
-    ret = connect(handle->fd, (struct sockaddr *)(&logc_server_addr), sizeof(logc_server_addr));
-    if(ret == -1) {
-        printf("\n\nerror: %s\n\n", strerror(errno));
+int
+logc_set_flight_recorder(struct logc_handle *handle, int channel, uint32_t dump_size)
+{
+    if(channel < 0 || channel >= handle->n_channels)
+        return -1;
+
+    handle->channels[channel].flight = 1;
+    handle->channels[channel].flight_size = dump_size;
+    return 0;
+}
+
+int
+logc_set_format(struct logc_handle *handle, int channel, int format)
+{
+    if(channel < 0 || channel >= handle->n_channels)
+        return -1;
+
+    if(format != LOGC_FORMAT_TEXT && format != LOGC_FORMAT_LZ && format != LOGC_FORMAT_BIN && format != LOGC_FORMAT_JSON)
         return -1;
+
+    handle->channels[channel].format = format;
+    return 0;
+}
+
+int
+logc_dump(struct logc_handle *handle, int channel)
+{
+    uint8_t req_buff[2] = { REQUEST_DUMP, channel };
+
+    return send_request(handle, req_buff, 2);
+}
+
+int
+logc_set_embedded(struct logc_handle *handle, int mode, bool shared)
+{
+    if(mode != LOGC_EMBEDDED_OFF && mode != LOGC_EMBEDDED_ON && mode != LOGC_EMBEDDED_FALLBACK)
+        return -1;
+
+    handle->embedded_mode = mode;
+    handle->embedded_shared = shared;
+    return 0;
+}
+
+int
+logc_set_pool_size(struct logc_handle *handle, int n_producers)
+{
+    if(n_producers < 1 || n_producers > LOGC_MAX_SHARDS)
+        return -1;
+
+    handle->n_shards = n_producers;
+    return 0;
+}
+
+/**
+ * Point the rings of every channel of the handle to a shard
+ */
+static void
+map_shard(struct logc_handle *handle, int shard)
+{
+    handle->shard = shard;
+
+    for(int i = 0; i < handle->n_channels; ++i) {
+        struct logc_channel *ch = &(handle->channels[i]);
+
+        logc_buffer_map(ch->log_buffer, logc_segment_bulk_ring(handle->mmap_addr, shard, i));
+        logc_buffer_map(ch->urgent_buffer, logc_segment_urgent_ring(handle->mmap_addr, shard, i));
+
+        // the levels of the shard are mapped on their first write
+        ch->ring_level = &(((struct logc_segment *)handle->mmap_addr)->ring_level[shard][i]);
+        ch->rings[0] = ch->log_buffer;
+        for(int level = 1; level < LOGC_RING_LEVELS; ++level)
+            ch->rings[level] = NULL;
+    }
+}
+
+/**
+ * Runs in the child after fork, before any other thread exists in the child.
+ * Claims a free shard of every pool handle.
+ */
+static void
+pool_atfork_child()
+{
+    int pid = getpid();
+
+    // a thread of the parent may have held the lock at fork
+    pthread_mutex_init(&ring_lock, NULL);
+
+    for(int i = 0; i < n_pool_handles; ++i) {
+        struct logc_handle *handle = pool_handles[i];
+        struct logc_segment *seg = (struct logc_segment *)handle->mmap_addr;
+        int shard = 0;
+
+        for(int j = 1; j < handle->n_shards; ++j) {
+            uint32_t free_owner = 0;
+            if(__atomic_compare_exchange_n(&(seg->owner[j]), &free_owner, pid, false,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                shard = j;
+                break;
+            }
+        }
+
+        // no free shard, share the shard of the parent
+        map_shard(handle, shard);
     }
 
-    // Send init request
-    ret = send_init_request(handle);
-    if(ret == -1)
+    // the forking thread claims its own latency slot in the child
+    latency_thread_hist = NULL;
+}
+
+static void
+pool_register_atfork()
+{
+    pthread_atfork(NULL, NULL, pool_atfork_child);
+}
+
+static void
+pool_register(struct logc_handle *handle)
+{
+    pthread_once(&pool_atfork_once, pool_register_atfork);
+
+    pthread_mutex_lock(&pool_lock);
+    if(n_pool_handles < MAX_POOL_HANDLES)
+        pool_handles[n_pool_handles++] = handle;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void
+pool_unregister(struct logc_handle *handle)
+{
+    pthread_mutex_lock(&pool_lock);
+    for(int i = 0; i < n_pool_handles; ++i) {
+        if(pool_handles[i] == handle) {
+            pool_handles[i] = pool_handles[--n_pool_handles];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int
+logc_set_latency_sampling(struct logc_handle *handle, uint32_t period)
+{
+    if((period & (period - 1)) != 0)
         return -1;
 
-    // Wait for response
-    char shm_name[MAX_FILE_PATH_SIZE];
-    ret = wait_for_init_response(handle, shm_name);
-    if(ret != 0) {
+    handle->latency_period = period;
+    if(handle->mmap_addr != NULL)
+        latency_start(handle);
+
+    return 0;
+}
+
+void
+logc_set_callsite_counting(struct logc_handle *handle, bool on)
+{
+    handle->count_callsites = on;
+    if(handle->mmap_addr != NULL)
+        __atomic_store_n(&(handle->callsites), on ? logc_segment_callsites(handle->mmap_addr) : NULL, __ATOMIC_RELAXED);
+}
+
+void
+logc_set_urgent_level(struct logc_handle *handle, enum logc_level level)
+{
+    handle->urgent_level = level;
+}
+
+int
+logc_connect(struct logc_handle *handle)
+{
+    int ret;
+    void *addr;
+
+    // Connect to logc server
+    handle->fd = handle->embedded_mode == LOGC_EMBEDDED_ON ? -1 : connect_to_server();
+    if(handle->fd == -1 && handle->embedded_mode == LOGC_EMBEDDED_OFF) {
+        printf("\n\nerror: %s\n\n", strerror(errno));
         return -1;
     }
 
-    // Create shared memory
-    void *addr = create_shared_mem(shm_name);
+    if(handle->fd != -1) {
+        // Send init request
+        ret = send_init_request(handle);
+        if(ret == -1)
+            return -1;
+
+        // Wait for response
+        ret = wait_for_init_response(handle, handle->shm_name);
+        if(ret != 0) {
+            return -1;
+        }
+
+        // Map the shared memory created by the server
+        size_t size = logc_segment_size(handle->n_shards, handle->n_channels);
+        addr = open_shared_mem(handle->shm_name, &size);
+    }
+    else {
+        // No server, the segment is drained in the process
+        addr = logc_embedded_segment(handle);
+    }
     if(addr == NULL) {
         return -1;
     }
+    handle->mmap_addr = addr;
+    handle->pid = getpid();
+
+    // Init bulk and urgent logc_buffers of every channel in every shard
+    struct logc_buffer *ring;
+    for(int shard = 0; shard < handle->n_shards; ++shard) {
+        for(int i = 0; i < handle->n_channels; ++i) {
+            logc_buffer_map_and_init(ring, logc_segment_bulk_ring(addr, shard, i),
+                                     MAX_LOG_BUFF_SIZE, MAX_LOG_BUFF_SIZE * 0.5);
+            logc_buffer_map_and_init(ring, logc_segment_urgent_ring(addr, shard, i),
+                                     MAX_URGENT_BUFF_SIZE, 0);
+        }
+    }
 
-    // Map logc_buffer with shared memory
-    logc_buffer_map_and_init(handle->log_buffer, addr);
+    // The connecting process owns shard 0
+    ((struct logc_segment *)addr)->owner[0] = handle->pid;
+    map_shard(handle, 0);
+
+    if(handle->fd == -1 && logc_embedded_start(handle) == -1)
+        return -1;
+
+    if(handle->n_shards > 1)
+        pool_register(handle);
+
+    if(handle->count_callsites)
+        __atomic_store_n(&(handle->callsites), logc_segment_callsites(addr), __ATOMIC_RELAXED);
+
+    // the level of the handle, unless the levels of the segment were already set
+    struct logc_levels *levels = &(((struct logc_segment *)addr)->levels);
+    uint32_t seq = logc_levels_lock(levels, 1);
+    if(seq != 0) {
+        levels->level = handle->level;
+        logc_levels_unlock(levels, seq);
+    }
+    handle->levels = levels;
+    handle->gate = &(levels->gate);
+
+    if(handle->latency_period != 0)
+        latency_start(handle);
+
+    LOGC_PROBE3(client_connect, handle->shm_name, handle->n_channels, handle->n_shards);
 
     return 0;
 }
@@ -199,13 +857,33 @@ logc_close(struct logc_handle *handle)
     if(handle == NULL)
         return 0;
 
+    // A pool worker flushes and releases its shard, the connection belongs to the pool owner
+    if(handle->n_shards > 1 && getpid() != handle->pid) {
+        for(int i = 0; i < handle->n_channels; ++i)
+            send_write_request(handle, i);
+
+        if(handle->shard != 0) {
+            struct logc_segment *seg = (struct logc_segment *)handle->mmap_addr;
+            __atomic_store_n(&(seg->owner[handle->shard]), 0, __ATOMIC_RELEASE);
+        }
+        return 0;
+    }
+
+    if(handle->n_shards > 1)
+        pool_unregister(handle);
+
+    LOGC_PROBE1(client_close, handle->shm_name);
+
+    if(handle->embedded != NULL)
+        return logc_embedded_stop(handle);
+
     // Make request
     uint8_t code = REQUEST_CLOSE;
     uint8_t req_buff[REQ_BUFF_SIZE];
 
     memcpy(req_buff, &code, 1);
 
-    if( (write(handle->fd, req_buff, 1)) <= 0)
+    if(send_request(handle, req_buff, 1) == -1)
         return -1;
 
     // close(handle->fd);
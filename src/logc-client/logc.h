@@ -26,11 +26,13 @@
 #define LOGC_H
 
 #include "../common/logc_buffer.h"
+#include "../common/logc_ring.h"
 #include "../common/logc_utils.h"
 
 #include <assert.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
 
 
 enum logc_level
@@ -38,13 +40,51 @@ enum logc_level
     ALL, INFO, DEBUG, WARN, ERROR, TRACE, DISABLE
 };
 
-struct logc_handle
+// modes of logc_set_embedded
+#define LOGC_EMBEDDED_OFF       0       // the logc server writes the logs
+#define LOGC_EMBEDDED_ON        1       // a thread of the process writes the logs, no server is used
+#define LOGC_EMBEDDED_FALLBACK  2       // a thread of the process writes the logs if the server cannot be reached
+
+struct logc_embedded;
+
+struct logc_channel
 {
     char log_file_path[MAX_FILE_PATH_SIZE];
-    enum logc_level level;
     uint8_t  append;
+    uint8_t  flight;
+    uint32_t flight_size;
+    uint8_t  format;
     struct logc_buffer *log_buffer;
+    struct logc_buffer *urgent_buffer;
+    uint32_t *ring_level;                           // level of the bulk ring in the segment, see logc_ring.h
+    struct logc_buffer *rings[LOGC_RING_LEVELS];    // levels of the bulk ring mapped, rings[0] is log_buffer
+};
+
+struct logc_handle
+{
+    enum logc_level level;
+    enum logc_level urgent_level;
+    int n_channels;
+    struct logc_channel channels[LOGC_MAX_CHANNELS];
+    int n_shards;
+    int shard;
+    int pid;
+    char shm_name[MAX_FILE_PATH_SIZE];
+    void *mmap_addr;
     int fd;
+    int reconnecting;
+    time_t reconnect_time;
+    uint32_t latency_period;
+    uint32_t latency_mask;
+    struct logc_latency *latency;
+    bool count_callsites;
+    struct logc_callsites *callsites;   // callsite table of the segment, NULL if not counted
+    int32_t level_gate;             // gate of the handle until it is connected
+    int32_t *gate;                  // lowest level that may be logged, in the segment once connected
+    struct logc_levels *levels;
+    int embedded_mode;                  // LOGC_EMBEDDED_*
+    bool embedded_shared;               // if true, the segment drained in the process is a named shared memory
+    struct logc_embedded *embedded;     // consumer thread of the process, NULL if the server writes the logs
 };
 
 
@@ -54,14 +94,41 @@ struct logc_handle
  * Builds the log message and write it to the logc_buffer
  * If the usage threshold of the logc_buffer is reached,
  * Sends write request to logc server
+ * If the level is greater than or equal to the urgent level of the handle,
+ * the message is written to the urgent buffer and an urgent write request
+ * is sent immediately
  * 
  * @param handle Log handle
+ * @param channel channel id
+ * @param level level of the log message
  * @param file current file
  * @param func current function
  * @param line current line
+ * @param site callsite id of the log call, 0 until the first call computes it
  * @param format format of the log message
  */
-void write_log_to_buffer__(struct logc_handle *handle, char * file, char *func, int line, const char *format, ...);
+void write_log_to_buffer__(struct logc_handle *handle, int channel, enum logc_level level, char * file, char *func, int line,
+                           uint32_t *site, const char *format, ...);
+
+/**
+ * logc_channel_log
+ * Writes the log to the logc_buffer of the channel if log_level is greater than or equal to
+ * the log level of the handle.
+ * Once connected the level is in the segment and logc-ctl changes it. The check only
+ * loads the gate, the lowest level of the handle and of its overrides.
+ * The callsite id is kept in a static of the call, hashed once on its first message.
+ * 
+ * @param handle: A logger handle
+ * @param channel: Channel id returned by logc_channel_add, 0 for the log file of the handle
+ * @param log_level: Log level
+ **/
+#define logc_channel_log(handle, channel, log_level, ...) \
+{ \
+    assert((handle) != NULL); \
+    static uint32_t logc_site__ = 0; \
+    if((int32_t)(log_level) >= __atomic_load_n((handle)->gate, __ATOMIC_RELAXED)) \
+        write_log_to_buffer__(handle, channel, log_level, __FILE__, (char *)__func__, __LINE__, &logc_site__, __VA_ARGS__); \
+}
 
 /**
  * logc_log
@@ -72,12 +139,7 @@ void write_log_to_buffer__(struct logc_handle *handle, char * file, char *func,
  * @param handle: A logger handle
  * @param log_level: Log level
  **/
-#define logc_log(handle, log_level, ...) \
-{ \
-    assert((handle) != NULL); \
-    if(log_level >= (handle)->level) \
-        write_log_to_buffer__(handle, __FILE__, (char *)__func__, __LINE__, __VA_ARGS__); \
-}
+#define logc_log(handle, log_level, ...) logc_channel_log(handle, 0, log_level, __VA_ARGS__)
 
 /**
  * log_info
@@ -121,10 +183,144 @@ void write_log_to_buffer__(struct logc_handle *handle, char * file, char *func,
  */
 struct logc_handle * logc_handle_init(char *log_file_path, enum logc_level level, bool append);
 
+/**
+ * Add a log channel to the handle
+ * All the channels of a handle share the connection and the shared memory with the logc server.
+ * The log file of the handle is channel 0. Channels must be added before logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param log_file_path Full path of the log file of the channel
+ * @param append If 1, log file will be open in append mode
+ * 
+ * @return channel id to be used with logc_channel_log, -1 if no more channels can be added
+ */
+int logc_channel_add(struct logc_handle *handle, char *log_file_path, bool append);
+
+/**
+ * Make a channel a flight recorder
+ * The logs of a flight recorder channel are kept only in the shared memory, overwriting the
+ * oldest logs, and never written to the log file while the client is healthy.
+ * The latest logs are dumped to <log file path>.flight if the client crashes,
+ * on logc_dump or when the logc server receives SIGUSR1.
+ * Urgent logs are still written to the log file immediately.
+ * Must be called before logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param channel Channel id
+ * @param dump_size Number of latest bytes to dump, 0 to dump the whole buffer
+ * 
+ * @return 0 on success, -1 if the channel is invalid
+ */
+int logc_set_flight_recorder(struct logc_handle *handle, int channel, uint32_t dump_size);
+
+/**
+ * Set the log file format of a channel
+ * LOGC_FORMAT_TEXT writes the logs as they are.
+ * LOGC_FORMAT_LZ writes independently compressed blocks with a block index in
+ * <log file path>.bidx, read the log file with logc-cat.
+ * LOGC_FORMAT_BIN writes CRC32C framed blocks of records with the time, level and
+ * callsite of every message, read the log file with logc-decode.
+ * LOGC_FORMAT_JSON writes a JSON line with the time, level, callsite, pid, file,
+ * function, line and message of every message.
+ * Must be called before logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param channel Channel id
+ * @param format LOGC_FORMAT_TEXT, LOGC_FORMAT_LZ, LOGC_FORMAT_BIN or LOGC_FORMAT_JSON
+ * 
+ * @return 0 on success, -1 if the channel or the format is invalid
+ */
+int logc_set_format(struct logc_handle *handle, int channel, int format);
+
+/**
+ * Dump the latest logs of a flight recorder channel
+ * 
+ * @param handle A logc handle
+ * @param channel Channel id
+ * 
+ * @return 0 on success, -1 on failure
+ */
+int logc_dump(struct logc_handle *handle, int channel);
+
+/**
+ * Share the handle with a pool of processes
+ * A pool handle is connected once, in the parent, before forking the worker processes.
+ * Every process forked after logc_connect gets its own shard of rings in the shared memory,
+ * so the processes never contend on a ring and a process crashing in the middle of
+ * a write cannot tear the logs of other processes. If all the shards are taken,
+ * the process shares the shard of the parent.
+ * A worker calling logc_close only releases its shard, the connection is closed by the parent.
+ * 
+ * @param handle A logc handle
+ * @param n_producers Maximum number of processes, including the parent, upto LOGC_MAX_SHARDS
+ * 
+ * @return 0 on success, -1 if n_producers is invalid
+ */
+int logc_set_pool_size(struct logc_handle *handle, int n_producers);
+
+/**
+ * Set the urgent level of the handle
+ * Log messages with level greater than or equal to the urgent level are written
+ * to a separate small ring and written to the log file by the server immediately.
+ * The default urgent level is ERROR. Use DISABLE to turn off the urgent ring.
+ * 
+ * @param handle A logc handle
+ * @param level Urgent log level
+ */
+void logc_set_urgent_level(struct logc_handle *handle, enum logc_level level);
+
+/**
+ * Sample the latency of the log calls of the handle
+ * One in every period log calls of a thread is timed with the cycle counter. The time
+ * taken to format the message, write it to the ring and send the write request is
+ * counted in histograms of the thread in the shared memory, the logc server reports
+ * them with its stats, see logc-stats. Can be called before or after logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param period Sample one in period calls, a power of two, 0 to stop sampling
+ * 
+ * @return 0 on success, -1 if period is not a power of two
+ */
+int logc_set_latency_sampling(struct logc_handle *handle, uint32_t period);
+
+/**
+ * Count the messages and bytes of every callsite of the handle
+ * The counters are in the shared memory, the logc server reports the noisiest
+ * callsites with its stats, see logc-stats. Off by default, a counted call pays
+ * for two atomic adds on counters shared by the threads and the processes of a pool.
+ * Can be called before or after logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param on If true, the callsites are counted
+ */
+void logc_set_callsite_counting(struct logc_handle *handle, bool on);
+
+/**
+ * Write the logs of the handle in the process, without a logc server
+ * A consumer thread of the process drains the rings and writes the log files, with the
+ * formats, the flight recorders and the pools of processes as the server does. The log
+ * calls are the same, the write requests go to the consumer thread without a socket.
+ * With LOGC_EMBEDDED_FALLBACK, the handle is drained in the process only if logc_connect
+ * cannot reach the server. If shared is true, the rings are in a named shared memory,
+ * /logc_shm_<pid>_<n>, and logc-recover writes the logs left by a crashed process;
+ * the segment is removed by logc_close. Must be called before logc_connect.
+ * 
+ * @param handle A logc handle
+ * @param mode LOGC_EMBEDDED_OFF, LOGC_EMBEDDED_ON or LOGC_EMBEDDED_FALLBACK
+ * @param shared If true, the rings are in a named shared memory
+ * 
+ * @return 0 on success, -1 if the mode is invalid
+ */
+int logc_set_embedded(struct logc_handle *handle, int mode, bool shared);
+
 /**
  * Connect to the logc server. 
  * This will send the log init request and setup the logger in logc server
  * If the process fails at the server side, server will send errno in the response
+ * A handle set by logc_set_embedded starts its consumer thread instead.
+ * 
+ * If the logc server restarts, the handle reconnects transparently and attaches its
+ * shared memory to the new server. The logs written meanwhile stay in the shared memory.
  * 
  * @param handle A logc handle
  * 
@@ -136,6 +332,7 @@ int logc_connect(struct logc_handle *handle);
  * Close the connection to logc server.
  * Logc server will flush the log mesages in the buffer to the log file
  * And free the shared memory
+ * A handle drained in the process writes the pending logs and stops its consumer thread
  * 
  * @param handle A logc handle
  * 
@@ -144,7 +341,7 @@ int logc_connect(struct logc_handle *handle);
 int logc_close(struct logc_handle *handle);
 
 #ifdef LOGC_DEBUG
-int send_write_request(struct logc_handle *handle);
+int send_write_request(struct logc_handle *handle, int channel);
 #endif
 
 #endif
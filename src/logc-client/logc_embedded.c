@@ -0,0 +1,332 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for pipe2
+
+#include "logc_embedded.h"
+#include "../logc-server/logc_sink.h"
+#include "../logc-server/logc_server_utils.h"
+#include "../common/logc_utils.h"
+#include "../common/logc_segment.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define MAX_SEGMENTS_PER_PID    1024    // as the server, the segments of a process are /logc_shm_<pid>_<n>
+#define EMBEDDED_TICK_MS        1000    // the log files are flushed once a second
+#define EMBEDDED_REQ_BUFF_SIZE  128     // requests read at once, every request is 2 bytes
+
+// the sinks log with the log of the server, the process has none
+int server_log_enable = 0;
+int server_log_fd = -1;
+
+struct logc_embedded
+{
+    /* consumer thread */
+    pthread_t thread;
+
+    /* requests to the consumer thread, the write end is non blocking */
+    int pipe_fd[2];
+
+    /* set once the handle is closed */
+    int stop;
+
+    /* handle drained by the consumer thread */
+    struct logc_handle *handle;
+
+    /* log file of every channel */
+    struct logc_sink sinks[LOGC_MAX_CHANNELS];
+
+    /* logs read from a ring, logc_buffer_read_all ends them with a nul byte */
+    char read_buff[MAX_LOG_BUFF_SIZE + 1];
+};
+
+
+void *
+logc_embedded_segment(struct logc_handle *handle)
+{
+    size_t size = logc_segment_size(handle->n_shards, handle->n_channels);
+    int pid = getpid();
+    void *addr = NULL;
+
+    if(handle->embedded_shared) {
+        for(int n = 0; addr == NULL && n < MAX_SEGMENTS_PER_PID; ++n) {
+            sprintf(handle->shm_name, "/logc_shm_%u_%d", pid, n);
+            addr = create_shared_mem(handle->shm_name, size);
+            if(addr == NULL && errno != EEXIST)
+                break;
+        }
+    }
+    else {
+        handle->shm_name[0] = '\0';
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(addr == MAP_FAILED)
+            addr = NULL;
+    }
+
+    if(addr == NULL)
+        return NULL;
+
+    // the segment describes itself, as the segments of the server, logc-recover reads a named one
+    struct logc_segment *seg = (struct logc_segment *)addr;
+    seg->pid = pid;
+    seg->n_channels = handle->n_channels;
+    seg->n_shards = handle->n_shards;
+    for(int i = 0; i < handle->n_channels; ++i) {
+        struct logc_channel *ch = &(handle->channels[i]);
+
+        seg->channels[i].flags = (ch->append ? LOGC_CHANNEL_APPEND : 0) | (ch->flight ? LOGC_CHANNEL_FLIGHT : 0);
+        seg->channels[i].format = ch->format;
+        seg->channels[i].dump_size = ch->flight_size;
+        strcpy(seg->channels[i].log_file_path, ch->log_file_path);
+    }
+    seg->magic = LOGC_SEGMENT_MAGIC;
+
+    return addr;
+}
+
+/**
+ * Write the logs of a ring to the log file of the channel
+ *
+ * @returns number of bytes written
+ */
+static int
+drain_ring(struct logc_embedded *emb, int channel, struct logc_buffer *ring)
+{
+    int n_bytes = logc_buffer_read_all(ring, emb->read_buff);
+
+    if(n_bytes > 0)
+        sink_write(&(emb->sinks[channel]), emb->read_buff, n_bytes);
+
+    return n_bytes;
+}
+
+/**
+ * Write the logs of a channel to its log file, the urgent rings first
+ * A flight recorder only has its urgent logs written
+ */
+static void
+drain_channel(struct logc_embedded *emb, int channel, int urgent_only)
+{
+    struct logc_handle *handle = emb->handle;
+    int n_bytes = 0;
+
+    if(handle->channels[channel].flight)
+        urgent_only = 1;
+
+    for(int shard = 0; shard < handle->n_shards; ++shard)
+        n_bytes += drain_ring(emb, channel, logc_segment_urgent_ring(handle->mmap_addr, shard, channel));
+
+    if(!urgent_only) {
+        for(int shard = 0; shard < handle->n_shards; ++shard)
+            n_bytes += drain_ring(emb, channel, logc_segment_bulk_ring(handle->mmap_addr, shard, channel));
+    }
+
+    if(n_bytes > 0)
+        sink_flush(&(emb->sinks[channel]));
+}
+
+/**
+ * Write the latest logs of a flight recorder to <log file path>.flight, as the server does
+ */
+static void
+dump_flight_recorder(struct logc_embedded *emb, int channel)
+{
+    struct logc_handle *handle = emb->handle;
+    struct logc_channel *ch = &(handle->channels[channel]);
+    struct logc_segment *seg = (struct logc_segment *)handle->mmap_addr;
+    char dump_path[MAX_FILE_PATH_SIZE + 8];
+    char time_buff[64];
+
+    sprintf(dump_path, "%s.flight", ch->log_file_path);
+    FILE *fp = fopen(dump_path, "a");
+    if(fp == NULL)
+        return;
+
+    time_t cur_time = time(NULL);
+    strftime(time_buff, sizeof(time_buff), "%c", localtime(&cur_time));
+    fprintf(fp, "==== logc flight recorder dump, client request, %s ====\n", time_buff);
+
+    int max = MAX_LOG_BUFF_SIZE - 1;
+    if(ch->flight_size > 0 && ch->flight_size < max)
+        max = ch->flight_size;
+
+    for(int shard = 0; shard < handle->n_shards; ++shard) {
+        if(handle->n_shards > 1)
+            fprintf(fp, "==== shard %d, pid %u ====\n", shard, seg->owner[shard]);
+
+        int n = logc_buffer_snapshot(logc_segment_bulk_ring(seg, shard, channel), emb->read_buff, max);
+        if(logc_format_structured(ch->format))
+            n = logc_record_to_text(emb->read_buff, n);
+        fwrite(emb->read_buff, 1, n, fp);
+    }
+
+    fclose(fp);
+}
+
+/**
+ * Consumer thread, takes the requests of the log calls as the client thread of the server does
+ */
+static void *
+consumer_thread(void *args)
+{
+    struct logc_embedded *emb = (struct logc_embedded *)args;
+    struct logc_handle *handle = emb->handle;
+    struct pollfd pfd = { emb->pipe_fd[0], POLLIN, 0 };
+    uint8_t req_buff[EMBEDDED_REQ_BUFF_SIZE];
+    time_t last_tick = time(NULL);
+
+    while(!__atomic_load_n(&(emb->stop), __ATOMIC_ACQUIRE)) {
+        int n_ready = poll(&pfd, 1, EMBEDDED_TICK_MS);
+        if(n_ready < 0 && errno != EINTR)
+            break;
+
+        // the requests are written whole, a read never splits one
+        int len = n_ready > 0 ? read(emb->pipe_fd[0], req_buff, sizeof(req_buff)) : 0;
+        for(int off = 0; off + 1 < len; off += 2) {
+            int channel = req_buff[off + 1];
+            if(channel >= handle->n_channels)
+                continue;
+
+            switch(req_buff[off]) {
+            case REQUEST_WRITE:
+                drain_channel(emb, channel, 0);
+                break;
+            case REQUEST_WRITE_URGENT:
+                drain_channel(emb, channel, 1);
+                break;
+            case REQUEST_DUMP:
+                if(handle->channels[channel].flight)
+                    dump_flight_recorder(emb, channel);
+                break;
+            }
+        }
+
+        // periodic flush, once a second
+        time_t now = time(NULL);
+        if(now != last_tick) {
+            last_tick = now;
+            for(int i = 0; i < handle->n_channels; ++i)
+                sink_flush(&(emb->sinks[i]));
+        }
+    }
+
+    return NULL;
+}
+
+int
+logc_embedded_start(struct logc_handle *handle)
+{
+    struct logc_embedded *emb = (struct logc_embedded *)calloc(1, sizeof(struct logc_embedded));
+    int i;
+
+    if(emb == NULL)
+        return -1;
+    emb->handle = handle;
+
+    if(pipe2(emb->pipe_fd, O_CLOEXEC) == -1) {
+        free(emb);
+        return -1;
+    }
+    fcntl(emb->pipe_fd[1], F_SETFL, O_NONBLOCK);
+
+    for(i = 0; i < handle->n_channels; ++i) {
+        struct logc_channel *ch = &(handle->channels[i]);
+        if(sink_open(&(emb->sinks[i]), ch->log_file_path, ch->append, ch->format, handle->pid) == -1)
+            break;
+    }
+
+    if(i == handle->n_channels && (errno = pthread_create(&(emb->thread), NULL, consumer_thread, emb)) == 0) {
+        handle->embedded = emb;
+        return 0;
+    }
+
+    int err = errno;
+    while(--i >= 0)
+        sink_close(&(emb->sinks[i]));
+    close(emb->pipe_fd[0]);
+    close(emb->pipe_fd[1]);
+    free(emb);
+
+    errno = err;
+    return -1;
+}
+
+int
+logc_embedded_request(struct logc_embedded *emb, uint8_t *req_buff, int len)
+{
+    if(len != 2)
+        return -1;
+
+    if(write(emb->pipe_fd[1], req_buff, len) == len || errno == EAGAIN)
+        return 0;
+    return -1;
+}
+
+int
+logc_embedded_stop(struct logc_handle *handle)
+{
+    struct logc_embedded *emb = handle->embedded;
+    uint8_t req_buff[2] = { REQUEST_CLOSE, 0 };
+
+    // a process forked without a shard of its own has no consumer thread, the parent writes its logs
+    if(getpid() != handle->pid) {
+        for(int i = 0; i < handle->n_channels; ++i) {
+            req_buff[0] = REQUEST_WRITE;
+            req_buff[1] = i;
+            logc_embedded_request(emb, req_buff, 2);
+        }
+        return 0;
+    }
+
+    __atomic_store_n(&(emb->stop), 1, __ATOMIC_RELEASE);
+    logc_embedded_request(emb, req_buff, 2);
+    pthread_join(emb->thread, NULL);
+
+    // the requests of the log calls after the close are dropped
+    __atomic_store_n(&(handle->embedded), NULL, __ATOMIC_RELEASE);
+
+    for(int i = 0; i < handle->n_channels; ++i) {
+        drain_channel(emb, i, 0);
+        sink_close(&(emb->sinks[i]));
+    }
+
+    // the logs are all written, a named segment is not left for logc-recover
+    if(handle->shm_name[0] != '\0')
+        shm_unlink(handle->shm_name);
+
+    close(emb->pipe_fd[0]);
+    close(emb->pipe_fd[1]);
+    free(emb);
+    return 0;
+}
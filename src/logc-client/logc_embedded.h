@@ -0,0 +1,85 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc embedded
+ * Drains the rings of a handle inside the process, for the processes that cannot reach
+ * a logc server
+ *
+ * The client creates the segment itself: in a named shared memory, like the segments of
+ * the server, if logc-recover must be able to write the logs of a crashed process, or
+ * else in an anonymous shared mapping. The log calls write to the rings as they do with
+ * a server. The requests go to a consumer thread of the process through a pipe instead
+ * of the socket, so the processes of a pool forked later reach it too. The consumer
+ * thread writes the logs to the log files with the sinks of the server, see
+ * ../logc-server/logc_sink.h.
+ */
+
+#ifndef LOGC_EMBEDDED_H
+#define LOGC_EMBEDDED_H
+
+#include "logc.h"
+
+#include <stdint.h>
+
+
+/**
+ * create the segment of a handle draining in the process
+ * sets the shm name of the handle, empty for an anonymous segment
+ *
+ * @param handle: a logc handle
+ * @returns address of the segment, NULL on failure
+ */
+void *logc_embedded_segment(struct logc_handle *handle);
+
+/**
+ * open the log files and start the consumer thread of a handle
+ * the rings of the segment must be initialised
+ *
+ * @param handle: a logc handle with an embedded segment
+ * @returns 0 on success, -1 on failure
+ */
+int logc_embedded_start(struct logc_handle *handle);
+
+/**
+ * pass a request to the consumer thread, never blocks
+ * a request is dropped if the pipe is full, the consumer is then busy draining anyway
+ *
+ * @param emb: consumer of the handle
+ * @param req_buff: request, as sent to a server
+ * @param len: length of the request
+ * @returns 0 on success, -1 on failure
+ */
+int logc_embedded_request(struct logc_embedded *emb, uint8_t *req_buff, int len);
+
+/**
+ * stop the consumer thread, write the pending logs and close the log files
+ * a named segment is removed, the logs are all written
+ *
+ * @param handle: a logc handle draining in the process
+ * @returns 0 on success, -1 on failure
+ */
+int logc_embedded_stop(struct logc_handle *handle);
+
+#endif
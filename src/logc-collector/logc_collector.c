@@ -0,0 +1,292 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-collector
+ * A stand-in log collector for the forwarder of the logc server, see ../common/logc_forward.h
+ *
+ * usage: logc-collector [-a address] [-d dir] port
+ *     -a  listen address, default is 127.0.0.1
+ *     -d  directory of the collected logs, default is the working directory
+ *
+ * The forwarded logs of every log file are appended to <dir>/<log file path>, with
+ * the / of the path replaced by _. The acked offset of every stream is kept in
+ * <dir>/.logc_stream_<stream id>, so a restarted collector resumes the streams.
+ * One connection is served at a time. A gap in a stream, batches the server had
+ * to drop, is reported on stderr.
+ */
+
+#include "../common/logc_forward.h"
+#include "../common/logc_lz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_OPEN_FILES  16
+#define MAX_PATH_SIZE   512
+
+struct collected_file
+{
+    char path[MAX_PATH_SIZE];
+    FILE *fp;
+};
+
+static char *dir = ".";
+static struct collected_file files[MAX_OPEN_FILES];
+static int n_files;
+
+
+static int
+recv_all(int fd, void *buff, int len)
+{
+    return recv(fd, buff, len, MSG_WAITALL) == len ? 0 : -1;
+}
+
+/**
+ * Get the open file of a forwarded log file, the least recent file is closed if too many are open
+ *
+ * @returns file, NULL if it cannot be opened
+ */
+static FILE *
+collected_file(char *log_path, int path_len)
+{
+    char path[MAX_PATH_SIZE];
+    int n = snprintf(path, sizeof(path), "%s/", dir);
+
+    for(int i = 0; i < path_len && n < sizeof(path) - 1; ++i) {
+        if(i == 0 && log_path[i] == '/')
+            continue;
+        path[n++] = log_path[i] == '/' ? '_' : log_path[i];
+    }
+    path[n] = '\0';
+
+    for(int i = 0; i < n_files; ++i) {
+        if(strcmp(files[i].path, path) == 0)
+            return files[i].fp;
+    }
+
+    if(n_files == MAX_OPEN_FILES) {
+        fclose(files[0].fp);
+        memmove(files, files + 1, sizeof(files[0]) * --n_files);
+    }
+
+    FILE *fp = fopen(path, "a");
+    if(fp == NULL) {
+        fprintf(stderr, "logc-collector: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    strcpy(files[n_files].path, path);
+    files[n_files++].fp = fp;
+    return fp;
+}
+
+/**
+ * Write the entries of a batch to the collected files
+ *
+ * @returns 0 on success, -1 if the batch is corrupt or a write failed
+ */
+static int
+write_batch(char *batch, int len)
+{
+    struct logc_forward_entry entry;
+
+    for(int off = 0; off < len; ) {
+        if(len - off < sizeof(entry))
+            return -1;
+
+        memcpy(&entry, batch + off, sizeof(entry));
+        off += sizeof(entry);
+        if(len - off < entry.path_len + entry.len)
+            return -1;
+
+        FILE *fp = collected_file(batch + off, entry.path_len);
+        if(fp == NULL || fwrite(batch + off + entry.path_len, 1, entry.len, fp) != entry.len)
+            return -1;
+        off += entry.path_len + entry.len;
+    }
+
+    for(int i = 0; i < n_files; ++i) {
+        if(fflush(files[i].fp) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Serve a forwarder connection
+ */
+static void
+serve(int fd)
+{
+    static char data[logc_lz_compress_bound(LOGC_FORWARD_BATCH_SIZE)];
+    static char raw[LOGC_FORWARD_BATCH_SIZE];
+    struct logc_forward_hello hello;
+    struct logc_forward_batch_header header;
+    struct logc_forward_ack ack = { .magic = LOGC_FORWARD_MAGIC };
+    char state_path[MAX_PATH_SIZE];
+    char state[32];
+    unsigned long long n_batches = 0, n_bytes = 0, n_dups = 0;
+
+    if(recv_all(fd, &hello, sizeof(hello)) == -1 || hello.magic != LOGC_FORWARD_MAGIC) {
+        fprintf(stderr, "logc-collector: invalid hello\n");
+        return;
+    }
+
+    // resume the stream from the acked offset
+    snprintf(state_path, sizeof(state_path), "%s/.logc_stream_%016llx", dir, (unsigned long long)hello.stream_id);
+    int state_fd = open(state_path, O_RDWR | O_CREAT, 0666);
+    if(state_fd == -1) {
+        fprintf(stderr, "logc-collector: cannot open %s: %s\n", state_path, strerror(errno));
+        return;
+    }
+
+    memset(state, 0, sizeof(state));
+    if(pread(state_fd, state, sizeof(state) - 1, 0) > 0)
+        ack.offset = strtoull(state, NULL, 10);
+
+    fprintf(stderr, "logc-collector: stream %016llx connected, offset: %llu\n",
+            (unsigned long long)hello.stream_id, (unsigned long long)ack.offset);
+
+    if(send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+        goto done;
+
+    while(recv_all(fd, &header, sizeof(header)) == 0) {
+        if(header.magic != LOGC_FORWARD_MAGIC || header.raw_len > LOGC_FORWARD_BATCH_SIZE || header.data_len > sizeof(data)) {
+            fprintf(stderr, "logc-collector: invalid batch header\n");
+            break;
+        }
+        if(recv_all(fd, data, header.data_len) == -1)
+            break;
+
+        if(header.offset + header.raw_len <= ack.offset) {
+            // sent again after a reconnect, already written
+            n_dups++;
+        }
+        else {
+            char *batch = data;
+            int len = header.data_len;
+
+            if(header.flags & LOGC_FORWARD_COMPRESSED) {
+                len = logc_lz_decompress(data, header.data_len, raw, sizeof(raw));
+                batch = raw;
+            }
+            if(len != header.raw_len || write_batch(batch, len) == -1) {
+                fprintf(stderr, "logc-collector: cannot write batch at offset %llu\n", (unsigned long long)header.offset);
+                break;
+            }
+
+            if(header.offset > ack.offset)
+                fprintf(stderr, "logc-collector: gap of %llu bytes at offset %llu\n",
+                        (unsigned long long)(header.offset - ack.offset), (unsigned long long)ack.offset);
+
+            ack.offset = header.offset + header.raw_len;
+            int n = snprintf(state, sizeof(state), "%020llu\n", (unsigned long long)ack.offset);
+            if(pwrite(state_fd, state, n, 0) != n) {
+                fprintf(stderr, "logc-collector: cannot write %s: %s\n", state_path, strerror(errno));
+                break;
+            }
+
+            n_batches++;
+            n_bytes += header.raw_len;
+        }
+
+        if(send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+            break;
+    }
+
+done:
+    fprintf(stderr, "logc-collector: stream %016llx disconnected, offset: %llu, batches: %llu, bytes: %llu, duplicates: %llu\n",
+            (unsigned long long)hello.stream_id, (unsigned long long)ack.offset, n_batches, n_bytes, n_dups);
+    close(state_fd);
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-collector [-a address] [-d dir] port\n"
+                    "    -a  listen address, default is 127.0.0.1\n"
+                    "    -d  directory of the collected logs\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int opt;
+    int one = 1;
+
+    while((opt = getopt(argc, argv, "a:d:h")) != -1) {
+        switch(opt) {
+        case 'a':
+            if(inet_pton(AF_INET, optarg, &addr.sin_addr) != 1) {
+                fprintf(stderr, "logc-collector: invalid address: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind != argc - 1) {
+        usage();
+        return 1;
+    }
+    addr.sin_port = htons(atoi(argv[optind]));
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd == -1 ||
+       setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+       bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+       listen(listen_fd, 1) == -1) {
+        fprintf(stderr, "logc-collector: cannot listen: %s\n", strerror(errno));
+        return 1;
+    }
+
+    for(;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd == -1) {
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "logc-collector: accept failed: %s\n", strerror(errno));
+            return 1;
+        }
+
+        serve(fd);
+        close(fd);
+    }
+}
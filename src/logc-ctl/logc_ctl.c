@@ -0,0 +1,230 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-ctl
+ * Changes the log levels of the clients of the logc server while they run
+ *
+ * usage: logc-ctl [-p pid] [-c channel] [-f file] show | set level | clear
+ *     -p  client pid, every client if not given
+ *     -c  channel of an override
+ *     -f  end of the source file path of an override, like net/conn.c
+ *     show   write the levels of the clients
+ *     set    set the level of the clients, or an override for the channel and/or the file
+ *     clear  remove the override of the channel and/or the file, every override if none is given
+ *
+ * The level is a name (all, info, debug, warn, error, trace, disable) or a number.
+ * The levels of the clients are written after a change, a levels line for every client
+ * and an override line for every override, with key=value fields:
+ *     levels pid level gate overrides
+ *     override pid channel file level
+ */
+
+#include "../common/logc_utils.h"
+#include "../common/logc_level.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *level_names[] = LOGC_LEVEL_NAMES;
+
+
+/**
+ * Parse a level name or number
+ *
+ * @returns level, -1 if the level is invalid
+ */
+static int
+parse_level(char *arg)
+{
+    for(int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); ++i) {
+        if(strcasecmp(arg, level_names[i]) == 0)
+            return i;
+    }
+
+    char *end;
+    long level = strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || level < 0 || level >= sizeof(level_names) / sizeof(level_names[0]))
+        return -1;
+
+    return level;
+}
+
+/**
+ * Connect to the logc server
+ *
+ * @returns connection fd, -1 on failure
+ */
+static int
+server_connect()
+{
+    struct sockaddr_un server_addr;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    if(connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Send a level request and write the levels to stdout
+ *
+ * @returns 0 on success, -1 on failure with errno set
+ */
+static int
+send_level_request(int fd, struct logc_level_request *req)
+{
+    uint8_t result;
+    uint32_t len;
+
+    if(write(fd, req, sizeof(*req)) != sizeof(*req) ||
+       recv(fd, &result, 1, MSG_WAITALL) != 1)
+        return -1;
+
+    // Failed in server side, will get errno
+    if(result != 1) {
+        int err;
+        if(recv(fd, &err, sizeof(err), MSG_WAITALL) != sizeof(err))
+            return -1;
+        errno = err;
+        return -1;
+    }
+
+    if(recv(fd, &len, sizeof(len), MSG_WAITALL) != sizeof(len))
+        return -1;
+
+    char *report = (char *)malloc(len);
+    if(recv(fd, report, len, MSG_WAITALL) != len) {
+        free(report);
+        return -1;
+    }
+
+    fwrite(report, 1, len, stdout);
+    free(report);
+    return 0;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-ctl [-p pid] [-c channel] [-f file] show | set level | clear\n"
+                    "    -p  client pid, every client if not given\n"
+                    "    -c  channel of an override\n"
+                    "    -f  end of the source file path of an override\n"
+                    "    show   write the levels of the clients\n"
+                    "    set    set the level, or an override for the channel and/or the file\n"
+                    "    clear  remove the override, every override if no channel and no file is given\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct logc_level_request req;
+    int opt;
+
+    memset(&req, 0, sizeof(req));
+    req.code = REQUEST_LEVEL;
+    req.channel = LOGC_LEVEL_ANY_CHANNEL;
+
+    while((opt = getopt(argc, argv, "p:c:f:h")) != -1) {
+        switch(opt) {
+        case 'p':
+            req.pid = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            req.channel = atoi(optarg);
+            if(req.channel < 0 || req.channel >= LOGC_MAX_CHANNELS) {
+                fprintf(stderr, "logc-ctl: invalid channel: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            // keep the end of a long path, an override matches the end of the file path
+            if(strlen(optarg) >= LOGC_LEVEL_FILE_LEN)
+                optarg += strlen(optarg) - (LOGC_LEVEL_FILE_LEN - 1);
+            strcpy(req.file, optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind == argc) {
+        usage();
+        return 1;
+    }
+
+    char *cmd = argv[optind];
+    if(strcmp(cmd, "show") == 0 && optind + 1 == argc) {
+        req.op = LOGC_LEVEL_GET;
+    }
+    else if(strcmp(cmd, "set") == 0 && optind + 2 == argc) {
+        int level = parse_level(argv[optind + 1]);
+        if(level == -1) {
+            fprintf(stderr, "logc-ctl: invalid level: %s\n", argv[optind + 1]);
+            return 1;
+        }
+        req.op = LOGC_LEVEL_SET;
+        req.level = level;
+    }
+    else if(strcmp(cmd, "clear") == 0 && optind + 1 == argc) {
+        req.op = LOGC_LEVEL_CLEAR;
+    }
+    else {
+        usage();
+        return 1;
+    }
+
+    int fd = server_connect();
+    if(fd == -1) {
+        fprintf(stderr, "logc-ctl: cannot connect to the logc server: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if(send_level_request(fd, &req) == -1) {
+        fprintf(stderr, "logc-ctl: level request failed: %s\n", errno == ESRCH ? "no such client" : strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    close(fd);
+    return 0;
+}
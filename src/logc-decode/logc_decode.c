@@ -0,0 +1,239 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-decode
+ * Writes the logs of binary log files to stdout as text or JSON lines,
+ * or verifies the CRC32C of every block
+ *
+ * usage: logc-decode [-j | -v] log_file ...
+ *     -j  write JSON lines
+ *     -v  only verify the blocks, the exit status is 1 if a block is corrupt
+ *
+ * A corrupt block is reported and skipped, decoding continues at the next block.
+ * An incomplete last block, left by a crash of the server, is reported and ignored.
+ */
+
+#include "../common/logc_record.h"
+#include "../common/logc_json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_BUFF_SIZE  (1024 * 1024)
+
+enum output { OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_NONE };
+
+static enum output output = OUTPUT_TEXT;
+
+
+/**
+ * Write a record as a JSON line
+ */
+static void
+write_json_record(struct logc_record *rec, char *msg)
+{
+    char line[LOGC_JSON_MAX_LINE];
+
+    fwrite(line, 1, logc_json_record(line, rec, msg, 0), stdout);
+}
+
+/**
+ * Write the records of a block
+ *
+ * @returns number of records, -1 if a record is malformed
+ */
+static int
+decode_block(char *records, uint32_t len)
+{
+    struct logc_record rec;
+    uint32_t off = 0;
+    int n_records = 0;
+
+    while(off < len) {
+        if(off + sizeof(rec) > len)
+            return -1;
+
+        memcpy(&rec, records + off, sizeof(rec));
+        char *msg = records + off + sizeof(rec);
+        if(rec.magic != LOGC_RECORD_MAGIC || rec.level > 6 || rec.len == 0 ||
+           off + sizeof(rec) + rec.len > len)
+            return -1;
+
+        if(output == OUTPUT_TEXT)
+            fwrite(msg, 1, rec.len, stdout);
+        else if(output == OUTPUT_JSON)
+            write_json_record(&rec, msg);
+
+        off += sizeof(rec) + rec.len;
+        n_records++;
+    }
+
+    return n_records;
+}
+
+/**
+ * Skip to the next block magic after a corrupt block
+ *
+ * @returns 0 if a block magic is found, -1 at the end of the file
+ */
+static int
+resync(FILE *fp, long from)
+{
+    uint32_t window = 0;
+    int c;
+
+    fseek(fp, from, SEEK_SET);
+    for(long n = 1; (c = getc(fp)) != EOF; ++n) {
+        // little endian, the last byte read is the most significant
+        window = (window >> 8) | ((uint32_t)c << 24);
+        if(n >= 4 && window == LOGC_BIN_BLOCK_MAGIC) {
+            fseek(fp, -4, SEEK_CUR);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Decode or verify a binary log file
+ *
+ * @returns 0 on success, -1 if the file is not a binary log file or has corrupt blocks
+ */
+static int
+decode_file(char *log_file_path)
+{
+    static char records[LOGC_BIN_BLOCK_SIZE];
+    char magic[LOGC_BIN_FILE_MAGIC_LEN];
+    struct logc_bin_block_header header;
+    long n_blocks = 0, n_records = 0, n_corrupt = 0;
+
+    FILE *fp = fopen(log_file_path, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "logc-decode: cannot open %s: %s\n", log_file_path, strerror(errno));
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, READ_BUFF_SIZE);
+
+    if(fread(magic, 1, LOGC_BIN_FILE_MAGIC_LEN, fp) != LOGC_BIN_FILE_MAGIC_LEN ||
+       memcmp(magic, LOGC_BIN_FILE_MAGIC, LOGC_BIN_FILE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "logc-decode: %s is not a binary log file\n", log_file_path);
+        fclose(fp);
+        return -1;
+    }
+
+    while(1) {
+        long block_offset = ftell(fp);
+
+        size_t n = fread(&header, 1, sizeof(header), fp);
+        if(n == 0)
+            break;
+
+        if(n == sizeof(header) && (header.magic != LOGC_BIN_BLOCK_MAGIC || header.len > LOGC_BIN_BLOCK_SIZE)) {
+            fprintf(stderr, "logc-decode: %s: corrupt block header at %ld\n", log_file_path, block_offset);
+            n_corrupt++;
+            if(resync(fp, block_offset + 1) == -1)
+                break;
+            continue;
+        }
+
+        if(n < sizeof(header) || fread(records, 1, header.len, fp) != header.len) {
+            // the server was stopped in the middle of writing the block
+            fprintf(stderr, "logc-decode: %s: incomplete last block at %ld\n", log_file_path, block_offset);
+            break;
+        }
+
+        if(logc_crc32c(0, records, header.len) != header.crc) {
+            fprintf(stderr, "logc-decode: %s: CRC mismatch in block at %ld\n", log_file_path, block_offset);
+            n_corrupt++;
+            if(resync(fp, block_offset + 1) == -1)
+                break;
+            continue;
+        }
+
+        int r = decode_block(records, header.len);
+        if(r == -1) {
+            fprintf(stderr, "logc-decode: %s: malformed record in block at %ld\n", log_file_path, block_offset);
+            n_corrupt++;
+            continue;
+        }
+
+        n_blocks++;
+        n_records += r;
+    }
+
+    if(output == OUTPUT_NONE) {
+        fprintf(stderr, "logc-decode: %s: %ld blocks, %ld records, %ld corrupt blocks\n",
+                log_file_path, n_blocks, n_records, n_corrupt);
+    }
+
+    fclose(fp);
+    return n_corrupt == 0 ? 0 : -1;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-decode [-j | -v] log_file ...\n"
+                    "    -j  write JSON lines\n"
+                    "    -v  only verify the blocks\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+
+    while((opt = getopt(argc, argv, "jvh")) != -1) {
+        switch(opt) {
+        case 'j':
+            output = OUTPUT_JSON;
+            break;
+        case 'v':
+            output = OUTPUT_NONE;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind == argc) {
+        usage();
+        return 1;
+    }
+
+    int ret = 0;
+    for(int i = optind; i < argc; ++i) {
+        if(decode_file(argv[i]) == -1)
+            ret = 1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,295 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-query
+ * Writes the logs of a time range from log files to stdout
+ *
+ * usage: logc-query [-t from] [-T to] log_file ...
+ *     -t  start of the time range
+ *     -T  end of the time range, inclusive
+ *
+ * A time is either epoch seconds or local time as YYYY-MM-DD HH:MM:SS.
+ * Text and binary log files are searched with their time index <log file>.tidx,
+ * so only the logs around the time range are read. Block compressed log files are
+ * searched with their block index. Any number of log files, like the rotated
+ * files of a log, can be given; the files without logs in the range are skipped
+ * after reading a few index entries.
+ */
+
+#include "../common/logc_index.h"
+#include "../common/logc_record.h"
+#include "../common/logc_lz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// a block compressed log file is read until the first block drained this long after the range
+#define LZ_QUERY_SLACK  60
+
+#define NSEC    1000000000LL
+
+// time range, epoch nanoseconds
+static int64_t from_time = 0;
+static int64_t to_time = INT64_MAX;
+
+
+/**
+ * Find the range of offsets to read with the time index of a log file
+ *
+ * @param start Set to the offset to start at, unchanged if there is no index
+ * @param end Set to the offset to stop at, unchanged if there is no index entry after the range
+ */
+static void
+find_range(char *log_file_path, int64_t *start, int64_t *end)
+{
+    char index_path[4096];
+
+    snprintf(index_path, sizeof(index_path), "%s%s", log_file_path, LOGC_TIME_INDEX_SUFFIX);
+    FILE *fp = fopen(index_path, "r");
+    if(fp == NULL)
+        return;
+
+    int64_t offset = logc_index_find(fp, from_time);
+    if(offset != -1 && offset > *start)
+        *start = offset;
+
+    offset = logc_index_find_end(fp, to_time);
+    if(offset != -1)
+        *end = offset;
+
+    fclose(fp);
+}
+
+/**
+ * Write the lines of a text log in the time range
+ * A line without a time, like a line of a multi line message, goes with the previous line
+ */
+static void
+query_lines(char *buff, int len, int *in_range)
+{
+    char *end = buff + len;
+
+    while(buff < end) {
+        char *eol = memchr(buff, '\n', end - buff);
+        char *next = eol != NULL ? eol + 1 : end;
+        int64_t ts;
+
+        if(logc_index_line_time(buff, &ts) == 0)
+            *in_range = ts * NSEC >= from_time && ts * NSEC <= to_time;
+
+        if(*in_range)
+            fwrite(buff, 1, next - buff, stdout);
+
+        buff = next;
+    }
+}
+
+static int
+query_text(char *log_file_path, FILE *fp)
+{
+    int64_t start = 0, end = INT64_MAX;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int in_range = 0;
+
+    find_range(log_file_path, &start, &end);
+    fseek(fp, start, SEEK_SET);
+
+    while(ftell(fp) < end && (len = getline(&line, &cap, fp)) != -1)
+        query_lines(line, len, &in_range);
+
+    free(line);
+    return 0;
+}
+
+static int
+query_bin(char *log_file_path, FILE *fp)
+{
+    static char records[LOGC_BIN_BLOCK_SIZE];
+    struct logc_bin_block_header header;
+    struct logc_record rec;
+    int64_t start = LOGC_BIN_FILE_MAGIC_LEN, end = INT64_MAX;
+
+    find_range(log_file_path, &start, &end);
+    fseek(fp, start, SEEK_SET);
+
+    while(ftell(fp) < end && fread(&header, sizeof(header), 1, fp) == 1) {
+        if(header.magic != LOGC_BIN_BLOCK_MAGIC || header.len > LOGC_BIN_BLOCK_SIZE ||
+           fread(records, 1, header.len, fp) != header.len ||
+           logc_crc32c(0, records, header.len) != header.crc) {
+            fprintf(stderr, "logc-query: %s: corrupt block, use logc-decode to skip corrupt blocks\n", log_file_path);
+            return -1;
+        }
+
+        for(uint32_t off = 0; off + sizeof(rec) <= header.len; off += sizeof(rec) + rec.len) {
+            memcpy(&rec, records + off, sizeof(rec));
+            if(off + sizeof(rec) + rec.len > header.len)
+                break;
+
+            if(rec.ts >= from_time && rec.ts <= to_time)
+                fwrite(records + off + sizeof(rec), 1, rec.len, stdout);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Query a block compressed log file
+ * The time of a block is the time it was drained, the messages in it were logged before
+ */
+static int
+query_lz(char *log_file_path, FILE *fp)
+{
+    static char data[logc_lz_compress_bound(LOGC_LZ_BLOCK_SIZE)];
+    static char raw[LOGC_LZ_BLOCK_SIZE];
+    char index_path[4096];
+    struct logc_lz_block_header header;
+    struct logc_lz_index_entry entry;
+    int in_range = 0;
+
+    // skip the blocks drained before the range with the block index
+    long start = LOGC_LZ_FILE_MAGIC_LEN;
+    snprintf(index_path, sizeof(index_path), "%s%s", log_file_path, LOGC_LZ_INDEX_SUFFIX);
+    FILE *index_fp = fopen(index_path, "r");
+    if(index_fp != NULL) {
+        while(fread(&entry, sizeof(entry), 1, index_fp) == 1) {
+            start = entry.file_offset;
+            if(entry.last_ts * NSEC >= from_time)
+                break;
+        }
+        fclose(index_fp);
+    }
+    fseek(fp, start, SEEK_SET);
+
+    while(fread(&header, sizeof(header), 1, fp) == 1) {
+        if(header.magic != LOGC_LZ_BLOCK_MAGIC || header.raw_len > LOGC_LZ_BLOCK_SIZE ||
+           header.data_len > sizeof(data) || fread(data, 1, header.data_len, fp) != header.data_len)
+            break;
+
+        if(header.first_ts > (to_time / NSEC) + LZ_QUERY_SLACK)
+            break;
+        if(header.last_ts * NSEC < from_time)
+            continue;
+
+        char *block = data;
+        if(!(header.flags & LOGC_LZ_BLOCK_RAW)) {
+            if(logc_lz_decompress(data, header.data_len, raw, sizeof(raw)) != header.raw_len) {
+                fprintf(stderr, "logc-query: %s: corrupt block\n", log_file_path);
+                return -1;
+            }
+            block = raw;
+        }
+
+        query_lines(block, header.raw_len, &in_range);
+    }
+
+    return 0;
+}
+
+/**
+ * Write the logs of a log file in the time range
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+query_file(char *log_file_path)
+{
+    char magic[8];
+
+    FILE *fp = fopen(log_file_path, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "logc-query: cannot open %s: %s\n", log_file_path, strerror(errno));
+        return -1;
+    }
+
+    int ret;
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    if(n == LOGC_BIN_FILE_MAGIC_LEN && memcmp(magic, LOGC_BIN_FILE_MAGIC, LOGC_BIN_FILE_MAGIC_LEN) == 0)
+        ret = query_bin(log_file_path, fp);
+    else if(n == LOGC_LZ_FILE_MAGIC_LEN && memcmp(magic, LOGC_LZ_FILE_MAGIC, LOGC_LZ_FILE_MAGIC_LEN) == 0)
+        ret = query_lz(log_file_path, fp);
+    else
+        ret = query_text(log_file_path, fp);
+
+    fclose(fp);
+    return ret;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-query [-t from] [-T to] log_file ...\n"
+                    "    -t  start of the time range\n"
+                    "    -T  end of the time range, inclusive\n"
+                    "    a time is epoch seconds or YYYY-MM-DD HH:MM:SS\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t ts;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:T:h")) != -1) {
+        switch(opt) {
+        case 't':
+            if(logc_index_parse_time(optarg, &ts) == -1) {
+                fprintf(stderr, "logc-query: invalid time: %s\n", optarg);
+                return 1;
+            }
+            from_time = ts * NSEC;
+            break;
+        case 'T':
+            if(logc_index_parse_time(optarg, &ts) == -1) {
+                fprintf(stderr, "logc-query: invalid time: %s\n", optarg);
+                return 1;
+            }
+            // the end of the second
+            to_time = ts * NSEC + NSEC - 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind == argc) {
+        usage();
+        return 1;
+    }
+
+    int ret = 0;
+    for(int i = optind; i < argc; ++i) {
+        if(query_file(argv[i]) == -1)
+            ret = 1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,305 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-recover
+ * Writes the pending logs of logc shared memory segments to the log files
+ * when no logc server is running
+ *
+ * usage: logc-recover [-s] [-u] [-r | shm_name ...]
+ *     -r  recover every segment in the logc registry
+ *     -s  write the logs to stdout instead of the log files
+ *     -u  remove the segments after recovering
+ *
+ * The logs of a channel that is not in text format are written as text to
+ * <log file path>.recovered, logc-recover never appends to a compressed log file.
+ */
+
+#include "../common/logc_buffer.h"
+#include "../common/logc_segment.h"
+#include "../common/logc_ring.h"
+#include "../common/logc_utils.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// write to stdout instead of the log files
+static int to_stdout = 0;
+
+// remove the segment after recovering
+static int unlink_segment = 0;
+
+
+/**
+ * Write the pending logs of a ring to fp
+ *
+ * @returns number of bytes written
+ */
+static int
+recover_ring(struct logc_buffer *ring, struct logc_segment_channel *ch, FILE *fp)
+{
+    static char read_buff[LOGC_RING_MAX_SIZE + 1];
+
+    // the rings of a client that died before initialising them
+    if(ring->size == 0)
+        return 0;
+
+    // the client is gone, a message it was writing is skipped
+    int torn;
+    int n_bytes = logc_buffer_read_abandoned(ring, read_buff, &torn);
+
+    if(n_bytes > 0 && logc_format_structured(ch->format))
+        n_bytes = logc_record_to_text(read_buff, n_bytes);
+
+    if(n_bytes > 0)
+        fwrite(read_buff, 1, n_bytes, fp);
+
+    return n_bytes;
+}
+
+/**
+ * Write the latest logs of a flight recorder ring to fp
+ *
+ * @returns number of bytes written
+ */
+static int
+recover_flight_recorder(struct logc_buffer *ring, struct logc_segment_channel *ch, FILE *fp)
+{
+    char read_buff[MAX_LOG_BUFF_SIZE];
+    int max = MAX_LOG_BUFF_SIZE - 1;
+
+    if(ch->dump_size > 0 && ch->dump_size < max)
+        max = ch->dump_size;
+
+    int n_bytes = logc_buffer_snapshot(ring, read_buff, max);
+    if(logc_format_structured(ch->format))
+        n_bytes = logc_record_to_text(read_buff, n_bytes);
+
+    fprintf(fp, "==== logc flight recorder dump, recovered ====\n");
+    fwrite(read_buff, 1, n_bytes, fp);
+
+    return n_bytes;
+}
+
+/**
+ * Write the pending logs of the bulk ring of a channel in a shard to fp
+ * The ring the server linked last holds the latest logs, the rings closed before it go first
+ *
+ * @returns number of bytes written
+ */
+static int
+recover_bulk_ring(struct logc_segment *seg, char *shm_name, int shard, int channel, FILE *fp)
+{
+    struct logc_segment_channel *ch = &(seg->channels[channel]);
+    struct logc_buffer *rings[LOGC_RING_LEVELS];
+    uint32_t level = seg->ring_level[shard][channel];
+    char name[MAX_FILE_PATH_SIZE];
+    int n_bytes = 0;
+
+    rings[0] = logc_segment_bulk_ring(seg, shard, channel);
+    for(int i = 1; i < LOGC_RING_LEVELS; ++i)
+        rings[i] = logc_ring_open(shm_name, shard, channel, i);
+
+    if(level >= LOGC_RING_LEVELS || rings[level] == NULL)
+        level = 0;
+
+    for(int i = 0; i < LOGC_RING_LEVELS; ++i) {
+        if(i != level && rings[i] != NULL)
+            n_bytes += recover_ring(rings[i], ch, fp);
+    }
+    n_bytes += recover_ring(rings[level], ch, fp);
+
+    for(int i = 1; i < LOGC_RING_LEVELS; ++i) {
+        if(rings[i] == NULL)
+            continue;
+
+        munmap(rings[i], logc_ring_object_size(i));
+        if(unlink_segment) {
+            logc_ring_name(name, shm_name, shard, channel, i);
+            shm_unlink(name);
+        }
+    }
+
+    return n_bytes;
+}
+
+/**
+ * Recover every channel of a segment
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+recover_segment(char *shm_name)
+{
+    size_t size = 0;
+    struct logc_segment *seg = (struct logc_segment *)open_shared_mem(shm_name, &size);
+    if(seg == NULL) {
+        fprintf(stderr, "logc-recover: cannot open %s: %s\n", shm_name, strerror(errno));
+        return -1;
+    }
+
+    if(size < sizeof(struct logc_segment) || seg->magic != LOGC_SEGMENT_MAGIC ||
+       seg->n_channels == 0 || seg->n_channels > LOGC_MAX_CHANNELS ||
+       seg->n_shards == 0 || seg->n_shards > LOGC_MAX_SHARDS ||
+       size < logc_segment_size(seg->n_shards, seg->n_channels)) {
+        fprintf(stderr, "logc-recover: %s is not a logc segment\n", shm_name);
+        munmap(seg, size);
+        return -1;
+    }
+
+    int ret = 0;
+    for(int i = 0; i < seg->n_channels; ++i) {
+        struct logc_segment_channel *ch = &(seg->channels[i]);
+        int flight = (ch->flags & LOGC_CHANNEL_FLIGHT) != 0;
+        char path[MAX_FILE_PATH_SIZE + 8];
+        char recovered_path[MAX_FILE_PATH_SIZE + 16];
+        FILE *fp = stdout;
+
+        ch->log_file_path[MAX_FILE_PATH_SIZE - 1] = '\0';
+
+        char *log_file_path = ch->log_file_path;
+        if(ch->format != LOGC_FORMAT_TEXT) {
+            sprintf(recovered_path, "%s.recovered", ch->log_file_path);
+            log_file_path = recovered_path;
+        }
+
+        if(!to_stdout) {
+            fp = fopen(log_file_path, "a");
+            if(fp == NULL) {
+                fprintf(stderr, "logc-recover: cannot open %s: %s\n", log_file_path, strerror(errno));
+                ret = -1;
+                continue;
+            }
+        }
+
+        int n_bytes = 0;
+        for(int shard = 0; shard < seg->n_shards; ++shard)
+            n_bytes += recover_ring(logc_segment_urgent_ring(seg, shard, i), ch, fp);
+
+        if(!flight) {
+            for(int shard = 0; shard < seg->n_shards; ++shard)
+                n_bytes += recover_bulk_ring(seg, shm_name, shard, i, fp);
+        }
+
+        if(!to_stdout)
+            fclose(fp);
+
+        // the latest logs of a flight recorder go to its dump file
+        if(flight) {
+            sprintf(path, "%s.flight", ch->log_file_path);
+            fp = to_stdout ? stdout : fopen(path, "a");
+            if(fp == NULL) {
+                fprintf(stderr, "logc-recover: cannot open %s: %s\n", path, strerror(errno));
+                ret = -1;
+                continue;
+            }
+
+            for(int shard = 0; shard < seg->n_shards; ++shard)
+                n_bytes += recover_flight_recorder(logc_segment_bulk_ring(seg, shard, i), ch, fp);
+
+            if(!to_stdout)
+                fclose(fp);
+        }
+
+        fprintf(stderr, "logc-recover: %s: recovered %d bytes of %s\n", shm_name, n_bytes, log_file_path);
+    }
+
+    munmap(seg, size);
+
+    if(unlink_segment && ret == 0)
+        shm_unlink(shm_name);
+
+    return ret;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-recover [-s] [-u] [-r | shm_name ...]\n"
+                    "    -r  recover every segment in the logc registry\n"
+                    "    -s  write the logs to stdout instead of the log files\n"
+                    "    -u  remove the segments after recovering\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int from_registry = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "rsuh")) != -1) {
+        switch(opt) {
+        case 'r':
+            from_registry = 1;
+            break;
+        case 's':
+            to_stdout = 1;
+            break;
+        case 'u':
+            unlink_segment = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(!from_registry && optind == argc) {
+        usage();
+        return 1;
+    }
+
+    int ret = 0;
+
+    for(int i = optind; i < argc; ++i) {
+        if(recover_segment(argv[i]) == -1)
+            ret = 1;
+    }
+
+    if(from_registry) {
+        char shm_name[MAX_FILE_PATH_SIZE];
+
+        FILE *fp = fopen(LOGC_REGISTRY_PATH, "r");
+        if(fp == NULL) {
+            fprintf(stderr, "logc-recover: cannot open %s: %s\n", LOGC_REGISTRY_PATH, strerror(errno));
+            return 1;
+        }
+
+        while(fgets(shm_name, MAX_FILE_PATH_SIZE, fp) != NULL) {
+            shm_name[strcspn(shm_name, "\n")] = '\0';
+            if(shm_name[0] != '\0' && recover_segment(shm_name) == -1)
+                ret = 1;
+        }
+
+        fclose(fp);
+    }
+
+    return ret;
+}
@@ -0,0 +1,416 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-replay
+ * Replays a trace captured by logc server -T to a logc server
+ *
+ * usage: logc-replay [-x speed] [-d dir] trace
+ *     -x  speed of the replay, 1 for the captured speed, 0 for as fast as possible
+ *     -d  directory of the log files, the working directory by default
+ *
+ * Every client of the trace is replayed by a thread with a connection of its own and
+ * channels of the same formats. The logs of a drain are written to the ring of the
+ * channel and a write request is sent at the time of the drain, so the server drains
+ * the same batches at the same times. A trace without payloads is replayed with
+ * generated messages of the same sizes. The log files are <dir>/replay_<client>_<channel>.log.
+ * The clients of a pool are replayed as a single process.
+ *
+ * The report is a line of key=value fields, with the most the replay fell behind the
+ * trace.
+ */
+
+#include "../logc-client/logc.h"
+#include "../common/logc_utils.h"
+#include "../common/logc_record.h"
+#include "../common/logc_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define GEN_MSG_SIZE    100         // size of a generated message
+
+struct replay_client
+{
+    uint32_t id;
+    struct logc_trace_record **records;     // records of the client, in time order
+    int n_records;
+    pthread_t tid;
+
+    // results
+    uint64_t drains;
+    uint64_t bytes;
+    int64_t max_behind;                     // nanoseconds
+    int failed;
+};
+
+static double speed = 1;
+static char *dir = ".";
+static int payloads;
+static struct timespec replay_start;
+
+
+static int64_t
+elapsed_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - replay_start.tv_sec) * 1000000000 + (now.tv_nsec - replay_start.tv_nsec);
+}
+
+/**
+ * Wait for the time of a record
+ *
+ * @returns nanoseconds the replay is behind the trace
+ */
+static int64_t
+wait_for(int64_t ts)
+{
+    if(speed == 0)
+        return 0;
+
+    int64_t due = (int64_t)(ts / speed);
+    int64_t now = elapsed_ns();
+
+    if(now < due) {
+        struct timespec ts_sleep = { (due - now) / 1000000000, (due - now) % 1000000000 };
+        nanosleep(&ts_sleep, NULL);
+        return 0;
+    }
+
+    return now - due;
+}
+
+/**
+ * Wait for the server to drain the previous batches out of a ring, upto a second
+ * The captured batch was drained whole, so it had the room in the ring
+ */
+static void
+wait_for_room(struct logc_buffer *ring, int len)
+{
+    struct timespec pause = { 0, 100000 };
+
+    for(int i = 0; i < 10000; ++i) {
+        if(logc_buffer_used(ring) + LOGC_FRAME_SIZE(len) <= ring->size)
+            return;
+        nanosleep(&pause, NULL);
+    }
+}
+
+/**
+ * Bulk ring of a channel, the server of the replay may have linked a bigger or a smaller ring
+ */
+static struct logc_buffer *
+bulk_ring(struct logc_handle *handle, int channel)
+{
+    struct logc_channel *ch = &(handle->channels[channel]);
+    uint32_t level = __atomic_load_n(ch->ring_level, __ATOMIC_ACQUIRE);
+
+    if(level == 0 || level >= LOGC_RING_LEVELS)
+        return ch->log_buffer;
+
+    if(ch->rings[level] == NULL)
+        ch->rings[level] = logc_ring_open(handle->shm_name, handle->shard, channel, level);
+
+    return ch->rings[level] != NULL ? ch->rings[level] : ch->log_buffer;
+}
+
+/**
+ * Write a message to a ring
+ */
+static void
+write_msg(struct logc_buffer *ring, char *msg, int len)
+{
+    if(len > 0)
+        logc_buffer_write(ring, msg, len);
+}
+
+/**
+ * Write the captured logs of a drain to a ring, a message at a time
+ */
+static void
+write_payload(struct logc_buffer *ring, int structured, char *buff, int len)
+{
+    int off = 0;
+
+    while(off < len) {
+        int msg_len;
+
+        if(structured) {
+            struct logc_record rec;
+
+            if(len - off < sizeof(rec))
+                break;
+            memcpy(&rec, buff + off, sizeof(rec));
+
+            // a drain torn by an overflow, write the rest as it is
+            if(rec.magic != LOGC_RECORD_MAGIC || off + sizeof(rec) + rec.len > len)
+                msg_len = len - off;
+            else
+                msg_len = sizeof(rec) + rec.len;
+        }
+        else {
+            char *nl = memchr(buff + off, '\n', len - off);
+            msg_len = nl != NULL ? nl - (buff + off) + 1 : len - off;
+        }
+
+        write_msg(ring, buff + off, msg_len);
+        off += msg_len;
+    }
+}
+
+/**
+ * Write generated messages of len bytes in total to a ring
+ */
+static void
+write_generated(struct logc_buffer *ring, int structured, uint32_t client, int len)
+{
+    char msg[sizeof(struct logc_record) + GEN_MSG_SIZE];
+
+    while(len > 0) {
+        int msg_len = len < sizeof(msg) ? len : sizeof(msg);
+        char *text = msg;
+        int text_len = msg_len;
+
+        if(structured && msg_len > sizeof(struct logc_record)) {
+            struct logc_record rec;
+            struct timespec now;
+
+            clock_gettime(CLOCK_REALTIME, &now);
+            rec.magic = LOGC_RECORD_MAGIC;
+            rec.level = INFO;
+            rec.len = msg_len - sizeof(rec);
+            rec.callsite = 0;
+            rec.ts = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+            memcpy(msg, &rec, sizeof(rec));
+
+            text += sizeof(rec);
+            text_len -= sizeof(rec);
+        }
+
+        // replay | client | message, padded to the size
+        int n = snprintf(text, text_len, "replay | %u | ", client);
+        if(n < text_len)
+            memset(text + n, 'x', text_len - n);
+        text[text_len - 1] = '\n';
+
+        write_msg(ring, msg, msg_len);
+        len -= msg_len;
+    }
+}
+
+static void *
+client_thread(void *arg)
+{
+    struct replay_client *client = (struct replay_client *)arg;
+    struct logc_handle *handle = NULL;
+    char path[MAX_FILE_PATH_SIZE];
+
+    for(int i = 0; i < client->n_records; ++i) {
+        struct logc_trace_record *rec = client->records[i];
+        char *payload = (char *)(rec + 1);
+
+        int64_t behind = wait_for(rec->ts);
+        if(behind > client->max_behind)
+            client->max_behind = behind;
+
+        if(rec->type == LOGC_TRACE_CONNECT && handle == NULL) {
+            struct logc_trace_channel *channels = (struct logc_trace_channel *)payload;
+            int n_channels = rec->payload_len / sizeof(struct logc_trace_channel);
+
+            if(n_channels == 0)
+                break;
+
+            for(int ch = 0; ch < n_channels; ++ch) {
+                snprintf(path, sizeof(path), "%s/replay_%u_%d.log", dir, client->id, ch);
+                if(ch == 0)
+                    handle = logc_handle_init(path, ALL, false);
+                else
+                    logc_channel_add(handle, path, false);
+
+                logc_set_format(handle, ch, channels[ch].format);
+                if(channels[ch].flags & LOGC_CHANNEL_FLIGHT)
+                    logc_set_flight_recorder(handle, ch, 0);
+            }
+
+            if(logc_connect(handle) == -1) {
+                client->failed = 1;
+                break;
+            }
+        }
+        else if(rec->type == LOGC_TRACE_DRAIN && handle != NULL && rec->channel < handle->n_channels) {
+            struct logc_channel *ch = &(handle->channels[rec->channel]);
+            int urgent = (rec->flags & LOGC_TRACE_URGENT) != 0;
+            struct logc_buffer *ring = urgent ? ch->urgent_buffer : bulk_ring(handle, rec->channel);
+            int structured = logc_format_structured(ch->format);
+
+            wait_for_room(ring, rec->len);
+            if(payloads)
+                write_payload(ring, structured, payload, rec->payload_len);
+            else
+                write_generated(ring, structured, client->id, rec->len);
+
+            // drain the batch now, as the server did
+            uint8_t req[2] = { urgent ? REQUEST_WRITE_URGENT : REQUEST_WRITE, rec->channel };
+            send(handle->fd, req, sizeof(req), MSG_NOSIGNAL);
+
+            client->drains++;
+            client->bytes += rec->len;
+        }
+        else if(rec->type == LOGC_TRACE_CLOSE && handle != NULL) {
+            logc_close(handle);
+            free(handle);
+            handle = NULL;
+        }
+    }
+
+    // the trace ended before the client closed
+    if(handle != NULL) {
+        if(!client->failed)
+            logc_close(handle);
+        free(handle);
+    }
+
+    return NULL;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-replay [-x speed] [-d dir] trace\n"
+                    "    -x  speed of the replay, 1 for the captured speed, 0 for as fast as possible\n"
+                    "    -d  directory of the log files, the working directory by default\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    struct replay_client *clients = NULL;
+    uint32_t n_clients = 0;
+    struct stat st;
+    int opt;
+
+    while((opt = getopt(argc, argv, "x:d:h")) != -1) {
+        switch(opt) {
+        case 'x':
+            speed = atof(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(optind != argc - 1 || speed < 0) {
+        usage();
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if(fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "logc-replay: cannot open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    char *trace = st.st_size > 0 ? (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    struct logc_trace_header *header = (struct logc_trace_header *)trace;
+    close(fd);
+
+    if(trace == MAP_FAILED || st.st_size < sizeof(*header) ||
+       memcmp(header->magic, LOGC_TRACE_MAGIC, LOGC_TRACE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "logc-replay: %s is not a logc trace\n", argv[optind]);
+        return 1;
+    }
+    payloads = (header->flags & LOGC_TRACE_PAYLOADS) != 0;
+
+    // the records of every client, a record cut by the end of the file is left out
+    off_t off = sizeof(*header);
+    while(off + sizeof(struct logc_trace_record) <= st.st_size) {
+        struct logc_trace_record *rec = (struct logc_trace_record *)(trace + off);
+
+        if(off + sizeof(*rec) + rec->payload_len > st.st_size || rec->client == 0)
+            break;
+        off += sizeof(*rec) + rec->payload_len;
+
+        if(rec->client > n_clients) {
+            clients = (struct replay_client *)realloc(clients, rec->client * sizeof(struct replay_client));
+            memset(clients + n_clients, 0, (rec->client - n_clients) * sizeof(struct replay_client));
+            n_clients = rec->client;
+        }
+
+        struct replay_client *client = &(clients[rec->client - 1]);
+        client->id = rec->client;
+        client->records = (struct logc_trace_record **)realloc(client->records, (client->n_records + 1) * sizeof(rec));
+        client->records[client->n_records++] = rec;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &replay_start);
+
+    for(uint32_t i = 0; i < n_clients; ++i) {
+        if(clients[i].n_records > 0)
+            pthread_create(&(clients[i].tid), NULL, client_thread, &(clients[i]));
+    }
+
+    uint64_t drains = 0, bytes = 0;
+    int64_t max_behind = 0;
+    int replayed = 0, failed = 0;
+
+    for(uint32_t i = 0; i < n_clients; ++i) {
+        struct replay_client *client = &(clients[i]);
+        if(client->n_records == 0)
+            continue;
+
+        pthread_join(client->tid, NULL);
+
+        replayed++;
+        failed += client->failed;
+        drains += client->drains;
+        bytes += client->bytes;
+        if(client->max_behind > max_behind)
+            max_behind = client->max_behind;
+        free(client->records);
+    }
+
+    double seconds = elapsed_ns() / 1e9;
+    printf("replay clients=%d failed=%d drains=%llu bytes=%llu seconds=%.3f mb_per_sec=%.2f max_behind_ms=%.3f payloads=%d\n",
+           replayed, failed, (unsigned long long)drains, (unsigned long long)bytes, seconds,
+           seconds > 0 ? bytes / seconds / 1e6 : 0, max_behind / 1e6, payloads);
+
+    free(clients);
+    munmap(trace, st.st_size);
+    return failed > 0 ? 1 : 0;
+}
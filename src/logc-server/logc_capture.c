@@ -0,0 +1,175 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_capture.h"
+#include "logc_server_utils.h"
+#include "../common/logc_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+struct capture_config capture_config;
+
+static FILE *trace_fp;
+static char *trace_buffer;
+static struct timespec trace_start;
+static uint32_t next_client_id;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+int
+capture_start()
+{
+    struct logc_trace_header header;
+    struct timespec now;
+
+    trace_fp = fopen(capture_config.path, "w");
+    if(trace_fp == NULL) {
+        logc_server_log("Cannot open the trace file: %s, error: %s", capture_config.path, strerror(errno));
+        return -1;
+    }
+
+    trace_buffer = (char *)malloc(CAPTURE_BUFFER_SIZE);
+    setvbuf(trace_fp, trace_buffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOGC_TRACE_MAGIC, LOGC_TRACE_MAGIC_LEN);
+    header.flags = capture_config.payloads ? LOGC_TRACE_PAYLOADS : 0;
+    header.start = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    fwrite(&header, sizeof(header), 1, trace_fp);
+
+    logc_server_log("Capturing the log traffic to %s, payloads: %d", capture_config.path, capture_config.payloads);
+    return 0;
+}
+
+void
+capture_stop()
+{
+    pthread_mutex_lock(&trace_lock);
+    if(trace_fp != NULL) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    free(trace_buffer);
+    trace_buffer = NULL;
+}
+
+/**
+ * write a record and its payload, the trace lock must be held
+ */
+static void
+write_record(struct logc_trace_record *rec, void *payload)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rec->ts = (int64_t)(now.tv_sec - trace_start.tv_sec) * 1000000000 + (now.tv_nsec - trace_start.tv_nsec);
+
+    fwrite(rec, sizeof(*rec), 1, trace_fp);
+    if(rec->payload_len > 0)
+        fwrite(payload, 1, rec->payload_len, trace_fp);
+}
+
+/**
+ * write the connect record of a client without an id, the trace lock must be held
+ */
+static void
+write_connect(struct client_info *c_info)
+{
+    struct logc_trace_channel channels[LOGC_MAX_CHANNELS];
+    struct logc_trace_record rec;
+
+    if(c_info->capture_id != 0)
+        return;
+
+    c_info->capture_id = ++next_client_id;
+
+    for(int i = 0; i < c_info->n_channels; ++i) {
+        channels[i].format = c_info->channels[i].format;
+        channels[i].flags = (c_info->channels[i].append ? LOGC_CHANNEL_APPEND : 0) |
+                            (c_info->channels[i].flight ? LOGC_CHANNEL_FLIGHT : 0);
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = LOGC_TRACE_CONNECT;
+    rec.channel = c_info->n_channels;
+    rec.n_shards = c_info->n_shards;
+    rec.client = c_info->capture_id;
+    rec.payload_len = c_info->n_channels * sizeof(struct logc_trace_channel);
+    write_record(&rec, channels);
+}
+
+void
+capture_connect(struct client_info *c_info)
+{
+    pthread_mutex_lock(&trace_lock);
+    if(trace_fp != NULL)
+        write_connect(c_info);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void
+capture_drain(struct client_info *c_info, int channel, int urgent, char *buff, int len)
+{
+    struct logc_trace_record rec;
+
+    pthread_mutex_lock(&trace_lock);
+    if(trace_fp != NULL) {
+        write_connect(c_info);
+
+        memset(&rec, 0, sizeof(rec));
+        rec.type = LOGC_TRACE_DRAIN;
+        rec.channel = channel;
+        rec.flags = urgent ? LOGC_TRACE_URGENT : 0;
+        rec.client = c_info->capture_id;
+        rec.len = len;
+        rec.payload_len = capture_config.payloads ? len : 0;
+        write_record(&rec, buff);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void
+capture_close(struct client_info *c_info)
+{
+    struct logc_trace_record rec;
+
+    pthread_mutex_lock(&trace_lock);
+    if(trace_fp != NULL && c_info->capture_id != 0) {
+        memset(&rec, 0, sizeof(rec));
+        rec.type = LOGC_TRACE_CLOSE;
+        rec.client = c_info->capture_id;
+        write_record(&rec, NULL);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,94 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc capture
+ * Capture of the log traffic to a trace file, see ../common/logc_trace.h
+ *
+ * The client threads append the records of their clients to a buffered trace file
+ * under a lock. A client gets its id in the trace on its first record, so the
+ * segments adopted from a previous server are captured too.
+ */
+
+#ifndef LOGC_CAPTURE_H
+#define LOGC_CAPTURE_H
+
+#include "logc_server.h"
+
+#define CAPTURE_BUFFER_SIZE     (1024 * 1024)
+
+struct capture_config
+{
+    /* path of the trace file, capture is disabled if empty */
+    char path[MAX_FILE_PATH_SIZE];
+
+    /* if 1, the drained logs are captured too */
+    int payloads;
+};
+
+extern struct capture_config capture_config;
+
+/**
+ * check if capture is enabled
+ */
+#define capture_enabled() (capture_config.path[0] != '\0')
+
+/**
+ * create the trace file
+ *
+ * @returns 0 on success, -1 on failure
+ */
+int capture_start();
+
+/**
+ * write the buffered records and close the trace file
+ */
+void capture_stop();
+
+/**
+ * capture the connection of a client
+ *
+ * @param c_info: client with its channels open
+ */
+void capture_connect(struct client_info *c_info);
+
+/**
+ * capture a drain of a ring
+ *
+ * @param c_info: client of the ring
+ * @param channel: channel id
+ * @param urgent: 1 if the ring is an urgent ring
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ */
+void capture_drain(struct client_info *c_info, int channel, int urgent, char *buff, int len);
+
+/**
+ * capture the close of a client
+ *
+ * @param c_info: client
+ */
+void capture_close(struct client_info *c_info);
+
+#endif
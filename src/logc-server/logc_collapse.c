@@ -0,0 +1,290 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for memmem
+
+#include "logc_collapse.h"
+#include "logc_req_handler.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COLLAPSE_DATE_SIZE      64      // the date is before the first separator
+#define COLLAPSE_FLUSH_AFTER    1000    // milliseconds a summary of consecutive repeats waits for the next message
+
+/**
+ * a recent message of a channel
+ */
+struct collapse_entry
+{
+    /* hash of the text after the date, 0 if the entry is free */
+    uint32_t hash;
+
+    /* length of the text after the date */
+    uint32_t len;
+
+    /* repeats not written since the message was */
+    uint32_t count;
+
+    /* level and callsite of the message, for the summary of a structured channel */
+    uint32_t level;
+    uint32_t callsite;
+
+    /* time the message was written, monotonic milliseconds */
+    int64_t start;
+
+    /* date of the last repeat, the summary is dated like it */
+    int64_t ts;
+    int date_len;
+    char date[COLLAPSE_DATE_SIZE];
+
+    /* text of the message after the date, kept on the first repeat */
+    int text_len;
+    char text[COLLAPSE_TEXT_SIZE];
+};
+
+/**
+ * collapsing state of a channel
+ */
+struct collapse_channel
+{
+    /* entry of the last message of the channel, -1 if there is none */
+    int last;
+
+    struct collapse_entry entries[COLLAPSE_ENTRIES];
+};
+
+/**
+ * a run of messages to write
+ */
+struct collapse_run
+{
+    int start;
+    int end;
+};
+
+struct collapse_config collapse_config;
+
+
+static int64_t
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline void
+write_run(struct client_info *c_info, struct channel_info *ch, char *buff, struct collapse_run *run)
+{
+    if(run->end > run->start)
+        write_channel(c_info, ch, buff + run->start, run->end - run->start);
+    run->start = run->end;
+}
+
+/**
+ * write the summary of the repeats of a message and free its entry
+ */
+static void
+write_summary(struct client_info *c_info, struct channel_info *ch, struct collapse_entry *e)
+{
+    char buff[sizeof(struct logc_record) + LOGC_RECORD_MAX_LEN];
+    char *line = buff + sizeof(struct logc_record);
+
+    uint32_t count = e->count;
+    e->hash = 0;
+    e->count = 0;
+    if(count == 0)
+        return;
+
+    // the text is " | file | func | line | msg\n", keep the callsite fields for the summary
+    const char *text_end = e->text + e->text_len;
+    const char *msg = e->text;
+    for(int i = 0; i < 4; ++i) {
+        const char *sep = memmem(msg, text_end - msg, " | ", 3);
+        if(sep == NULL)
+            break;
+        msg = sep + 3;
+    }
+
+    int msg_len = text_end - msg;
+    if(msg_len > 0 && msg[msg_len - 1] == '\n')
+        msg_len--;
+
+    memcpy(line, e->date, e->date_len);
+    int len = e->date_len;
+
+    if(collapse_config.window == 0)
+        len += snprintf(line + len, LOGC_RECORD_MAX_LEN - 1 - len, "%.*slast message repeated %u times",
+                        (int)(msg - e->text), e->text, count);
+    else
+        len += snprintf(line + len, LOGC_RECORD_MAX_LEN - 1 - len, "%.*smessage repeated %u times: %.*s",
+                        (int)(msg - e->text), e->text, count, msg_len, msg);
+
+    if(len > LOGC_RECORD_MAX_LEN - 2)
+        len = LOGC_RECORD_MAX_LEN - 2;
+    line[len++] = '\n';
+
+    if(!logc_format_structured(ch->format)) {
+        write_channel(c_info, ch, line, len);
+        return;
+    }
+
+    struct logc_record rec;
+    rec.magic = LOGC_RECORD_MAGIC;
+    rec.level = e->level;
+    rec.len = len;
+    rec.callsite = e->callsite;
+    rec.ts = e->ts;
+    memcpy(buff, &rec, sizeof(rec));
+
+    write_channel(c_info, ch, buff, sizeof(rec) + len);
+}
+
+void
+collapse_open(struct channel_info *ch)
+{
+    ch->collapse = NULL;
+    if(!collapse_enabled())
+        return;
+
+    ch->collapse = (struct collapse_channel *)calloc(1, sizeof(struct collapse_channel));
+    ch->collapse->last = -1;
+}
+
+int
+collapse_write(struct client_info *c_info, struct channel_info *ch, char *buff, int len)
+{
+    struct collapse_channel *c = ch->collapse;
+    struct collapse_run run = { 0, 0 };
+    int structured = logc_format_structured(ch->format);
+    int64_t now = now_ms();
+    int collapsed = 0;
+    int off = 0;
+
+    while(off < len) {
+        struct logc_record rec = { 0 };
+        char *msg;
+        int start, msg_len;
+
+        if(structured) {
+            if((msg = logc_record_next(buff, len, &off, &rec)) == NULL)
+                break;
+            start = msg - sizeof(rec) - buff;
+            msg_len = rec.len;
+        }
+        else {
+            char *nl = memchr(buff + off, '\n', len - off);
+            start = off;
+            off = nl != NULL ? nl - buff + 1 : len;
+            msg = buff + start;
+            msg_len = off - start;
+        }
+
+        // the repeats of a message differ only in the date
+        char *text = memmem(msg, msg_len < COLLAPSE_DATE_SIZE ? msg_len : COLLAPSE_DATE_SIZE, " | ", 3);
+        int text_len = text != NULL ? msg + msg_len - text : 0;
+        uint32_t hash = text != NULL ? logc_crc32c(rec.callsite, text, text_len) : 0;
+        if(text != NULL && hash == 0)
+            hash = 1;
+
+        int i = hash & (COLLAPSE_ENTRIES - 1);
+        struct collapse_entry *e = &(c->entries[i]);
+
+        if(hash != 0 && e->hash == hash && e->len == text_len &&
+           (collapse_config.window == 0 ? c->last == i : now - e->start < collapse_config.window)) {
+            if(e->count++ == 0) {
+                e->text_len = text_len < COLLAPSE_TEXT_SIZE ? text_len : COLLAPSE_TEXT_SIZE;
+                memcpy(e->text, text, e->text_len);
+            }
+            e->ts = rec.ts;
+            e->date_len = text - msg;
+            memcpy(e->date, msg, e->date_len);
+            collapsed++;
+
+            // the messages before the repeat are written, the repeat is skipped
+            write_run(c_info, ch, buff, &run);
+            run.start = run.end = off;
+            continue;
+        }
+
+        // the summary of the previous message, or of the message whose entry is taken, is written first
+        if((collapse_config.window == 0 && c->last != -1 && c->entries[c->last].count > 0) ||
+           (hash != 0 && e->count > 0)) {
+            write_run(c_info, ch, buff, &run);
+            if(collapse_config.window == 0 && c->last != -1)
+                write_summary(c_info, ch, &(c->entries[c->last]));
+            write_summary(c_info, ch, e);
+        }
+
+        if(hash != 0) {
+            e->hash = hash;
+            e->len = text_len;
+            e->count = 0;
+            e->level = rec.level;
+            e->callsite = rec.callsite;
+            e->start = now;
+        }
+        c->last = hash != 0 ? i : -1;
+
+        // garbage between records is not written
+        if(run.end != start) {
+            write_run(c_info, ch, buff, &run);
+            run.start = start;
+        }
+        run.end = off;
+    }
+
+    write_run(c_info, ch, buff, &run);
+
+    return collapsed;
+}
+
+void
+collapse_flush(struct client_info *c_info, struct channel_info *ch, int all)
+{
+    struct collapse_channel *c = ch->collapse;
+    if(c == NULL)
+        return;
+
+    int64_t now = now_ms();
+    int64_t due = collapse_config.window == 0 ? COLLAPSE_FLUSH_AFTER : collapse_config.window;
+
+    for(int i = 0; i < COLLAPSE_ENTRIES; ++i) {
+        struct collapse_entry *e = &(c->entries[i]);
+
+        if(e->count > 0 && (all || now - e->start >= due))
+            write_summary(c_info, ch, e);
+    }
+}
+
+void
+collapse_close(struct channel_info *ch)
+{
+    free(ch->collapse);
+    ch->collapse = NULL;
+}
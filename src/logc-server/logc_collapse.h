@@ -0,0 +1,103 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc collapse
+ * Collapsing of repeated messages in the drain path, before the routes and the sinks
+ *
+ * A message is identified by a CRC32C of its text after the date, so the repeats of a
+ * message logged from a retry loop are identical. Every channel keeps the hashes of
+ * its recent messages in a small direct mapped table, the state of a client is bounded
+ * by the number of its channels.
+ *
+ * With no window a message identical to the previous message of the channel is not
+ * written, and "last message repeated N times" is written before the next different
+ * message, like syslog. With a window the repeats of a message within the window of
+ * its first occurrence are not written, even between other messages, and
+ * "message repeated N times: <message>" is written when the window ends. A summary
+ * has the date of the last repeat, the callsite of the message and the format of the
+ * channel. The pending summaries are written once a second and when the channel closes.
+ */
+
+#ifndef LOGC_COLLAPSE_H
+#define LOGC_COLLAPSE_H
+
+#include "logc_server.h"
+
+#include <stdint.h>
+
+#define COLLAPSE_ENTRIES        64      // recent messages of a channel, a power of two
+#define COLLAPSE_TEXT_SIZE      192     // text of a message kept for its summary
+
+struct collapse_config
+{
+    /* if 1, the repeated messages are collapsed */
+    int enabled;
+
+    /* window of the repeats of a message in milliseconds, 0 for consecutive repeats only */
+    int64_t window;
+};
+
+extern struct collapse_config collapse_config;
+
+/**
+ * check if collapsing is enabled
+ */
+#define collapse_enabled() (collapse_config.enabled)
+
+/**
+ * set up the collapsing of a channel
+ *
+ * @param ch: channel
+ */
+void collapse_open(struct channel_info *ch);
+
+/**
+ * write the drained logs of a channel without the repeated messages
+ *
+ * @param c_info: client of the channel
+ * @param ch: channel with collapsing set up
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ * @returns number of messages collapsed
+ */
+int collapse_write(struct client_info *c_info, struct channel_info *ch, char *buff, int len);
+
+/**
+ * write the summaries of a channel that are due
+ *
+ * @param c_info: client of the channel
+ * @param ch: channel
+ * @param all: if 1, write every pending summary, like when the channel closes
+ */
+void collapse_flush(struct client_info *c_info, struct channel_info *ch, int all);
+
+/**
+ * free the collapsing state of a channel, the summaries must be flushed before
+ *
+ * @param ch: channel
+ */
+void collapse_close(struct channel_info *ch);
+
+#endif
@@ -0,0 +1,660 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_forwarder.h"
+#include "logc_server_utils.h"
+#include "../common/logc_forward.h"
+#include "../common/logc_lz.h"
+#include "../common/logc_record.h"
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define FORWARDER_WINDOW            (1024 * 1024)   // maximum bytes sent and not acked
+#define FORWARDER_RETRY_INTERVAL    1               // seconds between connection attempts
+#define FORWARDER_IO_TIMEOUT        1               // seconds
+#define FORWARDER_SPOOL_HEADER_LEN  (FORWARDER_SPOOL_MAGIC_LEN + sizeof(uint64_t))
+#define FORWARDER_MAX_FRAME_LEN     (sizeof(struct logc_forward_batch_header) + logc_lz_compress_bound(LOGC_FORWARD_BATCH_SIZE))
+
+
+struct forwarder_config forwarder_config = { .spool_dir = "." };
+
+/* a batch filled by the client threads */
+struct batch
+{
+    /* time the first entry was appended, milliseconds */
+    int64_t start;
+
+    int len;
+    char data[LOGC_FORWARD_BATCH_SIZE];
+
+    struct batch *next;
+};
+
+/* a sealed batch waiting for the ack of the collector */
+struct frame
+{
+    /* stream offset and uncompressed length of the batch */
+    uint64_t offset;
+    uint32_t raw_len;
+
+    /* length of the frame, header and data */
+    uint32_t len;
+
+    /* frame, NULL if it is spooled */
+    char *data;
+
+    /* position of the frame in the spool file */
+    off_t spool_pos;
+
+    struct frame *next;
+};
+
+// batches, filled by the client threads
+static struct batch *cur_batch;
+static struct batch *sealed_head;
+static struct batch *sealed_tail;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// frames, only used by the forwarder thread
+static struct frame *frames_head;
+static struct frame *frames_tail;
+static struct frame *send_next;
+static uint64_t stream_id;
+static uint64_t next_offset;
+static uint64_t acked;
+static size_t memory_used;
+static int n_spooled;
+static int spool_fd = -1;
+static off_t spool_end;
+static uint64_t dropped;
+
+// connection with the collector
+static int sock_fd = -1;
+static time_t retry_time;
+static int connect_failed;
+static char ack_buff[sizeof(struct logc_forward_ack)];
+static int ack_len;
+
+static pthread_t forwarder_tid;
+static volatile int stopping;
+
+
+static int64_t
+now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * move the current batch to the sealed batches, batch_lock must be held
+ */
+static void
+seal_batch()
+{
+    if(sealed_tail != NULL)
+        sealed_tail->next = cur_batch;
+    else
+        sealed_head = cur_batch;
+    sealed_tail = cur_batch;
+    cur_batch = NULL;
+}
+
+void
+forwarder_publish(struct client_info *c_info, int channel, char *buff, int len)
+{
+    if(!forwarder_enabled())
+        return;
+
+    struct channel_info *ch = &(c_info->channels[channel]);
+    char text[MAX_LOG_BUFF_SIZE];
+
+    // the collector gets text, convert the records outside the lock
+    if(logc_format_structured(ch->format)) {
+        memcpy(text, buff, len);
+        len = logc_record_to_text(text, len);
+        buff = text;
+    }
+    if(len == 0)
+        return;
+
+    struct logc_forward_entry entry = { .path_len = strlen(ch->log_file_path), .len = len };
+    int size = sizeof(entry) + entry.path_len + len;
+
+    pthread_mutex_lock(&batch_lock);
+
+    if(cur_batch != NULL && cur_batch->len + size > LOGC_FORWARD_BATCH_SIZE)
+        seal_batch();
+
+    if(cur_batch == NULL) {
+        cur_batch = (struct batch *)malloc(sizeof(struct batch));
+        cur_batch->start = now_ms();
+        cur_batch->len = 0;
+        cur_batch->next = NULL;
+    }
+
+    char *p = cur_batch->data + cur_batch->len;
+    memcpy(p, &entry, sizeof(entry));
+    memcpy(p + sizeof(entry), ch->log_file_path, entry.path_len);
+    memcpy(p + sizeof(entry) + entry.path_len, buff, len);
+    cur_batch->len += size;
+
+    pthread_mutex_unlock(&batch_lock);
+}
+
+/**
+ * take the sealed batches, the current batch is sealed if it is due
+ *
+ * @param all: if 1, the current batch is always sealed
+ * @returns list of the sealed batches
+ */
+static struct batch *
+take_batches(int all)
+{
+    pthread_mutex_lock(&batch_lock);
+
+    if(cur_batch != NULL && (all || now_ms() - cur_batch->start >= FORWARDER_FLUSH_INTERVAL))
+        seal_batch();
+
+    struct batch *b = sealed_head;
+    sealed_head = sealed_tail = NULL;
+
+    pthread_mutex_unlock(&batch_lock);
+    return b;
+}
+
+/**
+ * append a frame to the end of the spool file, the data of the frame is freed
+ *
+ * @returns 0 on success, -1 if the spool is full or the write failed
+ */
+static int
+spool_frame(struct frame *f)
+{
+    if(spool_fd == -1 || spool_end + f->len > FORWARDER_SPOOL_LIMIT)
+        return -1;
+
+    if(pwrite(spool_fd, f->data, f->len, spool_end) != f->len) {
+        logc_server_log("Cannot write forward spool: %s", strerror(errno));
+        return -1;
+    }
+
+    f->spool_pos = spool_end;
+    spool_end += f->len;
+    free(f->data);
+    f->data = NULL;
+    n_spooled++;
+
+    return 0;
+}
+
+/**
+ * insert a frame in the frames, in the order of the stream offsets
+ */
+static void
+insert_frame(struct frame *f)
+{
+    struct frame **p = &frames_head;
+
+    // the frames are mostly inserted in order, skip to the tail
+    if(frames_tail != NULL && frames_tail->offset < f->offset)
+        p = &(frames_tail->next);
+
+    while(*p != NULL && (*p)->offset < f->offset)
+        p = &((*p)->next);
+
+    f->next = *p;
+    *p = f;
+    if(f->next == NULL)
+        frames_tail = f;
+}
+
+/**
+ * make a frame of a batch, compressed if required
+ * the frame is kept in memory if there is room, spooled otherwise
+ */
+static void
+add_frame(struct batch *b)
+{
+    struct logc_forward_batch_header header = {
+        .magic = LOGC_FORWARD_MAGIC,
+        .offset = next_offset,
+        .raw_len = b->len,
+    };
+    char *data = (char *)malloc(FORWARDER_MAX_FRAME_LEN);
+    int data_len = 0;
+
+    if(forwarder_config.compress)
+        data_len = logc_lz_compress(b->data, b->len, data + sizeof(header), FORWARDER_MAX_FRAME_LEN - sizeof(header));
+
+    if(data_len > 0 && data_len < b->len) {
+        header.flags = LOGC_FORWARD_COMPRESSED;
+    }
+    else {
+        memcpy(data + sizeof(header), b->data, b->len);
+        data_len = b->len;
+    }
+    header.data_len = data_len;
+    memcpy(data, &header, sizeof(header));
+
+    struct frame *f = (struct frame *)calloc(1, sizeof(struct frame));
+    f->offset = next_offset;
+    f->raw_len = b->len;
+    f->len = sizeof(header) + data_len;
+    f->data = data;
+    next_offset += b->len;
+
+    if(memory_used + f->len > FORWARDER_MEMORY_LIMIT && spool_frame(f) == -1) {
+        // the collector sees a gap in the stream
+        if(dropped == 0)
+            logc_server_log("Forward spool is full, dropping batches");
+        dropped += f->raw_len;
+        free(f->data);
+        free(f);
+        return;
+    }
+
+    if(dropped > 0) {
+        logc_server_log("Forward spool has room, dropped %llu bytes", (unsigned long long)dropped);
+        dropped = 0;
+    }
+
+    if(f->data != NULL)
+        memory_used += f->len;
+
+    insert_frame(f);
+    if(send_next == NULL)
+        send_next = f;
+}
+
+/**
+ * get the data of a frame, read from the spool file if the frame is spooled
+ *
+ * @returns frame data, NULL if it cannot be read
+ */
+static char *
+frame_data(struct frame *f)
+{
+    static char spool_buff[FORWARDER_MAX_FRAME_LEN];
+
+    if(f->data != NULL)
+        return f->data;
+
+    if(pread(spool_fd, spool_buff, f->len, f->spool_pos) != f->len) {
+        logc_server_log("Cannot read forward spool: %s", strerror(errno));
+        return NULL;
+    }
+
+    return spool_buff;
+}
+
+/**
+ * free the frames acked by the collector, the spool file is emptied when no frame is spooled
+ */
+static void
+free_acked()
+{
+    while(frames_head != NULL && frames_head->offset + frames_head->raw_len <= acked) {
+        struct frame *f = frames_head;
+
+        frames_head = f->next;
+        if(frames_head == NULL)
+            frames_tail = NULL;
+        if(send_next == f)
+            send_next = f->next;
+
+        if(f->data != NULL) {
+            memory_used -= f->len;
+            free(f->data);
+        }
+        else {
+            n_spooled--;
+        }
+        free(f);
+    }
+
+    if(n_spooled == 0 && spool_end > FORWARDER_SPOOL_HEADER_LEN) {
+        if(ftruncate(spool_fd, FORWARDER_SPOOL_HEADER_LEN) == 0)
+            spool_end = FORWARDER_SPOOL_HEADER_LEN;
+    }
+}
+
+static void
+disconnect(char *reason)
+{
+    logc_server_log("Disconnected from collector: %s", reason);
+    close(sock_fd);
+    sock_fd = -1;
+    retry_time = time(NULL) + FORWARDER_RETRY_INTERVAL;
+}
+
+static int
+send_all(int fd, char *buff, int len)
+{
+    while(len > 0) {
+        int sb = send(fd, buff, len, MSG_NOSIGNAL);
+        if(sb < 0 && errno == EINTR)
+            continue;
+        if(sb <= 0)
+            return -1;
+
+        buff += sb;
+        len -= sb;
+    }
+
+    return 0;
+}
+
+/**
+ * connect to the collector, the frames are sent from the offset it has acked
+ */
+static void
+forwarder_connect()
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addr = NULL;
+    struct timeval timeout = { .tv_sec = FORWARDER_IO_TIMEOUT };
+    struct logc_forward_hello hello = { .magic = LOGC_FORWARD_MAGIC, .stream_id = stream_id };
+    struct logc_forward_ack ack;
+    int one = 1;
+    int fd = -1;
+    char *error = NULL;
+
+    retry_time = time(NULL) + FORWARDER_RETRY_INTERVAL;
+
+    int ret = getaddrinfo(forwarder_config.host, forwarder_config.port, &hints, &addr);
+    if(ret != 0) {
+        error = (char *)gai_strerror(ret);
+    }
+    else if((fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol)) == -1) {
+        error = strerror(errno);
+    }
+    else {
+        // the timeouts also bound the connect
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if(connect(fd, addr->ai_addr, addr->ai_addrlen) == -1 || send_all(fd, (char *)&hello, sizeof(hello)) == -1)
+            error = strerror(errno);
+        else if(recv(fd, &ack, sizeof(ack), MSG_WAITALL) != sizeof(ack) || ack.magic != LOGC_FORWARD_MAGIC)
+            error = "invalid hello response";
+    }
+
+    if(addr != NULL)
+        freeaddrinfo(addr);
+
+    if(error != NULL) {
+        // log only the first failure of a retry sequence
+        if(!connect_failed)
+            logc_server_log("Cannot connect to collector %s:%s, spooling: %s",
+                            forwarder_config.host, forwarder_config.port, error);
+        connect_failed = 1;
+        if(fd != -1)
+            close(fd);
+        return;
+    }
+
+    sock_fd = fd;
+    connect_failed = 0;
+    ack_len = 0;
+    acked = ack.offset;
+    send_next = frames_head;
+    free_acked();
+
+    logc_server_log("Connected to collector %s:%s, stream: %016llx, acked offset: %llu",
+                    forwarder_config.host, forwarder_config.port,
+                    (unsigned long long)stream_id, (unsigned long long)acked);
+}
+
+/**
+ * send the unsent frames, up to FORWARDER_WINDOW bytes ahead of the acked offset
+ */
+static void
+send_frames()
+{
+    while(send_next != NULL && send_next->offset < acked + FORWARDER_WINDOW) {
+        char *data = frame_data(send_next);
+
+        if(data == NULL || send_all(sock_fd, data, send_next->len) == -1) {
+            disconnect(data == NULL ? "spool read failed" : strerror(errno));
+            return;
+        }
+
+        send_next = send_next->next;
+    }
+}
+
+/**
+ * read the acks of the collector and free the acked frames
+ */
+static void
+read_acks()
+{
+    for(;;) {
+        int rb = recv(sock_fd, ack_buff + ack_len, sizeof(ack_buff) - ack_len, MSG_DONTWAIT);
+
+        if(rb < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        if(rb <= 0) {
+            disconnect(rb == 0 ? "closed by collector" : strerror(errno));
+            return;
+        }
+
+        ack_len += rb;
+        if(ack_len < sizeof(ack_buff))
+            continue;
+
+        struct logc_forward_ack ack;
+        memcpy(&ack, ack_buff, sizeof(ack));
+        ack_len = 0;
+
+        if(ack.magic != LOGC_FORWARD_MAGIC) {
+            disconnect("invalid ack");
+            return;
+        }
+        if(ack.offset > acked)
+            acked = ack.offset;
+    }
+
+    free_acked();
+}
+
+static void
+add_frames(int all)
+{
+    struct batch *b = take_batches(all);
+
+    while(b != NULL) {
+        struct batch *next = b->next;
+        add_frame(b);
+        free(b);
+        b = next;
+    }
+}
+
+/**
+ * forwarder thread
+ * seals the batches, sends them to the collector and reads the acks
+ */
+static void *
+forwarder_thread(void *args)
+{
+    while(!stopping) {
+        add_frames(0);
+
+        if(sock_fd == -1 && time(NULL) >= retry_time)
+            forwarder_connect();
+
+        if(sock_fd != -1)
+            send_frames();
+
+        // wait for the acks, or just sleep while disconnected
+        struct pollfd pfd = { .fd = sock_fd, .events = POLLIN };
+        if(poll(&pfd, sock_fd != -1, FORWARDER_FLUSH_INTERVAL) > 0)
+            read_acks();
+    }
+
+    add_frames(1);
+
+    // spool the frames in memory for the next server
+    int lost = 0;
+    for(struct frame *f = frames_head; f != NULL; f = f->next) {
+        if(f->data == NULL)
+            continue;
+
+        memory_used -= f->len;
+        if(spool_frame(f) == -1)
+            lost++;
+    }
+    if(lost > 0)
+        logc_server_log("Cannot spool %d forward batches, they are lost", lost);
+
+    if(sock_fd != -1)
+        close(sock_fd);
+
+    return NULL;
+}
+
+/**
+ * load the frames spooled by a previous server, they continue its stream
+ * a torn frame at the end of the spool file is removed
+ */
+static void
+load_spool()
+{
+    char magic[FORWARDER_SPOOL_MAGIC_LEN];
+    struct logc_forward_batch_header header;
+    struct stat st;
+    off_t pos = FORWARDER_SPOOL_HEADER_LEN;
+
+    if(fstat(spool_fd, &st) == -1 ||
+       pread(spool_fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+       memcmp(magic, FORWARDER_SPOOL_MAGIC, FORWARDER_SPOOL_MAGIC_LEN) != 0 ||
+       pread(spool_fd, &stream_id, sizeof(stream_id), FORWARDER_SPOOL_MAGIC_LEN) != sizeof(stream_id))
+        return;
+
+    while(pread(spool_fd, &header, sizeof(header), pos) == sizeof(header) &&
+          header.magic == LOGC_FORWARD_MAGIC &&
+          header.raw_len <= LOGC_FORWARD_BATCH_SIZE &&
+          header.data_len <= FORWARDER_MAX_FRAME_LEN - sizeof(header) &&
+          pos + sizeof(header) + header.data_len <= st.st_size) {
+        struct frame *f = (struct frame *)calloc(1, sizeof(struct frame));
+        f->offset = header.offset;
+        f->raw_len = header.raw_len;
+        f->len = sizeof(header) + header.data_len;
+        f->spool_pos = pos;
+        insert_frame(f);
+        n_spooled++;
+
+        if(f->offset + f->raw_len > next_offset)
+            next_offset = f->offset + f->raw_len;
+        pos += f->len;
+    }
+
+    // a new stream if nothing is left to forward
+    if(n_spooled == 0)
+        stream_id = 0;
+
+    spool_end = pos;
+    send_next = frames_head;
+}
+
+int
+forwarder_start()
+{
+    char spool_path[2 * MAX_FILE_PATH_SIZE];
+
+    snprintf(spool_path, sizeof(spool_path), "%s/%s", forwarder_config.spool_dir, FORWARDER_SPOOL_FILE);
+    spool_fd = open(spool_path, O_RDWR | O_CREAT, 0666);
+    if(spool_fd == -1)
+        logc_server_log("Cannot open forward spool, batches are only kept in memory. path: %s, error: %s",
+                        spool_path, strerror(errno));
+    else
+        load_spool();
+
+    if(stream_id == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        stream_id = ((uint64_t)ts.tv_sec << 32) ^ ((uint64_t)getpid() << 20) ^ ts.tv_nsec;
+        spool_end = FORWARDER_SPOOL_HEADER_LEN;
+
+        if(spool_fd != -1 &&
+           (pwrite(spool_fd, FORWARDER_SPOOL_MAGIC, FORWARDER_SPOOL_MAGIC_LEN, 0) != FORWARDER_SPOOL_MAGIC_LEN ||
+            pwrite(spool_fd, &stream_id, sizeof(stream_id), FORWARDER_SPOOL_MAGIC_LEN) != sizeof(stream_id))) {
+            logc_server_log("Cannot write forward spool, batches are only kept in memory: %s", strerror(errno));
+            close(spool_fd);
+            spool_fd = -1;
+        }
+    }
+
+    // remove the torn or stale end of the spool file
+    if(spool_fd != -1 && ftruncate(spool_fd, spool_end) == -1)
+        logc_server_log("Cannot truncate forward spool: %s", strerror(errno));
+
+    logc_server_log("Forwarding to collector %s:%s, stream: %016llx, spooled batches: %d",
+                    forwarder_config.host, forwarder_config.port, (unsigned long long)stream_id, n_spooled);
+
+    if(pthread_create(&forwarder_tid, NULL, forwarder_thread, NULL) != 0) {
+        logc_server_log("Cannot start forwarder thread");
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+forwarder_stop()
+{
+    stopping = 1;
+    pthread_join(forwarder_tid, NULL);
+
+    if(spool_fd == -1)
+        return;
+
+    // nothing left to forward, the next server starts a new stream
+    if(frames_head == NULL) {
+        char spool_path[2 * MAX_FILE_PATH_SIZE];
+        snprintf(spool_path, sizeof(spool_path), "%s/%s", forwarder_config.spool_dir, FORWARDER_SPOOL_FILE);
+        unlink(spool_path);
+    }
+    close(spool_fd);
+}
@@ -0,0 +1,95 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc forwarder
+ * Forwarding of the drained logs to a remote collector over TCP, see ../common/logc_forward.h
+ *
+ * Every drain is appended to a batch. A forwarder thread seals the batches every
+ * FORWARDER_FLUSH_INTERVAL milliseconds or when they are full, compresses them if
+ * required and sends them to the collector. The batches are kept until the collector
+ * acks them. Up to FORWARDER_MEMORY_LIMIT bytes of unacked batches are kept in memory,
+ * the rest are spooled to a file, up to FORWARDER_SPOOL_LIMIT bytes. When the spool is
+ * full the new batches are dropped.
+ *
+ * The spool keeps the id of the stream. When the server stops, the unacked batches
+ * in memory are spooled, and the next server resumes the stream from the offset the
+ * collector has acked.
+ */
+
+#ifndef LOGC_FORWARDER_H
+#define LOGC_FORWARDER_H
+
+#include "logc_server.h"
+
+#define FORWARDER_FLUSH_INTERVAL    100                 // milliseconds
+#define FORWARDER_MEMORY_LIMIT      (4 * 1024 * 1024)
+#define FORWARDER_SPOOL_LIMIT       (256 * 1024 * 1024)
+#define FORWARDER_SPOOL_FILE        "logc_forward.spool"
+#define FORWARDER_SPOOL_MAGIC       "LOGCFWS1"  // followed by the stream id, then the spooled frames
+#define FORWARDER_SPOOL_MAGIC_LEN   8
+
+struct forwarder_config
+{
+    /* host and port of the collector, forwarding is disabled if the host is empty */
+    char host[MAX_FILE_PATH_SIZE];
+    char port[16];
+
+    /* if 1, the batches are compressed, see logc_lz.h */
+    int compress;
+
+    /* directory of the spool file */
+    char spool_dir[MAX_FILE_PATH_SIZE];
+};
+
+extern struct forwarder_config forwarder_config;
+
+/**
+ * check if forwarding is enabled
+ */
+#define forwarder_enabled() (forwarder_config.host[0] != '\0')
+
+/**
+ * start the forwarder thread, load the spooled batches of a previous server
+ *
+ * @returns 0 on success, -1 on failure
+ */
+int forwarder_start();
+
+/**
+ * stop the forwarder thread, spool the unacked batches
+ */
+void forwarder_stop();
+
+/**
+ * append the drained logs of a channel to the current batch
+ *
+ * @param c_info: client of the channel
+ * @param channel: channel id
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ */
+void forwarder_publish(struct client_info *c_info, int channel, char *buff, int len);
+
+#endif
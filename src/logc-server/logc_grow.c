@@ -0,0 +1,293 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_grow.h"
+#include "logc_server_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct grow_config grow_config;
+
+
+void
+grow_set_max_size(long long size)
+{
+    grow_config.max_level = 0;
+    while(grow_config.max_level < LOGC_RING_LEVELS - 1 && logc_ring_size(grow_config.max_level) < size)
+        grow_config.max_level++;
+}
+
+/**
+ * level of a mapped ring, -1 if it is not a ring of the bulk ring
+ */
+static int
+ring_level(struct grow_ring *g, struct logc_buffer *ring)
+{
+    for(int level = 0; level < LOGC_RING_LEVELS; ++level) {
+        if(g->rings[level] == ring)
+            return level;
+    }
+
+    return -1;
+}
+
+/**
+ * create the extension of a level, or reuse the one left by a previous server
+ *
+ * @returns the ring, not initialised, NULL on failure
+ */
+static struct logc_buffer *
+create_ring(struct client_info *c_info, int channel, int shard, int level)
+{
+    char name[MAX_FILE_PATH_SIZE];
+    logc_ring_name(name, c_info->shm_name, shard, channel, level);
+
+    struct logc_buffer *ring = (struct logc_buffer *)create_shared_mem(name, logc_ring_object_size(level));
+    if(ring == NULL && errno == EEXIST)
+        ring = logc_ring_open(c_info->shm_name, shard, channel, level);
+
+    if(ring == NULL)
+        logc_server_log("Cannot create ring. shm_name: %s, error: %s", name, strerror(errno));
+
+    return ring;
+}
+
+void
+grow_open(struct client_info *c_info, int channel, int attached)
+{
+    struct channel_info *ch = &(c_info->channels[channel]);
+    struct logc_segment *seg = c_info->segment;
+    int grown = 0;
+
+    ch->grow = NULL;
+
+    // flight recorders are never drained, they never grow
+    if(ch->flight)
+        return;
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard)
+        grown |= seg->ring_level[shard][channel] != 0;
+
+    if(!grow_enabled() && !grown)
+        return;
+
+    ch->grow = (struct grow_ring *)calloc(c_info->n_shards, sizeof(struct grow_ring));
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard) {
+        struct grow_ring *g = &(ch->grow[shard]);
+        uint32_t level = seg->ring_level[shard][channel];
+
+        g->rings[0] = (struct logc_buffer *)logc_segment_bulk_ring(seg, shard, channel);
+
+        // a new segment may have the name of a removed one, its extensions are not looked up
+        if(!attached)
+            continue;
+
+        for(int i = 1; i < LOGC_RING_LEVELS; ++i)
+            g->rings[i] = logc_ring_open(c_info->shm_name, shard, channel, i);
+
+        if(level >= LOGC_RING_LEVELS || g->rings[level] == NULL) {
+            logc_server_log("Linked ring is missing, back to the ring in the segment. shm_name: %s, shard: %d, channel: %d, level: %u",
+                            c_info->shm_name, shard, channel, level);
+            level = 0;
+            __atomic_store_n(&(g->rings[0]->closed), 0, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&(seg->ring_level[shard][channel]), 0, __ATOMIC_RELEASE);
+        }
+        g->level = level;
+
+        // the previous server may have stopped between a link and the last drain of the closed ring
+        for(int i = 0; i < LOGC_RING_LEVELS; ++i) {
+            if(i == level || g->rings[i] == NULL)
+                continue;
+
+            __atomic_store_n(&(g->rings[i]->closed), 1, __ATOMIC_SEQ_CST);
+            if(!logc_buffer_empty(g->rings[i]))
+                g->closed_mask |= 1u << i;
+        }
+    }
+}
+
+struct logc_buffer *
+grow_closed_ring(struct client_info *c_info, int channel, int shard)
+{
+    struct grow_ring *g = &(c_info->channels[channel].grow[shard]);
+    if(g->closed_mask == 0) {
+        g->closed_mask = g->retry_mask;
+        g->retry_mask = 0;
+        return NULL;
+    }
+
+    int level = __builtin_ctz(g->closed_mask);
+    g->closed_mask &= ~(1u << level);
+    return g->rings[level];
+}
+
+struct logc_buffer *
+grow_resize(struct client_info *c_info, int channel, int shard, int fill_pct)
+{
+    struct grow_ring *g = &(c_info->channels[channel].grow[shard]);
+    int level = g->level;
+
+    if(fill_pct >= LOGC_RING_HIGH_PCT)
+        level = level < grow_config.max_level ? level + 1 : level;
+    else if(g->shrink)
+        level = level - 1;
+
+    g->shrink = 0;
+    if(level == g->level || level < 0)
+        return NULL;
+
+    // the ring is closed and not drained yet
+    if((g->closed_mask | g->retry_mask) & (1u << level))
+        return NULL;
+
+    if(g->rings[level] == NULL && (g->rings[level] = create_ring(c_info, channel, shard, level)) == NULL)
+        return NULL;
+
+    logc_buffer_map_and_init(g->rings[level], g->rings[level], logc_ring_size(level), logc_ring_size(level) / 2);
+
+    // link the new ring before closing the old one, a producer refused by the old ring finds the new one
+    struct logc_buffer *closed = g->rings[g->level];
+    __atomic_store_n(&(c_info->segment->ring_level[shard][channel]), level, __ATOMIC_RELEASE);
+    __atomic_store_n(&(closed->closed), 1, __ATOMIC_SEQ_CST);
+
+    if(level > g->level)
+        stats_add(c_info->stats.n_ring_grows, 1);
+    else
+        stats_add(c_info->stats.n_ring_shrinks, 1);
+
+    logc_server_log("Bulk ring moved. fd: %d, channel: %d, shard: %d, size: %u -> %u",
+                    c_info->fd, channel, shard, logc_ring_size(g->level), logc_ring_size(level));
+
+    g->level = level;
+    g->low_since = 0;
+    return closed;
+}
+
+void
+grow_retire(struct client_info *c_info, int channel, int shard, struct logc_buffer *ring)
+{
+    struct grow_ring *g = &(c_info->channels[channel].grow[shard]);
+    int level = ring_level(g, ring);
+
+    // a producer has not committed the frame it reserved before the ring was closed, drain again later
+    if(level >= 0 && level != g->level && !logc_buffer_empty(ring)) {
+        g->retry_mask |= 1u << level;
+        return;
+    }
+
+    // the ring in the segment keeps its memory, the header page of an extension keeps it closed
+    if(level <= 0 || level == g->level)
+        return;
+
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ring->buffer + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)ring + logc_ring_object_size(level)) & ~(uintptr_t)(page - 1);
+
+    if(end > start && madvise((void *)start, end - start, MADV_REMOVE) == -1)
+        logc_server_log("Cannot return the memory of a ring. fd: %d, error: %s", c_info->fd, strerror(errno));
+}
+
+int
+grow_check_idle(struct client_info *c_info, int channel, time_t now)
+{
+    struct grow_ring *grow = c_info->channels[channel].grow;
+    int due = 0;
+
+    if(grow == NULL)
+        return 0;
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard) {
+        struct grow_ring *g = &(grow[shard]);
+        if(g->level == 0)
+            continue;
+
+        struct logc_buffer *ring = g->rings[g->level];
+        uint32_t used = logc_buffer_used(ring);
+        uint32_t w_offset = __atomic_load_n(&(ring->w_offset), __ATOMIC_RELAXED);
+
+        // the logs left below the threshold after a burst are not drained until the next one
+        int written = w_offset != g->last_w_offset;
+        g->last_w_offset = w_offset;
+
+        if(written && (uint64_t)used * 100 >= (uint64_t)ring->size * LOGC_RING_LOW_PCT)
+            g->low_since = 0;
+        else if(g->low_since == 0)
+            g->low_since = now;
+        else if(now - g->low_since >= LOGC_RING_IDLE)
+            due = g->shrink = 1;
+    }
+
+    return due;
+}
+
+void
+grow_reset(struct client_info *c_info, int channel, int shard)
+{
+    struct grow_ring *grow = c_info->channels[channel].grow;
+    if(grow == NULL || grow[shard].level == 0)
+        return;
+
+    struct grow_ring *g = &(grow[shard]);
+    struct logc_buffer *closed = g->rings[g->level];
+
+    logc_buffer_map_and_init(g->rings[0], g->rings[0], MAX_LOG_BUFF_SIZE, MAX_LOG_BUFF_SIZE / 2);
+    __atomic_store_n(&(c_info->segment->ring_level[shard][channel]), 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&(closed->closed), 1, __ATOMIC_SEQ_CST);
+
+    g->level = 0;
+    g->low_since = 0;
+    g->shrink = 0;
+    grow_retire(c_info, channel, shard, closed);
+}
+
+void
+grow_close(struct client_info *c_info, int channel, int remove)
+{
+    struct channel_info *ch = &(c_info->channels[channel]);
+    char name[MAX_FILE_PATH_SIZE];
+
+    if(ch->grow == NULL)
+        return;
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard) {
+        for(int level = 1; level < LOGC_RING_LEVELS; ++level) {
+            if(ch->grow[shard].rings[level] == NULL)
+                continue;
+
+            munmap(ch->grow[shard].rings[level], logc_ring_object_size(level));
+            if(remove) {
+                logc_ring_name(name, c_info->shm_name, shard, channel, level);
+                shm_unlink(name);
+            }
+        }
+    }
+
+    free(ch->grow);
+    ch->grow = NULL;
+}
@@ -0,0 +1,189 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc grow
+ * Growing and shrinking of the bulk rings of the clients, see ../common/logc_ring.h
+ *
+ * A drain that finds a bulk ring above LOGC_RING_HIGH_PCT moves its producers to the
+ * next level, upto the largest level allowed. The periodic check of a client marks the
+ * rings that stayed below LOGC_RING_LOW_PCT or were not written to for LOGC_RING_IDLE
+ * seconds, and their next drain moves the producers a level down. The closed ring is
+ * drained right after the move, the memory of a closed extension is returned and its
+ * object is kept for the next burst. Memory follows the bursts: an idle client has
+ * the rings of its segment only.
+ *
+ * The rings of a segment adopted or attached after a restart keep their levels, the
+ * closed rings left by the previous server are drained first. A segment whose rings
+ * have grown is followed even if growing is disabled, its rings only shrink.
+ */
+
+#ifndef LOGC_GROW_H
+#define LOGC_GROW_H
+
+#include "logc_server.h"
+#include "../common/logc_ring.h"
+
+#include <stdint.h>
+#include <time.h>
+
+struct grow_config
+{
+    /* largest level of a bulk ring, 0 if the rings never grow */
+    int max_level;
+};
+
+/**
+ * a bulk ring of a channel in a shard
+ */
+struct grow_ring
+{
+    /* level the producers write to */
+    int level;
+
+    /* mapped levels, rings[0] is the ring in the segment */
+    struct logc_buffer *rings[LOGC_RING_LEVELS];
+
+    /* closed levels with logs left, drained before the linked level */
+    uint32_t closed_mask;
+
+    /* closed levels with frames not committed yet, drained again by the next drain */
+    uint32_t retry_mask;
+
+    /* time the ring went quiet, below LOGC_RING_LOW_PCT or not written to, 0 if it is busy */
+    time_t low_since;
+
+    /* write offset of the ring at the last check */
+    uint32_t last_w_offset;
+
+    /* if 1, the next drain moves the producers a level down */
+    int shrink;
+};
+
+extern struct grow_config grow_config;
+
+/**
+ * check if the bulk rings grow
+ */
+#define grow_enabled() (grow_config.max_level > 0)
+
+/**
+ * set the largest size of a bulk ring
+ *
+ * @param size: size in bytes, rounded up to a level
+ */
+void grow_set_max_size(long long size);
+
+/**
+ * set up the bulk rings of a channel, after the channel is open
+ * nothing is set up if growing is disabled and no ring of the channel has grown
+ *
+ * @param c_info: client of the channel
+ * @param channel: channel id
+ * @param attached: if 1, the segment existed before, its extensions are looked up
+ */
+void grow_open(struct client_info *c_info, int channel, int attached);
+
+/**
+ * bulk ring of a channel in a shard the producers write to
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param shard: shard id
+ * @returns the ring
+ */
+static inline struct logc_buffer *
+grow_bulk_ring(struct client_info *c_info, int channel, int shard)
+{
+    struct grow_ring *g = c_info->channels[channel].grow;
+    if(g == NULL)
+        return (struct logc_buffer *)logc_segment_bulk_ring(c_info->segment, shard, channel);
+
+    return g[shard].rings[g[shard].level];
+}
+
+/**
+ * next closed ring of a channel in a shard with logs left, the oldest logs first
+ * the closed ring is expected to be drained and retired
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param shard: shard id
+ * @returns the ring, NULL if there is none
+ */
+struct logc_buffer *grow_closed_ring(struct client_info *c_info, int channel, int shard);
+
+/**
+ * move the producers of a bulk ring to the next or the previous level if it is due
+ * the closed ring is expected to be drained and retired
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param shard: shard id
+ * @param fill_pct: fill of the linked ring found by the drain, percent of its size
+ * @returns the closed ring, NULL if the producers did not move
+ */
+struct logc_buffer *grow_resize(struct client_info *c_info, int channel, int shard, int fill_pct);
+
+/**
+ * return the memory of a drained closed ring
+ * A ring with frames not committed yet stays closed, it is drained again by the next drain
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param shard: shard id
+ * @param ring: closed ring, drained
+ */
+void grow_retire(struct client_info *c_info, int channel, int shard, struct logc_buffer *ring);
+
+/**
+ * mark the rings of a channel that are due to shrink, once a second
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param now: current time
+ * @returns 1 if a ring of the channel is due to shrink, 0 otherwise
+ */
+int grow_check_idle(struct client_info *c_info, int channel, time_t now);
+
+/**
+ * move the producers of a shard back to the ring in the segment, its producer has died
+ * the rings of the shard must be drained before
+ *
+ * @param c_info: client
+ * @param channel: channel id
+ * @param shard: shard id
+ */
+void grow_reset(struct client_info *c_info, int channel, int shard);
+
+/**
+ * unmap the extensions of a channel
+ *
+ * @param c_info: client of the channel
+ * @param channel: channel id
+ * @param remove: if 1, the extensions are removed with the segment
+ */
+void grow_close(struct client_info *c_info, int channel, int remove);
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_levels.h"
+#include "logc_server.h"
+#include "logc_server_utils.h"
+#include "logc_stats.h"
+#include "../common/logc_segment.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+struct levels_context
+{
+    struct logc_level_request *req;
+    char *report;
+    int size;
+    int len;
+    int matched;
+    int err;
+};
+
+static const char *level_names[] = LOGC_LEVEL_NAMES;
+
+#define LEVEL_NAME(level) \
+    ((level) >= 0 && (level) < sizeof(level_names) / sizeof(level_names[0]) ? level_names[level] : "?")
+
+
+/**
+ * Find the override of a channel and a file
+ *
+ * @returns index of the override, -1 if there is none
+ */
+static int
+find_override(struct logc_levels *levels, int channel, char *file)
+{
+    for(uint32_t i = 0; i < levels->n_overrides; ++i) {
+        if(levels->overrides[i].channel == channel &&
+           strncmp(levels->overrides[i].file, file, LOGC_LEVEL_FILE_LEN) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Change the levels of a segment, the sequence lock is held
+ *
+ * @returns 0 on success, errno on failure
+ */
+static int
+change_levels(struct logc_levels *levels, struct logc_level_request *req)
+{
+    int whole = req->channel == LOGC_LEVEL_ANY_CHANNEL && req->file[0] == '\0';
+    int i = whole ? -1 : find_override(levels, req->channel, req->file);
+
+    if(req->op == LOGC_LEVEL_SET) {
+        if(whole) {
+            levels->level = req->level;
+            return 0;
+        }
+
+        if(i == -1) {
+            if(levels->n_overrides == LOGC_LEVEL_OVERRIDES)
+                return ENOSPC;
+
+            i = levels->n_overrides;
+            levels->overrides[i].level = req->level;
+            levels->overrides[i].channel = req->channel;
+            memcpy(levels->overrides[i].file, req->file, LOGC_LEVEL_FILE_LEN);
+            __atomic_store_n(&(levels->n_overrides), i + 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        levels->overrides[i].level = req->level;
+        return 0;
+    }
+
+    // LOGC_LEVEL_CLEAR
+    if(whole) {
+        __atomic_store_n(&(levels->n_overrides), 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if(i == -1)
+        return ENOENT;
+
+    uint32_t n = levels->n_overrides - 1;
+    memmove(&(levels->overrides[i]), &(levels->overrides[i + 1]), (n - i) * sizeof(struct logc_level_override));
+    __atomic_store_n(&(levels->n_overrides), n, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Report the levels of a client
+ */
+static void
+report_levels(struct levels_context *ctx, uint32_t pid, struct logc_levels *levels)
+{
+    if(ctx->len >= ctx->size)
+        return;
+
+    int32_t level = __atomic_load_n(&(levels->level), __ATOMIC_RELAXED);
+    int32_t gate = __atomic_load_n(&(levels->gate), __ATOMIC_RELAXED);
+    uint32_t n = __atomic_load_n(&(levels->n_overrides), __ATOMIC_RELAXED);
+
+    ctx->len += snprintf(ctx->report + ctx->len, ctx->size - ctx->len, "levels pid=%u level=%s gate=%s overrides=%u\n",
+                         pid, LEVEL_NAME(level), LEVEL_NAME(gate), n);
+
+    for(uint32_t i = 0; i < n && i < LOGC_LEVEL_OVERRIDES && ctx->len < ctx->size; ++i) {
+        struct logc_level_override *o = &(levels->overrides[i]);
+        char channel[16] = "*";
+
+        if(o->channel != LOGC_LEVEL_ANY_CHANNEL)
+            snprintf(channel, sizeof(channel), "%d", o->channel);
+
+        ctx->len += snprintf(ctx->report + ctx->len, ctx->size - ctx->len, "override pid=%u channel=%s file=%.*s level=%s\n",
+                             pid, channel, LOGC_LEVEL_FILE_LEN, o->file[0] != '\0' ? o->file : "*",
+                             LEVEL_NAME(o->level));
+    }
+}
+
+/**
+ * Apply the request to a client if it is one of its clients
+ */
+static void
+apply_request(struct client_info *c_info, void *arg)
+{
+    struct levels_context *ctx = (struct levels_context *)arg;
+    struct logc_level_request *req = ctx->req;
+    uint32_t pid = __atomic_load_n(&(c_info->stats.pid), __ATOMIC_RELAXED);
+
+    if(req->pid != 0 && req->pid != pid)
+        return;
+
+    struct logc_levels *levels = &(c_info->segment->levels);
+    ctx->matched++;
+
+    if(req->op != LOGC_LEVEL_GET) {
+        if(req->channel >= c_info->n_channels) {
+            ctx->err = EINVAL;
+            return;
+        }
+
+        uint32_t seq = logc_levels_lock(levels, 0);
+        if(seq == 0) {
+            ctx->err = EBUSY;
+            return;
+        }
+
+        int err = change_levels(levels, req);
+        logc_levels_unlock(levels, seq);
+
+        if(err != 0) {
+            ctx->err = err;
+            return;
+        }
+
+        logc_server_log("Levels changed. pid: %u, op: %d, channel: %d, file: %.*s, level: %d",
+                        pid, req->op, req->channel, LOGC_LEVEL_FILE_LEN, req->file, req->level);
+    }
+
+    report_levels(ctx, pid, levels);
+}
+
+int
+levels_request(struct logc_level_request *req, char *report, int size)
+{
+    struct levels_context ctx = { req, report, size, 0, 0, 0 };
+
+    req->file[LOGC_LEVEL_FILE_LEN - 1] = '\0';
+
+    if(req->op < LOGC_LEVEL_GET || req->op > LOGC_LEVEL_CLEAR ||
+       req->level < 0 || req->level >= sizeof(level_names) / sizeof(level_names[0]) ||
+       req->channel < LOGC_LEVEL_ANY_CHANNEL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    stats_foreach_client(apply_request, &ctx);
+
+    if(ctx.matched == 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    if(ctx.err != 0) {
+        errno = ctx.err;
+        return -1;
+    }
+
+    return ctx.len < size ? ctx.len : size - 1;
+}
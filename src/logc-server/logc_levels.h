@@ -0,0 +1,50 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc levels
+ * Log levels of the clients changed at runtime, see ../common/logc_level.h
+ *
+ * logc-ctl sends a level request for a client, or for every client. The thread of
+ * the logc-ctl connection changes the levels in the segments of the clients under
+ * their sequence locks and replies with the levels of the clients.
+ */
+
+#ifndef LOGC_LEVELS_H
+#define LOGC_LEVELS_H
+
+#include "../common/logc_level.h"
+
+/**
+ * apply a level request to its clients and report their levels
+ * the report has a levels line for every client and an override line for every override
+ *
+ * @param req: level request
+ * @param report: buffer of the report
+ * @param size: size of the buffer
+ * @returns length of the report, -1 with errno set on failure
+ */
+int levels_request(struct logc_level_request *req, char *report, int size);
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_registry.h"
+#include "logc_req_handler.h"
+#include "logc_server_utils.h"
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+
+#define REGISTRY_TMP_PATH   LOGC_REGISTRY_PATH ".tmp"
+
+
+struct registry_entry
+{
+    /* name of the shared memory segment */
+    char shm_name[MAX_FILE_PATH_SIZE];
+
+    /* adopted client information, NULL if the segment is attached by a connected client */
+    struct client_info *orphan;
+
+    /* 1 while the orphan is drained outside registry_lock, it is not attached until then */
+    int draining;
+
+    /* next orphan in the list of a drain */
+    struct registry_entry *drain_next;
+
+    struct registry_entry *next;
+};
+
+static struct registry_entry *registry;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// signaled when the drain of the orphans ends
+static pthread_cond_t registry_cond = PTHREAD_COND_INITIALIZER;
+
+
+/**
+ * write the registry to the registry file
+ * the file is replaced atomically, a crash never leaves a partial registry
+ * registry_lock must be held
+ */
+static void
+registry_save()
+{
+    FILE *fp = fopen(REGISTRY_TMP_PATH, "w");
+    if(fp == NULL) {
+        logc_server_log("Cannot open registry file: %s, error: %s", REGISTRY_TMP_PATH, strerror(errno));
+        return;
+    }
+
+    for(struct registry_entry *entry = registry; entry != NULL; entry = entry->next)
+        fprintf(fp, "%s\n", entry->shm_name);
+
+    fclose(fp);
+
+    if(rename(REGISTRY_TMP_PATH, LOGC_REGISTRY_PATH) == -1)
+        logc_server_log("Cannot update registry file: %s, error: %s", LOGC_REGISTRY_PATH, strerror(errno));
+}
+
+/**
+ * find a segment in the registry
+ * registry_lock must be held
+ */
+static struct registry_entry *
+registry_find(char *shm_name)
+{
+    for(struct registry_entry *entry = registry; entry != NULL; entry = entry->next) {
+        if(strcmp(entry->shm_name, shm_name) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+ * add an entry to the registry
+ * registry_lock must be held
+ */
+static void
+registry_insert(char *shm_name, struct client_info *orphan)
+{
+    struct registry_entry *entry = (struct registry_entry *)malloc(sizeof(struct registry_entry));
+
+    strcpy(entry->shm_name, shm_name);
+    entry->orphan = orphan;
+    entry->draining = 0;
+    entry->next = registry;
+    registry = entry;
+}
+
+void
+registry_add(char *shm_name)
+{
+    pthread_mutex_lock(&registry_lock);
+
+    registry_insert(shm_name, NULL);
+    registry_save();
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void
+registry_remove(char *shm_name)
+{
+    pthread_mutex_lock(&registry_lock);
+
+    for(struct registry_entry **entry = &registry; *entry != NULL; entry = &((*entry)->next)) {
+        if(strcmp((*entry)->shm_name, shm_name) == 0) {
+            struct registry_entry *removed = *entry;
+            *entry = removed->next;
+            free(removed);
+
+            registry_save();
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int
+registry_attach(char *shm_name, struct client_info **orphan)
+{
+    int ret = 0;
+    *orphan = NULL;
+
+    pthread_mutex_lock(&registry_lock);
+
+    struct registry_entry *entry = registry_find(shm_name);
+
+    // wait for the drain of the orphan, it may also find the client dead
+    while(entry != NULL && entry->draining) {
+        pthread_cond_wait(&registry_cond, &registry_lock);
+        entry = registry_find(shm_name);
+    }
+
+    if(entry == NULL) {
+        registry_insert(shm_name, NULL);
+        registry_save();
+    }
+    else if(entry->orphan != NULL) {
+        *orphan = entry->orphan;
+        entry->orphan = NULL;
+    }
+    else {
+        ret = -1;
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+
+    return ret;
+}
+
+void
+registry_adopt_orphans()
+{
+    char shm_name[MAX_FILE_PATH_SIZE];
+
+    FILE *fp = fopen(LOGC_REGISTRY_PATH, "r");
+    if(fp == NULL)
+        return;
+
+    pthread_mutex_lock(&registry_lock);
+
+    while(fgets(shm_name, MAX_FILE_PATH_SIZE, fp) != NULL) {
+        shm_name[strcspn(shm_name, "\n")] = '\0';
+        if(shm_name[0] == '\0' || registry_find(shm_name) != NULL)
+            continue;
+
+        struct client_info *c_info = (struct client_info *)calloc(1, sizeof(struct client_info));
+        c_info->fd = -1;
+        c_info->epoll_fd = -1;
+
+        if(attach_segment(c_info, shm_name) == -1) {
+            logc_server_log("Cannot adopt segment: %s, error: %s", shm_name, strerror(errno));
+            free(c_info);
+            continue;
+        }
+
+        // write the logs pending since the previous server stopped
+        drain_client(c_info);
+        registry_insert(shm_name, c_info);
+
+        logc_server_log("Adopted segment: %s, pid: %u", shm_name, c_info->segment->pid);
+    }
+
+    fclose(fp);
+
+    registry_save();
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void
+registry_drain_orphans()
+{
+    struct registry_entry *orphans = NULL;
+    struct registry_entry *dead = NULL;
+
+    // the orphans are drained outside the lock, the attach requests are not held up by the drains
+    pthread_mutex_lock(&registry_lock);
+
+    for(struct registry_entry *entry = registry; entry != NULL; entry = entry->next) {
+        if(entry->orphan == NULL)
+            continue;
+
+        entry->draining = 1;
+        entry->drain_next = orphans;
+        orphans = entry;
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+
+    if(orphans == NULL)
+        return;
+
+    for(struct registry_entry *entry = orphans; entry != NULL; entry = entry->drain_next) {
+        drain_client(entry->orphan);
+        if(entry->orphan->n_shards > 1)
+            reap_dead_producers(entry->orphan);
+    }
+
+    pthread_mutex_lock(&registry_lock);
+
+    for(struct registry_entry **entry = &registry; *entry != NULL; ) {
+        if(!(*entry)->draining) {
+            entry = &((*entry)->next);
+            continue;
+        }
+        (*entry)->draining = 0;
+
+        // the client died while the server was away
+        uint32_t pid = (*entry)->orphan->segment->pid;
+        if(kill(pid, 0) == -1 && errno == ESRCH) {
+            struct registry_entry *removed = *entry;
+            *entry = removed->next;
+            removed->next = dead;
+            dead = removed;
+            continue;
+        }
+
+        entry = &((*entry)->next);
+    }
+
+    if(dead != NULL)
+        registry_save();
+
+    pthread_cond_broadcast(&registry_cond);
+    pthread_mutex_unlock(&registry_lock);
+
+    while(dead != NULL) {
+        struct registry_entry *entry = dead;
+        dead = dead->next;
+
+        logc_server_log("Adopted client has died. shm_name: %s", entry->shm_name);
+        dump_flight_recorders(entry->orphan, "client crash");
+        close_client(entry->orphan);
+        free(entry->orphan);
+        free(entry);
+    }
+}
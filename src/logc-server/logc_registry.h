@@ -0,0 +1,74 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc registry
+ * Keeps the names of the shared memory segments of the connected clients in
+ * LOGC_REGISTRY_PATH. A restarted server adopts the segments in the registry and
+ * keeps draining them until the clients reconnect and attach them again.
+ */
+
+#ifndef LOGC_REGISTRY_H
+#define LOGC_REGISTRY_H
+
+#include "logc_server.h"
+
+
+/**
+ * add a segment attached by a connected client to the registry
+ *
+ * @param shm_name: name of the shared memory segment
+ */
+void registry_add(char *shm_name);
+
+/**
+ * remove a segment from the registry
+ *
+ * @param shm_name: name of the shared memory segment
+ */
+void registry_remove(char *shm_name);
+
+/**
+ * mark a segment as attached by a reconnected client
+ * waits for a drain of the adopted segment in progress
+ *
+ * @param shm_name: name of the shared memory segment
+ * @param orphan: set to the adopted client information of the segment, NULL if the segment was not adopted
+ * @returns 0 on success, -1 if the segment is attached by another client
+ */
+int registry_attach(char *shm_name, struct client_info **orphan);
+
+/**
+ * adopt the segments in the registry file left by a previous server
+ * the pending logs are written to the log files right away
+ */
+void registry_adopt_orphans();
+
+/**
+ * drain the adopted segments which are not attached yet
+ * the segments of the clients that have died are closed
+ */
+void registry_drain_orphans();
+
+#endif
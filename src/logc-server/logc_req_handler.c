@@ -22,11 +22,25 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE       // for struct ucred
+
 #include "logc_req_handler.h"
 #include "logc_server.h"
 #include "logc_server_utils.h"
+#include "logc_registry.h"
+#include "logc_subscriber.h"
+#include "logc_forwarder.h"
+#include "logc_capture.h"
+#include "logc_levels.h"
+#include "logc_route.h"
+#include "logc_collapse.h"
+#include "logc_sched.h"
+#include "logc_grow.h"
 #include "../common/logc_buffer.h"
 #include "../common/logc_utils.h"
+#include "../common/logc_segment.h"
+#include "../common/logc_record.h"
+#include "../common/logc_probe.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -37,23 +51,72 @@
 #include <sys/shm.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+
+// a client gets a segment named /logc_shm_<pid>_<n> with the first unused n
+#define MAX_SEGMENTS_PER_PID    1024
+
+
+/**
+ * Open the log file of a channel
+ *
+ * @param c_info: information related to client
+ * @param ch: channel information
+ * @param attached: if 1, the segment existed before
+ * @return 0 on success, -1 on failure
+ */
+static int
+open_channel(struct client_info *c_info, struct channel_info *ch, int attached)
+{
+    if(sink_open(&(ch->sink), ch->log_file_path, ch->append, ch->format, c_info->segment->pid) == -1)
+        return -1;
+
+    route_open(ch, ch - c_info->channels);
+    collapse_open(ch);
+    grow_open(c_info, ch - c_info->channels, attached);
+    return 0;
+}
 
+/**
+ * Get the pid of the process at the other end of the connection
+ *
+ * @param c_info: information related to client
+ * @param pid: set to the pid of the client process
+ * @return 0 on success, -1 on failure
+ */
+static int
+get_peer_pid(struct client_info *c_info, uint32_t *pid)
+{
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+
+    if(getsockopt(c_info->fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1) {
+        logc_server_log("Cannot get client pid. fd: %d, error: %s", c_info->fd, strerror(errno));
+        return -1;
+    }
+
+    *pid = cred.pid;
+    return 0;
+}
 
 /**
  * Process init request 
  *
  * This functions will
- * Get the append mode and log file path from the request buffer 
- * Create a shared memory 
- * Open a file in the log file path 
+ * Get the append mode, format and log file path of every channel from the request buffer 
+ * Create a shared memory with the rings of all the channels
+ * Open a file in the log file path of every channel
  * Respond success / failure to the client 
  * 
  * @param c_info: information related to client
  * @param req_buffer: request buffer that was sent by the client
+ * @param len: length of the request buffer
  * @return 0 on success, -1 on failure
  */
 static int
-process_init_req(struct client_info *c_info, uint8_t *req_buff)
+process_init_req(struct client_info *c_info, uint8_t *req_buff, int len)
 {
     uint8_t success = 0;
     char shm_name[MAX_FILE_PATH_SIZE];
@@ -61,17 +124,66 @@ process_init_req(struct client_info *c_info, uint8_t *req_buff)
     /* parsing init request */
 
     uint8_t *ptr = req_buff + 1;  // skip 1 byte for request code
-    c_info->append = *ptr;        // append mode
-    ptr += 1; 
-    strcpy(c_info->log_file_path, (char *)ptr); // log file path
-
-    logc_server_log("Init request received. append_mode: %d, log_file_path: %s", c_info->append, c_info->log_file_path);
+    uint8_t *end = req_buff + len;
+    int n_channels = ptr[0];      // number of channels
+    int n_shards = ptr[1];        // number of producer shards
+    ptr += 2;
 
     // this loop will run once
     while(1) {
-        // create a shared memory
-        sprintf(shm_name, "/logc_shm_client_%d", c_info->fd);
-        void *addr = create_shared_mem(shm_name);
+        if(n_channels == 0 || n_channels > LOGC_MAX_CHANNELS) {
+            logc_server_log("Invalid number of channels: %d", n_channels);
+            errno = EINVAL;
+            break;
+        }
+
+        if(n_shards == 0 || n_shards > LOGC_MAX_SHARDS) {
+            logc_server_log("Invalid number of shards: %d", n_shards);
+            errno = EINVAL;
+            break;
+        }
+
+        // get append mode and log file path of every channel
+        int i;
+        for(i = 0; i < n_channels; ++i) {
+            struct channel_info *ch = &(c_info->channels[i]);
+            if(ptr + 6 >= end)
+                break;
+
+            int path_len = strnlen((char *)ptr + 6, end - ptr - 6);
+            if(ptr + 6 + path_len >= end || path_len >= MAX_FILE_PATH_SIZE)
+                break;
+
+            uint8_t flags = ptr[0];
+            ch->append = (flags & LOGC_CHANNEL_APPEND) != 0;
+            ch->flight = (flags & LOGC_CHANNEL_FLIGHT) != 0;
+            ch->format = ptr[1];
+            memcpy(&(ch->flight_size), ptr + 2, sizeof(uint32_t));
+            strcpy(ch->log_file_path, (char *)ptr + 6);
+            ptr += 7 + path_len;
+
+            logc_server_log("Init request received. channel: %d, append_mode: %d, flight: %d, format: %d, log_file_path: %s",
+                            i, ch->append, ch->flight, ch->format, ch->log_file_path);
+        }
+        if(i < n_channels) {
+            logc_server_log("Malformed init request. fd: %d", c_info->fd);
+            errno = EINVAL;
+            break;
+        }
+
+        // create a shared memory, named by the client pid so that it survives a server restart
+        uint32_t pid;
+        if(get_peer_pid(c_info, &pid) == -1)
+            break;
+
+        size_t size = logc_segment_size(n_shards, n_channels);
+        void *addr = NULL;
+        for(int n = 0; addr == NULL && n < MAX_SEGMENTS_PER_PID; ++n) {
+            sprintf(shm_name, "/logc_shm_%u_%d", pid, n);
+            addr = create_shared_mem(shm_name, size);
+            if(addr == NULL && errno != EEXIST)
+                break;
+        }
         if(addr == NULL) {
             logc_server_log("Cannot create shared memory. shm_name: %s, error: %s", shm_name, strerror(errno));
             break;
@@ -79,23 +191,42 @@ process_init_req(struct client_info *c_info, uint8_t *req_buff)
 
         // store shared memory addrress
         c_info->mmap_addr = addr;
+        c_info->mmap_size = size;
+        c_info->segment = (struct logc_segment *)addr;
+        c_info->n_shards = n_shards;
+        strcpy(c_info->shm_name, shm_name);
 
-        // map shared memory to log_buffer
-        logc_buffer_map(c_info->log_buff, addr);
+        // the segment describes itself, a restarted server or logc-recover can drain it without the client
+        struct logc_segment *seg = c_info->segment;
+        seg->pid = pid;
+        seg->n_channels = n_channels;
+        seg->n_shards = n_shards;
+        for(i = 0; i < n_channels; ++i) {
+            struct channel_info *ch = &(c_info->channels[i]);
 
-        // set open mode for the log file
-        char *mode;
-        if(c_info->append == 1)
-            mode = "a";
-        else
-            mode = "w";
+            seg->channels[i].flags = (ch->append ? LOGC_CHANNEL_APPEND : 0) | (ch->flight ? LOGC_CHANNEL_FLIGHT : 0);
+            seg->channels[i].format = ch->format;
+            seg->channels[i].dump_size = ch->flight_size;
+            strcpy(seg->channels[i].log_file_path, ch->log_file_path);
+        }
+        seg->magic = LOGC_SEGMENT_MAGIC;
 
-        // open the log file
-        c_info->fp = fopen(c_info->log_file_path, mode);
-        if(c_info->fp == NULL) {
-            logc_server_log("Cannot open log file: %s, error: %s", c_info->log_file_path, strerror(errno));
-            break;
+        // open the log files
+        for(i = 0; i < n_channels; ++i) {
+            if(open_channel(c_info, &(c_info->channels[i]), 0) == -1)
+                break;
+
+            c_info->n_channels++;
         }
+        if(i < n_channels)
+            break;
+
+        registry_add(shm_name);
+        __atomic_store_n(&(c_info->stats.pid), pid, __ATOMIC_RELAXED);
+        LOGC_PROBE2(server_connect, pid, c_info->shm_name);
+
+        if(capture_enabled())
+            capture_connect(c_info);
 
         // all completed successfully
         success = 1;
@@ -123,7 +254,257 @@ process_init_req(struct client_info *c_info, uint8_t *req_buff)
 }
 
 /**
- * Read from the logc_buff and write to the log file
+ * Get the channel id of a write request
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @returns channel id, -1 if the channel id is invalid
+ */
+static int
+get_req_channel(struct client_info *c_info, uint8_t *req_buff)
+{
+    int channel = req_buff[1];
+
+    if(channel >= c_info->n_channels) {
+        logc_server_log("Invalid channel. fd: %d, channel: %d", c_info->fd, channel);
+        return -1;
+    }
+
+    return channel;
+}
+
+void
+write_channel(struct client_info *c_info, struct channel_info *ch, char *buff, int len)
+{
+    if(ch->route != NULL)
+        stats_add(c_info->stats.bytes_filtered, route_write(ch, buff, len));
+    else
+        sink_write(&(ch->sink), buff, len);
+}
+
+/**
+ * Length of the first part of drained logs passed on at once
+ * A drain of a grown ring is split at message boundaries into parts of at most
+ * MAX_LOG_BUFF_SIZE - 1 bytes, like a drain of a ring of the segment
+ *
+ * @param ch: channel information
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ * @returns length of the part
+ */
+static int
+drain_chunk(struct channel_info *ch, char *buff, int len)
+{
+    int max = MAX_LOG_BUFF_SIZE - 1;
+    if(len <= max)
+        return len;
+
+    if(logc_format_structured(ch->format)) {
+        struct logc_record rec;
+        int off = 0, end = 0;
+
+        while(logc_record_next(buff, max, &off, &rec) != NULL)
+            end = off;
+        return end > 0 ? end : max;
+    }
+
+    char *nl = memrchr(buff, '\n', max);
+    return nl != NULL ? nl - buff + 1 : max;
+}
+
+/**
+ * Read all the messages from a logc_buffer and write to the log file of the channel
+ * The messages are also published to the subscribers and forwarded to the collector
+ *
+ * @param c_info: information related to client
+ * @param channel: channel id
+ * @param log_buff: logc_buffer to be drained
+ * @param urgent: 1 if log_buff is an urgent ring
+ * @param torn: if not NULL, the producers of the ring are gone, set to 1 if a message not
+ *              committed was skipped
+ * @returns number of bytes written
+ */
+static int
+drain_buffer(struct client_info *c_info, int channel, struct logc_buffer *log_buff, int urgent, int *torn)
+{
+    struct channel_info *ch = &(c_info->channels[channel]);
+    struct client_stats *stats = &(c_info->stats);
+    char stack_buff[MAX_LOG_BUFF_SIZE + 1];
+    char *read_buff = stack_buff;
+
+    // the rings of a client that died before initialising them
+    if(log_buff->size == 0)
+        return 0;
+
+    // a grown ring does not fit on the stack
+    if(log_buff->size > MAX_LOG_BUFF_SIZE) {
+        if(c_info->drain_buff == NULL)
+            c_info->drain_buff = (char *)malloc(LOGC_RING_MAX_SIZE + 1);
+        read_buff = c_info->drain_buff;
+    }
+
+    uint32_t used = logc_buffer_used(log_buff);
+    uint32_t dropped = log_buff->dropped;
+    int n_bytes = torn != NULL ? logc_buffer_read_abandoned(log_buff, read_buff, torn)
+                               : logc_buffer_read_all(log_buff, read_buff);
+
+    uint32_t fill = used < log_buff->size ? used : log_buff->size;
+    stats_max(stats->ring_high_water, fill);
+    stats_max(stats->ring_high_water_pct, (uint32_t)((uint64_t)fill * 100 / log_buff->size));
+
+    // the writers have overwritten messages not read
+    if(log_buff->dropped != dropped) {
+        stats_add(stats->n_overflows, 1);
+        stats_add(stats->bytes_dropped, log_buff->dropped - dropped);
+    }
+
+    // the stages after the drain take at most the size of a ring of the segment at once
+    for(int off = 0, len; off < n_bytes; off += len) {
+        char *buff = read_buff + off;
+        len = drain_chunk(ch, buff, n_bytes - off);
+
+        if(ch->collapse != NULL)
+            stats_add(stats->messages_collapsed, collapse_write(c_info, ch, buff, len));
+        else
+            write_channel(c_info, ch, buff, len);
+        subscriber_publish(c_info, channel, buff, len);
+        forwarder_publish(c_info, channel, buff, len);
+
+        if(capture_enabled())
+            capture_drain(c_info, channel, urgent, buff, len);
+    }
+
+    if(n_bytes > 0)
+        logc_server_log("Written %d bytes to log file: %s", n_bytes, ch->log_file_path);
+
+    return n_bytes;
+}
+
+/**
+ * Write the messages of the bulk ring of a channel in a shard to the log file
+ * The producers of a growing ring are moved to a bigger or a smaller ring if it is due,
+ * the closed rings are drained first
+ *
+ * @param c_info: information related to client
+ * @param channel: channel id
+ * @param shard: shard id
+ * @returns number of bytes written
+ */
+static int
+drain_bulk(struct client_info *c_info, int channel, int shard)
+{
+    struct logc_buffer *ring = grow_bulk_ring(c_info, channel, shard);
+    struct logc_buffer *closed;
+    int n_bytes = 0;
+
+    if(c_info->channels[channel].grow == NULL)
+        return drain_buffer(c_info, channel, ring, 0, NULL);
+
+    while((closed = grow_closed_ring(c_info, channel, shard)) != NULL) {
+        n_bytes += drain_buffer(c_info, channel, closed, 0, NULL);
+        grow_retire(c_info, channel, shard, closed);
+    }
+
+    uint32_t used = logc_buffer_used(ring);
+    int fill_pct = used >= ring->size ? 100 : (int)((uint64_t)used * 100 / ring->size);
+    n_bytes += drain_buffer(c_info, channel, ring, 0, NULL);
+
+    // the producers have moved, the logs written to the closed ring before are drained
+    if((closed = grow_resize(c_info, channel, shard, fill_pct)) != NULL) {
+        n_bytes += drain_buffer(c_info, channel, closed, 0, NULL);
+        grow_retire(c_info, channel, shard, closed);
+    }
+
+    return n_bytes;
+}
+
+/**
+ * Fill of the fullest ring of a channel
+ *
+ * @param c_info: information related to client
+ * @param channel: channel id
+ * @param urgent_only: if 1, only the urgent rings are checked
+ * @returns percent of the ring size rounded up, 0 if the rings are empty
+ */
+static int
+channel_fill_pct(struct client_info *c_info, int channel, int urgent_only)
+{
+    int max = 0;
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard) {
+        for(int bulk = 0; bulk <= !urgent_only; ++bulk) {
+            struct logc_buffer *log_buff = bulk ? grow_bulk_ring(c_info, channel, shard)
+                                                : logc_segment_urgent_ring(c_info->segment, shard, channel);
+            uint32_t used = logc_buffer_used(log_buff);
+            if(used == 0 || log_buff->size == 0)
+                continue;
+
+            int pct = used >= log_buff->size ? 100 : (int)(((uint64_t)used * 100 + log_buff->size - 1) / log_buff->size);
+            if(pct > max)
+                max = pct;
+        }
+    }
+
+    return max;
+}
+
+/**
+ * Write the messages of a channel in every shard to the log file
+ * The urgent buffers are drained first
+ *
+ * @param c_info: information related to client
+ * @param channel: channel id
+ * @param urgent_only: if 1, only the urgent buffers are drained
+ * @returns number of bytes written
+ *
+ * Note: Bulk buffers of a flight recorder are never drained
+ */
+static int
+drain_channel(struct client_info *c_info, int channel, int urgent_only)
+{
+    struct channel_info *ch = &(c_info->channels[channel]);
+    struct timespec start, end;
+    int n_bytes = 0;
+
+    if(ch->flight)
+        urgent_only = 1;
+
+    // an empty channel does not wait for a drain slot
+    int fill_pct = sched_enabled() ? channel_fill_pct(c_info, channel, urgent_only) : 0;
+    if(fill_pct > 0)
+        sched_acquire(c_info, fill_pct, urgent_only);
+
+    LOGC_PROBE2(drain_start, c_info->stats.pid, channel);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int shard = 0; shard < c_info->n_shards; ++shard)
+        n_bytes += drain_buffer(c_info, channel, logc_segment_urgent_ring(c_info->segment, shard, channel), 1, NULL);
+
+    if(!urgent_only) {
+        for(int shard = 0; shard < c_info->n_shards; ++shard)
+            n_bytes += drain_bulk(c_info, channel, shard);
+    }
+
+    if(n_bytes > 0) {
+        sink_flush(&(ch->sink));
+        route_flush(ch);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stats_drain(&(c_info->stats), n_bytes, (int64_t)(end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec));
+    }
+
+    LOGC_PROBE3(drain_end, c_info->stats.pid, channel, n_bytes);
+
+    if(fill_pct > 0)
+        sched_release(c_info, n_bytes);
+
+    return n_bytes;
+}
+
+/**
+ * Read from the logc_buff of the channel and write to the log file
+ * The urgent buffer is drained first
  *
  * @param c_info: information related to client
  * @param req_buff: request buffer
@@ -134,24 +515,422 @@ process_init_req(struct client_info *c_info, uint8_t *req_buff)
 static int
 process_write_req(struct client_info *c_info, uint8_t *req_buff)
 {
-    logc_server_log("Received write request. fd: %d", c_info->fd);
+    logc_server_log("Received write request. fd: %d, channel: %d", c_info->fd, req_buff[1]);
 
-    // Read logs
-    char read_buff[MAX_LOG_BUFF_SIZE];
-    int n_bytes = logc_buffer_read_all(c_info->log_buff, read_buff);
-  
-    if(n_bytes == 0) {
+    int channel = get_req_channel(c_info, req_buff);
+    if(channel == -1)
+        return 0;
+
+    if(drain_channel(c_info, channel, 0) == 0)
         logc_server_log("Nothing to write");
+
+    return 0;
+}
+
+/**
+ * Read from the urgent buffer of the channel and write to the log file immediately
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @returns 0
+ *
+ * Note: This functions always succeeds
+ */
+static int
+process_urgent_write_req(struct client_info *c_info, uint8_t *req_buff)
+{
+    logc_server_log("Received urgent write request. fd: %d, channel: %d", c_info->fd, req_buff[1]);
+
+    int channel = get_req_channel(c_info, req_buff);
+    if(channel == -1)
+        return 0;
+
+    drain_channel(c_info, channel, 1);
+
+    return 0;
+}
+
+void
+drain_client(struct client_info *c_info)
+{
+    for(int i = 0; i < c_info->n_channels; ++i)
+        drain_channel(c_info, i, 0);
+
+    flush_client(c_info);
+}
+
+void
+flush_client(struct client_info *c_info)
+{
+    time_t now = time(NULL);
+
+    for(int i = 0; i < c_info->n_channels; ++i) {
+        // the next drain moves the producers of an idle grown ring a level down
+        if(grow_check_idle(c_info, i, now))
+            drain_channel(c_info, i, 0);
+
+        collapse_flush(c_info, &(c_info->channels[i]), 0);
+        sink_flush(&(c_info->channels[i].sink));
+        route_flush(&(c_info->channels[i]));
     }
-    else {
-        fprintf(c_info->fp, "%s", read_buff);
-        fflush(c_info->fp);
-        logc_server_log("Written %d bytes to log file: %s", n_bytes, c_info->log_file_path);
+}
+
+int
+attach_segment(struct client_info *c_info, char *shm_name)
+{
+    size_t size = 0;
+    struct logc_segment *seg = (struct logc_segment *)open_shared_mem(shm_name, &size);
+    if(seg == NULL)
+        return -1;
+
+    if(size < sizeof(struct logc_segment) || seg->magic != LOGC_SEGMENT_MAGIC ||
+       seg->n_channels == 0 || seg->n_channels > LOGC_MAX_CHANNELS ||
+       seg->n_shards == 0 || seg->n_shards > LOGC_MAX_SHARDS ||
+       size < logc_segment_size(seg->n_shards, seg->n_channels)) {
+        munmap(seg, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    c_info->mmap_addr = seg;
+    c_info->mmap_size = size;
+    c_info->segment = seg;
+    c_info->n_shards = seg->n_shards;
+    c_info->adopted = 1;
+    strcpy(c_info->shm_name, shm_name);
+
+    for(int i = 0; i < seg->n_channels; ++i) {
+        struct channel_info *ch = &(c_info->channels[i]);
+
+        // the log file was opened by the previous server, never truncate it
+        ch->append = 1;
+        ch->flight = (seg->channels[i].flags & LOGC_CHANNEL_FLIGHT) != 0;
+        ch->format = seg->channels[i].format;
+        ch->flight_size = seg->channels[i].dump_size;
+        memcpy(ch->log_file_path, seg->channels[i].log_file_path, MAX_FILE_PATH_SIZE);
+        ch->log_file_path[MAX_FILE_PATH_SIZE - 1] = '\0';
+
+        if(open_channel(c_info, ch, 1) == -1)
+            break;
+
+        c_info->n_channels++;
+    }
+
+    if(c_info->n_channels < seg->n_channels) {
+        // leave the segment as it is for another attempt
+        for(int i = 0; i < c_info->n_channels; ++i) {
+            sink_close(&(c_info->channels[i].sink));
+            route_close(&(c_info->channels[i]));
+            collapse_close(&(c_info->channels[i]));
+            grow_close(c_info, i, 0);
+        }
+
+        munmap(seg, size);
+        memset(c_info->shm_name, 0, MAX_FILE_PATH_SIZE);
+        c_info->mmap_addr = NULL;
+        c_info->segment = NULL;
+        c_info->n_channels = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Move the adopted segment of an orphan to a client, a field at a time
+ * The connection, the thread and the registrations of the client stay
+ *
+ * @param c_info: information related to client
+ * @param arg: orphan, client information of the adopted segment
+ */
+static void
+adopt_orphan(struct client_info *c_info, void *arg)
+{
+    struct client_info *orphan = (struct client_info *)arg;
+
+    c_info->n_channels = orphan->n_channels;
+    memcpy(c_info->channels, orphan->channels, sizeof(c_info->channels));
+    c_info->n_shards = orphan->n_shards;
+    c_info->segment = orphan->segment;
+    c_info->mmap_addr = orphan->mmap_addr;
+    c_info->mmap_size = orphan->mmap_size;
+    memcpy(c_info->shm_name, orphan->shm_name, MAX_FILE_PATH_SIZE);
+    c_info->adopted = orphan->adopted;
+    c_info->stats = orphan->stats;
+    c_info->capture_id = orphan->capture_id;
+    c_info->drain_buff = orphan->drain_buff;
+
+    // the share of the drain slots goes on
+    if(c_info->sched == NULL) {
+        __atomic_store_n(&(c_info->sched), orphan->sched, __ATOMIC_RELEASE);
+        orphan->sched = NULL;
+    }
+}
+
+/**
+ * Process attach request
+ * A client reconnecting to a restarted server attaches its shared memory segment.
+ * If the segment was adopted by the server, the client thread takes it over.
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @param len: length of the request buffer
+ * @returns 0 on success, -1 on failure
+ */
+static int
+process_attach_req(struct client_info *c_info, uint8_t *req_buff, int len)
+{
+    uint8_t success = 0;
+    char shm_name[MAX_FILE_PATH_SIZE];
+    struct client_info *orphan;
+
+    // this loop will run once
+    while(1) {
+        int name_len = strnlen((char *)req_buff + 1, len - 1);
+        if(name_len == len - 1 || name_len >= MAX_FILE_PATH_SIZE) {
+            logc_server_log("Malformed attach request. fd: %d", c_info->fd);
+            errno = EINVAL;
+            break;
+        }
+        strcpy(shm_name, (char *)req_buff + 1);
+
+        logc_server_log("Attach request received. fd: %d, shm_name: %s", c_info->fd, shm_name);
+
+        if(registry_attach(shm_name, &orphan) == -1) {
+            logc_server_log("Segment is attached by another client. shm_name: %s", shm_name);
+            errno = EBUSY;
+            break;
+        }
+
+        if(orphan != NULL) {
+            // take over the adopted segment, keep the connection of this client
+            stats_update_client(c_info, adopt_orphan, orphan);
+            sched_remove(orphan);
+            free(orphan);
+        }
+        else if(attach_segment(c_info, shm_name) == -1) {
+            logc_server_log("Cannot attach segment. shm_name: %s, error: %s", shm_name, strerror(errno));
+            registry_remove(shm_name);
+            break;
+        }
+
+        __atomic_store_n(&(c_info->stats.pid), c_info->segment->pid, __ATOMIC_RELAXED);
+        LOGC_PROBE2(server_connect, c_info->stats.pid, c_info->shm_name);
+
+        if(capture_enabled())
+            capture_connect(c_info);
+
+        success = 1;
+        break;
+    }
+
+    uint8_t resp_buff[MAX_WRITE_BUFF_SIZE];
+    memcpy(resp_buff, &success, sizeof(uint8_t));
+    if(!success)
+        memcpy(resp_buff + 1, &errno, sizeof(int));
+
+    logc_server_log("Log attach %s", success ? "success" : "failed");
+
+    if(send_response(c_info->fd, resp_buff, MAX_WRITE_BUFF_SIZE) < 0)
+        success = 0;
+
+    if(success)
+        return 0;
+    return -1;
+}
+
+/**
+ * Process subscribe request
+ * The connection becomes a subscriber of the drained logs, it gets a shared memory
+ * with a ring of the lines that pass its filters.
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @param len: length of the request buffer
+ * @returns 0 on success, -1 on failure
+ */
+static int
+process_subscribe_req(struct client_info *c_info, uint8_t *req_buff, int len)
+{
+    uint8_t success = 0;
+    char shm_name[MAX_FILE_PATH_SIZE];
+    char pattern[MAX_SUBSCRIBE_PATTERN_SIZE];
+    uint32_t peer_pid;
+    uint32_t pid;
+
+    // this loop will run once
+    while(1) {
+        int pattern_len = len > 6 ? strnlen((char *)req_buff + 6, len - 6) : 0;
+        if(len <= 6 || pattern_len == len - 6 || pattern_len >= MAX_SUBSCRIBE_PATTERN_SIZE) {
+            logc_server_log("Malformed subscribe request. fd: %d", c_info->fd);
+            errno = EINVAL;
+            break;
+        }
+
+        int level = req_buff[1];
+        memcpy(&pid, req_buff + 2, sizeof(uint32_t));
+        strcpy(pattern, (char *)req_buff + 6);
+
+        if(get_peer_pid(c_info, &peer_pid) == -1)
+            break;
+
+        if(subscriber_add(c_info, peer_pid, level, pid, pattern, shm_name) == -1)
+            break;
+
+        success = 1;
+        break;
+    }
+
+    uint8_t resp_buff[MAX_WRITE_BUFF_SIZE];
+    memcpy(resp_buff, &success, sizeof(uint8_t));
+    if(success)
+        memcpy(resp_buff + 1, shm_name, strlen(shm_name) + 1);
+    else
+        memcpy(resp_buff + 1, &errno, sizeof(int));
+
+    if(send_response(c_info->fd, resp_buff, MAX_WRITE_BUFF_SIZE) < 0)
+        success = 0;
+
+    if(success)
+        return 0;
+    return -1;
+}
+
+/**
+ * Write the latest logs of a flight recorder channel to <log file path>.flight
+ *
+ * @param c_info: information related to client
+ * @param channel: channel id
+ * @param reason: reason of the dump, written in the dump header
+ */
+static void
+dump_flight_recorder(struct client_info *c_info, int channel, char *reason)
+{
+    struct channel_info *ch = &(c_info->channels[channel]);
+    char dump_path[MAX_FILE_PATH_SIZE + 8];
+    char read_buff[MAX_LOG_BUFF_SIZE];
+    char time_buff[64];
+
+    sprintf(dump_path, "%s.flight", ch->log_file_path);
+    FILE *fp = fopen(dump_path, "a");
+    if(fp == NULL) {
+        logc_server_log("Cannot open flight recorder dump file: %s, error: %s", dump_path, strerror(errno));
+        return;
+    }
+
+    time_t cur_time = time(NULL);
+    strftime(time_buff, sizeof(time_buff), "%c", localtime(&cur_time));
+    fprintf(fp, "==== logc flight recorder dump, %s, %s ====\n", reason, time_buff);
+
+    int max = MAX_LOG_BUFF_SIZE - 1;
+    if(ch->flight_size > 0 && ch->flight_size < max)
+        max = ch->flight_size;
+
+    int n_bytes = 0;
+    for(int shard = 0; shard < c_info->n_shards; ++shard) {
+        if(c_info->n_shards > 1)
+            fprintf(fp, "==== shard %d, pid %u ====\n", shard, c_info->segment->owner[shard]);
+
+        int n = logc_buffer_snapshot(logc_segment_bulk_ring(c_info->segment, shard, channel), read_buff, max);
+        if(logc_format_structured(ch->format))
+            n = logc_record_to_text(read_buff, n);
+        fwrite(read_buff, 1, n, fp);
+        n_bytes += n;
     }
 
+    fclose(fp);
+    logc_server_log("Flight recorder dumped. fd: %d, reason: %s, %d bytes to %s", c_info->fd, reason, n_bytes, dump_path);
+}
+
+void
+dump_flight_recorders(struct client_info *c_info, char *reason)
+{
+    for(int i = 0; i < c_info->n_channels; ++i) {
+        if(c_info->channels[i].flight)
+            dump_flight_recorder(c_info, i, reason);
+    }
+}
+
+/**
+ * Dump the flight recorder of the channel
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @returns 0
+ *
+ * Note: This functions always succeeds
+ */
+static int
+process_dump_req(struct client_info *c_info, uint8_t *req_buff)
+{
+    logc_server_log("Received dump request. fd: %d, channel: %d", c_info->fd, req_buff[1]);
+
+    int channel = get_req_channel(c_info, req_buff);
+    if(channel == -1 || !c_info->channels[channel].flight)
+        return 0;
+
+    dump_flight_recorder(c_info, channel, "client request");
+
     return 0;
 }
 
+/**
+ * Drain and release the shard of a pool process that died
+ * If the process died in the middle of a write, the message it was writing is skipped
+ *
+ * @param c_info: information related to client
+ * @param shard: shard id
+ */
+static void
+release_dead_shard(struct client_info *c_info, int shard)
+{
+    for(int i = 0; i < c_info->n_channels; ++i) {
+        struct channel_info *ch = &(c_info->channels[i]);
+        struct logc_buffer *rings[2] = {
+            logc_segment_urgent_ring(c_info->segment, shard, i),
+            grow_bulk_ring(c_info, i, shard)
+        };
+
+        for(int j = 0; j < 2; ++j) {
+            int torn;
+
+            drain_buffer(c_info, i, rings[j], j == 0, &torn);
+            if(torn) {
+                char note[MAX_WRITE_BUFF_SIZE];
+                snprintf(note, sizeof(note), "producer %u died in the middle of a write, its last message is lost",
+                         c_info->segment->owner[shard]);
+                sink_note(&(ch->sink), LOGC_LEVEL_WARN, note);
+            }
+
+            // the producer is gone, start the ring afresh for the next owner
+            logc_buffer_map_and_init(rings[j], rings[j], rings[j]->size, rings[j]->threshold);
+        }
+
+        // the next owner starts with the ring in the segment
+        grow_reset(c_info, i, shard);
+
+        sink_flush(&(ch->sink));
+        route_flush(ch);
+    }
+
+    logc_server_log("Released shard of dead producer. fd: %d, shard: %d, pid: %u",
+                    c_info->fd, shard, c_info->segment->owner[shard]);
+
+    __atomic_store_n(&(c_info->segment->owner[shard]), 0, __ATOMIC_RELEASE);
+}
+
+void
+reap_dead_producers(struct client_info *c_info)
+{
+    // shard 0 belongs to the connected process, its death closes the connection
+    for(int shard = 1; shard < c_info->n_shards; ++shard) {
+        uint32_t pid = __atomic_load_n(&(c_info->segment->owner[shard]), __ATOMIC_ACQUIRE);
+
+        if(pid != 0 && kill(pid, 0) == -1 && errno == ESRCH)
+            release_dead_shard(c_info, shard);
+    }
+}
+
 /**
  * Close the logc client
  * Close all the related fds
@@ -175,63 +954,196 @@ process_close_req(struct client_info *c_info, uint8_t *req_buff)
 void
 close_client(struct client_info *c_info)
 {
+    LOGC_PROBE1(server_close, c_info->stats.pid);
+
     // close the client connection
     close(c_info->fd);
 
     // close the client epoll fd
     close(c_info->epoll_fd);
+
+    subscriber_remove(c_info);
    
-    // read logs if there is any
-    char read_buff[MAX_LOG_BUFF_SIZE];
-    int n_bytes = logc_buffer_read_all(c_info->log_buff, read_buff);
+    for(int i = 0; i < c_info->n_channels; ++i) {
+        struct channel_info *ch = &(c_info->channels[i]);
 
-    // write to file
-    if(n_bytes > 0) {
-        fprintf(c_info->fp, "%s", read_buff);
-        logc_server_log("Written %d bytes to log file: %s", n_bytes, c_info->log_file_path);
+        // write the logs in urgent and bulk buffers of every shard if there is any
+        drain_channel(c_info, i, 0);
+
+        // write the pending summaries and logs and close the log file
+        collapse_flush(c_info, ch, 1);
+        collapse_close(ch);
+        sink_close(&(ch->sink));
+        route_close(ch);
+        grow_close(c_info, i, c_info->shm_name[0] != '\0');
+
+        logc_server_log("Channel closed. fd = %d, log_file_path: %s", c_info->fd, ch->log_file_path);
     }
 
-    // flush the log file fp and close it
-    fflush(c_info->fp);
-    fclose(c_info->fp);
+    // the stats read the latency histograms of the segment
+    stats_unregister(c_info);
+    sched_remove(c_info);
 
-    // unmap memory
-    munmap(c_info->mmap_addr, MAX_LOG_BUFF_SIZE);
+    if(capture_enabled())
+        capture_close(c_info);
 
-    logc_server_log("Client closed. fd = %d, log_file_path: %s", c_info->fd, c_info->log_file_path);
+    free(c_info->drain_buff);
+    c_info->drain_buff = NULL;
+
+    // unmap memory, the logs are all written, remove the segment
+    if(c_info->mmap_addr != NULL)
+        munmap(c_info->mmap_addr, c_info->mmap_size);
+
+    if(c_info->shm_name[0] != '\0') {
+        shm_unlink(c_info->shm_name);
+        registry_remove(c_info->shm_name);
+    }
+
+    logc_server_log("Client closed. fd = %d", c_info->fd);
+}
+
+/**
+ * Process stats request
+ * The response has the result, the length of the report and the report, see logc_stats.h
+ *
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @returns 0 on success, -1 on failure
+ */
+static int
+process_stats_req(struct client_info *c_info, uint8_t *req_buff)
+{
+    uint8_t resp_buff[1 + sizeof(uint32_t) + STATS_MAX_REPORT_SIZE];
+    uint32_t len = stats_report((char *)resp_buff + 1 + sizeof(uint32_t), STATS_MAX_REPORT_SIZE);
+
+    logc_server_log("Stats request received. fd: %d", c_info->fd);
+
+    resp_buff[0] = 1;
+    memcpy(resp_buff + 1, &len, sizeof(uint32_t));
+
+    if(send_response(c_info->fd, resp_buff, 1 + sizeof(uint32_t) + len) < 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Process level request
+ * Changes the levels of a client, or of every client, and replies with their levels
+ * 
+ * @param c_info: information related to client
+ * @param req_buff: request buffer
+ * @returns 0 on success, -1 on failure
+ */
+static int
+process_level_req(struct client_info *c_info, uint8_t *req_buff)
+{
+    uint8_t resp_buff[1 + sizeof(uint32_t) + STATS_MAX_REPORT_SIZE];
+    struct logc_level_request req;
+    int len;
+
+    memcpy(&req, req_buff, sizeof(req));
+
+    logc_server_log("Level request received. fd: %d, op: %d, pid: %u", c_info->fd, req.op, req.pid);
+
+    len = levels_request(&req, (char *)resp_buff + 1 + sizeof(uint32_t), STATS_MAX_REPORT_SIZE);
+    if(len == -1) {
+        logc_server_log("Level request failed. fd: %d, error: %s", c_info->fd, strerror(errno));
+
+        resp_buff[0] = 0;
+        memcpy(resp_buff + 1, &errno, sizeof(int));
+        len = sizeof(int);
+    }
+    else {
+        resp_buff[0] = 1;
+        memcpy(resp_buff + 1, &len, sizeof(uint32_t));
+        len += sizeof(uint32_t);
+    }
+
+    if(send_response(c_info->fd, resp_buff, 1 + len) < 0)
+        return -1;
+
+    return 0;
 }
 
 /**
  * Process client request
+ * Write requests are 2 bytes long, so several of them can be read at once.
+ * A request split across reads is left in the buffer, consumed is set to the
+ * number of bytes processed.
+ * Init and attach requests are always alone in the buffer as the client waits for the response.
  *
  * @param c_info: information related to client
  * @param buffer: request buffer
+ * @param len: number of bytes in the request buffer
+ * @param consumed: number of bytes processed
  *
  * @returns 0 on success, -1 on failure, 1 on client closed
  */
 int
-process_client_request(struct client_info *c_info, uint8_t *buffer)
+process_client_request(struct client_info *c_info, uint8_t *buffer, int len, int *consumed)
 {
-    // get the request type
-    uint8_t req_type = *(uint8_t *)buffer;
+    int ret = 0;
+    int off = 0;
 
-    logc_server_log("Processing request. fd: %d, type: %d", c_info->fd, req_type);
+    while(off < len && ret == 0) {
+        // get the request type
+        uint8_t req_type = buffer[off];
 
-    int ret;
+        logc_server_log("Processing request. fd: %d, type: %d", c_info->fd, req_type);
 
-    switch(req_type) {
-    case REQUEST_INIT:
-        ret = process_init_req(c_info, buffer);
-        break;
-    case REQUEST_WRITE:
-        ret = process_write_req(c_info, buffer);
-        break;
-    case REQUEST_CLOSE:
-        ret = process_close_req(c_info, buffer);
-        break;
-    default:
-        logc_server_log("Invalid request received. fd: %d, type: %d", c_info->fd, req_type);
+        switch(req_type) {
+        case REQUEST_INIT:
+            ret = process_init_req(c_info, buffer + off, len - off);
+            off = len;
+            break;
+        case REQUEST_ATTACH:
+            ret = process_attach_req(c_info, buffer + off, len - off);
+            off = len;
+            break;
+        case REQUEST_SUBSCRIBE:
+            ret = process_subscribe_req(c_info, buffer + off, len - off);
+            off = len;
+            break;
+        case REQUEST_WRITE:
+            if(off + 2 > len)
+                goto partial;
+            ret = process_write_req(c_info, buffer + off);
+            off += 2;
+            break;
+        case REQUEST_WRITE_URGENT:
+            if(off + 2 > len)
+                goto partial;
+            ret = process_urgent_write_req(c_info, buffer + off);
+            off += 2;
+            break;
+        case REQUEST_DUMP:
+            if(off + 2 > len)
+                goto partial;
+            ret = process_dump_req(c_info, buffer + off);
+            off += 2;
+            break;
+        case REQUEST_CLOSE:
+            ret = process_close_req(c_info, buffer + off);
+            off += 1;
+            break;
+        case REQUEST_STATS:
+            ret = process_stats_req(c_info, buffer + off);
+            off += 1;
+            break;
+        case REQUEST_LEVEL:
+            if(off + sizeof(struct logc_level_request) > len)
+                goto partial;
+            ret = process_level_req(c_info, buffer + off);
+            off += sizeof(struct logc_level_request);
+            break;
+        default:
+            logc_server_log("Invalid request received. fd: %d, type: %d", c_info->fd, req_type);
+            off = len;
+        }
     }
 
+partial:
+    *consumed = off;
     return ret;
 }
@@ -39,13 +39,65 @@
  */
 void close_client(struct client_info *c_info);
 
+/**
+ * write the logs of every channel of the client to the log files
+ *
+ * @param c_info: information about the client
+ */
+void drain_client(struct client_info *c_info);
+
+/**
+ * flush the log files of every channel of the client
+ * the partially filled blocks of block compressed channels are written once they are a second old
+ *
+ * @param c_info: information about the client
+ */
+void flush_client(struct client_info *c_info);
+
+/**
+ * write the drained logs of a channel to the routes of the channel, or to its log file
+ *
+ * @param c_info: information about the client
+ * @param ch: channel
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ */
+void write_channel(struct client_info *c_info, struct channel_info *ch, char *buff, int len);
+
+/**
+ * attach an existing segment, the configuration of the channels is read from the segment
+ * the log files are opened in append mode
+ *
+ * @param c_info: information about the client
+ * @param shm_name: name of the shared memory segment
+ * @returns 0 on success, -1 on failure
+ */
+int attach_segment(struct client_info *c_info, char *shm_name);
+
+/**
+ * write the latest logs of every flight recorder channel to the dump files
+ *
+ * @param c_info: information about the client
+ * @param reason: reason of the dump, written in the dump header
+ */
+void dump_flight_recorders(struct client_info *c_info, char *reason);
+
+/**
+ * drain and release the shards of the pool processes that have died
+ *
+ * @param c_info: information about the client
+ */
+void reap_dead_producers(struct client_info *c_info);
+
 /**
  * process client request
  *
  * @param c_info: information about the client
  * @param req_buff: request buffer 
+ * @param len: number of bytes in the request buffer
+ * @param consumed: number of bytes processed, the rest is an incomplete request
  * @returns 0 on success, -1 on failure, 1 on client closed
  **/
-int process_client_request(struct client_info *c_info, uint8_t *req_buff);
+int process_client_request(struct client_info *c_info, uint8_t *req_buff, int len, int *consumed);
 
 #endif
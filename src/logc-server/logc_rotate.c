@@ -0,0 +1,344 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE     // for memrchr
+
+#include "logc_rotate.h"
+#include "logc_server_utils.h"
+#include "../common/logc_utils.h"
+#include "../common/logc_lz.h"
+#include "../common/logc_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define ROTATED_PATH_SIZE   (MAX_FILE_PATH_SIZE + LOGC_ROTATED_SUFFIX_LEN + 1)
+#define ROTATE_NICE         19
+
+
+struct rotate_job
+{
+    char log_file_path[MAX_FILE_PATH_SIZE];
+    char rotated_path[ROTATED_PATH_SIZE];
+    int format;
+    int keep;
+    struct rotate_job *next;
+};
+
+struct rotate_policy rotate_policy;
+
+static struct rotate_job *rotate_queue_head;
+static struct rotate_job *rotate_queue_tail;
+static pthread_mutex_t rotate_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rotate_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t rotate_thread_once = PTHREAD_ONCE_INIT;
+
+// suffixes of the files of a rotated log file
+static char *rotated_suffixes[] = {
+    "", LOGC_TIME_INDEX_SUFFIX, LOGC_LZ_INDEX_SUFFIX,
+    LOGC_ROTATED_LZ_SUFFIX, LOGC_ROTATED_LZ_SUFFIX LOGC_LZ_INDEX_SUFFIX
+};
+
+
+time_t
+rotate_next_time(time_t now)
+{
+    if(rotate_policy.interval <= 0)
+        return 0;
+
+    // intervals are aligned, a daily log rotates at midnight UTC
+    return (now / rotate_policy.interval + 1) * rotate_policy.interval;
+}
+
+int
+rotate_name(char *log_file_path, char *rotated_path)
+{
+    char stamp[32];
+    char lz_path[ROTATED_PATH_SIZE + sizeof(LOGC_ROTATED_LZ_SUFFIX)];
+
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+
+    for(int n = 0; n < 1000; ++n) {
+        snprintf(rotated_path, ROTATED_PATH_SIZE, "%s.%s-%03d", log_file_path, stamp, n);
+        snprintf(lz_path, sizeof(lz_path), "%s%s", rotated_path, LOGC_ROTATED_LZ_SUFFIX);
+
+        if(access(rotated_path, F_OK) == -1 && access(lz_path, F_OK) == -1)
+            return 0;
+    }
+
+    errno = EEXIST;
+    return -1;
+}
+
+/**
+ * Time of the line starting at line, or fallback if the line has no time
+ */
+static int64_t
+line_time(char *line, int64_t fallback)
+{
+    int64_t ts;
+
+    if(logc_index_line_time(line, &ts) == -1)
+        return fallback;
+    return ts;
+}
+
+/**
+ * Block compress a rotated text log file to <rotated path>.lz
+ * The blocks end at a line end and have the times of their first and last lines
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+compress_rotated(char *rotated_path)
+{
+    static char raw[LOGC_LZ_BLOCK_SIZE];
+    char lz_path[ROTATED_PATH_SIZE + 8];
+    char index_path[ROTATED_PATH_SIZE + 16];
+    char tmp_path[ROTATED_PATH_SIZE + 16];
+    char tmp_index_path[ROTATED_PATH_SIZE + 24];
+
+    snprintf(lz_path, sizeof(lz_path), "%s%s", rotated_path, LOGC_ROTATED_LZ_SUFFIX);
+    snprintf(index_path, sizeof(index_path), "%s%s", lz_path, LOGC_LZ_INDEX_SUFFIX);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", lz_path);
+    snprintf(tmp_index_path, sizeof(tmp_index_path), "%s.tmp", index_path);
+
+    FILE *in = fopen(rotated_path, "r");
+    FILE *out = fopen(tmp_path, "w");
+    FILE *index_fp = fopen(tmp_index_path, "w");
+    int ret = -1;
+
+    if(in == NULL || out == NULL || index_fp == NULL) {
+        logc_server_log("Cannot compress rotated log file: %s, error: %s", rotated_path, strerror(errno));
+        goto out;
+    }
+
+    fwrite(LOGC_LZ_FILE_MAGIC, 1, LOGC_LZ_FILE_MAGIC_LEN, out);
+
+    uint64_t raw_offset = 0;
+    int64_t last_ts = time(NULL);
+    int carry = 0;
+    while(1) {
+        int n = fread(raw + carry, 1, LOGC_LZ_BLOCK_SIZE - carry, in);
+        int len = carry + n;
+        if(len == 0)
+            break;
+
+        // end the block at the last line end, unless it is the end of the file
+        int cut = len;
+        if(n > 0) {
+            char *eol = memrchr(raw, '\n', len);
+            if(eol != NULL)
+                cut = eol + 1 - raw;
+        }
+
+        // times of the first and last lines of the block
+        char *last_line = memrchr(raw, '\n', cut - 1);
+        int64_t first_ts = line_time(raw, last_ts);
+        last_ts = line_time(last_line != NULL ? last_line + 1 : raw, first_ts);
+
+        if(logc_lz_write_block(out, index_fp, raw, cut, raw_offset, first_ts, last_ts) == -1) {
+            logc_server_log("Cannot write compressed log file: %s, error: %s", tmp_path, strerror(errno));
+            goto out;
+        }
+
+        raw_offset += cut;
+        carry = len - cut;
+        memmove(raw, raw + cut, carry);
+    }
+
+    // the compressed file replaces the rotated file only once it is complete
+    if(rename(tmp_index_path, index_path) == -1 || rename(tmp_path, lz_path) == -1) {
+        logc_server_log("Cannot rename compressed log file: %s, error: %s", tmp_path, strerror(errno));
+        goto out;
+    }
+
+    // the time index has the offsets of the uncompressed file
+    unlink(rotated_path);
+    snprintf(index_path, sizeof(index_path), "%s%s", rotated_path, LOGC_TIME_INDEX_SUFFIX);
+    unlink(index_path);
+
+    logc_server_log("Compressed rotated log file: %s, %llu bytes", lz_path, (unsigned long long)raw_offset);
+    ret = 0;
+
+out:
+    if(in != NULL)
+        fclose(in);
+    if(out != NULL)
+        fclose(out);
+    if(index_fp != NULL)
+        fclose(index_fp);
+    if(ret == -1) {
+        unlink(tmp_path);
+        unlink(tmp_index_path);
+    }
+    return ret;
+}
+
+static int
+compare_stamps(const void *a, const void *b)
+{
+    return strcmp(*(char **)b, *(char **)a);
+}
+
+/**
+ * Remove the oldest rotated files of a log file, keeping keep of them
+ */
+static void
+remove_old_rotated(char *log_file_path, int keep)
+{
+    char dir_path[MAX_FILE_PATH_SIZE];
+    char path[ROTATED_PATH_SIZE + 16];
+    char **stamps = NULL;
+    int n_stamps = 0;
+
+    char *base;
+    strcpy(dir_path, log_file_path);
+    char *slash = strrchr(dir_path, '/');
+    if(slash == NULL) {
+        base = log_file_path;
+        strcpy(dir_path, ".");
+    }
+    else {
+        base = log_file_path + (slash + 1 - dir_path);
+        slash[slash == dir_path ? 1 : 0] = '\0';
+    }
+    int base_len = strlen(base);
+
+    DIR *dir = opendir(dir_path);
+    if(dir == NULL)
+        return;
+
+    // every rotated file has a stamp .YYYYmmdd-HHMMSS-nnn after the name of the log file
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL) {
+        char *name = ent->d_name;
+        if(strncmp(name, base, base_len) != 0 || strlen(name) < base_len + LOGC_ROTATED_SUFFIX_LEN ||
+           name[base_len] != '.' || name[base_len + 9] != '-' || name[base_len + 16] != '-')
+            continue;
+
+        char *stamp = strndup(name + base_len, LOGC_ROTATED_SUFFIX_LEN);
+        int dup = 0;
+        for(int i = 0; i < n_stamps && !dup; ++i)
+            dup = strcmp(stamps[i], stamp) == 0;
+
+        if(dup) {
+            free(stamp);
+            continue;
+        }
+
+        stamps = realloc(stamps, (n_stamps + 1) * sizeof(char *));
+        stamps[n_stamps++] = stamp;
+    }
+    closedir(dir);
+
+    // newest first, the stamps sort by time
+    qsort(stamps, n_stamps, sizeof(char *), compare_stamps);
+
+    for(int i = 0; i < n_stamps; ++i) {
+        if(i >= keep) {
+            for(int j = 0; j < sizeof(rotated_suffixes) / sizeof(rotated_suffixes[0]); ++j) {
+                snprintf(path, sizeof(path), "%s%s%s", log_file_path, stamps[i], rotated_suffixes[j]);
+                if(unlink(path) == 0)
+                    logc_server_log("Removed rotated log file: %s", path);
+            }
+        }
+        free(stamps[i]);
+    }
+    free(stamps);
+}
+
+/**
+ * Post processing thread of the rotated files, runs at the lowest priority
+ */
+static void *
+rotate_thread(void *args)
+{
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), ROTATE_NICE);
+
+    while(1) {
+        pthread_mutex_lock(&rotate_queue_lock);
+        while(rotate_queue_head == NULL)
+            pthread_cond_wait(&rotate_queue_cond, &rotate_queue_lock);
+
+        struct rotate_job *job = rotate_queue_head;
+        rotate_queue_head = job->next;
+        if(rotate_queue_head == NULL)
+            rotate_queue_tail = NULL;
+        pthread_mutex_unlock(&rotate_queue_lock);
+
+        // binary and block compressed log files are not compressed again
+        if(rotate_policy.compress && (job->format == LOGC_FORMAT_TEXT || job->format == LOGC_FORMAT_JSON))
+            compress_rotated(job->rotated_path);
+
+        int keep = job->keep > 0 ? job->keep : rotate_policy.keep;
+        if(keep > 0)
+            remove_old_rotated(job->log_file_path, keep);
+
+        free(job);
+    }
+
+    return NULL;
+}
+
+static void
+rotate_start_thread()
+{
+    pthread_t tid;
+
+    if(pthread_create(&tid, NULL, rotate_thread, NULL) != 0)
+        exit_with_errno();
+    pthread_detach(tid);
+}
+
+void
+rotate_post_process(char *log_file_path, char *rotated_path, int format, int keep)
+{
+    struct rotate_job *job = (struct rotate_job *)malloc(sizeof(struct rotate_job));
+
+    strcpy(job->log_file_path, log_file_path);
+    strcpy(job->rotated_path, rotated_path);
+    job->format = format;
+    job->keep = keep;
+    job->next = NULL;
+
+    pthread_once(&rotate_thread_once, rotate_start_thread);
+
+    pthread_mutex_lock(&rotate_queue_lock);
+    if(rotate_queue_tail != NULL)
+        rotate_queue_tail->next = job;
+    else
+        rotate_queue_head = job;
+    rotate_queue_tail = job;
+    pthread_cond_signal(&rotate_queue_cond);
+    pthread_mutex_unlock(&rotate_queue_lock);
+}
@@ -0,0 +1,95 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc rotate
+ * Rotation policy of the log files and post processing of the rotated files
+ *
+ * A sink rotates its log file when it reaches the maximum size or at the end of the
+ * rotation interval. The log file and its index files are renamed to
+ * <log file path>.<YYYYmmdd-HHMMSS>-<n> and a new log file is opened, so the clients
+ * never see the rotation. The rotated files are compressed and the oldest rotated
+ * files are removed by a low priority background thread.
+ */
+
+#ifndef LOGC_ROTATE_H
+#define LOGC_ROTATE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define LOGC_ROTATED_SUFFIX_LEN     20      // .YYYYmmdd-HHMMSS-nnn
+#define LOGC_ROTATED_LZ_SUFFIX      ".lz"
+
+struct rotate_policy
+{
+    /* rotate when the log file reaches this size in bytes, 0 for no size limit */
+    uint64_t max_size;
+
+    /* rotate at the end of every interval of this many seconds, 0 for no time limit */
+    int interval;
+
+    /* number of rotated files kept for a log file, 0 to keep all */
+    int keep;
+
+    /* if 1, the rotated text log files are block compressed, see logc_lz.h */
+    int compress;
+};
+
+extern struct rotate_policy rotate_policy;
+
+/**
+ * check if rotation is enabled
+ */
+#define rotate_enabled() (rotate_policy.max_size > 0 || rotate_policy.interval > 0)
+
+/**
+ * time of the next time based rotation
+ *
+ * @param now: current time
+ * @returns end of the current rotation interval, 0 if there is no time limit
+ */
+time_t rotate_next_time(time_t now);
+
+/**
+ * find a free name for a rotated log file
+ *
+ * @param log_file_path: path of the log file
+ * @param rotated_path: set to the path of the rotated file, MAX_FILE_PATH_SIZE + LOGC_ROTATED_SUFFIX_LEN + 1 bytes
+ * @returns 0 on success, -1 if there is no free name
+ */
+int rotate_name(char *log_file_path, char *rotated_path);
+
+/**
+ * hand over a rotated log file to the background thread
+ * the rotated file is compressed if required, and the oldest rotated files are removed
+ *
+ * @param log_file_path: path of the log file
+ * @param rotated_path: path of the rotated file
+ * @param format: format of the log file, LOGC_FORMAT_*
+ * @param keep: number of rotated files kept, 0 for the rotation policy
+ */
+void rotate_post_process(char *log_file_path, char *rotated_path, int format, int keep);
+
+#endif
@@ -0,0 +1,615 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for memmem
+
+#include "logc_route.h"
+#include "logc_sink.h"
+#include "logc_server_utils.h"
+#include "../common/logc_record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define ROUTE_SCAN_BATCH    256     // line ends found by a newline scan
+
+
+/**
+ * routes of a channel
+ */
+struct route_channel
+{
+    /* rules that apply to the channel, indexes in the rules of the routes */
+    int n_rules;
+    int rules[ROUTE_MAX_RULES];
+
+    /* route files of the channel, opened on the first message */
+    struct logc_sink *sinks[ROUTE_MAX_RULES];
+
+    /* a route file that cannot be opened is not tried again, its messages go to the log file */
+    int failed[ROUTE_MAX_RULES];
+};
+
+/**
+ * a run of messages going to the same file
+ */
+struct route_run
+{
+    int file;       // route file, -1 for the log file
+    int start;
+    int end;
+};
+
+struct route_config route_config;
+
+static const char *level_names[] = LOGC_LEVEL_NAMES;
+
+static pthread_once_t route_once = PTHREAD_ONCE_INIT;
+static int route_avx2_supported;
+
+
+static int
+scan_lines_scalar(const char *buff, int from, int len, int *ends, int max)
+{
+    int n = 0;
+
+    while(n < max) {
+        const char *nl = memchr(buff + from, '\n', len - from);
+        if(nl == NULL)
+            break;
+
+        from = nl - buff + 1;
+        ends[n++] = from;
+    }
+
+    return n;
+}
+
+#if defined(__x86_64__)
+/**
+ * find the line ends 16 bytes at a time, SSE2 is always there on x86_64
+ */
+static int
+scan_lines_sse2(const char *buff, int from, int len, int *ends, int max)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    int n = 0;
+    int i = from;
+
+    for(; i + 16 <= len; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buff + i)), nl));
+
+        while(mask != 0) {
+            ends[n++] = i + __builtin_ctz(mask) + 1;
+            if(n == max)
+                return n;
+            mask &= mask - 1;
+        }
+    }
+
+    return n + scan_lines_scalar(buff, i, len, ends + n, max - n);
+}
+
+__attribute__((target("avx2")))
+static int
+scan_lines_avx2(const char *buff, int from, int len, int *ends, int max)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    int n = 0;
+    int i = from;
+
+    for(; i + 32 <= len; i += 32) {
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buff + i)), nl));
+
+        while(mask != 0) {
+            ends[n++] = i + __builtin_ctz(mask) + 1;
+            if(n == max)
+                return n;
+            mask &= mask - 1;
+        }
+    }
+
+    return n + scan_lines_scalar(buff, i, len, ends + n, max - n);
+}
+
+/**
+ * find a pattern of 2 bytes or more 16 positions at a time
+ * a position is only compared whole if its first and last bytes match the pattern
+ */
+static int
+contains_sse2(const char *s, int n, const char *p, int m)
+{
+    const __m128i first = _mm_set1_epi8(p[0]);
+    const __m128i last = _mm_set1_epi8(p[m - 1]);
+    int i = 0;
+
+    for(; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while(mask != 0) {
+            if(memcmp(s + i + __builtin_ctz(mask) + 1, p + 1, m - 2) == 0)
+                return 1;
+            mask &= mask - 1;
+        }
+    }
+
+    return memmem(s + i, n - i, p, m) != NULL;
+}
+
+__attribute__((target("avx2")))
+static int
+contains_avx2(const char *s, int n, const char *p, int m)
+{
+    const __m256i first = _mm256_set1_epi8(p[0]);
+    const __m256i last = _mm256_set1_epi8(p[m - 1]);
+    int i = 0;
+
+    for(; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while(mask != 0) {
+            if(memcmp(s + i + __builtin_ctz(mask) + 1, p + 1, m - 2) == 0)
+                return 1;
+            mask &= mask - 1;
+        }
+    }
+
+    return memmem(s + i, n - i, p, m) != NULL;
+}
+#endif
+
+static void
+route_init()
+{
+#if defined(__x86_64__)
+    route_avx2_supported = __builtin_cpu_supports("avx2");
+#endif
+}
+
+/**
+ * find the ends of the lines of a buffer, the offsets after their new lines
+ *
+ * @returns number of line ends found from the offset, up to max
+ */
+static inline int
+scan_lines(const char *buff, int from, int len, int *ends, int max)
+{
+#if defined(__x86_64__)
+    if(route_avx2_supported)
+        return scan_lines_avx2(buff, from, len, ends, max);
+    return scan_lines_sse2(buff, from, len, ends, max);
+#else
+    return scan_lines_scalar(buff, from, len, ends, max);
+#endif
+}
+
+/**
+ * check if a message has the pattern of a rule
+ */
+static inline int
+contains(const char *msg, int len, struct route_rule *rule)
+{
+    if(rule->pattern_len > len)
+        return 0;
+    if(rule->pattern_len == 1)
+        return memchr(msg, rule->pattern[0], len) != NULL;
+
+#if defined(__x86_64__)
+    if(route_avx2_supported)
+        return contains_avx2(msg, len, rule->pattern, rule->pattern_len);
+    return contains_sse2(msg, len, rule->pattern, rule->pattern_len);
+#else
+    return memmem(msg, len, rule->pattern, rule->pattern_len) != NULL;
+#endif
+}
+
+/**
+ * find the first rule of a channel matching a message
+ *
+ * @returns index of the rule, -1 if no rule matches
+ */
+static inline int
+match(struct route_channel *r, int level, uint32_t callsite, const char *msg, int len)
+{
+    for(int i = 0; i < r->n_rules; ++i) {
+        struct route_rule *rule = &(route_config.rules[r->rules[i]]);
+
+        if(level < rule->level || (rule->callsite != 0 && rule->callsite != callsite))
+            continue;
+        if(rule->pattern_len > 0 && !contains(msg, len, rule))
+            continue;
+
+        return r->rules[i];
+    }
+
+    return -1;
+}
+
+/**
+ * get the sink of a route file of a channel, open it on the first message
+ *
+ * @returns sink, NULL if the route file cannot be opened
+ */
+static struct logc_sink *
+route_sink(struct channel_info *ch, int file)
+{
+    struct route_channel *r = ch->route;
+
+    if(r->sinks[file] != NULL || r->failed[file])
+        return r->sinks[file];
+
+    char path[MAX_FILE_PATH_SIZE];
+    struct logc_sink *sink = (struct logc_sink *)malloc(sizeof(struct logc_sink));
+
+    if(snprintf(path, sizeof(path), "%s.%s", ch->log_file_path, route_config.files[file].name) >= sizeof(path) ||
+       sink_open(sink, path, ch->append, ch->format, ch->sink.client_pid) == -1) {
+        logc_server_log("Cannot open route file: %s.%s, error: %s", ch->log_file_path,
+                        route_config.files[file].name, strerror(errno));
+        free(sink);
+        r->failed[file] = 1;
+        return NULL;
+    }
+
+    sink->keep = route_config.files[file].keep;
+    r->sinks[file] = sink;
+    return sink;
+}
+
+/**
+ * write a run of messages to its file
+ */
+static void
+write_run(struct channel_info *ch, char *buff, struct route_run *run)
+{
+    if(run->end == run->start)
+        return;
+
+    struct logc_sink *sink = run->file == -1 ? &(ch->sink) : route_sink(ch, run->file);
+    if(sink == NULL)
+        sink = &(ch->sink);
+
+    sink_write(sink, buff + run->start, run->end - run->start);
+}
+
+/**
+ * add a message to the run of its file, write the run if the message does not continue it
+ */
+static inline void
+add_to_run(struct channel_info *ch, char *buff, struct route_run *run, int file, int start, int end)
+{
+    if(run->file != file || run->end != start) {
+        write_run(ch, buff, run);
+        run->file = file;
+        run->start = start;
+    }
+    run->end = end;
+}
+
+/**
+ * route a message
+ *
+ * @returns number of bytes dropped
+ */
+static inline int
+route_message(struct channel_info *ch, char *buff, struct route_run *main_run, struct route_run *route_run,
+              int rule_id, int start, int end)
+{
+    if(rule_id == -1) {
+        add_to_run(ch, buff, main_run, -1, start, end);
+        return 0;
+    }
+
+    struct route_rule *rule = &(route_config.rules[rule_id]);
+
+    if(rule->action == ROUTE_DROP)
+        return end - start;
+
+    add_to_run(ch, buff, route_run, rule->file, start, end);
+    if(rule->action == ROUTE_COPY)
+        add_to_run(ch, buff, main_run, -1, start, end);
+
+    return 0;
+}
+
+int
+route_write(struct channel_info *ch, char *buff, int len)
+{
+    struct route_run main_run = { -1, 0, 0 };
+    struct route_run route_run = { -1, 0, 0 };
+    int dropped = 0;
+
+    if(logc_format_structured(ch->format)) {
+        struct logc_record rec;
+        char *msg;
+        int off = 0;
+
+        while((msg = logc_record_next(buff, len, &off, &rec)) != NULL) {
+            int rule = match(ch->route, rec.level, rec.callsite, msg, rec.len);
+            dropped += route_message(ch, buff, &main_run, &route_run, rule, msg - sizeof(rec) - buff, off);
+        }
+    }
+    else {
+        int ends[ROUTE_SCAN_BATCH];
+        int line = 0;
+
+        while(line < len) {
+            int n = scan_lines(buff, line, len, ends, ROUTE_SCAN_BATCH);
+
+            // the last line of a torn message has no new line
+            if(n == 0)
+                ends[n++] = len;
+
+            for(int i = 0; i < n; ++i) {
+                int rule = match(ch->route, 0, 0, buff + line, ends[i] - line);
+                dropped += route_message(ch, buff, &main_run, &route_run, rule, line, ends[i]);
+                line = ends[i];
+            }
+        }
+    }
+
+    write_run(ch, buff, &route_run);
+    write_run(ch, buff, &main_run);
+
+    return dropped;
+}
+
+void
+route_open(struct channel_info *ch, int channel)
+{
+    struct route_channel *r = NULL;
+
+    ch->route = NULL;
+    if(!route_enabled())
+        return;
+
+    for(int i = 0; i < route_config.n_rules; ++i) {
+        struct route_rule *rule = &(route_config.rules[i]);
+
+        if(rule->channel != -1 && rule->channel != channel)
+            continue;
+        if(!logc_format_structured(ch->format) && (rule->level > 0 || rule->callsite != 0))
+            continue;
+
+        if(r == NULL)
+            r = (struct route_channel *)calloc(1, sizeof(struct route_channel));
+        r->rules[r->n_rules++] = i;
+    }
+
+    ch->route = r;
+}
+
+void
+route_flush(struct channel_info *ch)
+{
+    if(ch->route == NULL)
+        return;
+
+    for(int i = 0; i < route_config.n_files; ++i) {
+        if(ch->route->sinks[i] != NULL)
+            sink_flush(ch->route->sinks[i]);
+    }
+}
+
+void
+route_close(struct channel_info *ch)
+{
+    if(ch->route == NULL)
+        return;
+
+    for(int i = 0; i < route_config.n_files; ++i) {
+        if(ch->route->sinks[i] != NULL) {
+            sink_close(ch->route->sinks[i]);
+            free(ch->route->sinks[i]);
+        }
+    }
+
+    free(ch->route);
+    ch->route = NULL;
+}
+
+/**
+ * get the next word of a rule, a quoted text is part of the word
+ *
+ * @returns word, NULL at the end of the line
+ */
+static char *
+next_word(char **line)
+{
+    char *s = *line;
+    int quoted = 0;
+
+    while(*s == ' ' || *s == '\t')
+        s++;
+    if(*s == '\0')
+        return NULL;
+
+    char *word = s;
+    for(; *s != '\0' && (quoted || (*s != ' ' && *s != '\t')); ++s) {
+        if(*s == '"')
+            quoted = !quoted;
+    }
+    if(*s != '\0')
+        *s++ = '\0';
+
+    *line = s;
+    return word;
+}
+
+static int
+parse_level(char *arg)
+{
+    for(int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); ++i) {
+        if(strcasecmp(arg, level_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * find the route file of a name, add it if it is new
+ *
+ * @returns index of the route file, -1 if the name is invalid
+ */
+static int
+add_file(char *name)
+{
+    if(name == NULL || name[0] == '\0' || strlen(name) >= ROUTE_NAME_SIZE || strchr(name, '/') != NULL ||
+       strchr(name, '=') != NULL)
+        return -1;
+
+    for(int i = 0; i < route_config.n_files; ++i) {
+        if(strcmp(route_config.files[i].name, name) == 0)
+            return i;
+    }
+
+    strcpy(route_config.files[route_config.n_files].name, name);
+    return route_config.n_files++;
+}
+
+/**
+ * parse a condition or an option of a rule
+ *
+ * @returns 0 on success, -1 if it is invalid
+ */
+static int
+parse_condition(struct route_rule *rule, char *word)
+{
+    char *end;
+
+    if(strncmp(word, "channel=", 8) == 0) {
+        rule->channel = strtol(word + 8, &end, 10);
+        return *end == '\0' && rule->channel >= 0 && rule->channel < LOGC_MAX_CHANNELS ? 0 : -1;
+    }
+    if(strncmp(word, "level>=", 7) == 0) {
+        rule->level = parse_level(word + 7);
+        return rule->level >= 0 ? 0 : -1;
+    }
+    if(strncmp(word, "callsite=", 9) == 0) {
+        rule->callsite = strtoul(word + 9, &end, 16);
+        return *end == '\0' && rule->callsite != 0 ? 0 : -1;
+    }
+    if(strncmp(word, "keep=", 5) == 0 && rule->action != ROUTE_DROP) {
+        route_config.files[rule->file].keep = strtol(word + 5, &end, 10);
+        return *end == '\0' && route_config.files[rule->file].keep > 0 ? 0 : -1;
+    }
+    if(strncmp(word, "contains=", 9) == 0) {
+        char *text = word + 9;
+        int len = strlen(text);
+
+        if(len >= 2 && text[0] == '"' && text[len - 1] == '"') {
+            text++;
+            len -= 2;
+        }
+        if(len == 0 || len >= ROUTE_PATTERN_SIZE)
+            return -1;
+
+        memcpy(rule->pattern, text, len);
+        rule->pattern[len] = '\0';
+        rule->pattern_len = len;
+        return 0;
+    }
+
+    return -1;
+}
+
+int
+route_load(char *path)
+{
+    char line[1024];
+    int line_no = 0;
+
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "logcserver: cannot open routes file: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    pthread_once(&route_once, route_init);
+
+    while(fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        line_no++;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char *word = next_word(&p);
+        if(word == NULL || word[0] == '#')
+            continue;
+
+        if(route_config.n_rules == ROUTE_MAX_RULES) {
+            fprintf(stderr, "logcserver: %s:%d: too many rules, at most %d\n", path, line_no, ROUTE_MAX_RULES);
+            fclose(fp);
+            return -1;
+        }
+
+        struct route_rule *rule = &(route_config.rules[route_config.n_rules]);
+        memset(rule, 0, sizeof(struct route_rule));
+        rule->channel = -1;
+        rule->file = -1;
+
+        if(strcmp(word, "drop") == 0)
+            rule->action = ROUTE_DROP;
+        else if(strcmp(word, "move") == 0)
+            rule->action = ROUTE_MOVE;
+        else if(strcmp(word, "copy") == 0)
+            rule->action = ROUTE_COPY;
+        else {
+            fprintf(stderr, "logcserver: %s:%d: invalid action: %s\n", path, line_no, word);
+            fclose(fp);
+            return -1;
+        }
+
+        if(rule->action != ROUTE_DROP && (rule->file = add_file(word = next_word(&p))) == -1) {
+            fprintf(stderr, "logcserver: %s:%d: invalid route file name: %s\n", path, line_no, word != NULL ? word : "");
+            fclose(fp);
+            return -1;
+        }
+
+        while((word = next_word(&p)) != NULL) {
+            if(parse_condition(rule, word) == -1) {
+                fprintf(stderr, "logcserver: %s:%d: invalid condition: %s\n", path, line_no, word);
+                fclose(fp);
+                return -1;
+            }
+        }
+
+        route_config.n_rules++;
+    }
+
+    fclose(fp);
+    return 0;
+}
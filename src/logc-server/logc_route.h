@@ -0,0 +1,153 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc route
+ * Filter and route stage of the drained logs, between a drain and the sink of a channel
+ *
+ * The routes are a list of rules read from a file at start. A rule has an action and
+ * conditions on the channel, the level, the callsite and a substring of a message,
+ * all of them must match. The first matching rule of a message applies:
+ *     drop           the message is not written
+ *     move <name>    the message is written to <log file path>.<name> instead of the log file
+ *     copy <name>    the message is written to <log file path>.<name> and to the log file
+ * A message without a matching rule goes to the log file. The route files have the
+ * format of the channel and are rotated like the log files, a rule can keep fewer of
+ * their rotated files.
+ *
+ * The drained text is split into lines with a vectorized newline scan, the records of
+ * a structured channel are already framed. The lines and records going to the same
+ * file are written in runs, so the logs of a channel with no matching message reach
+ * the sink in one write. Text lines have no level or callsite, the rules with such
+ * conditions only apply to structured channels. The subscribers, the forwarder and
+ * the capture see the drained logs before routing.
+ */
+
+#ifndef LOGC_ROUTE_H
+#define LOGC_ROUTE_H
+
+#include "logc_server.h"
+
+#include <stdint.h>
+
+#define ROUTE_MAX_RULES         16
+#define ROUTE_NAME_SIZE         32
+#define ROUTE_PATTERN_SIZE      64
+
+#define ROUTE_DROP      0
+#define ROUTE_MOVE      1
+#define ROUTE_COPY      2
+
+struct route_rule
+{
+    /* ROUTE_DROP, ROUTE_MOVE or ROUTE_COPY */
+    int action;
+
+    /* route file of a move or copy, index in the files of the routes */
+    int file;
+
+    /* channel of the messages, -1 for every channel */
+    int channel;
+
+    /* minimum level of the messages, 0 for every level */
+    int level;
+
+    /* callsite of the messages, see logc_record.h, 0 for every callsite */
+    uint32_t callsite;
+
+    /* substring of the messages, empty for every message */
+    char pattern[ROUTE_PATTERN_SIZE];
+    int pattern_len;
+};
+
+struct route_file
+{
+    /* name appended to the log file path */
+    char name[ROUTE_NAME_SIZE];
+
+    /* number of rotated files kept, 0 for the rotation policy */
+    int keep;
+};
+
+struct route_config
+{
+    int n_rules;
+    struct route_rule rules[ROUTE_MAX_RULES];
+
+    /* route files, the rules with the same name share one */
+    int n_files;
+    struct route_file files[ROUTE_MAX_RULES];
+};
+
+extern struct route_config route_config;
+
+/**
+ * check if routing is enabled
+ */
+#define route_enabled() (route_config.n_rules > 0)
+
+/**
+ * read the rules of the routes
+ * a line has an action, the name and keep=<n> of the route file of a move or copy,
+ * and the conditions: channel=<n> level>=<level> callsite=<hex id> contains=<text>,
+ * the text can be quoted. Empty lines and lines starting with # are skipped.
+ *
+ * @param path: path of the rules file
+ * @returns 0 on success, -1 on failure with the error written to stderr
+ */
+int route_load(char *path);
+
+/**
+ * set up the routes of a channel, the channel has no routes if no rule applies to it
+ *
+ * @param ch: channel with its sink open
+ * @param channel: channel id
+ */
+void route_open(struct channel_info *ch, int channel);
+
+/**
+ * write the drained logs of a channel through its routes
+ *
+ * @param ch: channel with routes
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ * @returns number of bytes dropped
+ */
+int route_write(struct channel_info *ch, char *buff, int len);
+
+/**
+ * make the logs written to the route files of a channel durable
+ *
+ * @param ch: channel
+ */
+void route_flush(struct channel_info *ch);
+
+/**
+ * close the route files of a channel
+ *
+ * @param ch: channel
+ */
+void route_close(struct channel_info *ch);
+
+#endif
@@ -0,0 +1,335 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_sched.h"
+#include "logc_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * a drain waiting for a slot, on the stack of the waiting thread
+ */
+struct sched_waiter
+{
+    struct sched_client *sc;
+    int fill_pct;
+    int urgent;
+
+    /* set to 1 with the slot taken for the waiter */
+    int granted;
+    pthread_cond_t cond;
+
+    struct sched_waiter *next;
+};
+
+struct sched_config sched_config;
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// drain slots taken
+static int sched_busy;
+
+// waiting drains, in arrival order
+static struct sched_waiter *sched_waiters;
+
+// clients with a scheduled drain
+static struct sched_client *sched_clients;
+
+// virtual time of the scheduler, the lowest virtual time of the active clients at the last grant
+static uint64_t sched_vclock;
+
+// monotonic time the held slots are given to the clients beyond their share, 0 if no slot is held
+static int64_t sched_hold_until;
+
+static pthread_once_t sched_once = PTHREAD_ONCE_INIT;
+static pthread_condattr_t sched_condattr;
+
+
+static int64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+sched_init()
+{
+    // the waits for a held slot end on the monotonic clock
+    pthread_condattr_init(&sched_condattr);
+    pthread_condattr_setclock(&sched_condattr, CLOCK_MONOTONIC);
+}
+
+int
+sched_add_weight(char *arg)
+{
+    char *eq = strchr(arg, '=');
+    if(eq == NULL || eq == arg || eq - arg >= SCHED_NAME_SIZE || sched_config.n_weights == SCHED_MAX_WEIGHTS)
+        return -1;
+
+    char *end;
+    long weight = strtol(eq + 1, &end, 10);
+    if(end == eq + 1 || *end != '\0' || weight < 1 || weight > SCHED_MAX_WEIGHT)
+        return -1;
+
+    struct sched_weight *w = &(sched_config.weights[sched_config.n_weights++]);
+    memcpy(w->name, arg, eq - arg);
+    w->name[eq - arg] = '\0';
+    w->weight = weight;
+    return 0;
+}
+
+/**
+ * weight of the process of a client
+ *
+ * @param pid: pid of the process
+ * @returns the weight of its name, 1 if it has none
+ */
+static uint32_t
+process_weight(uint32_t pid)
+{
+    char path[64];
+    char name[SCHED_NAME_SIZE + 1] = { 0 };
+
+    snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL)
+        return 1;
+
+    if(fgets(name, sizeof(name), fp) != NULL)
+        name[strcspn(name, "\n")] = '\0';
+    fclose(fp);
+
+    for(int i = 0; i < sched_config.n_weights; ++i) {
+        if(strcmp(sched_config.weights[i].name, name) == 0)
+            return sched_config.weights[i].weight;
+    }
+
+    return 1;
+}
+
+/**
+ * check if a client has drained recently
+ */
+static inline int
+sched_active(struct sched_client *sc, int64_t now)
+{
+    return sc->busy > 0 || sc->waiting || now - sc->last_release < SCHED_ACTIVE;
+}
+
+/**
+ * check if a waiting drain goes before another
+ */
+static int
+sched_before(struct sched_waiter *a, struct sched_waiter *b, uint64_t limit)
+{
+    if(a->urgent != b->urgent)
+        return a->urgent;
+
+    int a_within = a->sc->vtime <= limit;
+    int b_within = b->sc->vtime <= limit;
+    if(a_within != b_within)
+        return a_within;
+
+    if(a_within && a->fill_pct != b->fill_pct)
+        return a->fill_pct > b->fill_pct;
+
+    return a->sc->vtime < b->sc->vtime;
+}
+
+/**
+ * give the free slots to the waiting drains, under sched_lock
+ *
+ * @param now: monotonic time, nanoseconds
+ */
+static void
+sched_grant(int64_t now)
+{
+    while(sched_busy < sched_config.slots && sched_waiters != NULL) {
+        uint64_t lowest = UINT64_MAX;
+        for(struct sched_client *sc = sched_clients; sc != NULL; sc = sc->next) {
+            if(sched_active(sc, now) && sc->vtime < lowest)
+                lowest = sc->vtime;
+        }
+
+        if(lowest > sched_vclock)
+            sched_vclock = lowest;
+
+        uint64_t limit = lowest + ((uint64_t)SCHED_SLACK << 10);
+        struct sched_waiter **best = &sched_waiters;
+        for(struct sched_waiter **w = &(sched_waiters->next); *w != NULL; w = &((*w)->next)) {
+            if(sched_before(*w, *best, limit))
+                best = w;
+        }
+
+        // hold the slot for a client within its share between two of its drains
+        sched_hold_until = 0;
+        if(!(*best)->urgent && (*best)->sc->vtime > limit) {
+            for(struct sched_client *sc = sched_clients; sc != NULL; sc = sc->next) {
+                if(!sc->waiting && sc->busy == 0 && sc->vtime <= limit &&
+                   now - sc->last_release < SCHED_HOLD && sc->last_release + SCHED_HOLD > sched_hold_until)
+                    sched_hold_until = sc->last_release + SCHED_HOLD;
+            }
+
+            // a waiter may be in an untimed wait, wake one to end the hold
+            if(sched_hold_until != 0) {
+                pthread_cond_signal(&(sched_waiters->cond));
+                return;
+            }
+        }
+
+        struct sched_waiter *granted = *best;
+        *best = granted->next;
+
+        sched_busy++;
+        granted->sc->busy++;
+        granted->sc->waiting = 0;
+        granted->granted = 1;
+        pthread_cond_signal(&(granted->cond));
+    }
+}
+
+/**
+ * add a client to the scheduler, it starts idle
+ */
+static void
+sched_add_client(struct client_info *c_info)
+{
+    struct sched_client *sc = (struct sched_client *)calloc(1, sizeof(struct sched_client));
+
+    pthread_mutex_lock(&sched_lock);
+    sc->next = sched_clients;
+    sched_clients = sc;
+    pthread_mutex_unlock(&sched_lock);
+
+    // the stats read the weight
+    __atomic_store_n(&(c_info->sched), sc, __ATOMIC_RELEASE);
+}
+
+void
+sched_acquire(struct client_info *c_info, int fill_pct, int urgent)
+{
+    pthread_once(&sched_once, sched_init);
+
+    if(c_info->sched == NULL)
+        sched_add_client(c_info);
+
+    struct sched_client *sc = c_info->sched;
+    if(sc->weight == 0 && c_info->stats.pid != 0)
+        __atomic_store_n(&(sc->weight), process_weight(c_info->stats.pid), __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&sched_lock);
+
+    // no credit for the idle time
+    int64_t now = now_ns();
+    if(!sched_active(sc, now) && sc->vtime < sched_vclock)
+        sc->vtime = sched_vclock;
+
+    if(sched_busy < sched_config.slots && sched_waiters == NULL && sched_hold_until <= now) {
+        sched_busy++;
+        sc->busy++;
+        pthread_mutex_unlock(&sched_lock);
+        return;
+    }
+
+    struct sched_waiter waiter = { sc, fill_pct, urgent, 0, PTHREAD_COND_INITIALIZER, NULL };
+    pthread_cond_init(&(waiter.cond), &sched_condattr);
+
+    struct sched_waiter **tail = &sched_waiters;
+    while(*tail != NULL)
+        tail = &((*tail)->next);
+    *tail = &waiter;
+    sc->waiting = 1;
+
+    sched_grant(now);
+
+    while(!waiter.granted) {
+        if(sched_hold_until == 0) {
+            pthread_cond_wait(&(waiter.cond), &sched_lock);
+            continue;
+        }
+
+        // the held slot goes to the waiting drains when the hold ends
+        struct timespec until = { sched_hold_until / 1000000000, sched_hold_until % 1000000000 };
+        if(pthread_cond_timedwait(&(waiter.cond), &sched_lock, &until) == ETIMEDOUT && !waiter.granted) {
+            if(now_ns() >= sched_hold_until)
+                sched_hold_until = 0;
+            sched_grant(now_ns());
+        }
+    }
+
+    pthread_mutex_unlock(&sched_lock);
+    pthread_cond_destroy(&(waiter.cond));
+
+    stats_sched_wait(&(c_info->stats), now_ns() - now);
+}
+
+void
+sched_release(struct client_info *c_info, int n_bytes)
+{
+    struct sched_client *sc = c_info->sched;
+    uint32_t weight = sc->weight != 0 ? sc->weight : 1;
+
+    pthread_mutex_lock(&sched_lock);
+
+    sc->vtime += ((uint64_t)n_bytes << 10) / weight;
+    sc->last_release = now_ns();
+    sc->busy--;
+    sched_busy--;
+    sched_grant(sc->last_release);
+
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void
+sched_remove(struct client_info *c_info)
+{
+    struct sched_client *sc = c_info->sched;
+    if(sc == NULL)
+        return;
+
+    pthread_mutex_lock(&sched_lock);
+
+    for(struct sched_client **p = &sched_clients; *p != NULL; p = &((*p)->next)) {
+        if(*p == sc) {
+            *p = sc->next;
+            break;
+        }
+    }
+
+    // a slot held for the client is given to the waiting drains
+    sched_hold_until = 0;
+    sched_grant(now_ns());
+
+    pthread_mutex_unlock(&sched_lock);
+
+    __atomic_store_n(&(c_info->sched), NULL, __ATOMIC_RELEASE);
+    free(sc);
+}
@@ -0,0 +1,144 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc sched
+ * Weighted fair scheduling of the drains of the clients
+ *
+ * Every client has its own thread, so without scheduling the thread that wins the race
+ * for a saturated disk writes first, and a chatty client can keep the others waiting
+ * until their rings overflow. With scheduling a drain of a channel takes one of a fixed
+ * number of drain slots, and the waiting drains get the free slots in this order:
+ *     urgent drains first, the urgent rings are small
+ *     drains of the clients within their share, the fullest ring first
+ *     the drain of the client furthest behind its share, if no client is within
+ * The share of a client is tracked by its virtual time, the bytes it has drained divided
+ * by its weight. A client is within its share until its virtual time is more than
+ * SCHED_SLACK bytes ahead of the active client furthest behind, a client is active if
+ * it has drained in the last SCHED_ACTIVE nanoseconds. A client thread asks for a slot
+ * again right after a drain, so if only the clients beyond their share are waiting,
+ * a free slot is held for up to SCHED_HOLD nanoseconds after the last drain of an
+ * active client within its share. Under overload the bytes drained by the clients
+ * follow their weights. A client coming back from idle starts at the virtual time of
+ * the scheduler, it gets no credit for the idle time.
+ *
+ * The weight of a client is set by the name of its process, clients without a weight
+ * have weight 1. The time a drain waits for a slot is reported in the stats.
+ */
+
+#ifndef LOGC_SCHED_H
+#define LOGC_SCHED_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_WEIGHTS       16
+#define SCHED_NAME_SIZE         16              // like the name of a process in /proc/<pid>/comm
+#define SCHED_MAX_WEIGHT        1000
+#define SCHED_SLACK             (256 * 1024)    // bytes at weight 1 a client may run ahead of the others
+#define SCHED_ACTIVE            100000000       // nanoseconds a client is active after a drain
+#define SCHED_HOLD              1000000         // nanoseconds a slot is held for a client within its share
+
+struct client_info;
+
+struct sched_weight
+{
+    /* name of the process */
+    char name[SCHED_NAME_SIZE];
+
+    /* weight of its clients */
+    uint32_t weight;
+};
+
+struct sched_config
+{
+    /* channels drained at once, 0 if the drains are not scheduled */
+    int slots;
+
+    /* weights of the clients by the name of the process */
+    int n_weights;
+    struct sched_weight weights[SCHED_MAX_WEIGHTS];
+};
+
+/**
+ * scheduling state of a client, allocated by the first drain of the client
+ */
+struct sched_client
+{
+    /* weight of the client, 0 until its process is known */
+    uint32_t weight;
+
+    /* bytes drained divided by the weight, scaled by 1024 */
+    uint64_t vtime;
+
+    /* monotonic time of the end of the last drain, nanoseconds */
+    int64_t last_release;
+
+    /* slots taken by the client, and 1 if a drain of the client is waiting */
+    int busy;
+    int waiting;
+
+    /* next client of the scheduler */
+    struct sched_client *next;
+};
+
+extern struct sched_config sched_config;
+
+/**
+ * check if the drains are scheduled
+ */
+#define sched_enabled() (sched_config.slots > 0)
+
+/**
+ * add a weight for the clients of a process
+ *
+ * @param arg: name=weight, like indexer=4
+ * @returns 0 on success, -1 if the weight is invalid
+ */
+int sched_add_weight(char *arg);
+
+/**
+ * wait for a drain slot
+ *
+ * @param c_info: client of the drain
+ * @param fill_pct: fill of the fullest ring to drain, percent of the ring size
+ * @param urgent: if 1, only urgent rings are drained
+ */
+void sched_acquire(struct client_info *c_info, int fill_pct, int urgent);
+
+/**
+ * release the drain slot of a client and charge the drained bytes to its share
+ *
+ * @param c_info: client of the drain
+ * @param n_bytes: bytes drained
+ */
+void sched_release(struct client_info *c_info, int n_bytes);
+
+/**
+ * remove a client from the scheduler, after its last drain
+ *
+ * @param c_info: client
+ */
+void sched_remove(struct client_info *c_info);
+
+#endif
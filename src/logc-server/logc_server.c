@@ -26,6 +26,14 @@
 #include "logc_server.h"
 #include "logc_req_handler.h"
 #include "logc_server_utils.h"
+#include "logc_registry.h"
+#include "logc_rotate.h"
+#include "logc_forwarder.h"
+#include "logc_capture.h"
+#include "logc_route.h"
+#include "logc_collapse.h"
+#include "logc_sched.h"
+#include "logc_grow.h"
 #include "../common/logc_utils.h"
 
 #include <stdio.h>
@@ -61,6 +69,8 @@ int logc_epoll_fd;
 
 volatile int running = 1;
 
+volatile sig_atomic_t flight_dump_gen = 0;
+
 
 void
 sigint_handler(int sig)
@@ -69,6 +79,12 @@ sigint_handler(int sig)
     running = 0;
 }
 
+void
+sigusr1_handler(int sig)
+{
+    flight_dump_gen++;
+}
+
 /**
  * Initialise logc server
  * This function will
@@ -125,6 +141,16 @@ logc_server_init()
     if(ret == -1)
         exit_with_errno();
 
+    // start forwarding and capture before the adopted segments are drained
+    if(forwarder_enabled() && forwarder_start() == -1)
+        exit_with_errno();
+
+    if(capture_enabled() && capture_start() == -1)
+        exit_with_errno();
+
+    // adopt the segments left by a previous server
+    registry_adopt_orphans();
+
     logc_server_log("Started logc server...");
 }
 
@@ -136,6 +162,12 @@ static void
 logc_server_close()
 {
   logc_server_log("Shuting down logc server");
+
+  if(forwarder_enabled())
+      forwarder_stop();
+
+  if(capture_enabled())
+      capture_stop();
   
   close(server_log_fd);
   close(logc_epoll_fd);
@@ -159,6 +191,8 @@ static void *
 client_thread(void *args)
 {
     struct client_info *c_info = (struct client_info *)args;
+    c_info->flight_dump_gen = flight_dump_gen;
+    stats_register(c_info);
 
     // return value for process request
     int proc_req_ret = 0;
@@ -166,6 +200,9 @@ client_thread(void *args)
     // buffer for reading request
     uint8_t read_buffer[MAX_READ_BUFF_SIZE];
 
+    // bytes of an incomplete request left in read_buffer
+    int pending = 0;
+
     // create epoll interface for the client
     c_info->epoll_fd = epoll_create(1);
 
@@ -188,20 +225,43 @@ client_thread(void *args)
                 n_ready_events = epoll_wait(c_info->epoll_fd, events, EPOLL_MAX_EVENTS, EPOLL_TIMEOUT);
 
                 // epoll wait failed. exit client thread
-                if(n_ready_events < 0) {
+                if(n_ready_events < 0 && errno != EINTR) {
                     logc_server_log("epoll wait failed: %s", strerror(errno));
                     break;
                 }
+
+                // dump the flight recorders if SIGUSR1 was received
+                if(c_info->flight_dump_gen != flight_dump_gen) {
+                    c_info->flight_dump_gen = flight_dump_gen;
+                    dump_flight_recorders(c_info, "SIGUSR1");
+                }
+
+                // periodic checks, once a second
+                time_t now = time(NULL);
+                if(now != c_info->last_tick) {
+                    c_info->last_tick = now;
+
+                    // release the shards of the pool processes that have died
+                    if(c_info->n_shards > 1)
+                        reap_dead_producers(c_info);
+
+                    // pool processes of an adopted segment cannot send requests, drain periodically
+                    if(c_info->adopted)
+                        drain_client(c_info);
+                    else
+                        flush_client(c_info);
+                }
                 
                 for(int i = 0; i < n_ready_events; ++i) {
                     /**
                      * process events
                      */
 
-                    if(events[i].events & EPOLLERR) {
+                    if((events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN)) {
                         /**
                          * client closes the connection
                          * break the client loop
+                         * pending requests are read first, a hang up can come with the close request
                          */
 
                         logc_server_log("Connection closed. fd: %d", c_info->fd);
@@ -217,7 +277,7 @@ client_thread(void *args)
                         logc_server_log("Request received from client: %d", c_info->fd);
 
                         // read
-                        int rb = read(c_info->fd, read_buffer, MAX_READ_BUFF_SIZE);
+                        int rb = read(c_info->fd, read_buffer + pending, MAX_READ_BUFF_SIZE - pending);
                         if(rb <= 0) {
                             /**
                              * read failed
@@ -234,7 +294,13 @@ client_thread(void *args)
                         }
                         else {
                             // process the request
-                            proc_req_ret = process_client_request(c_info, read_buffer);
+                            int consumed;
+                            rb += pending;
+                            proc_req_ret = process_client_request(c_info, read_buffer, rb, &consumed);
+
+                            // keep the incomplete request for the next read
+                            pending = rb - consumed;
+                            memmove(read_buffer, read_buffer + consumed, pending);
                             
                             /**
                              * if ret ==  0, success
@@ -256,11 +322,14 @@ client_thread(void *args)
         logc_server_log("Cannot create epoll interface: %s", strerror(errno));
     }
 
-    // close the client if it was not closed properly
-    if(proc_req_ret != 1)
+    // close the client if it was not closed properly, the client has crashed
+    if(proc_req_ret != 1) {
+        dump_flight_recorders(c_info, "client crash");
         close_client(c_info);
+    }
 
-    // cleanup client info structure
+    // cleanup client info structure, the client is out of the stats once closed
+    stats_unregister(c_info);
     client_info_free(c_info);
 
     return NULL;
@@ -277,6 +346,7 @@ void
 logc_server_main()
 {
     signal(SIGINT, sigint_handler);
+    signal(SIGUSR1, sigusr1_handler);
 
     // initialise logc server
     logc_server_init();
@@ -289,11 +359,19 @@ logc_server_main()
     while(running) {
         n_ready_events = epoll_wait(logc_epoll_fd, events, EPOLL_MAX_EVENTS, EPOLL_TIMEOUT);
 
+        // drain the adopted segments until their clients reconnect
+        registry_drain_orphans();
+
+        // dump the metrics if the dump interval has ended
+        stats_dump(time(NULL));
+
         // epoll wait error
         if(n_ready_events < 0) {
-            // do not log if epoll wait was interrupted
-            if(errno != EINTR)
-                logc_server_log("epoll wait error: %s", strerror(errno));
+            // interrupted by a signal, SIGINT will end the loop
+            if(errno == EINTR)
+                continue;
+
+            logc_server_log("epoll wait error: %s", strerror(errno));
 
             // break loop, shut down logc server
             break;
@@ -310,7 +388,7 @@ logc_server_main()
                  * accept connection and start client thread
                  */
 
-                struct client_info *c_info = (struct client_info *)malloc(sizeof(struct client_info));
+                struct client_info *c_info = (struct client_info *)calloc(1, sizeof(struct client_info));
 
                 // accept connection
                 socklen_t sock_addr_len;
@@ -323,6 +401,7 @@ logc_server_main()
                 }
 
                 logc_server_log("Client connected. fd: %d", c_info->fd);
+                stats_accepted();
 
                 // start client thread
                 pthread_create(&(c_info->tid), NULL, client_thread, c_info);
@@ -334,9 +413,182 @@ logc_server_main()
     logc_server_close();
 }
 
+/**
+ * parse a number with an optional unit suffix
+ *
+ * @param arg: number, like 64M or 1d
+ * @param units: unit suffixes
+ * @param scales: scale of every unit
+ * @returns the number, -1 if it is invalid
+ */
+static long long
+parse_scaled(char *arg, char *units, long long *scales)
+{
+    char *end;
+    long long n = strtoll(arg, &end, 10);
+
+    if(end == arg || n < 0)
+        return -1;
+    if(*end == '\0')
+        return n;
+
+    char *unit = strchr(units, *end);
+    if(unit == NULL || end[1] != '\0')
+        return -1;
+
+    return n * scales[unit - units];
+}
+
+/**
+ * split a host:port address, the host of an IPv6 address is in brackets
+ *
+ * @param arg: address, like localhost:7070 or [::1]:7070
+ * @param host: set to the host, MAX_FILE_PATH_SIZE bytes
+ * @param port: set to the port, 16 bytes
+ * @returns 0 on success, -1 if the address is invalid
+ */
+static int
+parse_host_port(char *arg, char *host, char *port)
+{
+    char *colon = strrchr(arg, ':');
+    if(colon == NULL || colon == arg || colon[1] == '\0' || strlen(colon + 1) >= 16 || colon - arg >= MAX_FILE_PATH_SIZE)
+        return -1;
+
+    int host_len = colon - arg;
+
+    if(arg[0] == '[' && colon[-1] == ']') {
+        arg++;
+        host_len -= 2;
+    }
+
+    memcpy(host, arg, host_len);
+    host[host_len] = '\0';
+    strcpy(port, colon + 1);
+    return 0;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logcserver [-s size] [-i interval] [-k keep] [-z] [-f host:port [-c] [-S dir]] [-m interval]\n"
+                    "                  [-T trace [-p]] [-R routes] [-C window] [-D slots [-W name=weight]...] [-G size]\n"
+                    "    -s  rotate the log files at this size, like 64M (K, M, G)\n"
+                    "    -i  rotate the log files every interval, like 1h (s, m, h, d)\n"
+                    "    -k  keep this many rotated files of every log file\n"
+                    "    -z  compress the rotated text log files, read them with logc-cat\n"
+                    "    -f  forward the drained logs to the collector at host:port\n"
+                    "    -c  compress the forwarded batches\n"
+                    "    -S  directory of the forward spool file, default is the working directory\n"
+                    "    -m  append the metrics to " STATS_DUMP_FILE " every interval, like 10s (s, m, h, d)\n"
+                    "    -T  capture the drains of every client to the trace file, replay it with logc-replay\n"
+                    "    -p  capture the drained logs too\n"
+                    "    -R  filter and route the drained logs by the rules of the routes file\n"
+                    "    -C  collapse the repeats of a message within the window, like 30s (s, m, h, d), 0 for consecutive repeats\n"
+                    "    -D  drain at most this many channels at once, by urgency, share and ring fill\n"
+                    "    -W  weight of the share of the clients of the named process, default is 1\n"
+                    "    -G  grow the bulk rings of a busy channel up to this size, like 1M (K, M, G)\n");
+}
+
 int
 main(int argc, char **argv)
 {
+    long long size_scales[] = { 1LL << 10, 1LL << 20, 1LL << 30 };
+    long long time_scales[] = { 1, 60, 3600, 86400 };
+    long long n;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:i:k:zf:cS:m:T:pR:C:D:W:G:h")) != -1) {
+        switch(opt) {
+        case 's':
+            if((n = parse_scaled(optarg, "KMG", size_scales)) <= 0) {
+                fprintf(stderr, "logcserver: invalid size: %s\n", optarg);
+                return 1;
+            }
+            rotate_policy.max_size = n;
+            break;
+        case 'i':
+            if((n = parse_scaled(optarg, "smhd", time_scales)) <= 0) {
+                fprintf(stderr, "logcserver: invalid interval: %s\n", optarg);
+                return 1;
+            }
+            rotate_policy.interval = n;
+            break;
+        case 'k':
+            rotate_policy.keep = atoi(optarg);
+            break;
+        case 'z':
+            rotate_policy.compress = 1;
+            break;
+        case 'f':
+            if(parse_host_port(optarg, forwarder_config.host, forwarder_config.port) == -1) {
+                fprintf(stderr, "logcserver: invalid collector address: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            forwarder_config.compress = 1;
+            break;
+        case 'm':
+            if((n = parse_scaled(optarg, "smhd", time_scales)) <= 0) {
+                fprintf(stderr, "logcserver: invalid interval: %s\n", optarg);
+                return 1;
+            }
+            stats_interval = n;
+            break;
+        case 'S':
+            if(strlen(optarg) >= MAX_FILE_PATH_SIZE) {
+                fprintf(stderr, "logcserver: spool directory is too long: %s\n", optarg);
+                return 1;
+            }
+            strcpy(forwarder_config.spool_dir, optarg);
+            break;
+        case 'T':
+            if(strlen(optarg) >= MAX_FILE_PATH_SIZE) {
+                fprintf(stderr, "logcserver: trace file path is too long: %s\n", optarg);
+                return 1;
+            }
+            strcpy(capture_config.path, optarg);
+            break;
+        case 'p':
+            capture_config.payloads = 1;
+            break;
+        case 'R':
+            if(route_load(optarg) == -1)
+                return 1;
+            break;
+        case 'C':
+            if((n = parse_scaled(optarg, "smhd", time_scales)) < 0) {
+                fprintf(stderr, "logcserver: invalid window: %s\n", optarg);
+                return 1;
+            }
+            collapse_config.enabled = 1;
+            collapse_config.window = n * 1000;
+            break;
+        case 'D':
+            if((sched_config.slots = atoi(optarg)) <= 0) {
+                fprintf(stderr, "logcserver: invalid number of drain slots: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W':
+            if(sched_add_weight(optarg) == -1) {
+                fprintf(stderr, "logcserver: invalid weight: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'G':
+            if((n = parse_scaled(optarg, "KMG", size_scales)) <= 0) {
+                fprintf(stderr, "logcserver: invalid ring size: %s\n", optarg);
+                return 1;
+            }
+            grow_set_max_size(n);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
     logc_server_main();
     return 0;
 }
@@ -26,11 +26,51 @@
 #define LOGC_SERVER_H
 
 #include "../common/logc_buffer.h"
+#include "../common/logc_segment.h"
 #include "../common/logc_utils.h"
+#include "logc_sink.h"
+#include "logc_stats.h"
+#include "logc_sched.h"
 
 #include <stdio.h>        // for FILE
 #include <pthread.h>      // for pthread_t
+#include <time.h>         // for time_t
+#include <signal.h>       // for sig_atomic_t
 
+struct route_channel;
+struct collapse_channel;
+struct grow_ring;
+
+
+struct channel_info
+{
+    /* append mode of the log file */
+    int  append;
+
+    /* absolute path of the log file for the channel */
+    char log_file_path[MAX_FILE_PATH_SIZE];
+
+    /* if 1, the bulk ring is a flight recorder, only dumped on crash or trigger */
+    int flight;
+
+    /* number of latest bytes to dump from a flight recorder, 0 for the whole ring */
+    uint32_t flight_size;
+
+    /* log file format, LOGC_FORMAT_* */
+    int format;
+
+    /* writes the drained logs to the log file */
+    struct logc_sink sink;
+
+    /* routes of the drained logs, see logc_route.h, NULL if no rule applies to the channel */
+    struct route_channel *route;
+
+    /* recent messages of the channel, see logc_collapse.h, NULL if collapsing is disabled */
+    struct collapse_channel *collapse;
+
+    /* bulk ring of every shard, see logc_grow.h, NULL if the rings of the channel never grow */
+    struct grow_ring *grow;
+};
 
 struct client_info
 {
@@ -43,20 +83,54 @@ struct client_info
     /* thread id for the client thread */
     pthread_t tid;
 
-    /* append mode of the log file */
-    int  append;
+    /* number of log channels of the client */
+    int n_channels;
 
-    /* absolute path of the log file for the client */
-    char log_file_path[MAX_FILE_PATH_SIZE];
+    /* log channels of the client */
+    struct channel_info channels[LOGC_MAX_CHANNELS];
 
-    /* wait free ring buffer for storing log messages */
-    struct logc_buffer *log_buff;
+    /* number of producer shards, more than 1 if the client is a pool of processes */
+    int n_shards;
 
-    /* file pointer for the log file */
-    FILE *fp;
+    /**
+     * shared memory segment of the client
+     * every shard has a bulk ring and a small urgent ring for every channel,
+     * the urgent ring is drained ahead of the bulk ring
+     */
+    struct logc_segment *segment;
 
     /* start address of the memory mapped address */
     void *mmap_addr;
+
+    /* size of the memory mapped segment */
+    size_t mmap_size;
+
+    /* name of the shared memory segment */
+    char shm_name[MAX_FILE_PATH_SIZE];
+
+    /* if 1, the segment was adopted from a previous server, drained periodically */
+    int adopted;
+
+    /* time of the last periodic check of the client thread */
+    time_t last_tick;
+
+    /* last flight recorder dump generation handled by the client thread */
+    sig_atomic_t flight_dump_gen;
+
+    /* counters of the client, see logc_stats.h */
+    struct client_stats stats;
+
+    /* share of the drain slots of the client, see logc_sched.h, NULL until its first scheduled drain */
+    struct sched_client *sched;
+
+    /* id of the client in the trace, 0 until it is captured, see logc_capture.h */
+    uint32_t capture_id;
+
+    /* buffer of the drains of the rings larger than the rings of the segment, NULL until one is drained */
+    char *drain_buff;
 };
 
+/* incremented on SIGUSR1, every client thread dumps its flight recorders */
+extern volatile sig_atomic_t flight_dump_gen;
+
 #endif
@@ -0,0 +1,589 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "logc_sink.h"
+#include "logc_server_utils.h"
+#include "logc_rotate.h"
+#include "logc_stats.h"
+#include "../common/logc_lz.h"
+#include "../common/logc_record.h"
+#include "../common/logc_index.h"
+#include "../common/logc_json.h"
+#include "../common/logc_probe.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+// blocks waiting for the compressor, client threads wait if there are more
+#define LZ_MAX_PENDING_BLOCKS   64
+
+// a partially filled block is handed over to the compressor after this many seconds
+#define LZ_MAX_BLOCK_AGE        1
+
+
+struct lz_block
+{
+    uint64_t raw_offset;    // uncompressed offset of the block in the log
+    int64_t  first_ts;      // time the first byte was written
+    int64_t  last_ts;       // time the last byte was written
+    int      len;           // bytes in data
+    char     data[LOGC_LZ_BLOCK_SIZE];
+};
+
+struct lz_job
+{
+    /* block to write, NULL if the files are to be closed */
+    struct lz_block *block;
+
+    /* log file and block index file of the sink */
+    FILE *fp;
+    FILE *index_fp;
+
+    struct lz_job *next;
+};
+
+static struct lz_job *lz_queue_head;
+static struct lz_job *lz_queue_tail;
+static int lz_queue_len;
+static pthread_mutex_t lz_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lz_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t lz_compressor_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * compressor thread
+ * writes the blocks of every block compressed sink in the order they were handed over
+ */
+static void *
+lz_compressor_thread(void *args)
+{
+    while(1) {
+        pthread_mutex_lock(&lz_queue_lock);
+        while(lz_queue_head == NULL)
+            pthread_cond_wait(&lz_queue_cond, &lz_queue_lock);
+
+        struct lz_job *job = lz_queue_head;
+        lz_queue_head = job->next;
+        if(lz_queue_head == NULL)
+            lz_queue_tail = NULL;
+        lz_queue_len--;
+
+        pthread_cond_broadcast(&lz_queue_cond);
+        pthread_mutex_unlock(&lz_queue_lock);
+
+        if(job->block != NULL) {
+            struct lz_block *block = job->block;
+            logc_lz_write_block(job->fp, job->index_fp, block->data, block->len,
+                                block->raw_offset, block->first_ts, block->last_ts);
+            free(job->block);
+        }
+        else {
+            fclose(job->fp);
+            fclose(job->index_fp);
+        }
+
+        free(job);
+    }
+
+    return NULL;
+}
+
+static void
+lz_start_compressor()
+{
+    pthread_t tid;
+
+    if(pthread_create(&tid, NULL, lz_compressor_thread, NULL) != 0)
+        exit_with_errno();
+    pthread_detach(tid);
+}
+
+/**
+ * hand over a job to the compressor thread
+ * waits if the compressor is behind
+ */
+static void
+lz_enqueue(struct lz_block *block, FILE *fp, FILE *index_fp)
+{
+    struct lz_job *job = (struct lz_job *)malloc(sizeof(struct lz_job));
+
+    job->block = block;
+    job->fp = fp;
+    job->index_fp = index_fp;
+    job->next = NULL;
+
+    pthread_mutex_lock(&lz_queue_lock);
+    while(lz_queue_len >= LZ_MAX_PENDING_BLOCKS)
+        pthread_cond_wait(&lz_queue_cond, &lz_queue_lock);
+
+    if(lz_queue_tail != NULL)
+        lz_queue_tail->next = job;
+    else
+        lz_queue_head = job;
+    lz_queue_tail = job;
+    lz_queue_len++;
+
+    pthread_cond_broadcast(&lz_queue_cond);
+    pthread_mutex_unlock(&lz_queue_lock);
+}
+
+/**
+ * hand over the block being filled to the compressor
+ */
+static void
+lz_seal_block(struct logc_sink *sink)
+{
+    if(sink->block == NULL || sink->block->len == 0)
+        return;
+
+    sink->raw_offset += sink->block->len;
+    lz_enqueue(sink->block, sink->fp, sink->index_fp);
+    sink->block = NULL;
+}
+
+/**
+ * open the block index file and find where the log file ends
+ */
+static int
+lz_open(struct logc_sink *sink, int append)
+{
+    char index_path[MAX_FILE_PATH_SIZE + sizeof(LOGC_LZ_INDEX_SUFFIX)];
+    struct logc_lz_index_entry entry;
+
+    pthread_once(&lz_compressor_once, lz_start_compressor);
+
+    sprintf(index_path, "%s%s", sink->path, LOGC_LZ_INDEX_SUFFIX);
+    sink->index_fp = fopen(index_path, append ? "a+" : "w+");
+    if(sink->index_fp == NULL) {
+        logc_server_log("Cannot open block index file: %s, error: %s", index_path, strerror(errno));
+        return -1;
+    }
+
+    // continue after the last block of the log file
+    sink->raw_offset = 0;
+    if(fseek(sink->index_fp, -(long)sizeof(entry), SEEK_END) == 0 &&
+       fread(&entry, sizeof(entry), 1, sink->index_fp) == 1)
+        sink->raw_offset = entry.raw_offset + entry.raw_len;
+
+    if(ftell(sink->fp) == 0) {
+        fwrite(LOGC_LZ_FILE_MAGIC, 1, LOGC_LZ_FILE_MAGIC_LEN, sink->fp);
+        fflush(sink->fp);
+    }
+
+    sink->block = NULL;
+    return 0;
+}
+
+/**
+ * collect logs in blocks, full blocks are handed over to the compressor
+ * a block starts with the logs of a drain, so blocks start at a message boundary
+ */
+static void
+lz_write(struct logc_sink *sink, char *buff, int len)
+{
+    int64_t now = time(NULL);
+
+    while(len > 0) {
+        if(sink->block != NULL && sink->block->len + len > LOGC_LZ_BLOCK_SIZE)
+            lz_seal_block(sink);
+
+        if(sink->block == NULL) {
+            sink->block = (struct lz_block *)malloc(sizeof(struct lz_block));
+            sink->block->raw_offset = sink->raw_offset;
+            sink->block->first_ts = now;
+            sink->block->len = 0;
+        }
+
+        int n = len;
+        if(n > LOGC_LZ_BLOCK_SIZE - sink->block->len)
+            n = LOGC_LZ_BLOCK_SIZE - sink->block->len;
+
+        memcpy(sink->block->data + sink->block->len, buff, n);
+        sink->block->len += n;
+        sink->block->last_ts = now;
+
+        buff += n;
+        len -= n;
+    }
+}
+
+/**
+ * open the time index file and find the time of its last entry
+ */
+static int
+time_index_open(struct logc_sink *sink, int append)
+{
+    char index_path[MAX_FILE_PATH_SIZE + sizeof(LOGC_TIME_INDEX_SUFFIX)];
+    struct logc_time_index_entry entry;
+
+    sprintf(index_path, "%s%s", sink->path, LOGC_TIME_INDEX_SUFFIX);
+    sink->time_index_fp = fopen(index_path, append ? "a+" : "w+");
+    if(sink->time_index_fp == NULL) {
+        logc_server_log("Cannot open time index file: %s, error: %s", index_path, strerror(errno));
+        return -1;
+    }
+
+    sink->time_index_ts = 0;
+    if(fseek(sink->time_index_fp, -(long)sizeof(entry), SEEK_END) == 0 &&
+       fread(&entry, sizeof(entry), 1, sink->time_index_fp) == 1)
+        sink->time_index_ts = entry.ts;
+
+    // the first message written gets an entry
+    sink->time_index_next = 0;
+    return 0;
+}
+
+/**
+ * add a time index entry for the message written next, if an entry is due
+ *
+ * @param sink: a text or binary sink
+ * @param ts: time of the message, epoch nanoseconds
+ */
+static void
+time_index_add(struct logc_sink *sink, int64_t ts)
+{
+    struct logc_time_index_entry entry;
+
+    // messages of different shards are not in order, the index times never decrease
+    if(ts < sink->time_index_ts)
+        ts = sink->time_index_ts;
+
+    entry.ts = ts;
+    entry.offset = ftell(sink->fp);
+    fwrite(&entry, sizeof(entry), 1, sink->time_index_fp);
+
+    sink->time_index_ts = ts;
+    sink->time_index_next = entry.offset + LOGC_TIME_INDEX_INTERVAL;
+}
+
+/**
+ * check if a time index entry is due before the next write
+ */
+static inline int
+time_index_due(struct logc_sink *sink)
+{
+    return sink->time_index_fp != NULL && ftell(sink->fp) >= sink->time_index_next;
+}
+
+/**
+ * write text logs, the time of the first message goes to the time index if an entry is due
+ */
+static void
+text_write(struct logc_sink *sink, char *buff, int len)
+{
+    int64_t ts;
+
+    // a line without a time, like a note of the server, waits for the next write
+    if(time_index_due(sink) && logc_index_line_time(buff, &ts) == 0)
+        time_index_add(sink, ts * 1000000000);
+
+    fwrite(buff, 1, len, sink->fp);
+}
+
+/**
+ * write the records of a drain as a block of a binary log file
+ * the records of a torn write are left out
+ */
+static void
+bin_write(struct logc_sink *sink, char *buff, int len)
+{
+    static __thread char block[sizeof(struct logc_bin_block_header) + LOGC_BIN_BLOCK_SIZE];
+    struct logc_bin_block_header header;
+    struct logc_record rec;
+    char *msg;
+    int off = 0;
+
+    header.magic = LOGC_BIN_BLOCK_MAGIC;
+    header.len = 0;
+    header.n_records = 0;
+
+    char *records = block + sizeof(header);
+    while((msg = logc_record_next(buff, len, &off, &rec)) != NULL) {
+        int rec_len = sizeof(rec) + rec.len;
+        if(header.len + rec_len > LOGC_BIN_BLOCK_SIZE)
+            break;
+
+        memcpy(records + header.len, msg - sizeof(rec), rec_len);
+        header.len += rec_len;
+        header.n_records++;
+    }
+
+    if(header.n_records == 0)
+        return;
+
+    header.crc = logc_crc32c(0, records, header.len);
+    memcpy(block, &header, sizeof(header));
+
+    if(time_index_due(sink)) {
+        memcpy(&rec, records, sizeof(rec));
+        time_index_add(sink, rec.ts);
+    }
+
+    // the block is written at once, a crash can only tear the last block
+    fwrite(block, 1, sizeof(header) + header.len, sink->fp);
+}
+
+/**
+ * write the records of a drain as JSON lines
+ * the time of the first record goes to the time index if an entry is due
+ */
+static void
+json_write(struct logc_sink *sink, char *buff, int len)
+{
+    static __thread char lines[LOGC_BIN_BLOCK_SIZE + LOGC_JSON_MAX_LINE];
+    struct logc_record rec;
+    char *msg;
+    int off = 0;
+    int n = 0;
+
+    while((msg = logc_record_next(buff, len, &off, &rec)) != NULL) {
+        if(n == 0 && time_index_due(sink))
+            time_index_add(sink, rec.ts);
+
+        n += logc_json_record(lines + n, &rec, msg, sink->client_pid);
+        if(n >= LOGC_BIN_BLOCK_SIZE) {
+            fwrite(lines, 1, n, sink->fp);
+            n = 0;
+        }
+    }
+
+    fwrite(lines, 1, n, sink->fp);
+}
+
+/**
+ * size of the logs written to the log file, uncompressed size for a block compressed sink
+ */
+static uint64_t
+sink_size(struct logc_sink *sink)
+{
+    if(sink->format == LOGC_FORMAT_LZ)
+        return sink->raw_offset + (sink->block != NULL ? sink->block->len : 0);
+
+    return ftell(sink->fp);
+}
+
+/**
+ * rotate the log file of a sink
+ * the log file and its index files are renamed and a new log file is opened.
+ * the files of the old log file are closed after its pending logs are written
+ */
+static void
+sink_rotate(struct logc_sink *sink)
+{
+    char rotated_path[MAX_FILE_PATH_SIZE + LOGC_ROTATED_SUFFIX_LEN + 1];
+    char index_path[MAX_FILE_PATH_SIZE + 8];
+    char rotated_index_path[sizeof(rotated_path) + 8];
+    struct logc_sink old;
+
+    sink->rotate_time = rotate_next_time(time(NULL));
+
+    // an empty log file is kept
+    if(sink_size(sink) == (sink->format == LOGC_FORMAT_BIN ? LOGC_BIN_FILE_MAGIC_LEN : 0))
+        return;
+
+    if(rotate_name(sink->path, rotated_path) == -1 || rename(sink->path, rotated_path) == -1) {
+        logc_server_log("Cannot rotate log file: %s, error: %s", sink->path, strerror(errno));
+        return;
+    }
+
+    // the index files go with the log file
+    char *index_suffix = sink->format == LOGC_FORMAT_LZ ? LOGC_LZ_INDEX_SUFFIX : LOGC_TIME_INDEX_SUFFIX;
+    sprintf(index_path, "%s%s", sink->path, index_suffix);
+    sprintf(rotated_index_path, "%s%s", rotated_path, index_suffix);
+    rename(index_path, rotated_index_path);
+
+    if(sink->format == LOGC_FORMAT_LZ)
+        lz_seal_block(sink);
+    old = *sink;
+
+    if(sink_open(sink, old.path, 0, old.format, old.client_pid) == -1) {
+        // keep writing to the rotated file
+        logc_server_log("Cannot open log file after rotation: %s, error: %s", old.path, strerror(errno));
+        *sink = old;
+        return;
+    }
+
+    sink->keep = old.keep;
+    sink_close(&old);
+    rotate_post_process(sink->path, rotated_path, sink->format, sink->keep);
+
+    logc_server_log("Rotated log file: %s to %s", sink->path, rotated_path);
+}
+
+/**
+ * rotate the log file if it has reached the maximum size or the rotation interval has ended
+ */
+static void
+sink_check_rotate(struct logc_sink *sink)
+{
+    if(!rotate_enabled())
+        return;
+
+    if((rotate_policy.max_size > 0 && sink_size(sink) >= rotate_policy.max_size) ||
+       (sink->rotate_time != 0 && time(NULL) >= sink->rotate_time))
+        sink_rotate(sink);
+}
+
+int
+sink_open(struct logc_sink *sink, char *path, int append, int format, uint32_t client_pid)
+{
+    strcpy(sink->path, path);
+    sink->format = format;
+    sink->client_pid = client_pid;
+    sink->keep = 0;
+    sink->index_fp = NULL;
+    sink->time_index_fp = NULL;
+    sink->block = NULL;
+    sink->rotate_time = rotate_next_time(time(NULL));
+
+    if(format != LOGC_FORMAT_TEXT && format != LOGC_FORMAT_LZ && format != LOGC_FORMAT_BIN && format != LOGC_FORMAT_JSON) {
+        logc_server_log("Invalid log file format: %d, log_file_path: %s", format, path);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // set open mode for the log file
+    char *mode;
+    if(append == 1)
+        mode = "a";
+    else
+        mode = "w";
+
+    // open the log file
+    // the write syscalls of the log file are counted, see logc_stats.h
+    sink->fp = stats_fopen(path, mode);
+    if(sink->fp == NULL) {
+        logc_server_log("Cannot open log file: %s, error: %s", path, strerror(errno));
+        return -1;
+    }
+
+    fseek(sink->fp, 0, SEEK_END);
+
+    if(format == LOGC_FORMAT_LZ && lz_open(sink, append) == -1) {
+        fclose(sink->fp);
+        return -1;
+    }
+
+    if(format == LOGC_FORMAT_BIN && ftell(sink->fp) == 0) {
+        fwrite(LOGC_BIN_FILE_MAGIC, 1, LOGC_BIN_FILE_MAGIC_LEN, sink->fp);
+        fflush(sink->fp);
+    }
+
+    // the blocks of a block compressed sink have their times in the block index
+    if(format != LOGC_FORMAT_LZ && time_index_open(sink, append) == -1) {
+        fclose(sink->fp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+sink_write(struct logc_sink *sink, char *buff, int len)
+{
+    LOGC_PROBE2(file_write, sink->format, len);
+
+    switch(sink->format) {
+    case LOGC_FORMAT_LZ:
+        lz_write(sink, buff, len);
+        break;
+    case LOGC_FORMAT_BIN:
+        bin_write(sink, buff, len);
+        break;
+    case LOGC_FORMAT_JSON:
+        json_write(sink, buff, len);
+        break;
+    default:
+        text_write(sink, buff, len);
+    }
+
+    sink_check_rotate(sink);
+}
+
+void
+sink_note(struct logc_sink *sink, int level, char *note)
+{
+    char buff[sizeof(struct logc_record) + LOGC_RECORD_MAX_LEN];
+    struct logc_record rec;
+    struct timespec ts;
+
+    int len = snprintf(buff + sizeof(rec), LOGC_RECORD_MAX_LEN - 1, "logc: %s", note);
+    if(len > LOGC_RECORD_MAX_LEN - 2)
+        len = LOGC_RECORD_MAX_LEN - 2;
+    buff[sizeof(rec) + len++] = '\n';
+
+    if(!logc_format_structured(sink->format)) {
+        sink_write(sink, buff + sizeof(rec), len);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.magic = LOGC_RECORD_MAGIC;
+    rec.level = level;
+    rec.len = len;
+    rec.callsite = 0;
+    rec.ts = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    memcpy(buff, &rec, sizeof(rec));
+
+    sink_write(sink, buff, sizeof(rec) + len);
+}
+
+void
+sink_flush(struct logc_sink *sink)
+{
+    switch(sink->format) {
+    case LOGC_FORMAT_LZ:
+        if(sink->block != NULL && time(NULL) - sink->block->first_ts >= LZ_MAX_BLOCK_AGE)
+            lz_seal_block(sink);
+        break;
+    default:
+        // the log file first, an index entry never points past the written logs
+        fflush(sink->fp);
+        fflush(sink->time_index_fp);
+    }
+
+    sink_check_rotate(sink);
+}
+
+void
+sink_close(struct logc_sink *sink)
+{
+    switch(sink->format) {
+    case LOGC_FORMAT_LZ:
+        // the compressor closes the files after writing the pending blocks
+        lz_seal_block(sink);
+        lz_enqueue(NULL, sink->fp, sink->index_fp);
+        break;
+    default:
+        fclose(sink->fp);
+        fclose(sink->time_index_fp);
+    }
+
+    sink->fp = NULL;
+    sink->index_fp = NULL;
+    sink->time_index_fp = NULL;
+}
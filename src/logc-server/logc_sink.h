@@ -0,0 +1,134 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc sink
+ * Writes the drained logs of a channel to its log file in the format of the channel
+ * The logs of a structured channel are records, see logc_record.h
+ * A JSON sink writes the records as JSON lines, see logc_json.h
+ * A text, binary or JSON sink also writes a sparse time index, see logc_index.h
+ * A sink rotates its log file as set by the rotation policy, see logc_rotate.h
+ *
+ * A block compressed sink collects the logs in a block. Full blocks are compressed and
+ * written by a compressor thread, so the client threads never spend time compressing.
+ */
+
+#ifndef LOGC_SINK_H
+#define LOGC_SINK_H
+
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+
+struct lz_block;
+
+struct logc_sink
+{
+    /* log file format, LOGC_FORMAT_* */
+    int format;
+
+    /* path of the log file */
+    char path[MAX_FILE_PATH_SIZE];
+
+    /* pid of the client, written to the JSON lines */
+    uint32_t client_pid;
+
+    /* file pointer for the log file */
+    FILE *fp;
+
+    /* block index file of a block compressed sink */
+    FILE *index_fp;
+
+    /* block being filled by a block compressed sink */
+    struct lz_block *block;
+
+    /* uncompressed offset of the next block */
+    uint64_t raw_offset;
+
+    /* time index file of a text or binary sink, see logc_index.h */
+    FILE *time_index_fp;
+
+    /* offset of the log file at which the next time index entry is due */
+    uint64_t time_index_next;
+
+    /* time of the last time index entry, epoch nanoseconds */
+    int64_t time_index_ts;
+
+    /* time of the next time based rotation, 0 if there is none */
+    time_t rotate_time;
+
+    /* number of rotated files kept, 0 for the rotation policy */
+    int keep;
+};
+
+/**
+ * open the log file of a sink
+ *
+ * @param sink: sink to open
+ * @param path: path of the log file
+ * @param append: if 1, the log file is opened in append mode
+ * @param format: log file format, LOGC_FORMAT_*
+ * @param client_pid: pid of the client
+ * @returns 0 on success, -1 on failure
+ */
+int sink_open(struct logc_sink *sink, char *path, int append, int format, uint32_t client_pid);
+
+/**
+ * write logs to a sink
+ *
+ * @param sink: an open sink
+ * @param buff: logs
+ * @param len: length of the logs
+ */
+void sink_write(struct logc_sink *sink, char *buff, int len);
+
+/**
+ * write a message of the server, like a note about lost logs, to a sink
+ *
+ * @param sink: an open sink
+ * @param level: log level of the message
+ * @param note: message without the end line
+ */
+void sink_note(struct logc_sink *sink, int level, char *note);
+
+/**
+ * make the logs written to a sink durable
+ * a block compressed sink hands over the block being filled if it is older than a second
+ * the log file is rotated if the rotation interval has ended
+ *
+ * @param sink: an open sink
+ */
+void sink_flush(struct logc_sink *sink);
+
+/**
+ * write the pending logs and close a sink
+ *
+ * @param sink: an open sink
+ */
+void sink_close(struct logc_sink *sink);
+
+#endif
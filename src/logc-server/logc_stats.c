@@ -0,0 +1,476 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for fopencookie
+
+#include "logc_stats.h"
+#include "logc_server.h"
+#include "logc_server_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+
+struct stats_node
+{
+    struct client_info *c_info;
+    struct stats_node *next;
+};
+
+int stats_interval;
+
+// clients in the report, the lock is only taken on connect, disconnect and report
+static struct stats_node *clients;
+static int n_clients;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// only counted by the main thread
+static uint64_t n_accepts;
+
+static time_t next_dump;
+
+// counters of the client served by the thread, for the write syscalls
+static __thread struct client_stats *thread_stats;
+
+
+void
+stats_register(struct client_info *c_info)
+{
+    struct stats_node *node = (struct stats_node *)malloc(sizeof(struct stats_node));
+    node->c_info = c_info;
+
+    pthread_mutex_lock(&clients_lock);
+    node->next = clients;
+    clients = node;
+    n_clients++;
+    pthread_mutex_unlock(&clients_lock);
+
+    thread_stats = &(c_info->stats);
+}
+
+void
+stats_unregister(struct client_info *c_info)
+{
+    struct stats_node *node = NULL;
+
+    pthread_mutex_lock(&clients_lock);
+    for(struct stats_node **p = &clients; *p != NULL; p = &((*p)->next)) {
+        if((*p)->c_info == c_info) {
+            node = *p;
+            *p = node->next;
+            n_clients--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+
+    free(node);
+    if(thread_stats == &(c_info->stats))
+        thread_stats = NULL;
+}
+
+void
+stats_set_thread_client(struct client_info *c_info)
+{
+    thread_stats = c_info != NULL ? &(c_info->stats) : NULL;
+}
+
+void
+stats_accepted()
+{
+    stats_add(n_accepts, 1);
+}
+
+int
+stats_foreach_client(void (*fn)(struct client_info *c_info, void *arg), void *arg)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&clients_lock);
+
+    for(struct stats_node *node = clients; node != NULL; node = node->next) {
+        if(__atomic_load_n(&(node->c_info->stats.pid), __ATOMIC_RELAXED) != 0) {
+            fn(node->c_info, arg);
+            n++;
+        }
+    }
+
+    pthread_mutex_unlock(&clients_lock);
+
+    return n;
+}
+
+void
+stats_update_client(struct client_info *c_info, void (*fn)(struct client_info *c_info, void *arg), void *arg)
+{
+    pthread_mutex_lock(&clients_lock);
+    fn(c_info, arg);
+    pthread_mutex_unlock(&clients_lock);
+}
+
+void
+stats_drain(struct client_stats *stats, int n_bytes, int64_t latency)
+{
+    int bucket = latency > 1 ? 63 - __builtin_clzll(latency) : 0;
+    if(bucket >= STATS_LATENCY_BUCKETS)
+        bucket = STATS_LATENCY_BUCKETS - 1;
+
+    stats_add(stats->bytes_drained, n_bytes);
+    stats_add(stats->n_drains, 1);
+    stats_add(stats->drain_latency[bucket], 1);
+}
+
+void
+stats_sched_wait(struct client_stats *stats, int64_t wait)
+{
+    int bucket = wait > 1 ? 63 - __builtin_clzll(wait) : 0;
+    if(bucket >= STATS_LATENCY_BUCKETS)
+        bucket = STATS_LATENCY_BUCKETS - 1;
+
+    stats_add(stats->n_sched_waits, 1);
+    stats_add(stats->sched_wait[bucket], 1);
+}
+
+static ssize_t
+counted_write(void *cookie, const char *buff, size_t size)
+{
+    int fd = (int)(intptr_t)cookie;
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t wb = write(fd, buff + done, size - done);
+
+        if(thread_stats != NULL)
+            stats_add(thread_stats->n_write_syscalls, 1);
+
+        if(wb < 0 && errno == EINTR)
+            continue;
+        if(wb <= 0)
+            break;
+        done += wb;
+    }
+
+    // a short count is an error for stdio
+    return done;
+}
+
+static int
+counted_seek(void *cookie, off64_t *offset, int whence)
+{
+    off_t pos = lseek((int)(intptr_t)cookie, *offset, whence);
+    if(pos == -1)
+        return -1;
+
+    *offset = pos;
+    return 0;
+}
+
+static int
+counted_close(void *cookie)
+{
+    return close((int)(intptr_t)cookie);
+}
+
+FILE *
+stats_fopen(char *path, char *mode)
+{
+    cookie_io_functions_t io = { .write = counted_write, .seek = counted_seek, .close = counted_close };
+    int flags = O_WRONLY | O_CREAT | (mode[0] == 'a' ? O_APPEND : O_TRUNC);
+
+    int fd = open(path, flags, 0666);
+    if(fd == -1)
+        return NULL;
+
+    FILE *fp = fopencookie((void *)(intptr_t)fd, mode, io);
+    if(fp == NULL)
+        close(fd);
+
+    return fp;
+}
+
+/**
+ * upper bound of the bucket of a percentile of the drain latency
+ *
+ * @param hist: latency histogram, loaded
+ * @param n: number of drains
+ * @param pct: percentile, like 99.9
+ * @returns latency in nanoseconds, 0 if there are no drains
+ */
+static uint64_t
+latency_percentile(uint64_t *hist, uint64_t n, double pct)
+{
+    uint64_t rank = (uint64_t)(n * pct / 100.0);
+    uint64_t seen = 0;
+
+    if(n == 0)
+        return 0;
+
+    for(int i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+        seen += hist[i];
+        if(seen > rank)
+            return 2ULL << i;
+    }
+
+    return 2ULL << (STATS_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * write the report line of a client
+ *
+ * @returns length of the line
+ */
+static int
+report_client(char *buff, int size, struct client_info *c_info)
+{
+    struct client_stats *stats = &(c_info->stats);
+    struct sched_client *sched = __atomic_load_n(&(c_info->sched), __ATOMIC_ACQUIRE);
+    uint64_t hist[STATS_LATENCY_BUCKETS], wait_hist[STATS_LATENCY_BUCKETS];
+    uint64_t n = 0, n_waits = 0;
+    int max = -1, wait_max = -1;
+
+    for(int i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+        hist[i] = __atomic_load_n(&(stats->drain_latency[i]), __ATOMIC_RELAXED);
+        n += hist[i];
+        if(hist[i] > 0)
+            max = i;
+
+        wait_hist[i] = __atomic_load_n(&(stats->sched_wait[i]), __ATOMIC_RELAXED);
+        n_waits += wait_hist[i];
+        if(wait_hist[i] > 0)
+            wait_max = i;
+    }
+
+    return snprintf(buff, size,
+                    "client pid=%u fd=%d drained_bytes=%llu drains=%llu drain_p50_ns=%llu drain_p99_ns=%llu drain_max_ns=%llu "
+                    "ring_high_water=%u ring_high_water_pct=%u overflows=%llu dropped_bytes=%llu write_syscalls=%llu filtered_bytes=%llu collapsed_messages=%llu "
+                    "ring_grows=%llu ring_shrinks=%llu weight=%u sched_waits=%llu sched_wait_p50_ns=%llu sched_wait_p99_ns=%llu sched_wait_max_ns=%llu\n",
+                    __atomic_load_n(&(stats->pid), __ATOMIC_RELAXED), c_info->fd,
+                    (unsigned long long)__atomic_load_n(&(stats->bytes_drained), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->n_drains), __ATOMIC_RELAXED),
+                    (unsigned long long)latency_percentile(hist, n, 50),
+                    (unsigned long long)latency_percentile(hist, n, 99),
+                    (unsigned long long)(max >= 0 ? 2ULL << max : 0),
+                    __atomic_load_n(&(stats->ring_high_water), __ATOMIC_RELAXED),
+                    __atomic_load_n(&(stats->ring_high_water_pct), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->n_overflows), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->bytes_dropped), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->n_write_syscalls), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->bytes_filtered), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->messages_collapsed), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->n_ring_grows), __ATOMIC_RELAXED),
+                    (unsigned long long)__atomic_load_n(&(stats->n_ring_shrinks), __ATOMIC_RELAXED),
+                    sched != NULL ? __atomic_load_n(&(sched->weight), __ATOMIC_RELAXED) : 0,
+                    (unsigned long long)__atomic_load_n(&(stats->n_sched_waits), __ATOMIC_RELAXED),
+                    (unsigned long long)latency_percentile(wait_hist, n_waits, 50),
+                    (unsigned long long)latency_percentile(wait_hist, n_waits, 99),
+                    (unsigned long long)(wait_max >= 0 ? 2ULL << wait_max : 0));
+}
+
+/**
+ * upper bound of the bucket of a percentile of the log call latency
+ *
+ * @param counts: histogram of a stage, summed over the threads
+ * @param n: number of samples
+ * @param pct: percentile, 100 for the maximum
+ * @param ticks_per_ms: cycle counter frequency of the client
+ * @returns latency in nanoseconds, 0 if there are no samples
+ */
+static uint64_t
+call_latency_percentile(uint64_t *counts, uint64_t n, double pct, uint32_t ticks_per_ms)
+{
+    uint64_t rank = pct < 100 ? (uint64_t)(n * pct / 100.0) : n - 1;
+    uint64_t seen = 0;
+    int b;
+
+    if(n == 0)
+        return 0;
+
+    for(b = 0; b < LOGC_LATENCY_BUCKETS - 1; ++b) {
+        seen += counts[b];
+        if(seen > rank)
+            break;
+    }
+
+    return logc_latency_bucket_low(b + 1) * 1000000 / ticks_per_ms;
+}
+
+/**
+ * write the latency line of a client sampling its log calls
+ *
+ * @returns length of the line, 0 if the client does not sample
+ */
+static int
+report_client_latency(char *buff, int size, struct client_info *c_info)
+{
+    static const char *stage_names[] = LOGC_LATENCY_STAGE_NAMES;
+    struct logc_latency *hist = logc_segment_latency(c_info->segment);
+    uint64_t counts[LOGC_LATENCY_BUCKETS];
+    int len;
+
+    if(__atomic_load_n(&(hist->magic), __ATOMIC_ACQUIRE) != LOGC_LATENCY_MAGIC)
+        return 0;
+
+    uint32_t ticks_per_ms = hist->ticks_per_ms > 0 ? hist->ticks_per_ms : 1;
+    uint32_t n_threads = __atomic_load_n(&(hist->n_slots), __ATOMIC_RELAXED);
+    int n_slots = n_threads < LOGC_LATENCY_SLOTS ? n_threads : LOGC_LATENCY_SLOTS;
+
+    len = snprintf(buff, size, "latency pid=%u period=%u threads=%u", c_info->stats.pid, hist->period, n_threads);
+
+    for(int stage = 0; stage < LOGC_LATENCY_STAGES && len < size; ++stage) {
+        uint64_t n = 0;
+
+        memset(counts, 0, sizeof(counts));
+        for(int i = 0; i < n_slots; ++i) {
+            for(int b = 0; b < LOGC_LATENCY_BUCKETS; ++b)
+                counts[b] += __atomic_load_n(&(hist->slots[i].counts[stage][b]), __ATOMIC_RELAXED);
+        }
+        for(int b = 0; b < LOGC_LATENCY_BUCKETS; ++b)
+            n += counts[b];
+
+        len += snprintf(buff + len, size - len, " %s_samples=%llu %s_p50_ns=%llu %s_p99_ns=%llu %s_p999_ns=%llu %s_max_ns=%llu",
+                        stage_names[stage], (unsigned long long)n,
+                        stage_names[stage], (unsigned long long)call_latency_percentile(counts, n, 50, ticks_per_ms),
+                        stage_names[stage], (unsigned long long)call_latency_percentile(counts, n, 99, ticks_per_ms),
+                        stage_names[stage], (unsigned long long)call_latency_percentile(counts, n, 99.9, ticks_per_ms),
+                        stage_names[stage], (unsigned long long)call_latency_percentile(counts, n, 100, ticks_per_ms));
+    }
+
+    if(len < size)
+        len += snprintf(buff + len, size - len, "\n");
+
+    return len;
+}
+
+/**
+ * write the lines of the noisiest callsites of a client, by the bytes logged
+ *
+ * @returns length of the lines, 0 if the client has logged nothing
+ */
+static int
+report_client_callsites(char *buff, int size, struct client_info *c_info)
+{
+    struct logc_callsites *table = logc_segment_callsites(c_info->segment);
+    struct logc_callsite_entry *top[STATS_TOP_CALLSITES];
+    uint64_t top_bytes[STATS_TOP_CALLSITES];
+    int n_top = 0;
+    int len;
+
+    uint32_t n_callsites = __atomic_load_n(&(table->n_callsites), __ATOMIC_RELAXED);
+    if(n_callsites == 0)
+        return 0;
+
+    // insertion into the short list of the noisiest
+    for(int i = 0; i < LOGC_CALLSITES; ++i) {
+        struct logc_callsite_entry *entry = &(table->entries[i]);
+
+        if(__atomic_load_n(&(entry->line), __ATOMIC_ACQUIRE) == 0)
+            continue;
+
+        uint64_t bytes = __atomic_load_n(&(entry->bytes), __ATOMIC_RELAXED);
+        int pos = n_top < STATS_TOP_CALLSITES ? n_top++ : STATS_TOP_CALLSITES;
+
+        for(; pos > 0 && top_bytes[pos - 1] < bytes; --pos) {
+            if(pos < STATS_TOP_CALLSITES) {
+                top[pos] = top[pos - 1];
+                top_bytes[pos] = top_bytes[pos - 1];
+            }
+        }
+        if(pos < STATS_TOP_CALLSITES) {
+            top[pos] = entry;
+            top_bytes[pos] = bytes;
+        }
+    }
+
+    len = snprintf(buff, size, "callsites pid=%u count=%u untracked_messages=%llu\n", c_info->stats.pid, n_callsites,
+                   (unsigned long long)__atomic_load_n(&(table->untracked), __ATOMIC_RELAXED));
+
+    for(int i = 0; i < n_top && len < size; ++i) {
+        char file[LOGC_CALLSITE_FILE_LEN];
+
+        memcpy(file, top[i]->file, LOGC_CALLSITE_FILE_LEN);
+        file[LOGC_CALLSITE_FILE_LEN - 1] = '\0';
+
+        len += snprintf(buff + len, size - len, "callsite pid=%u rank=%d id=%08x file=%s line=%u messages=%llu bytes=%llu\n",
+                        c_info->stats.pid, i + 1, top[i]->id, file, top[i]->line,
+                        (unsigned long long)__atomic_load_n(&(top[i]->messages), __ATOMIC_RELAXED),
+                        (unsigned long long)top_bytes[i]);
+    }
+
+    return len;
+}
+
+int
+stats_report(char *buff, int size)
+{
+    int len;
+
+    pthread_mutex_lock(&clients_lock);
+
+    len = snprintf(buff, size, "server time=%lld accepts=%llu active_clients=%d\n", (long long)time(NULL),
+                   (unsigned long long)__atomic_load_n(&n_accepts, __ATOMIC_RELAXED), n_clients);
+
+    // connections without a segment, like the subscribers, have nothing drained
+    for(struct stats_node *node = clients; node != NULL && len < size; node = node->next) {
+        if(__atomic_load_n(&(node->c_info->stats.pid), __ATOMIC_RELAXED) != 0) {
+            len += report_client(buff + len, size - len, node->c_info);
+            if(len < size)
+                len += report_client_latency(buff + len, size - len, node->c_info);
+            if(len < size)
+                len += report_client_callsites(buff + len, size - len, node->c_info);
+        }
+    }
+
+    pthread_mutex_unlock(&clients_lock);
+
+    return len < size ? len : size - 1;
+}
+
+void
+stats_dump(time_t now)
+{
+    static char report[STATS_MAX_REPORT_SIZE];
+
+    if(stats_interval <= 0)
+        return;
+
+    if(next_dump == 0)
+        next_dump = now + stats_interval;
+    if(now < next_dump)
+        return;
+    next_dump = now + stats_interval;
+
+    FILE *fp = fopen(STATS_DUMP_FILE, "a");
+    if(fp == NULL) {
+        logc_server_log("Cannot open stats dump file: %s", strerror(errno));
+        return;
+    }
+
+    fwrite(report, 1, stats_report(report, sizeof(report)), fp);
+    fclose(fp);
+}
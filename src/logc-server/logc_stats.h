@@ -0,0 +1,189 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc stats
+ * Metrics of the server, reported for a stats request and dumped periodically
+ *
+ * Every client has its own counters, written only by the thread that serves the
+ * client, so counting takes no lock and no atomic read-modify-write. A report reads
+ * the counters of the other threads with relaxed loads. The write syscalls of a
+ * thread are counted by the files opened with stats_fopen.
+ */
+
+#ifndef LOGC_STATS_H
+#define LOGC_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define STATS_LATENCY_BUCKETS   32          // bucket i counts the drains or waits of [2^i, 2^(i+1)) nanoseconds
+#define STATS_MAX_REPORT_SIZE   (64 * 1024)
+#define STATS_TOP_CALLSITES     10          // noisiest callsites reported for a client
+#define STATS_DUMP_FILE         "logc_server.stats"
+
+struct client_info;
+
+struct client_stats
+{
+    /* pid of the client, 0 if the connection has no segment */
+    uint32_t pid;
+
+    /* bytes written to the log files and number of drains of a channel */
+    uint64_t bytes_drained;
+    uint64_t n_drains;
+
+    /* histogram of the time taken by a drain of a channel */
+    uint64_t drain_latency[STATS_LATENCY_BUCKETS];
+
+    /* highest fill of a ring seen by a drain, in bytes and percent of the ring size */
+    uint32_t ring_high_water;
+    uint32_t ring_high_water_pct;
+
+    /* drains that found a ring overwritten, and the estimated bytes overwritten */
+    uint64_t n_overflows;
+    uint64_t bytes_dropped;
+
+    /* write syscalls to the log files by the thread of the client */
+    uint64_t n_write_syscalls;
+
+    /* bytes dropped by the routes, see logc_route.h */
+    uint64_t bytes_filtered;
+
+    /* repeated messages not written, see logc_collapse.h */
+    uint64_t messages_collapsed;
+
+    /* bulk rings moved to a bigger and to a smaller ring, see logc_grow.h */
+    uint64_t n_ring_grows;
+    uint64_t n_ring_shrinks;
+
+    /* drains that waited for a drain slot, and the histogram of the wait, see logc_sched.h */
+    uint64_t n_sched_waits;
+    uint64_t sched_wait[STATS_LATENCY_BUCKETS];
+};
+
+/* seconds between the periodic dumps, 0 for no dump */
+extern int stats_interval;
+
+/**
+ * add to a counter, only the thread serving the client writes its counters
+ */
+#define stats_add(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+/**
+ * set a counter to a value if it is higher
+ */
+#define stats_max(counter, n) do { if((n) > (counter)) __atomic_store_n(&(counter), (n), __ATOMIC_RELAXED); } while(0)
+
+/**
+ * add a client to the report, set the client counters of the calling thread
+ *
+ * @param c_info: client served by the calling thread
+ */
+void stats_register(struct client_info *c_info);
+
+/**
+ * remove a client from the report, before its segment is unmapped
+ * removing a client again does nothing
+ *
+ * @param c_info: client
+ */
+void stats_unregister(struct client_info *c_info);
+
+/**
+ * set the client whose counters get the write syscalls of the calling thread
+ *
+ * @param c_info: client, NULL for none
+ */
+void stats_set_thread_client(struct client_info *c_info);
+
+/**
+ * count a drain of a channel
+ *
+ * @param stats: counters of the client
+ * @param n_bytes: bytes drained
+ * @param latency: time taken, nanoseconds
+ */
+void stats_drain(struct client_stats *stats, int n_bytes, int64_t latency);
+
+/**
+ * count a drain that waited for a drain slot
+ *
+ * @param stats: counters of the client
+ * @param wait: time waited, nanoseconds
+ */
+void stats_sched_wait(struct client_stats *stats, int64_t wait);
+
+/**
+ * open a file whose write syscalls are counted for the client of the writing thread
+ *
+ * @param path: path of the file
+ * @param mode: "w" or "a"
+ * @returns file, NULL on failure
+ */
+FILE *stats_fopen(char *path, char *mode);
+
+/**
+ * write the report of the server and its clients
+ *
+ * @param buff: buffer of the report
+ * @param size: size of the buffer
+ * @returns length of the report
+ */
+int stats_report(char *buff, int size);
+
+/**
+ * append the report to STATS_DUMP_FILE if the dump interval has ended
+ *
+ * @param now: current time
+ */
+void stats_dump(time_t now);
+
+/**
+ * count an accepted connection
+ */
+void stats_accepted();
+
+/**
+ * call a function for every client with a segment, under the lock of the clients
+ * the segments stay mapped until the function returns
+ *
+ * @param fn: function called with a client and arg
+ * @param arg: argument of fn
+ * @returns number of clients
+ */
+int stats_foreach_client(void (*fn)(struct client_info *c_info, void *arg), void *arg);
+
+/**
+ * call a function that changes a client, under the lock of the clients
+ * the report never reads a client half changed
+ *
+ * @param c_info: client
+ * @param fn: function called with the client and arg
+ * @param arg: argument of fn
+ */
+void stats_update_client(struct client_info *c_info, void (*fn)(struct client_info *c_info, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE       // for memmem
+
+#include "logc_subscriber.h"
+#include "logc_server_utils.h"
+#include "../common/logc_subscribe.h"
+#include "../common/logc_record.h"
+#include "../common/logc_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// a subscriber gets a shared memory named /logc_sub_<pid>_<n> with the first unused n
+#define MAX_SUBSCRIPTIONS_PER_PID   64
+
+
+struct subscriber
+{
+    /* connection of the subscriber */
+    struct client_info *c_info;
+
+    /* shared memory of the subscription */
+    char shm_name[MAX_FILE_PATH_SIZE];
+    struct logc_subscription *sub;
+
+    /* filters */
+    int level;
+    uint32_t pid;
+    char pattern[MAX_SUBSCRIBE_PATTERN_SIZE];
+    int pattern_len;
+
+    struct subscriber *next;
+};
+
+static struct subscriber *subscribers;
+static int n_subscribers;
+static pthread_rwlock_t subscribers_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+int
+subscriber_add(struct client_info *c_info, uint32_t peer_pid, int level, uint32_t pid, char *pattern, char *shm_name)
+{
+    size_t size = logc_subscription_size();
+    struct logc_subscription *sub = NULL;
+
+    for(int n = 0; sub == NULL && n < MAX_SUBSCRIPTIONS_PER_PID; ++n) {
+        sprintf(shm_name, "/logc_sub_%u_%d", peer_pid, n);
+        sub = (struct logc_subscription *)create_shared_mem(shm_name, size);
+        if(sub == NULL && errno != EEXIST)
+            break;
+    }
+    if(sub == NULL) {
+        logc_server_log("Cannot create subscription shared memory. shm_name: %s, error: %s", shm_name, strerror(errno));
+        return -1;
+    }
+
+    struct logc_buffer *ring;
+    logc_buffer_map_and_init(ring, logc_subscription_ring(sub), LOGC_SUBSCRIPTION_RING_SIZE, LOGC_SUBSCRIPTION_RING_SIZE);
+    sub->state = LOGC_SUBSCRIPTION_ACTIVE;
+    sub->n_lines = 0;
+    sub->magic = LOGC_SUBSCRIPTION_MAGIC;
+
+    struct subscriber *s = (struct subscriber *)calloc(1, sizeof(struct subscriber));
+    s->c_info = c_info;
+    strcpy(s->shm_name, shm_name);
+    s->sub = sub;
+    s->level = level;
+    s->pid = pid;
+    strcpy(s->pattern, pattern);
+    s->pattern_len = strlen(pattern);
+
+    pthread_rwlock_wrlock(&subscribers_lock);
+    s->next = subscribers;
+    subscribers = s;
+    __atomic_add_fetch(&n_subscribers, 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&subscribers_lock);
+
+    logc_server_log("Subscriber added. fd: %d, shm_name: %s, level: %d, pid: %u, pattern: %s",
+                    c_info->fd, shm_name, level, pid, pattern);
+    return 0;
+}
+
+void
+subscriber_remove(struct client_info *c_info)
+{
+    struct subscriber *s = NULL;
+
+    pthread_rwlock_wrlock(&subscribers_lock);
+    for(struct subscriber **p = &subscribers; *p != NULL; p = &((*p)->next)) {
+        if((*p)->c_info == c_info) {
+            s = *p;
+            *p = s->next;
+            __atomic_sub_fetch(&n_subscribers, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&subscribers_lock);
+
+    if(s == NULL)
+        return;
+
+    // logc-tail removes the shared memory once it is mapped, unlink in case it did not
+    munmap(s->sub, logc_subscription_size());
+    shm_unlink(s->shm_name);
+
+    logc_server_log("Subscriber removed. fd: %d, shm_name: %s", c_info->fd, s->shm_name);
+    free(s);
+}
+
+/**
+ * check if a line passes the filters of a subscriber
+ */
+static inline int
+line_matches(struct subscriber *s, int level, char *line, int len)
+{
+    if(level < s->level)
+        return 0;
+
+    return s->pattern_len == 0 || memmem(line, len, s->pattern, s->pattern_len) != NULL;
+}
+
+/**
+ * write the lines that pass the filters of a subscriber to its ring
+ */
+static void
+publish(struct subscriber *s, int structured, char *buff, int len)
+{
+    char out[MAX_LOG_BUFF_SIZE];
+    int n = 0;
+    int n_lines = 0;
+
+    if(structured) {
+        struct logc_record rec;
+        char *msg;
+        int off = 0;
+
+        while((msg = logc_record_next(buff, len, &off, &rec)) != NULL) {
+            if(line_matches(s, rec.level, msg, rec.len)) {
+                memcpy(out + n, msg, rec.len);
+                n += rec.len;
+                n_lines++;
+            }
+        }
+    }
+    else {
+        // a text line has no level, it only passes when there is no level filter
+        for(char *line = buff, *end = buff + len; line < end; ) {
+            char *eol = memchr(line, '\n', end - line);
+            char *next = eol != NULL ? eol + 1 : end;
+
+            if(line_matches(s, 0, line, next - line)) {
+                memcpy(out + n, line, next - line);
+                n += next - line;
+                n_lines++;
+            }
+            line = next;
+        }
+    }
+
+    if(n == 0)
+        return;
+
+    // drop the subscriber before its unread lines can be overwritten
+    struct logc_buffer *ring = logc_subscription_ring(s->sub);
+    if(logc_buffer_used(ring) + n > ring->size / 2) {
+        if(__atomic_exchange_n(&(s->sub->state), LOGC_SUBSCRIPTION_DROPPED, __ATOMIC_RELEASE) == LOGC_SUBSCRIPTION_ACTIVE)
+            logc_server_log("Subscriber dropped, too slow. fd: %d, shm_name: %s", s->c_info->fd, s->shm_name);
+        return;
+    }
+
+    logc_buffer_write(ring, out, n);
+    __atomic_add_fetch(&(s->sub->n_lines), n_lines, __ATOMIC_RELAXED);
+}
+
+void
+subscriber_publish(struct client_info *c_info, int channel, char *buff, int len)
+{
+    if(__atomic_load_n(&n_subscribers, __ATOMIC_RELAXED) == 0)
+        return;
+
+    int structured = logc_format_structured(c_info->channels[channel].format);
+    uint32_t pid = c_info->segment->pid;
+
+    pthread_rwlock_rdlock(&subscribers_lock);
+    for(struct subscriber *s = subscribers; s != NULL; s = s->next) {
+        if(__atomic_load_n(&(s->sub->state), __ATOMIC_ACQUIRE) != LOGC_SUBSCRIPTION_ACTIVE)
+            continue;
+
+        if(s->pid == 0 || s->pid == pid)
+            publish(s, structured, buff, len);
+    }
+    pthread_rwlock_unlock(&subscribers_lock);
+}
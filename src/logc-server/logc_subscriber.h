@@ -0,0 +1,72 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Logc subscriber
+ * Live subscribers of the drained logs, see logc_subscribe.h
+ *
+ * Every drain of a channel is published to the subscribers whose filters it passes.
+ * Publishing only writes to the rings of the subscribers, it never waits for them.
+ */
+
+#ifndef LOGC_SUBSCRIBER_H
+#define LOGC_SUBSCRIBER_H
+
+#include "logc_server.h"
+
+#include <stdint.h>
+
+#define MAX_SUBSCRIBE_PATTERN_SIZE  64
+
+/**
+ * add a subscriber, create its shared memory
+ *
+ * @param c_info: connection of the subscriber
+ * @param peer_pid: pid of the subscriber process
+ * @param level: minimum level of the lines, 0 for all the lines
+ * @param pid: pid of the client to subscribe to, 0 for all the clients
+ * @param pattern: substring the lines must have, empty for all the lines
+ * @param shm_name: set to the name of the shared memory of the subscription
+ * @returns 0 on success, -1 on failure
+ */
+int subscriber_add(struct client_info *c_info, uint32_t peer_pid, int level, uint32_t pid, char *pattern, char *shm_name);
+
+/**
+ * remove the subscriber of a connection, if the connection has one
+ *
+ * @param c_info: connection of the subscriber
+ */
+void subscriber_remove(struct client_info *c_info);
+
+/**
+ * publish the drained logs of a channel to the subscribers
+ *
+ * @param c_info: client of the channel
+ * @param channel: channel id
+ * @param buff: drained logs
+ * @param len: length of the drained logs
+ */
+void subscriber_publish(struct client_info *c_info, int channel, char *buff, int len);
+
+#endif
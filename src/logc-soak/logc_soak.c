@@ -0,0 +1,674 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-soak
+ * Soak test of the logc server with client processes killed while they write
+ *
+ * usage: logc-soak [-c clients] [-r rate] [-t seconds] [-k interval] [-s size]
+ *                  [-l lost] [-S server] [-d dir] [-K]
+ *     -c  client processes, 4 by default
+ *     -r  messages a second of a client, 0 for as fast as possible, 2000 by default
+ *     -t  seconds to run, 10 by default
+ *     -k  mean milliseconds between the kills of a random client, 0 for no kill, 500 by default
+ *     -s  message size, 100 by default
+ *     -l  lost messages allowed, 0 by default
+ *     -S  logc server binary, started in dir if no server is running
+ *     -d  directory of the log files, a new directory in /tmp by default
+ *     -K  keep the log files, they are kept anyway if the test fails
+ *
+ * Every client process logs sequence numbered messages to its own log file, with the
+ * time it was logged and a checksum. A killed client is replaced by a new process with
+ * a new log file. The log files are followed while the clients run, for the drain lag,
+ * the time from logging a message to finding it in the log file.
+ *
+ * When the clients are done, every log file must have the messages logged by its
+ * process, in order, once and intact. A killed process can leave a torn message at
+ * the end of its log file. The report is a line of key=value fields, the exit status
+ * is 0 if the test passed, 1 if it failed.
+ */
+
+#include "../logc-client/logc.h"
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAX_CLIENTS     64
+#define MAX_MSG_SIZE    900
+#define LAG_BUCKETS     32          // bucket i counts the lags of [2^i, 2^(i+1)) microseconds
+#define READ_SIZE       (64 * 1024)
+#define SETTLE_SECONDS  5           // wait for the last logs after the clients are done
+
+// progress of a client process, shared with the harness
+struct soak_progress
+{
+    uint64_t logged;                // messages logged
+};
+
+// a log file, of a client process
+struct soak_file
+{
+    int slot;
+    int gen;
+    pid_t pid;
+    int killed;
+    int done;                       // the process has exited
+    uint64_t logged;                // messages logged by the process, once done
+    char path[MAX_FILE_PATH_SIZE];
+
+    // follower of the log file
+    off_t offset;
+    char partial[MAX_MSG_SIZE + 256];
+    int partial_len;
+
+    // sequence numbers found
+    uint8_t *seen;
+    uint64_t seen_size;
+    uint64_t max_seq;
+    uint64_t found;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t corrupted;
+    uint64_t last_corrupted;        // found count when the last corrupt line was found
+};
+
+static int n_clients = 4;
+static int rate = 2000;
+static int seconds = 10;
+static int kill_interval = 500;
+static int msg_size = 100;
+static uint64_t max_lost = 0;
+static char *dir;
+
+static struct soak_progress *progress;
+static struct soak_file *files;
+static int n_files;
+static int slot_file[MAX_CLIENTS];
+static uint64_t lag_hist[LAG_BUCKETS];
+static uint64_t n_lags;
+
+static volatile sig_atomic_t stop;
+
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Checksum of the fields of a message
+ */
+static uint32_t
+checksum(int slot, int gen, uint64_t seq, uint64_t ts)
+{
+    uint64_t fields[] = { slot, gen, seq, ts };
+    uint8_t *p = (uint8_t *)fields;
+    uint32_t h = 2166136261u;
+
+    for(int i = 0; i < sizeof(fields); ++i)
+        h = (h ^ p[i]) * 16777619u;
+
+    return h;
+}
+
+static void
+stop_handler(int sig)
+{
+    stop = 1;
+}
+
+/**
+ * Client process, logs until SIGTERM
+ * message: soak <slot> <gen> <seq> <time ns> <checksum> <padding>
+ */
+static void
+client_main(int slot, int gen, char *path)
+{
+    struct soak_progress *p = &(progress[slot]);
+    char pad[MAX_MSG_SIZE];
+    uint64_t start = now_ns();
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    signal(SIGTERM, stop_handler);
+
+    struct logc_handle *handle = logc_handle_init(path, ALL, false);
+    if(logc_connect(handle) == -1)
+        _exit(2);
+
+    for(uint64_t seq = 0; !stop; ++seq) {
+        // keep to the rate, in bursts of a millisecond
+        while(rate > 0 && !stop && seq * 1000000000 / rate > now_ns() - start)
+            usleep(1000);
+
+        int pad_len = msg_size - 60;
+        memset(pad, 'a' + seq % 26, pad_len > 0 ? pad_len : 0);
+        pad[pad_len > 0 ? pad_len : 0] = '\0';
+
+        uint64_t ts = now_ns();
+        logc_info(handle, "soak %d %d %llu %llu %08x %s", slot, gen, (unsigned long long)seq,
+                  (unsigned long long)ts, checksum(slot, gen, seq, ts), pad);
+
+        __atomic_store_n(&(p->logged), seq + 1, __ATOMIC_RELEASE);
+    }
+
+    logc_close(handle);
+    _exit(0);
+}
+
+/**
+ * Start a client process in a slot, with a new log file
+ */
+static int
+start_client(int slot, int gen)
+{
+    struct soak_file *f;
+
+    files = (struct soak_file *)realloc(files, (n_files + 1) * sizeof(struct soak_file));
+    f = &(files[n_files]);
+    memset(f, 0, sizeof(*f));
+    f->slot = slot;
+    f->gen = gen;
+    snprintf(f->path, sizeof(f->path), "%s/soak_%d_%d.log", dir, slot, gen);
+
+    __atomic_store_n(&(progress[slot].logged), 0, __ATOMIC_RELEASE);
+
+    pid_t pid = fork();
+    if(pid == -1)
+        return -1;
+    if(pid == 0)
+        client_main(slot, gen, f->path);
+
+    f->pid = pid;
+    slot_file[slot] = n_files++;
+    return 0;
+}
+
+static void
+seen_set(struct soak_file *f, uint64_t seq)
+{
+    if(seq >= f->seen_size * 8) {
+        uint64_t size = f->seen_size * 2 > seq / 8 + 1 ? f->seen_size * 2 : seq / 8 + 1024;
+        f->seen = (uint8_t *)realloc(f->seen, size);
+        memset(f->seen + f->seen_size, 0, size - f->seen_size);
+        f->seen_size = size;
+    }
+
+    f->seen[seq / 8] |= 1 << (seq % 8);
+}
+
+static int
+seen_get(struct soak_file *f, uint64_t seq)
+{
+    return seq < f->seen_size * 8 && (f->seen[seq / 8] & (1 << (seq % 8))) != 0;
+}
+
+/**
+ * Check a line of a log file
+ * line: date time | file | func | line | soak ...
+ */
+static void
+check_line(struct soak_file *f, char *line, uint64_t now)
+{
+    int slot, gen, consumed = 0;
+    unsigned long long seq, ts;
+    unsigned int sum;
+    char *msg = NULL;
+
+    for(char *p = strstr(line, " | "); p != NULL; p = strstr(p + 3, " | "))
+        msg = p + 3;
+
+    if(msg == NULL || sscanf(msg, "soak %d %d %llu %llu %08x %n", &slot, &gen, &seq, &ts, &sum, &consumed) != 5 ||
+       consumed == 0 || slot != f->slot || gen != f->gen || sum != checksum(slot, gen, seq, ts)) {
+        f->corrupted++;
+        f->last_corrupted = f->found;
+        return;
+    }
+
+    // the padding is a single letter
+    for(char *p = msg + consumed; *p != '\0'; ++p) {
+        if(*p != 'a' + seq % 26) {
+            f->corrupted++;
+            f->last_corrupted = f->found;
+            return;
+        }
+    }
+
+    if(seen_get(f, seq)) {
+        f->duplicated++;
+        return;
+    }
+    if(f->found > 0 && seq < f->max_seq)
+        f->reordered++;
+
+    seen_set(f, seq);
+    f->found++;
+    if(seq > f->max_seq)
+        f->max_seq = seq;
+
+    // drain lag, upto the time the line is read
+    if(now > ts) {
+        uint64_t us = (now - ts) / 1000;
+        int bucket = us > 1 ? 63 - __builtin_clzll(us) : 0;
+        lag_hist[bucket < LAG_BUCKETS ? bucket : LAG_BUCKETS - 1]++;
+        n_lags++;
+    }
+}
+
+/**
+ * Read the new lines of a log file
+ *
+ * @returns bytes read
+ */
+static int
+follow_file(struct soak_file *f)
+{
+    static char buff[READ_SIZE];
+    int total = 0;
+
+    int fd = open(f->path, O_RDONLY);
+    if(fd == -1)
+        return 0;
+
+    for(;;) {
+        ssize_t n = pread(fd, buff, sizeof(buff), f->offset);
+        if(n <= 0)
+            break;
+
+        uint64_t now = now_ns();
+        f->offset += n;
+        total += n;
+
+        for(ssize_t i = 0; i < n; ++i) {
+            if(buff[i] == '\n') {
+                f->partial[f->partial_len] = '\0';
+                check_line(f, f->partial, now);
+                f->partial_len = 0;
+            }
+            else if(f->partial_len < sizeof(f->partial) - 1) {
+                f->partial[f->partial_len++] = buff[i];
+            }
+        }
+    }
+
+    close(fd);
+    return total;
+}
+
+static int
+follow_files()
+{
+    int total = 0;
+
+    for(int i = 0; i < n_files; ++i)
+        total += follow_file(&(files[i]));
+
+    return total;
+}
+
+/**
+ * Reap the exited client processes, and record what they logged
+ */
+static void
+reap_clients()
+{
+    int status;
+    pid_t pid;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for(int i = 0; i < n_files; ++i) {
+            struct soak_file *f = &(files[i]);
+
+            if(f->pid == pid && !f->done) {
+                f->done = 1;
+                f->logged = __atomic_load_n(&(progress[f->slot].logged), __ATOMIC_ACQUIRE);
+                if(WIFEXITED(status) && WEXITSTATUS(status) == 2)
+                    fprintf(stderr, "logc-soak: client %d cannot connect to the logc server\n", f->slot);
+            }
+        }
+    }
+}
+
+static int
+server_running()
+{
+    struct sockaddr_un server_addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int ret;
+
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    ret = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0;
+
+    close(fd);
+    return ret;
+}
+
+/**
+ * Start the logc server in dir if none is running
+ *
+ * @returns pid of the started server, 0 if a server is running or none could be started
+ */
+static pid_t
+start_server(char *server)
+{
+    if(server == NULL || server_running())
+        return 0;
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if(chdir(dir) == 0)
+            execl(server, server, (char *)NULL);
+        _exit(127);
+    }
+
+    // wait for the server to listen
+    for(int i = 0; pid > 0 && i < 200 && !server_running(); ++i)
+        usleep(10000);
+
+    return pid > 0 ? pid : 0;
+}
+
+static uint64_t
+lag_percentile(double pct)
+{
+    uint64_t rank = pct < 100 ? (uint64_t)(n_lags * pct / 100.0) : n_lags - 1;
+    uint64_t seen = 0;
+
+    if(n_lags == 0)
+        return 0;
+
+    for(int i = 0; i < LAG_BUCKETS; ++i) {
+        seen += lag_hist[i];
+        if(seen > rank)
+            return 2ULL << i;
+    }
+
+    return 2ULL << (LAG_BUCKETS - 1);
+}
+
+static void
+remove_files()
+{
+    char path[MAX_FILE_PATH_SIZE + 256];
+    struct dirent *entry;
+    DIR *d = opendir(dir);
+
+    if(d == NULL)
+        return;
+
+    while((entry = readdir(d)) != NULL) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-soak [-c clients] [-r rate] [-t seconds] [-k interval] [-s size]\n"
+                    "                 [-l lost] [-S server] [-d dir] [-K]\n"
+                    "    -c  client processes, 4 by default\n"
+                    "    -r  messages a second of a client, 0 for as fast as possible, 2000 by default\n"
+                    "    -t  seconds to run, 10 by default\n"
+                    "    -k  mean milliseconds between the kills of a random client, 0 for no kill, 500 by default\n"
+                    "    -s  message size, 100 by default\n"
+                    "    -l  lost messages allowed, 0 by default\n"
+                    "    -S  logc server binary, started in dir if no server is running\n"
+                    "    -d  directory of the log files, a new directory in /tmp by default\n"
+                    "    -K  keep the log files, they are kept anyway if the test fails\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    char tmp_dir[] = "/tmp/logc_soak_XXXXXX";
+    char *server = NULL;
+    int keep = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "c:r:t:k:s:l:S:d:Kh")) != -1) {
+        switch(opt) {
+        case 'c':
+            n_clients = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'k':
+            kill_interval = atoi(optarg);
+            break;
+        case 's':
+            msg_size = atoi(optarg);
+            break;
+        case 'l':
+            max_lost = strtoull(optarg, NULL, 10);
+            break;
+        case 'S':
+            server = realpath(optarg, NULL);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'K':
+            keep = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if(n_clients <= 0 || n_clients > MAX_CLIENTS || rate < 0 || seconds <= 0 || kill_interval < 0 ||
+       msg_size < 64 || msg_size > MAX_MSG_SIZE) {
+        usage();
+        return 1;
+    }
+
+    if(dir == NULL) {
+        dir = mkdtemp(tmp_dir);
+        if(dir == NULL) {
+            fprintf(stderr, "logc-soak: cannot create a directory: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    progress = (struct soak_progress *)mmap(NULL, MAX_CLIENTS * sizeof(struct soak_progress), PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(progress == MAP_FAILED) {
+        fprintf(stderr, "logc-soak: %s\n", strerror(errno));
+        return 1;
+    }
+
+    pid_t server_pid = start_server(server);
+    if(!server_running()) {
+        fprintf(stderr, "logc-soak: no logc server is running\n");
+        return 1;
+    }
+
+    signal(SIGINT, stop_handler);
+    srand(getpid());
+
+    int gens[MAX_CLIENTS] = { 0 };
+    for(int i = 0; i < n_clients; ++i)
+        start_client(i, 0);
+
+    // kill a random client now and then, follow the log files
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * 1000000000;
+    uint64_t next_kill = kill_interval > 0 ? start + (uint64_t)(rand() % (2 * kill_interval)) * 1000000 : end;
+    int kills = 0;
+
+    while(!stop && now_ns() < end) {
+        usleep(10000);
+        follow_files();
+        reap_clients();
+
+        if(now_ns() >= next_kill) {
+            int slot = rand() % n_clients;
+            struct soak_file *f = &(files[slot_file[slot]]);
+
+            if(!f->done) {
+                kill(f->pid, SIGKILL);
+                waitpid(f->pid, NULL, 0);
+                f->killed = 1;
+                f->done = 1;
+                f->logged = __atomic_load_n(&(progress[slot].logged), __ATOMIC_ACQUIRE);
+                kills++;
+
+                start_client(slot, ++gens[slot]);
+            }
+
+            next_kill = now_ns() + (uint64_t)(rand() % (2 * kill_interval) + 1) * 1000000;
+        }
+    }
+
+    // stop the clients, they close their handles
+    uint64_t run_ns = now_ns() - start;
+    for(int i = 0; i < n_files; ++i) {
+        if(!files[i].done)
+            kill(files[i].pid, SIGTERM);
+    }
+
+    for(int i = 0; i < n_files; ++i) {
+        struct soak_file *f = &(files[i]);
+        if(f->done)
+            continue;
+
+        int status;
+        waitpid(f->pid, &status, 0);
+        f->done = 1;
+        f->logged = __atomic_load_n(&(progress[f->slot].logged), __ATOMIC_ACQUIRE);
+    }
+
+    // the server drains the segments of the closed and the killed clients
+    uint64_t settle_end = now_ns() + (uint64_t)SETTLE_SECONDS * 1000000000;
+    for(;;) {
+        follow_files();
+
+        int complete = 1;
+        for(int i = 0; i < n_files && complete; ++i)
+            complete = files[i].found >= files[i].logged;
+
+        if(complete || now_ns() >= settle_end)
+            break;
+        usleep(100000);
+    }
+
+    if(server_pid > 0) {
+        kill(server_pid, SIGINT);
+        waitpid(server_pid, NULL, 0);
+    }
+
+    // a killed process can tear the message it was writing
+    uint64_t logged = 0, delivered = 0, lost = 0, duplicated = 0, reordered = 0, corrupted = 0, torn = 0;
+    for(int i = 0; i < n_files; ++i) {
+        struct soak_file *f = &(files[i]);
+        uint64_t file_corrupted = f->corrupted;
+
+        if(f->partial_len > 0)
+            file_corrupted++;
+
+        if(f->killed && file_corrupted == 1 && (f->partial_len > 0 || f->last_corrupted == f->found)) {
+            torn++;
+            file_corrupted = 0;
+        }
+
+        // a killed process can have logged one message more than it counted
+        uint64_t expected = f->logged;
+        if(f->killed && seen_get(f, expected))
+            expected++;
+
+        uint64_t file_lost = 0;
+        for(uint64_t seq = 0; seq < expected; ++seq) {
+            if(!seen_get(f, seq))
+                file_lost++;
+        }
+
+        if(file_lost > 0 || f->duplicated > 0 || f->reordered > 0 || file_corrupted > 0)
+            fprintf(stderr, "logc-soak: %s killed=%d logged=%llu found=%llu lost=%llu duplicated=%llu reordered=%llu corrupted=%llu\n",
+                    f->path, f->killed, (unsigned long long)expected, (unsigned long long)f->found,
+                    (unsigned long long)file_lost, (unsigned long long)f->duplicated,
+                    (unsigned long long)f->reordered, (unsigned long long)file_corrupted);
+
+        lost += file_lost;
+        logged += expected;
+        delivered += f->found;
+        duplicated += f->duplicated;
+        reordered += f->reordered;
+        corrupted += file_corrupted;
+    }
+
+    int passed = lost <= max_lost && duplicated == 0 && reordered == 0 && corrupted == 0;
+
+    printf("soak clients=%d rate=%d seconds=%.1f kills=%d processes=%d logged=%llu delivered=%llu lost=%llu "
+           "duplicated=%llu reordered=%llu corrupted=%llu torn=%llu throughput_msgs_per_sec=%.0f "
+           "drain_lag_p50_us=%llu drain_lag_p99_us=%llu drain_lag_max_us=%llu result=%s\n",
+           n_clients, rate, run_ns / 1e9, kills, n_files,
+           (unsigned long long)logged, (unsigned long long)delivered, (unsigned long long)lost,
+           (unsigned long long)duplicated, (unsigned long long)reordered, (unsigned long long)corrupted,
+           (unsigned long long)torn, delivered / (run_ns / 1e9),
+           (unsigned long long)lag_percentile(50), (unsigned long long)lag_percentile(99),
+           (unsigned long long)lag_percentile(100), passed ? "PASS" : "FAIL");
+
+    if(passed && !keep)
+        remove_files();
+    else
+        fprintf(stderr, "logc-soak: log files in %s\n", dir);
+
+    for(int i = 0; i < n_files; ++i)
+        free(files[i].seen);
+    free(files);
+    free(server);
+
+    return passed ? 0 : 1;
+}
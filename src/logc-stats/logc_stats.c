@@ -0,0 +1,155 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-stats
+ * Writes the metrics of the logc server to stdout
+ *
+ * usage: logc-stats [-i interval]
+ *     -i  write the metrics every interval seconds
+ *
+ * Every report has a server line and lines for every client, with key=value fields:
+ *     server time accepts active_clients
+ *     client pid fd drained_bytes drains drain_p50_ns drain_p99_ns drain_max_ns
+ *            ring_high_water ring_high_water_pct overflows dropped_bytes write_syscalls filtered_bytes
+ *            collapsed_messages ring_grows ring_shrinks weight sched_waits sched_wait_p50_ns sched_wait_p99_ns sched_wait_max_ns
+ *     latency pid period threads, and <stage>_samples <stage>_p50_ns <stage>_p99_ns
+ *             <stage>_p999_ns <stage>_max_ns of the stages total, format, ring and doorbell,
+ *             if the client samples its log calls
+ *     callsites pid count untracked_messages
+ *     callsite pid rank id file line messages bytes, for the noisiest callsites
+ * The latencies are upper bounds of histogram buckets.
+ */
+
+#include "../common/logc_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/**
+ * Connect to the logc server
+ *
+ * @returns connection fd, -1 on failure
+ */
+static int
+server_connect()
+{
+    struct sockaddr_un server_addr;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    if(connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Send a stats request and write the report to stdout
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int
+write_stats(int fd)
+{
+    uint8_t req = REQUEST_STATS;
+    uint8_t result;
+    uint32_t len;
+
+    if(write(fd, &req, 1) != 1 ||
+       recv(fd, &result, 1, MSG_WAITALL) != 1 || result != 1 ||
+       recv(fd, &len, sizeof(len), MSG_WAITALL) != sizeof(len))
+        return -1;
+
+    char *report = (char *)malloc(len);
+    if(recv(fd, report, len, MSG_WAITALL) != len) {
+        free(report);
+        return -1;
+    }
+
+    fwrite(report, 1, len, stdout);
+    fflush(stdout);
+    free(report);
+    return 0;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-stats [-i interval]\n"
+                    "    -i  write the metrics every interval seconds\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    int interval = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:h")) != -1) {
+        switch(opt) {
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    int fd = server_connect();
+    if(fd == -1) {
+        fprintf(stderr, "logc-stats: cannot connect to the logc server: %s\n", strerror(errno));
+        return 1;
+    }
+
+    do {
+        if(write_stats(fd) == -1) {
+            fprintf(stderr, "logc-stats: stats request failed\n");
+            close(fd);
+            return 1;
+        }
+
+        if(interval > 0) {
+            sleep(interval);
+            putchar('\n');
+        }
+    } while(interval > 0);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * MIT License
+ * 
+ * Copyright (c) 2020 Stardust
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * logc-tail
+ * Writes the logs drained by the logc server to stdout as they are drained
+ *
+ * usage: logc-tail [-p pid] [-l level] [-g pattern]
+ *     -p  only the logs of the client with the pid
+ *     -l  only the logs at or above the level, like WARN; text channels have no level
+ *     -g  only the lines with the pattern
+ *
+ * The lines are read from a shared memory ring filled by the server, no log file
+ * is read. If logc-tail cannot keep up, the server drops it and it exits with 1.
+ */
+
+#include "../common/logc_utils.h"
+#include "../common/logc_buffer.h"
+#include "../common/logc_record.h"
+#include "../common/logc_subscribe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define POLL_INTERVAL   20      // milliseconds, while the ring is empty
+
+static const char *level_names[] = LOGC_LEVEL_NAMES;
+
+
+/**
+ * Parse a level name or number
+ *
+ * @returns level, -1 if the level is invalid
+ */
+static int
+parse_level(char *arg)
+{
+    for(int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); ++i) {
+        if(strcasecmp(arg, level_names[i]) == 0)
+            return i;
+    }
+
+    char *end;
+    long level = strtol(arg, &end, 10);
+    if(*arg == '\0' || *end != '\0' || level < 0 || level >= sizeof(level_names) / sizeof(level_names[0]))
+        return -1;
+
+    return level;
+}
+
+/**
+ * Connect to the logc server and subscribe
+ *
+ * @returns connection fd, -1 on failure
+ */
+static int
+subscribe(int level, uint32_t pid, char *pattern, char *shm_name)
+{
+    struct sockaddr_un server_addr;
+    uint8_t req_buff[MAX_WRITE_BUFF_SIZE];
+    uint8_t resp_buff[MAX_WRITE_BUFF_SIZE];
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, LOGC_SERVER_SOCKET_PATH);
+    if(connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // code | level | pid | pattern
+    req_buff[0] = REQUEST_SUBSCRIBE;
+    req_buff[1] = level;
+    memcpy(req_buff + 2, &pid, sizeof(uint32_t));
+    strcpy((char *)req_buff + 6, pattern);
+
+    if(write(fd, req_buff, 7 + strlen(pattern)) <= 0 ||
+       recv(fd, resp_buff, MAX_WRITE_BUFF_SIZE, MSG_WAITALL) != MAX_WRITE_BUFF_SIZE) {
+        close(fd);
+        return -1;
+    }
+
+    if(resp_buff[0] != 1) {
+        memcpy(&errno, resp_buff + 1, sizeof(int));
+        close(fd);
+        return -1;
+    }
+
+    strncpy(shm_name, (char *)resp_buff + 1, MAX_FILE_PATH_SIZE - 1);
+    shm_name[MAX_FILE_PATH_SIZE - 1] = '\0';
+    return fd;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: logc-tail [-p pid] [-l level] [-g pattern]\n"
+                    "    -p  only the logs of the client with the pid\n"
+                    "    -l  only the logs at or above the level, text channels have no level\n"
+                    "    -g  only the lines with the pattern\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static char read_buff[LOGC_SUBSCRIPTION_RING_SIZE + 1];
+    char shm_name[MAX_FILE_PATH_SIZE];
+    char *pattern = "";
+    uint32_t pid = 0;
+    int level = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "p:l:g:h")) != -1) {
+        switch(opt) {
+        case 'p':
+            pid = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            if((level = parse_level(optarg)) == -1) {
+                fprintf(stderr, "logc-tail: invalid level: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            if(strlen(optarg) >= MAX_WRITE_BUFF_SIZE - 7) {
+                fprintf(stderr, "logc-tail: pattern is too long\n");
+                return 1;
+            }
+            pattern = optarg;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    int fd = subscribe(level, pid, pattern, shm_name);
+    if(fd == -1) {
+        fprintf(stderr, "logc-tail: cannot subscribe: %s\n", strerror(errno));
+        return 1;
+    }
+
+    size_t size = logc_subscription_size();
+    struct logc_subscription *sub = (struct logc_subscription *)open_shared_mem(shm_name, &size);
+    if(sub == NULL) {
+        fprintf(stderr, "logc-tail: cannot open %s: %s\n", shm_name, strerror(errno));
+        return 1;
+    }
+
+    // the mappings stay, the shared memory is removed even if logc-tail is killed
+    shm_unlink(shm_name);
+
+    struct logc_buffer *ring = logc_subscription_ring(sub);
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ret = 0;
+
+    while(1) {
+        int n = logc_buffer_read_all(ring, read_buff);
+        if(n > 0) {
+            fwrite(read_buff, 1, n, stdout);
+            fflush(stdout);
+        }
+
+        if(__atomic_load_n(&(sub->state), __ATOMIC_ACQUIRE) == LOGC_SUBSCRIPTION_DROPPED) {
+            logc_buffer_read_all(ring, read_buff);
+            fprintf(stderr, "logc-tail: dropped by the logc server, the output could not keep up\n");
+            ret = 1;
+            break;
+        }
+
+        // the server closes the connection when it stops
+        if(poll(&pfd, 1, n > 0 ? 0 : POLL_INTERVAL) > 0) {
+            char c;
+            if(recv(fd, &c, 1, 0) <= 0)
+                break;
+        }
+    }
+
+    munmap(sub, size);
+    close(fd);
+    return ret;
+}